@@ -298,6 +298,30 @@ bsched_unused(bsched_bws_t bws)
 	return uint64_saturate_sub(unused, bs->bw_urgent);
 }
 
+/**
+ * @return the name of the bandwidth scheduler.
+ */
+const char *
+bsched_name(bsched_bws_t bws)
+{
+	const bsched_t *bs = bsched_get(bws);
+	return bs->name;
+}
+
+/**
+ * @return the total amount of bytes transferred through the bandwidth
+ * scheduler during the session.
+ */
+uint64
+bsched_bytes(bsched_bws_t bws)
+{
+	const bsched_t *bs = bsched_get(bws);
+	uint64 value;
+
+	gnet_prop_get_guint64_val(bs->byte_count, &value);
+	return value;
+}
+
 uint64
 bsched_bps(bsched_bws_t bws)
 {
@@ -106,6 +106,8 @@ bool bws_uniform_allocation(bsched_bws_t bws, bool uniform);
 bool bsched_enough_up_bandwidth(void);
 bool bsched_saturated(bsched_bws_t bws);
 uint64 bsched_unused(bsched_bws_t bws);
+const char *bsched_name(bsched_bws_t bws);
+uint64 bsched_bytes(bsched_bws_t bws);
 uint64 bsched_bps(bsched_bws_t bws);
 uint64 bsched_avg_bps(bsched_bws_t bws);
 ulong bsched_pct(bsched_bws_t bws);
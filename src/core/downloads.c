@@ -164,6 +164,7 @@
 
 static hash_list_t *sl_downloads;	/**< All downloads (queued + unqueued) */
 static hash_list_t *sl_unqueued;	/**< Unqueued downloads only */
+static hash_list_t *sl_ticking;		/**< Downloads needing the heartbeat */
 static pslist_t *sl_removed;		/**< Removed downloads only */
 static pslist_t *sl_removed_servers;/**< Removed servers only */
 static aging_table_t *local_pushes;	/**< Throttle push messages to a server */
@@ -344,6 +345,64 @@ download_status_to_string(const download_t *d)
 	return "UNKNOWN";
 }
 
+/**
+ * Whether download needs to be looked at by download_timer(), based on
+ * its status.
+ */
+static bool
+download_is_ticking(const struct download *d)
+{
+	switch (d->status) {
+	case GTA_DL_CONNECTING:
+	case GTA_DL_CONNECTED:
+	case GTA_DL_PUSH_SENT:
+	case GTA_DL_FALLBACK:
+	case GTA_DL_REQ_SENT:
+	case GTA_DL_HEADERS:
+	case GTA_DL_RECEIVING:
+	case GTA_DL_TIMEOUT_WAIT:
+	case GTA_DL_VERIFYING:
+	case GTA_DL_MOVING:
+	case GTA_DL_SINKING:
+	case GTA_DL_ACTIVE_QUEUED:
+	case GTA_DL_REQ_SENDING:
+	case GTA_DL_IGNORING:
+		return TRUE;
+	case GTA_DL_INVALID:
+	case GTA_DL_QUEUED:
+	case GTA_DL_COMPLETED:
+	case GTA_DL_ERROR:
+	case GTA_DL_ABORTED:
+	case GTA_DL_REMOVED:
+	case GTA_DL_VERIFY_WAIT:
+	case GTA_DL_VERIFIED:
+	case GTA_DL_MOVE_WAIT:
+	case GTA_DL_DONE:
+	case GTA_DL_PASSIVE_QUEUED:
+		break;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Insert or remove the download from the `sl_ticking' list, depending on
+ * whether its current status requires periodic attention.
+ *
+ * Queued and stopped downloads, which are usually the vast majority, need
+ * not be looked at every second.
+ */
+static void
+download_ticking_update(struct download *d)
+{
+	if (download_is_ticking(d)) {
+		if (!hash_list_contains(sl_ticking, d))
+			hash_list_append(sl_ticking, d);
+	} else {
+		hash_list_remove(sl_ticking, d);
+	}
+}
+
 static void
 download_set_status(struct download *d, download_status_t status)
 {
@@ -356,6 +415,7 @@ download_set_status(struct download *d, download_status_t status)
 
 	was_alive = download_is_alive(d);
 	d->status = status;
+	download_ticking_update(d);
 
 	g_return_if_fail(d->file_info);
 
@@ -416,20 +476,19 @@ server_host_info(const struct dl_server *server)
  * This `dl_key' is inserted in the `dl_by_host' hash table were we find a
  * `dl_server' structure describing all the downloads for the given host.
  *
- * All `dl_server' structures are also inserted in the `dl_by_time' struct,
- * where hosts are sorted based on their retry time.
+ * All `dl_server' structures having downloads in their waiting list are
+ * also inserted in the `dl_ready' tree, where hosts are sorted based on their
+ * retry time, so that we only need to look at the head of the tree to find
+ * the servers on which we can schedule something.
  */
 
 static hikset_t *dl_by_host;
 
-#define DHASH_SIZE	(1UL << 10)	/**< Hash list size, must be a power of 2 */
-#define DHASH_MASK 	(DHASH_SIZE - 1)
-#define DL_HASH(x)	((x) & DHASH_MASK)
-
 static struct {
-	plist_t *servers[DHASH_SIZE];	/**< Lists of servers, by retry time */
-	int change[DHASH_SIZE];			/**< Counts changes to the list */
-} dl_by_time;
+	erbtree_t tree;			/**< Servers with waiting downloads, by retry time */
+	uint change;			/**< Counts changes to the tree */
+	uint32 pickup;			/**< Pickup pass number */
+} dl_ready;
 
 /**
  * To handle download meshes, where we only know the IP/port of the host and
@@ -1136,13 +1195,18 @@ dl_retry_cmp(const void *p, const void *q)
 /**
  * Compare two `dl_server' structures based on the `retry_after' field.
  * The smaller that time, the smaller the structure is.
+ *
+ * Servers with the same `retry_after' are ordered by address to get a
+ * total order, as required by the `dl_ready' tree.
  */
 static int
 dl_server_retry_cmp(const void *p, const void *q)
 {
 	const struct dl_server *a = p, *b = q;
+	int c;
 
-	return CMP(a->retry_after, b->retry_after);
+	c = CMP(a->retry_after, b->retry_after);
+	return 0 == c ? ptr_cmp(a, b) : c;
 }
 
 /**
@@ -1341,6 +1405,9 @@ download_init(void)
 
 	sl_downloads = hash_list_new(NULL, NULL);
 	sl_unqueued = hash_list_new(NULL, NULL);
+	sl_ticking = hash_list_new(NULL, NULL);
+	erbtree_init(&dl_ready.tree, dl_server_retry_cmp,
+		offsetof(struct dl_server, ready_node));
 
 	pat_rm_from_parq = PATTERN_COMPILE_CONST("removed from PARQ");
 }
@@ -1755,32 +1822,32 @@ buffers_strip_trailing(struct download *d, size_t amount)
 /* ----------------------------------------- */
 
 /**
- * Insert server by retry time into the `dl_by_time' structure.
+ * Insert server by retry time into the `dl_ready' tree.
  */
 static void
-dl_by_time_insert(struct dl_server *server)
+dl_ready_insert(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
-
 	g_assert(dl_server_valid(server));
+	g_assert(!server->ready);
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_insert_sorted(dl_by_time.servers[idx],
-		server, dl_server_retry_cmp);
+	dl_ready.change++;
+	erbtree_insert(&dl_ready.tree, &server->ready_node);
+	server->ready = TRUE;
 }
 
 /**
- * Remove server from the `dl_by_time' structure.
+ * Remove server from the `dl_ready' tree, if present.
  */
 static void
-dl_by_time_remove(struct dl_server *server)
+dl_ready_remove(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
-
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_remove(dl_by_time.servers[idx], server);
+	if (server->ready) {
+		dl_ready.change++;
+		erbtree_remove(&dl_ready.tree, &server->ready_node);
+		server->ready = FALSE;
+	}
 }
 
 /**
@@ -1850,7 +1917,6 @@ allocate_server(const struct guid *guid, const host_addr_t addr, uint16 port)
 	server->sha1_counts = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
 
 	hikset_insert_key(dl_by_host, &server->key);
-	dl_by_time_insert(server);
 
 	/*
 	 * If host is reacheable directly, its GUID does not matter much to
@@ -1946,7 +2012,7 @@ server_unregister(struct dl_server *server)
 {
 	g_assert(dl_server_valid(server));
 
-	dl_by_time_remove(server);
+	dl_ready_remove(server);
 	server_key_unregister(server->key);
 
 	/*
@@ -3253,6 +3319,17 @@ server_list_by_index(struct dl_server *server, enum dl_list idx)
 	return server->list[idx];
 }
 
+/**
+ * Record that a download was added to one of the lists of the server,
+ * making the server ready if it is the first one in its waiting list.
+ */
+static void
+server_list_added(struct dl_server *server, enum dl_list idx)
+{
+	if (DL_LIST_WAITING == idx && !server->ready)
+		dl_ready_insert(server);
+}
+
 static void
 server_list_insert_download_sorted(struct dl_server *server, enum dl_list idx,
 	struct download *d)
@@ -3262,6 +3339,7 @@ server_list_insert_download_sorted(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_insert_sorted(server_list_by_index(server, idx), d, dl_retry_cmp);
+	server_list_added(server, idx);
 }
 
 static void
@@ -3273,6 +3351,7 @@ server_list_append_download(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_append(server_list_by_index(server, idx), d);
+	server_list_added(server, idx);
 }
 
 static void
@@ -3284,6 +3363,7 @@ server_list_prepend_download(struct dl_server *server, enum dl_list idx,
 
 	server_sha1_count_inc(server, d);
 	list_prepend(server_list_by_index(server, idx), d);
+	server_list_added(server, idx);
 }
 
 static struct download *
@@ -3309,6 +3389,8 @@ server_list_remove_download(struct dl_server *server, enum dl_list idx,
 	list_remove(server->list[idx], d);
 	if (0 == server_list_length(server, idx)) {
 		list_free(&server->list[idx]);
+		if (DL_LIST_WAITING == idx)
+			dl_ready_remove(server);
 	}
 }
 
@@ -3961,6 +4043,7 @@ download_clone(struct download *d)
 		download_set_status(cd, GTA_DL_CONNECTED);
 	}
 
+	download_ticking_update(cd);	/* Status may have been struct-copied */
 	download_set_sha1(d, NULL);
 
 	/*
@@ -4066,9 +4149,12 @@ download_server_retry_after(struct dl_server *server, time_t now, int hold)
 		after = MAX(after, time_advance(now, hold));
 
 	if (server->retry_after != after) {
-		dl_by_time_remove(server);
+		bool ready = server->ready;
+
+		dl_ready_remove(server);
 		server->retry_after = after;
-		dl_by_time_insert(server);
+		if (ready)
+			dl_ready_insert(server);
 	}
 }
 
@@ -6586,20 +6672,34 @@ static void
 download_pickup_queued(void)
 {
 	time_t now = tm_time();
-	uint i;
+	rbnode_t *rn;
+	uint32 pass;
 
 	/*
-	 * To select downloads, we iterate over the sorted `dl_by_time' list and
-	 * look for something we could schedule.
+	 * To select downloads, we iterate over the `dl_ready' tree, which only
+	 * holds servers with waiting downloads, sorted by increasing retry time,
+	 * and look for something we could schedule.  As soon as we reach a server
+	 * whose retry time is in the future, we can stop.
 	 *
 	 * Note that we jump from one host to the other, even if we have multiple
 	 * things to schedule on the same host: It's better to spread load among
 	 * all hosts first.
 	 */
 
-	for (i = 0; i < DHASH_SIZE; i++) {
-		plist_t *l;
-		int last_change;
+	pass = ++dl_ready.pickup;
+	if G_UNLIKELY(0 == pass)
+		pass = ++dl_ready.pickup;		/* Servers are created with 0 */
+
+retry:
+	for (rn = erbtree_first(&dl_ready.tree); rn != NULL; rn = erbtree_next(rn)) {
+		struct dl_server *server = erbtree_data(&dl_ready.tree, rn);
+		list_iter_t *iter;
+		struct download *d;
+		uint n, last_change;
+		bool only_special = FALSE;
+
+		g_assert(dl_server_valid(server));
+		g_assert(server->ready);
 
 		if (download_queue_is_frozen())
 			break;
@@ -6610,156 +6710,144 @@ download_pickup_queued(void)
 		if (!bws_can_connect(SOCK_TYPE_DOWNLOAD))
 			break;
 
-	retry:
-		l = dl_by_time.servers[i];
-		last_change = dl_by_time.change[i];
-
-		for (/* NOTHING */; NULL != l; l = plist_next(l)) {
-			struct dl_server *server = l->data;
-			list_iter_t *iter;
-			struct download *d;
-			uint n;
-			bool only_special = FALSE;
-
-			g_assert(dl_server_valid(server));
+		/*
+		 * Tree is sorted, so as soon as we go beyond the current time,
+		 * we can stop.
+		 */
 
-			if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-				break;
+		if (delta_time(now, server->retry_after) < 0)
+			break;
 
-			/*
-			 * List is sorted, so as soon as we go beyond the current time,
-			 * we can stop.
-			 */
+		/*
+		 * Skip servers we already handled during this pass, in case we
+		 * had to restart the iteration.
+		 */
 
-			if (delta_time(now, server->retry_after) < 0)
-				break;
+		if (pass == server->pickup)
+			continue;
 
-			if (server_list_length(server, DL_LIST_WAITING) == 0)
-				continue;
+		server->pickup = pass;
+		last_change = dl_ready.change;
 
-			if (
-				count_running_on_server(server)
-					>= GNET_PROPERTY(max_host_downloads)
-			) {
-				download_list_send_head_ping(server->list[DL_LIST_WAITING]);
+		g_assert(server_list_length(server, DL_LIST_WAITING) != 0);
 
-				/*
-				 * Normally, special downloads are served by remote servents
-				 * regardless of the amount of upload slots or per host
-				 * restrictions (since these downloads are small, usually).
-				 *
-				 * Hence, allow such special downloads to be scheduled even
-				 * if we reached the configured local maximum.
-				 */
-
-				only_special = TRUE;
-			}
+		if (
+			count_running_on_server(server)
+				>= GNET_PROPERTY(max_host_downloads)
+		) {
+			download_list_send_head_ping(server->list[DL_LIST_WAITING]);
 
 			/*
-			 * Avoid hammering servers.  In case we have multiple files queued
-			 * on that server, we must not issue all the requests in a short
-			 * period of time as this can be frowned upon.
+			 * Normally, special downloads are served by remote servents
+			 * regardless of the amount of upload slots or per host
+			 * restrictions (since these downloads are small, usually).
+			 *
+			 * Hence, allow such special downloads to be scheduled even
+			 * if we reached the configured local maximum.
 			 */
 
-			if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY)
-				continue;
+			only_special = TRUE;
+		}
 
-			/*
-			 * OK, select a download within the waiting list, but do not
-			 * remove it yet.  This will be done by download_start().
-			 */
+		/*
+		 * Avoid hammering servers.  In case we have multiple files queued
+		 * on that server, we must not issue all the requests in a short
+		 * period of time as this can be frowned upon.
+		 */
 
-			g_assert(server->list[DL_LIST_WAITING]);	/* Since count != 0 */
+		if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY)
+			continue;
 
-			n = 0;
-			d = NULL;
-			iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
-			while (list_iter_has_next(iter)) {
-				struct download *cur;
+		/*
+		 * OK, select a download within the waiting list, but do not
+		 * remove it yet.  This will be done by download_start().
+		 */
 
-				cur = list_iter_next(iter);
-				download_check(cur);
+		n = 0;
+		d = NULL;
+		iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
+		while (list_iter_has_next(iter)) {
+			struct download *cur;
 
-				if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
-					continue;
+			cur = list_iter_next(iter);
+			download_check(cur);
 
-				if (only_special && !download_is_special(cur))
-					continue;
+			if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
+				continue;
 
-				if (download_has_enough_active_sources(cur)) {
-					download_send_head_ping(cur);
-					continue;
-				}
+			if (only_special && !download_is_special(cur))
+				continue;
 
-				if (
-					delta_time(now, cur->last_update) <=
-						(time_delta_t) cur->timeout_delay
-				) {
-					download_send_head_ping(cur);
-					continue;
-				}
+			if (download_has_enough_active_sources(cur)) {
+				download_send_head_ping(cur);
+				continue;
+			}
 
-				/* Note that we skip over paused and suspended downloads */
-				if (delta_time(now, cur->retry_after) < 0)
-					break;	/* List is sorted */
+			if (
+				delta_time(now, cur->last_update) <=
+					(time_delta_t) cur->timeout_delay
+			) {
+				download_send_head_ping(cur);
+				continue;
+			}
 
-				if (d) {
-					if ((NULL != d->thex) == (NULL != cur->thex)) {
-						/*
-						 * Pick the download with the most progress. Otherwise
-						 * we easily end up with dozens of partials from the
-						 * the server.
-						 */
+			/* Note that we skip over paused and suspended downloads */
+			if (delta_time(now, cur->retry_after) < 0)
+				break;	/* List is sorted */
 
-						if (
-							download_total_progress(d)
-								>= download_total_progress(cur)
-						) {
-							download_send_head_ping(cur);
-							continue;
-						}
-					}
+			if (d) {
+				if ((NULL != d->thex) == (NULL != cur->thex)) {
+					/*
+					 * Pick the download with the most progress. Otherwise
+					 * we easily end up with dozens of partials from the
+					 * the server.
+					 */
 
-					/* Give priority to THEX downloads */
-					if (d->thex && NULL == cur->thex) {
+					if (
+						download_total_progress(d)
+							>= download_total_progress(cur)
+					) {
 						download_send_head_ping(cur);
 						continue;
 					}
 				}
 
-				if (d)
-					download_send_head_ping(d);
-
-				d = cur;
-
-				/*
-				 * If there are a lot of downloads queued at a single server we
-				 * might spend a lot of time scanning the queue of a download
-				 * to pick. Thus limit the amount of items we're going to take
-				 * into account.
-				 */
-
-				if (n++ > 100)
-					break;
+				/* Give priority to THEX downloads */
+				if (d->thex && NULL == cur->thex) {
+					download_send_head_ping(cur);
+					continue;
+				}
 			}
-			list_iter_free(&iter);
 
-			if (d) {
-				download_start(d, FALSE);
-			}
+			if (d)
+				download_send_head_ping(d);
 
+			d = cur;
 
 			/*
-			 * It's possible that download_start() ended-up changing the
-			 * dl_by_time list we're iterating over.  That's why all changes
-			 * to that list update the dl_by_time_change variable, which we
-			 * snapshot upon entry into the loop.
-			 *		--RAM, 24/08/2002.
+			 * If there are a lot of downloads queued at a single server we
+			 * might spend a lot of time scanning the queue of a download
+			 * to pick. Thus limit the amount of items we're going to take
+			 * into account.
 			 */
 
-			if (last_change != dl_by_time.change[i])
-				goto retry;
+			if (n++ > 100)
+				break;
+		}
+		list_iter_free(&iter);
+
+		if (d) {
+			download_start(d, FALSE);
 		}
+
+		/*
+		 * It's possible that download_start() ended-up changing the
+		 * dl_ready tree we're iterating over, in which case we restart
+		 * from the head, skipping the servers we already processed.
+		 */
+
+		if (last_change != dl_ready.change)
+			goto retry;
 	}
 }
 
@@ -8100,6 +8188,7 @@ download_free_removed(void)
 
 		hash_list_remove(sl_downloads, d);
 		hash_list_remove(sl_unqueued, d);
+		g_assert(!hash_list_contains(sl_ticking, d));
 
 		download_free(&d);
 	}
@@ -16279,6 +16368,7 @@ download_close(void)
 
 	hash_list_free(&sl_downloads);
 	hash_list_free(&sl_unqueued);
+	hash_list_free(&sl_ticking);
 
 	aging_destroy(&local_pushes);
 	htable_free_null(&dl_by_guid);
@@ -17144,6 +17234,15 @@ download_clear_stopped(bool complete,
 {
 	struct download *next;
 
+	/*
+	 * This is called every second from download_timer(), so avoid a
+	 * useless traversal of all the unqueued downloads when nothing can
+	 * be cleared.
+	 */
+
+	if (!(complete || failed || unavailable || finished || now))
+		return;
+
 	next = hash_list_head(sl_unqueued);
 	while (next) {
 		struct download *d = next;
@@ -17211,17 +17310,28 @@ download_clear_stopped(bool complete,
 void
 download_timer(time_t now)
 {
-	struct download *next;
+	plist_t *ticking, *l;
 
-	next = hash_list_head(sl_unqueued);
-	while (next) {
-		struct download *d = next;
+	/*
+	 * We only look at downloads whose status requires periodic attention,
+	 * not at all the unqueued ones, which include the stopped downloads.
+	 *
+	 * Since handling a download can change the status of others, we iterate
+	 * over a snapshot and skip downloads that left the list meanwhile.
+	 * Downloads are only freed by download_free_removed(), below.
+	 */
+
+	ticking = hash_list_list(sl_ticking);
+
+	PLIST_FOREACH(ticking, l) {
+		struct download *d = l->data;
+
+		if (!hash_list_contains(sl_ticking, d))
+			continue;
 
 		download_check(d);
 		g_assert(dl_server_valid(d->server));
 
-		next = hash_list_next(sl_unqueued, next);
-
 		switch (d->status) {
 		time_delta_t timeout;
 		case GTA_DL_RECEIVING:
@@ -17439,7 +17549,7 @@ download_timer(time_t now)
 			break;
 		case GTA_DL_PASSIVE_QUEUED:
 		case GTA_DL_QUEUED:
-			g_error("found queued download in sl_unqueued list: \"%s\"",
+			g_error("found queued download in sl_ticking list: \"%s\"",
 				download_pathname(d));
 			break;
 		case GTA_DL_INVALID:
@@ -17447,6 +17557,8 @@ download_timer(time_t now)
 		}
 	}
 
+	plist_free_null(&ticking);
+
 	download_clear_stopped(
 		GNET_PROPERTY(clear_complete_downloads),
 		GNET_PROPERTY(clear_failed_downloads),
@@ -45,6 +45,7 @@
 #include "lib/htable.h"
 #include "lib/log.h"
 #include "lib/mempcpy.h"
+#include "lib/phash.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/walloc.h"
@@ -94,8 +95,8 @@
  * not compressed nor COBS-encoded, the ext_xxx() routine will return the
  * physical data.
  *
- * The structure here refers to the opaque data that is dynamically allocated
- * each time a new extension is found.
+ * The structure here refers to the opaque data that is filled each time a
+ * new extension is found.
  */
 typedef struct extdesc {
 	const char *ext_phys_payload;	/**< Start of payload buffer */
@@ -115,6 +116,26 @@ typedef struct extdesc {
 
 } extdesc_t;
 
+/**
+ * The descriptors of a parsed extension vector are allocated as one flat
+ * block holding as many descriptors as there are slots in the vector, so
+ * that parsing costs a single allocation whatever the amount of extensions
+ * found.  The descriptor of exv[i] is always the i-th one in the block,
+ * which lets us find the block back from exv[0].
+ */
+struct extdesc_block {
+	size_t size;				/**< Allocated size of the block */
+};
+
+#define EXTDESC_BLOCK_OFFSET	\
+	((sizeof(struct extdesc_block) + MEM_ALIGNBYTES - 1) & \
+		~(MEM_ALIGNBYTES - 1))
+
+#define extdesc_block_first(b)	\
+	((extdesc_t *) ptr_add_offset((b), EXTDESC_BLOCK_OFFSET))
+#define extdesc_block_of(d)		\
+	((struct extdesc_block *) ptr_add_offset((d), -EXTDESC_BLOCK_OFFSET))
+
 #define ext_phys_headlen(d)	((d)->ext_phys_len - (d)->ext_phys_paylen)
 #define ext_phys_base(d)	((d)->ext_phys_payload - ext_phys_headlen(d))
 
@@ -324,18 +345,84 @@ rw_is_sorted(const char *name,
 	}
 }
 
+/***
+ *** Perfect hashing of known GGEP IDs.
+ ***
+ *** GGEP IDs are looked up for every extension we parse, so instead of
+ *** doing a binary search in ggeptable[], we hash the ID whilst reading it
+ *** and probe a collision-free table built once at startup.
+ ***/
+
+#define GGEP_PHASH_BITS		10
+#define GGEP_PHASH_SIZE		(1U << GGEP_PHASH_BITS)
+
 /**
- * @return the GGEP token value upon success, EXT_T_UNKNOWN_GGEP if not found.
- * If keyword was found, its static shared string is returned in `retkw'.
+ * The perfect hash table: maps a slot to a ggeptable[] index + 1,
+ * 0 meaning an empty slot.
  */
-static ext_token_t
-rw_ggep_screen(char *word, const char **retkw)
+static uint8 ggep_phash[GGEP_PHASH_SIZE];
+static uint8 ggep_phash_len[N_ITEMS(ggeptable)];
+static uint32 ggep_phash_seed;
+
+/**
+ * Hashing step.
+ */
+static inline uint32
+ggep_phash_mix(uint32 h, uchar c)
 {
-	ext_token_t t;
+	return phash_mix(h, c);
+}
+
+static inline uint
+ggep_phash_slot(uint32 h)
+{
+	return phash_slot(h, GGEP_PHASH_BITS);
+}
+
+/**
+ * Compute the perfect hash seed and fill the slot table.
+ */
+static void G_COLD
+ggep_phash_init(void)
+{
+	const char *keys[N_ITEMS(ggeptable)];
+	uint i;
 
-	t = rw_screen(TRUE, ggeptable, N_ITEMS(ggeptable), word, retkw);
+	STATIC_ASSERT(N_ITEMS(ggeptable) < MAX_INT_VAL(uint8));
 
-	return (t == EXT_T_UNKNOWN) ? EXT_T_UNKNOWN_GGEP : t;
+	for (i = 0; i < N_ITEMS(ggeptable); i++)
+		keys[i] = ggeptable[i].rw_name;
+
+	ggep_phash_seed = phash_build(keys, N_ITEMS(keys),
+		GGEP_PHASH_BITS, FALSE, ggep_phash, ggep_phash_len);
+}
+
+/**
+ * Look up a GGEP ID given its perfect hash value.
+ *
+ * @param id		the GGEP ID (need not be NUL-terminated)
+ * @param len		length of the ID
+ * @param h			perfect hash value of the ID
+ * @param retkw		where the static shared string of the ID is returned
+ *
+ * @return the GGEP token value upon success, EXT_T_UNKNOWN_GGEP if not found,
+ * in which case `retkw' is set to NULL.
+ */
+static inline ext_token_t
+rw_ggep_screen(const char *id, size_t len, uint32 h, const char **retkw)
+{
+	uint i = ggep_phash[ggep_phash_slot(h)];
+
+	if (
+		i != 0 && ggep_phash_len[i - 1] == len &&
+		0 == memcmp(ggeptable[i - 1].rw_name, id, len)
+	) {
+		*retkw = ggeptable[i - 1].rw_name;
+		return ggeptable[i - 1].rw_token;
+	}
+
+	*retkw = NULL;
+	return EXT_T_UNKNOWN_GGEP;
 }
 
 /**
@@ -430,7 +517,8 @@ ext_names_kv_free(const void *key, void *value, void *unused_udata)
  * Parses a GGEP block (can hold several extensions).
  */
 static int G_HOT
-ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
+ext_ggep_parse(const char **retp, int len,
+	extvec_t *exv, extdesc_t *dv, int exvcnt)
 {
 	const char *p = *retp;
 	const char *end = &p[len];
@@ -441,6 +529,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		uchar flags;
 		char id[GGEP_F_IDLEN + 1];
 		uint id_len, data_length, i;
+		uint32 h = ggep_phash_seed;
 		bool length_ended = FALSE;
 		const char *name;
 		extdesc_t *d;
@@ -480,6 +569,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 			if (c == '\0' || !isascii(c) || is_ascii_cntrl(c))
 				goto abort;
 			id[i] = c;
+			h = ggep_phash_mix(h, c);
 		}
 		id[i] = '\0';
 
@@ -566,7 +656,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 * OK, at this point we have validated the GGEP header.
 		 */
 
-		WALLOC(d);
+		d = dv;
 
 		d->ext_phys_payload = p;
 		d->ext_phys_paylen = data_length;
@@ -592,7 +682,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 */
 
 		exv->ext_type = EXT_GGEP;
-		exv->ext_token = rw_ggep_screen(id, &name);
+		exv->ext_token = rw_ggep_screen(id, id_len, h, &name);
 		exv->ext_name = name;
 
 		if (name != NULL)
@@ -605,6 +695,7 @@ ext_ggep_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 		 */
 
 		exv++;
+		dv++;
 		count++;
 		lastp = p + data_length;
 		p = lastp;
@@ -628,7 +719,6 @@ abort:
 
 	while (count--) {
 		exv--;
-		wfree(exv->opaque, sizeof(extdesc_t));
 		exv->opaque = NULL;
 	}
 
@@ -636,11 +726,11 @@ abort:
 }
 
 static int
-ext_urn_bad_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
+ext_urn_bad_parse(const char **retp, int len,
+	extvec_t *exv, extdesc_t *d, int exvcnt)
 {
 	const char *p = *retp;
 	const char *lastp = p;				/* Last parsed point */
-	extdesc_t *d;
 
 	g_assert(exvcnt > 0);
 	g_assert(exv->opaque == NULL);
@@ -655,8 +745,6 @@ ext_urn_bad_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
-
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
@@ -679,7 +767,8 @@ ext_urn_bad_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
  * Parses a URN block (one URN only).
  */
 static int
-ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
+ext_huge_parse(const char **retp, int len,
+	extvec_t *exv, extdesc_t *d, int exvcnt)
 {
 	const char *p = *retp;
 	const char *end = &p[len];
@@ -688,7 +777,6 @@ ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	const char *payload_start = NULL;
 	int data_length;
 	const char *name = NULL;
-	extdesc_t *d;
 
 	g_assert(exvcnt > 0);
 	g_assert(exv->opaque == NULL);
@@ -698,7 +786,7 @@ ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 */
 
 	if (len < 4)
-		return ext_urn_bad_parse(retp, len, exv, exvcnt);
+		return ext_urn_bad_parse(retp, len, exv, d, exvcnt);
 
 	/*
 	 * Recognize "urn:".
@@ -782,8 +870,6 @@ ext_huge_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 found:
 	g_assert(payload_start);
 
-	WALLOC(d);
-
 	d->ext_phys_payload = payload_start;
 	d->ext_phys_paylen = data_length;
 	d->ext_phys_len = (payload_start - lastp) + data_length;
@@ -810,12 +896,12 @@ found:
  * Parses a XML block (grabs the whole xml up to the first NUL or separator).
  */
 static int
-ext_xml_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
+ext_xml_parse(const char **retp, int len,
+	extvec_t *exv, extdesc_t *d, int exvcnt)
 {
 	const char *p = *retp;
 	const char *end = &p[len];
 	const char *lastp = p;				/* Last parsed point */
-	extdesc_t *d;
 
 	g_assert(exvcnt > 0);
 	g_assert(exv->opaque == NULL);
@@ -831,8 +917,6 @@ ext_xml_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * We don't analyze the XML, encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
-
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
@@ -860,12 +944,11 @@ ext_xml_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
  * If `skip' is TRUE, we don't resync on the first resync point.
  */
 static int
-ext_unknown_parse(const char **retp, int len, extvec_t *exv,
-	int exvcnt, bool skip)
+ext_unknown_parse(const char **retp, int len,
+	extvec_t *exv, extdesc_t *d, int exvcnt, bool skip)
 {
 	const char *p = *retp;
 	const char *lastp = p;				/* Last parsed point */
-	extdesc_t *d;
 	bool separator = FALSE;
 
 	g_assert(exvcnt > 0);
@@ -911,8 +994,6 @@ ext_unknown_parse(const char **retp, int len, extvec_t *exv,
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
-
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
@@ -942,12 +1023,12 @@ ext_unknown_parse(const char **retp, int len, extvec_t *exv,
  * "none" extension.
  */
 static int
-ext_none_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
+ext_none_parse(const char **retp, int len,
+	extvec_t *exv, extdesc_t *d, int exvcnt)
 {
 	const char *p = *retp;
 	const char *end = &p[len];
 	const char *lastp = p;				/* Last parsed point */
-	extdesc_t *d;
 
 	g_assert(exvcnt > 0);
 	g_assert(exv->opaque == NULL);
@@ -970,8 +1051,6 @@ ext_none_parse(const char **retp, int len, extvec_t *exv, int exvcnt)
 	 * Encapsulate as one big opaque chunk.
 	 */
 
-	WALLOC(d);
-
 	d->ext_phys_payload = lastp;
 	d->ext_phys_len = d->ext_phys_paylen = p - lastp;
 	d->ext_payload = d->ext_phys_payload;
@@ -1037,14 +1116,14 @@ ext_merge_adjacent(extvec_t *exv, extvec_t *next)
 	}
 
 	/*
-	 * Get rid of the `next' opaque descriptor.
+	 * Get rid of the `next' opaque descriptor, whose slot in the descriptor
+	 * block will be reused by the next extension we parse.
 	 * We should not have computed any "virtual" payload at this point.
 	 */
 
 	g_assert(
 		nd->ext_payload == NULL || nd->ext_payload == nd->ext_phys_payload);
 
-	WFREE(nd);
 	next->opaque = NULL;
 }
 
@@ -1066,6 +1145,8 @@ ext_parse_buffer(const char *buf, size_t len, int flags,
 	extvec_t *exv, int exvcnt, char **endptr)
 {
 	const char *p = buf, *end = &buf[len];
+	struct extdesc_block *b;
+	extdesc_t *dv;
 	int cnt = 0;
 
 	g_assert(buf);
@@ -1074,6 +1155,19 @@ ext_parse_buffer(const char *buf, size_t len, int flags,
 	g_assert(exvcnt > 0);
 	g_assert(exv->opaque == NULL);
 
+	/*
+	 * Allocate all the descriptors we may need at once, for the whole vector.
+	 * Descriptor dv[i] is used by the extension in exv[i].
+	 */
+
+	{
+		size_t size = EXTDESC_BLOCK_OFFSET + exvcnt * sizeof dv[0];
+
+		b = walloc(size);
+		b->size = size;
+		dv = extdesc_block_first(b);
+	}
+
 	while (p < end && exvcnt > 0) {
 		const char *old_p = p;
 		int found = 0;
@@ -1091,14 +1185,14 @@ ext_parse_buffer(const char *buf, size_t len, int flags,
 			p++;
 			if (p == end)
 				goto out;
-			found = ext_ggep_parse(&p, len-1, exv, exvcnt);
+			found = ext_ggep_parse(&p, len-1, exv, dv, exvcnt);
 			break;
 		case 'u':
 		case 'U':
-			found = ext_huge_parse(&p, len, exv, exvcnt);
+			found = ext_huge_parse(&p, len, exv, dv, exvcnt);
 			break;
 		case '<':
-			found = ext_xml_parse(&p, len, exv, exvcnt);
+			found = ext_xml_parse(&p, len, exv, dv, exvcnt);
 			break;
 		case HUGE_FS:
 		case '\0':
@@ -1107,14 +1201,14 @@ ext_parse_buffer(const char *buf, size_t len, int flags,
 				goto out;
 			if ((flags & EXT_F_NUL_END) && '\0' == *(p - 1))
 				goto out;
-			found = ext_none_parse(&p, len-1, exv, exvcnt);
+			found = ext_none_parse(&p, len-1, exv, dv, exvcnt);
 			if (!found) {
 				len--;
 				continue;			/* Single separator, no bloat then */
 			}
 			break;
 		default:
-			found = ext_unknown_parse(&p, len, exv, exvcnt, FALSE);
+			found = ext_unknown_parse(&p, len, exv, dv, exvcnt, FALSE);
 			break;
 		}
 
@@ -1139,7 +1233,7 @@ ext_parse_buffer(const char *buf, size_t len, int flags,
 				g_assert(p == old_p);
 			}
 
-			found = ext_unknown_parse(&p, len, exv, exvcnt, TRUE);
+			found = ext_unknown_parse(&p, len, exv, dv, exvcnt, TRUE);
 		} else {
 			/*
 			 * The possible trailing NUL at the end of the extension we
@@ -1176,6 +1270,7 @@ ext_parse_buffer(const char *buf, size_t len, int flags,
 		}
 
 		exv += found;
+		dv += found;
 		exvcnt -= found;
 		cnt += found;
 	}
@@ -1184,6 +1279,9 @@ out:
 	if (endptr != NULL)
 		*endptr = deconstify_pointer(p);	/* Beyond what we parsed */
 
+	if (0 == cnt)
+		wfree(b, b->size);
+
 	return cnt;
 }
 
@@ -1228,6 +1326,7 @@ ext_ggep_nextblock(const char *buf, int len)
 {
 	const char *p = buf, *end = &buf[len];
 	extvec_t exv[1];
+	extdesc_t dv[1];
 
 	g_assert(buf != NULL);
 	g_assert(len >= 0);
@@ -1251,24 +1350,24 @@ ext_ggep_nextblock(const char *buf, int len)
 			return deconstify_pointer(p);	/* Start of GGEP data */
 		case 'u':
 		case 'U':
-			found = ext_huge_parse(&p, len, exv, N_ITEMS(exv));
+			found = ext_huge_parse(&p, len, exv, dv, N_ITEMS(exv));
 			break;
 		case '<':
-			found = ext_xml_parse(&p, len, exv, N_ITEMS(exv));
+			found = ext_xml_parse(&p, len, exv, dv, N_ITEMS(exv));
 			break;
 		case HUGE_FS:
 		case '\0':
 			p++;
 			if (p == end)
 				return NULL;
-			found = ext_none_parse(&p, len-1, exv, N_ITEMS(exv));
+			found = ext_none_parse(&p, len-1, exv, dv, N_ITEMS(exv));
 			if (!found) {
 				len--;
 				continue;			/* Single separator, no bloat then */
 			}
 			break;
 		default:
-			found = ext_unknown_parse(&p, len, exv, N_ITEMS(exv), FALSE);
+			found = ext_unknown_parse(&p, len, exv, dv, N_ITEMS(exv), FALSE);
 			break;
 		}
 
@@ -1281,7 +1380,7 @@ ext_ggep_nextblock(const char *buf, int len)
 
 		if (found == 0) {
 			g_assert(p == old_p);
-			found = ext_unknown_parse(&p, len, exv, N_ITEMS(exv), TRUE);
+			found = ext_unknown_parse(&p, len, exv, dv, N_ITEMS(exv), TRUE);
 		}
 
 		g_assert(found > 0);
@@ -1290,7 +1389,12 @@ ext_ggep_nextblock(const char *buf, int len)
 
 		len -= p - old_p;
 
-		ext_reset(exv, N_ITEMS(exv));
+		/*
+		 * None of these extensions can have a "virtual" payload, and the
+		 * descriptor lies on the stack: simply discard it.
+		 */
+
+		ext_prepare(exv, N_ITEMS(exv));
 	}
 
 	return NULL;	/* Did not find any GGEP start */
@@ -2204,8 +2308,14 @@ ext_prepare(extvec_t *exv, int exvcnt)
 void
 ext_reset(extvec_t *exv, int exvcnt)
 {
+	struct extdesc_block *b;
 	int i;
 
+	if (exvcnt <= 0 || NULL == exv[0].opaque)
+		return;
+
+	b = extdesc_block_of(exv[0].opaque);
+
 	for (i = 0; i < exvcnt; i++) {
 		extvec_t *e = &exv[i];
 		extdesc_t *d;
@@ -2226,9 +2336,10 @@ ext_reset(extvec_t *exv, int exvcnt)
 			d->ext_payload = NULL;
 		}
 
-		WFREE(d);
 		e->opaque = NULL;
 	}
+
+	wfree(b, b->size);
 }
 
 const char *
@@ -2260,6 +2371,8 @@ ext_init(void)
 
 	rw_is_sorted("ggeptable", ggeptable, N_ITEMS(ggeptable));
 	rw_is_sorted("urntable", urntable, N_ITEMS(urntable));
+
+	ggep_phash_init();
 }
 
 /**
@@ -72,6 +72,8 @@
 #include "lib/concat.h"
 #include "lib/crash.h"
 #include "lib/cstr.h"
+#include "lib/dbmw.h"
+#include "lib/dbstore.h"
 #include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
@@ -83,6 +85,7 @@
 #include "lib/halloc.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/hset.h"
 #include "lib/htable.h"
 #include "lib/http_range.h"
 #include "lib/idtable.h"
@@ -147,6 +150,7 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded node in fi->chunktree */
 };
 
 static inline void
@@ -211,9 +215,30 @@ static htable_t *fi_by_namesize;
 static hikset_t *fi_by_outname;
 static hikset_t *fi_by_guid;
 
+/*
+ * Each fileinfo is persisted as one record in `db_fileinfo', keyed by its
+ * GUID.  Only the records of the fileinfos listed in `fi_db_dirty' are
+ * rewritten when the database is stored, and `fi_db_deleted' lists the GUIDs
+ * of the records to remove.
+ *
+ * The former ASCII "fileinfo" file is only read once, to populate the
+ * database when it does not exist yet.
+ */
+
 static const char file_info_file[] = "fileinfo";
 static const char file_info_what[] = "fileinfo database";
-static bool fileinfo_dirty = FALSE;
+
+static dbmw_t *db_fileinfo;
+static char db_fileinfo_base[] = "fileinfo";
+static char db_fileinfo_what[] = "Fileinfo records";
+
+static hset_t *fi_db_dirty;			/**< Fileinfos to persist */
+static hset_t *fi_db_deleted;		/**< GUID atoms of records to remove */
+static bool fi_db_created;			/**< Database did not exist at startup */
+static bool fi_db_loading;			/**< Loading records from the database */
+
+#define FILEINFO_DB_VERSION	0
+#define FILEINFO_DB_MAXSIZE	(128 * 1024)	/**< Max serialized record size */
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
 
@@ -242,6 +267,62 @@ enum dl_file_info_field {
 #define FI_STORE_DELAY		60	/**< Max delay (secs) for flushing fileinfo */
 #define FI_TRAILER_INT		6	/**< Amount of uint32 in the trailer */
 
+/**
+ * Record that the database record of the fileinfo must be rewritten.
+ */
+static void
+fi_db_mark_dirty(const fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	if (fi_db_dirty != NULL)
+		hset_insert(fi_db_dirty, fi);
+}
+
+/**
+ * Fileinfo is being recorded: cancel any pending removal of its database
+ * record, and make sure the record is written.
+ */
+static void
+fi_db_inserted(const fileinfo_t *fi)
+{
+	const struct guid *guid;
+
+	file_info_check(fi);
+
+	if (NULL == fi_db_deleted)
+		return;
+
+	guid = hset_lookup(fi_db_deleted, fi->guid);
+	if (guid != NULL) {
+		hset_remove(fi_db_deleted, guid);
+		atom_guid_free(guid);
+	}
+
+	/*
+	 * When loading the database, the record is already up-to-date.
+	 */
+
+	if (!fi_db_loading)
+		fi_db_mark_dirty(fi);
+}
+
+/**
+ * Fileinfo is being forgotten: its database record must be removed.
+ */
+static void
+fi_db_removed(const fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	if (NULL == fi_db_deleted)
+		return;
+
+	hset_remove(fi_db_dirty, fi);
+	if (!hset_contains(fi_db_deleted, fi->guid))
+		hset_insert(fi_db_deleted, atom_guid_get(fi->guid));
+}
+
 /**
  * Update the minimum download chunksize.
  *
@@ -581,6 +662,10 @@ fi_event_trigger(fileinfo_t *fi, gnet_fi_ev_t id)
 {
 	file_info_check(fi);
 	g_assert(UNSIGNED(id) < EV_FI_EVENTS);
+
+	if (EV_FI_INFO_CHANGED == id)
+		fi_db_mark_dirty(fi);
+
 	event_trigger(fi_events[id], T_NORMAL(fi_listener_t, (fi->fi_handle)));
 }
 
@@ -673,6 +758,149 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/*
+ * The chunks of a file are kept in the ordered fi->chunklist, and are also
+ * indexed by fi->chunktree, a red-black tree where chunks are compared by
+ * their range, overlapping chunks being equal.
+ *
+ * Since chunks are disjoint and cover the whole file, the tree lets us find
+ * the chunk holding a given offset in O(log n), along with its neighbours,
+ * which is what the hot paths need, instead of walking the whole list.
+ *
+ * Chunks are only inserted in the tree when they do not overlap with any
+ * existing one, i.e. a chunk being split must first be shrunk before the
+ * new chunk is inserted.  Changing the bounds of chunks in place is fine as
+ * long as their relative order is preserved.
+ */
+
+/**
+ * Compare two chunks, overlapping chunks being equal.
+ */
+static int
+fi_chunk_overlap_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+/**
+ * Append chunk at the tail of the chunk list.
+ *
+ * Chunks loaded from disk may be inconsistent and overlap: they are then
+ * not indexed, but the list will be found inconsistent and discarded.
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	eslist_append(&fi->chunklist, fc);
+	erbtree_insert(&fi->chunktree, &fc->node);
+}
+
+/**
+ * Insert chunk `nfc' right after `fc' in the chunk list.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	void *old;
+
+	g_assert(fc->to == nfc->from);
+
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	old = erbtree_insert(&fi->chunktree, &nfc->node);
+
+	g_assert_log(NULL == old,
+		"%s(): new chunk [%s, %s] overlaps with [%s, %s]",
+		G_STRFUNC, filesize_to_string(nfc->from), filesize_to_string2(nfc->to),
+		filesize_to_string3(((struct dl_file_chunk *) old)->from),
+		fileoffset_t_to_string(((struct dl_file_chunk *) old)->to));
+}
+
+/**
+ * Remove the chunk following `fc' in the chunk list.
+ *
+ * @return the removed chunk, which must be freed by the caller.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *next;
+
+	next = eslist_remove_after(&fi->chunklist, fc);
+	erbtree_remove(&fi->chunktree, &next->node);
+
+	return next;
+}
+
+/**
+ * Find the chunk holding the byte at offset `pos'.
+ *
+ * @return the chunk, NULL if `pos' lies beyond the last chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_lookup(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return erbtree_lookup(&fi->chunktree, &key);
+}
+
+/**
+ * @return the chunk preceding `fc' in the chunk list, NULL if first.
+ */
+static struct dl_file_chunk *
+fi_chunk_prev(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	return erbtree_data(&fi->chunktree, erbtree_prev(&fc->node));
+}
+
+/**
+ * @return the chunk following `fc' in the chunk list, NULL if last.
+ */
+static struct dl_file_chunk *
+fi_chunk_next(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	return eslist_next_data(&fi->chunklist, fc);
+}
+
+/**
+ * Find the first empty chunk overlapping with the [from, to[ range.
+ *
+ * Since adjacent empty chunks are merged, we rarely need to look at more
+ * than a couple of chunks past the one holding `from'.
+ *
+ * @return the empty chunk, NULL if the range has no missing part.
+ */
+static struct dl_file_chunk *
+fi_chunk_empty_over(const fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	struct dl_file_chunk *fc;
+
+	for (
+		fc = fi_chunk_lookup(fi, from);
+		fc != NULL && fc->from < to;
+		fc = fi_chunk_next(fi, fc)
+	) {
+		dl_file_chunk_check(fc);
+
+		if (DL_CHUNK_EMPTY == fc->status)
+			return fc;
+	}
+
+	return NULL;
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -861,7 +1089,7 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	}
 
 	fi->dirty = FALSE;
-	fileinfo_dirty = TRUE;
+	fi_db_mark_dirty(fi);
 
 	entropy_harvest_time();
 }
@@ -1132,6 +1360,7 @@ file_info_chunklist_free(fileinfo_t *fi)
 	file_info_check(fi);
 
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
+	erbtree_clear(&fi->chunktree);
 }
 
 /**
@@ -1179,6 +1408,9 @@ fi_free(fileinfo_t *fi)
 
 	file_info_upload_stop(fi, N_("File info being freed"));
 
+	if (fi_db_dirty != NULL)
+		hset_remove(fi_db_dirty, fi);
+
 	if (fi->alias != NULL) {
 		pslist_t *sl;
 
@@ -1304,7 +1536,7 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1344,7 +1576,7 @@ file_info_resize(fileinfo_t *fi, filesize_t size)
 
 	if (!(fi->flags & FI_F_TRANSIENT)) {
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		fi_db_mark_dirty(fi);
 	}
 }
 
@@ -1380,6 +1612,14 @@ fi_alias(fileinfo_t *fi, const char *name, bool record)
 
 		fi->alias = pslist_append_const(fi->alias, atom_str_get(name));
 
+		/*
+		 * Aliases are part of the database record, which is already
+		 * up-to-date when we are loading it.
+		 */
+
+		if (!fi_db_loading)
+			fi_db_mark_dirty(fi);
+
 		if (record) {
 			if (NULL != list) {
 				pslist_append(list, fi);
@@ -1908,6 +2148,8 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
+	erbtree_init(&fi->chunktree, fi_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, node));
 	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
 
 	return fi;
@@ -2169,7 +2411,7 @@ G_STMT_START {				\
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2254,198 +2496,401 @@ eof:
 #undef BAILOUT
 }
 
+/*
+ * Flags of a serialized fileinfo record.
+ */
+#define FI_DBF_PAUSED		(1U << 0)	/**< Download paused */
+#define FI_DBF_SEEDING		(1U << 1)	/**< File seeded */
+#define FI_DBF_SIZE_UNKNOWN	(1U << 2)	/**< !file_size_known */
+#define FI_DBF_NO_SWARMING	(1U << 3)	/**< !use_swarming */
+#define FI_DBF_SHA1			(1U << 4)	/**< Server SHA1 follows */
+#define FI_DBF_TTH			(1U << 5)	/**< Server TTH follows */
+#define FI_DBF_CHA1			(1U << 6)	/**< Computed SHA1 follows */
+
+#define FI_DB_ULE64_MAX		10		/**< Max size of an ule64-encoded value */
+#define FI_DB_CHUNK_MAX		(FI_DB_ULE64_MAX + 1)	/**< Max chunk size */
+
+/**
+ * The value held in the fileinfo database.
+ *
+ * When writing, the record is serialized straight from the fileinfo we
+ * are given.  When reading, a new fileinfo is allocated, which is then owned
+ * by whoever clears the `fi' field, or freed with the value otherwise.
+ */
+struct fi_dbrecord {
+	const fileinfo_t *src;		/**< Fileinfo to serialize */
+	fileinfo_t *fi;				/**< Deserialized fileinfo */
+};
+
 /**
- * Stores a file info record to the config_dir/fileinfo file, and
- * appends it to the output file in question if needed.
+ * Serialization routine for fileinfo records.
+ *
+ * Records are bounded by FILEINFO_DB_MAXSIZE: when the chunks do not fit,
+ * none are written and they will be recovered from the file trailer on
+ * the next startup.  Aliases that do not fit are simply dropped.
  */
 static void
-file_info_store_one(FILE *f, fileinfo_t *fi)
+serialize_fileinfo(pmsg_t *mb, const void *data)
 {
-	slink_t *cl;
-	pslist_t *sl;
-	char *path;
+	const struct fi_dbrecord *r = data;
+	const fileinfo_t *fi = r->src;
+	const struct dl_file_chunk *fc;
+	const pslist_t *sl;
+	size_t chunks, aliases, room;
+	uint8 flags = 0;
 
 	file_info_check(fi);
 
+	if (FI_F_PAUSED & fi->flags)
+		flags |= FI_DBF_PAUSED;
+	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
+		flags |= FI_DBF_SEEDING;
+	if (!fi->file_size_known)
+		flags |= FI_DBF_SIZE_UNKNOWN;
+	if (!fi->use_swarming)
+		flags |= FI_DBF_NO_SWARMING;
+	if (fi->sha1 != NULL)
+		flags |= FI_DBF_SHA1;
+	if (fi->tth != NULL)
+		flags |= FI_DBF_TTH;
+	if (fi->cha1 != NULL)
+		flags |= FI_DBF_CHA1;
+
+	pmsg_write_u8(mb, FILEINFO_DB_VERSION);
+	pmsg_write_string(mb, fi->pathname, (size_t) -1);
+	pmsg_write(mb, fi->guid, GUID_RAW_SIZE);
+	pmsg_write_be32(mb, fi->generation);
+	pmsg_write_u8(mb, flags);
+
+	if (fi->sha1 != NULL)
+		pmsg_write(mb, fi->sha1, SHA1_RAW_SIZE);
+	if (fi->tth != NULL)
+		pmsg_write(mb, fi->tth, TTH_RAW_SIZE);
+	if (fi->cha1 != NULL)
+		pmsg_write(mb, fi->cha1, SHA1_RAW_SIZE);
+
+	pmsg_write_be64(mb, fi->size);
+	pmsg_write_be64(mb, fi->done);
+	pmsg_write_time(mb, fi->stamp);
+	pmsg_write_time(mb, fi->created);
+	pmsg_write_time(mb, fi->ntime);
+
 	/*
-	 * We now persist seeded files in order to be able to resume seeding
-	 * after a crash and a restart, thereby ensuring continuity of the
-	 * user session.
-	 * 		--RAM, 2017-10-21
+	 * Reserve room for the two counts and the chunks before the aliases.
 	 */
 
-	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
-		goto persist;		/* Skip trailer writes, of course */
+	room = pmsg_available(mb);
+	chunks = eslist_count(&fi->chunklist);
 
-	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
-		return;
+	if (room < 2 * FI_DB_ULE64_MAX + chunks * FI_DB_CHUNK_MAX) {
+		g_warning("%s(): too many chunks (%zu) to persist \"%s\"",
+			G_STRFUNC, chunks, fi->pathname);
+		chunks = 0;
+	}
 
-	if (fi->use_swarming && fi->dirty) {
-		file_info_store_binary(fi, FALSE);
+	room -= 2 * FI_DB_ULE64_MAX + chunks * FI_DB_CHUNK_MAX;
+	aliases = 0;
+
+	PSLIST_FOREACH(fi->alias, sl) {
+		size_t len = vstrlen(sl->data) + FI_DB_ULE64_MAX;
+
+		if (len > room)
+			break;
+		room -= len;
+		aliases++;
 	}
 
-persist:
+	pmsg_write_ule64(mb, aliases);
 
-	/*
-	 * Keep entries for incomplete or not even started downloads so that the
-	 * download is started/resumed as soon as a search gains a source.
-	 */
+	PSLIST_FOREACH(fi->alias, sl) {
+		if (0 == aliases--)
+			break;
+		pmsg_write_string(mb, sl->data, (size_t) -1);
+	}
 
-	if (0 == fi->refcount && fi->done == fi->size) {
-		filestat_t st;
+	pmsg_write_ule64(mb, chunks);
 
-		if (-1 == stat(fi->pathname, &st)) {
-			return; 	/* Skip: not referenced, and file no longer exists */
+	if (chunks != 0) {
+		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+			dl_file_chunk_check(fc);
+			pmsg_write_ule64(mb, fc->to - fc->from);
+			pmsg_write_u8(mb, fc->status);
 		}
 	}
+}
 
-	path = filepath_directory(fi->pathname);
-	fprintf(f,
-		"# refcount %u\n"
-		"NAME %s\n"
-		"PATH %s\n"
-		"GUID %s\n"
-		"GENR %u\n",
-		fi->refcount,
-		filepath_basename(fi->pathname),
-		path,
-		guid_hex_str(fi->guid),
-		fi->generation);
-	HFREE_NULL(path);
+/**
+ * Deserialization routine for fileinfo records.
+ */
+static void
+deserialize_fileinfo(bstr_t *bs, void *valptr, size_t len)
+{
+	struct fi_dbrecord *r = valptr;
+	fileinfo_t *fi;
+	struct guid guid;
+	struct sha1 sha1;
+	struct tth tth;
+	filesize_t from = 0;
+	uint64 i, n;
+	uint8 version, flags = 0;
+	char *s;
 
-	PSLIST_FOREACH(fi->alias, sl) {
-		const char *alias = sl->data;
+	g_assert(sizeof *r == len);
+
+	r->src = NULL;
+	r->fi = fi = file_info_allocate();
+	fi->file_size_known = TRUE;		/* Unless stated otherwise below */
+	fi->use_swarming = TRUE;		/* Unless stated otherwise below */
+
+	bstr_read_u8(bs, &version);
+
+	/*
+	 * A record written by a more recent release cannot be decoded safely.
+	 * Consume it without interpreting it: file_info_retrieve_record() will
+	 * leave it untouched in the database.
+	 */
 
-		g_assert(NULL != alias);
-		if (looks_like_urn(alias)) {
-			g_warning("skipping fileinfo alias which looks like a urn: "
-				"\"%s\" (filename=\"%s\")",
-				alias, filepath_basename(fi->pathname));
-		} else
-			fprintf(f, "ALIA %s\n", alias);
+	if G_UNLIKELY(version > FILEINFO_DB_VERSION) {
+		g_warning("%s(): ignoring fileinfo record with unknown version %u",
+			G_STRFUNC, version);
+		bstr_skip(bs, bstr_unread_size(bs));
+		fi_free(fi);
+		r->fi = NULL;
+		return;
 	}
 
-	if (fi->sha1)
-		fprintf(f, "SHA1 %s\n", sha1_base32(fi->sha1));
-	if (fi->tth)
-		fprintf(f, "TTH %s\n", tth_base32(fi->tth));
-	if (fi->cha1)
-		fprintf(f, "CHA1 %s\n", sha1_base32(fi->cha1));
+	if (bstr_read_string(bs, NULL, &s)) {
+		fi->pathname = atom_str_get(s);
+		HFREE_NULL(s);
+	}
+
+	if (bstr_read(bs, &guid, GUID_RAW_SIZE))
+		fi->guid = atom_guid_get(&guid);
+
+	bstr_read_be32(bs, &fi->generation);
+	bstr_read_u8(bs, &flags);
 
-	fprintf(f, "SIZE %s\n", filesize_to_string(fi->size));
-	fprintf(f, "DONE %s\n", filesize_to_string(fi->done));
-	fprintf(f, "TIME %s\n", time_t_to_string(fi->stamp));
-	fprintf(f, "CTIM %s\n", time_t_to_string(fi->created));
-	fprintf(f, "NTIM %s\n", time_t_to_string(fi->ntime));
+	if ((FI_DBF_SHA1 & flags) && bstr_read(bs, &sha1, SHA1_RAW_SIZE))
+		fi->sha1 = atom_sha1_get(&sha1);
+	if ((FI_DBF_TTH & flags) && bstr_read(bs, &tth, TTH_RAW_SIZE))
+		fi->tth = atom_tth_get(&tth);
+	if ((FI_DBF_CHA1 & flags) && bstr_read(bs, &sha1, SHA1_RAW_SIZE))
+		fi->cha1 = atom_sha1_get(&sha1);
+
+	bstr_read_be64(bs, &fi->size);
+	bstr_read_be64(bs, &fi->done);
+	bstr_read_time(bs, &fi->stamp);
+	bstr_read_time(bs, &fi->created);
+	bstr_read_time(bs, &fi->ntime);
+	fi->modified = fi->stamp;		/* Until we know better */
+
+	if (FI_DBF_PAUSED & flags)
+		fi->flags |= FI_F_PAUSED;
+	if (FI_DBF_SEEDING & flags)
+		fi->flags |= FI_F_SEEDING | FI_F_STRIPPED;
+	if (FI_DBF_SIZE_UNKNOWN & flags)
+		fi->file_size_known = FALSE;
+	if (FI_DBF_NO_SWARMING & flags)
+		fi->use_swarming = FALSE;
 
 	/*
-	 * The following boolean tags are emitted conditionally because they
-	 * have defaults: we only emit them when the value is not the default.
-	 *
-	 * For instance, "PAUS" is emitted only when TRUE, so when missing, the
-	 * assumption will be that the file downloading was not paused, i.e. that
-	 * the value of that tag was FALSE.
-	 *
-	 * Note that although here we only emit "PAUS 1", we can correctly process
-	 * input with "PAUS 0": although we no longer emit these, we accept them.
-	 *
-	 * 		--RAM, 2017-10-21
+	 * Aliases are prepended, as file_info_retrieved() expects.
 	 */
 
-	if (FI_F_PAUSED & fi->flags)
-		fputs("PAUS 1\n", f);
+	if (bstr_read_ule64(bs, &n)) {
+		for (i = 0; i < n && bstr_read_string(bs, NULL, &s); i++) {
+			fi->alias = pslist_prepend_const(fi->alias, atom_str_get(s));
+			HFREE_NULL(s);
+		}
+	}
 
-	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
-		fputs("SEED 1\n", f);
+	/*
+	 * Chunks are contiguous, so we only serialize their length.  An invalid
+	 * chunk list is dropped: chunks will be reloaded from the trailer.
+	 */
 
-	if (!fi->file_size_known)
-		fputs("FSKN 0\n", f);
+	if (bstr_read_ule64(bs, &n)) {
+		for (i = 0; i < n; i++) {
+			struct dl_file_chunk *fc;
+			uint64 length;
+			uint8 status;
 
-	if (!fi->use_swarming)
-		fputs("SWRM 0\n", f);
+			if (!bstr_read_ule64(bs, &length) || !bstr_read_u8(bs, &status))
+				break;
 
-	g_assert(file_info_check_chunklist(fi, TRUE));
+			if (
+				0 == length || status > DL_CHUNK_DONE ||
+				length > fi->size || from > fi->size - length
+			) {
+				g_warning("%s(): dropping invalid chunks for \"%s\"",
+					G_STRFUNC, NULL_STRING(fi->pathname));
+				file_info_chunklist_free(fi);
+				break;
+			}
 
-	ESLIST_FOREACH(&fi->chunklist, cl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
+			fc = dl_file_chunk_alloc();
+			fc->from = from;
+			fc->to = from + length;
+			fc->status = DL_CHUNK_BUSY == status ? DL_CHUNK_EMPTY : status;
+			fi_chunk_append(fi, fc);
+			from = fc->to;
+		}
+	}
 
-		dl_file_chunk_check(fc);
-		fprintf(f, "CHNK %s %s %u\n",
-			filesize_to_string(fc->from), filesize_to_string2(fc->to),
-			(uint) fc->status);
+	/*
+	 * On errors, the DBMW layer discards the value without calling
+	 * free_fileinfo(), hence we must free the fileinfo ourselves.
+	 */
+
+	if (bstr_has_error(bs)) {
+		fi_free(fi);
+		r->fi = NULL;
 	}
-	fprintf(f, "\n");
 }
 
 /**
- * Callback for hash table iterator. Used by file_info_store().
+ * Free routine for fileinfo records, to release the deserialized fileinfo
+ * when nobody took it.
  */
 static void
-file_info_store_list(void *value, void *user_data)
+free_fileinfo(void *valptr, size_t len)
 {
-	fileinfo_t *fi = value;
+	struct fi_dbrecord *r = valptr;
 
-	file_info_check(fi);
-	file_info_store_one(user_data, fi);
+	g_assert(sizeof *r == len);
+
+	if (r->fi != NULL) {
+		fi_free(r->fi);
+		r->fi = NULL;
+	}
 }
 
 /**
- * Stores the list of output files and their metainfo to the
- * configdir/fileinfo database.
+ * Write or remove the database record of the fileinfo, and flush its
+ * trailer if needed.
  */
-void
-file_info_store(void)
+static void
+file_info_store_one(fileinfo_t *fi)
 {
-	FILE *f;
-	file_path_t fp;
+	struct fi_dbrecord r;
 
-	file_path_set(&fp, settings_config_dir(), file_info_file);
-	f = file_config_open_write(file_info_what, &fp);
+	file_info_check(fi);
 
-	if (!f)
+	if (!fi->hashed)
 		return;
 
-	file_config_preamble(f, "Fileinfo database");
-
-	fputs(
-		"#\n"
-		"# Format is:\n"
-		"#	NAME <file name>\n"
-		"#	PATH <path>\n"
-		"#	GUID <file ID>\n"
-		"#	GENR <generation number>\n"
-		"#	ALIA <alias file name>\n"
-		"#	SIZE <size>\n"
-		"#	SHA1 <server sha1>\n"
-		"#	TTH  <server tth>\n"
-		"#	CHA1 <computed sha1> [when done only]\n"
-		"#	DONE <bytes done>\n"
-		"#	TIME <last update stamp>\n"
-		"#	CTIM <entry creation time>\n"
-		"#	NTIM <time when new source was seen>\n"
-		"#	PAUS <boolean; paused> [when TRUE only]\n"
-		"#	SEED <boolean; file seeded> [when TRUE only]\n"
-		"#	FSKN <boolean; file_size_known> [when FALSE only]\n"
-		"#	SWRM <boolean; use_swarming> [when FALSE only]\n"
-		"#	CHNK <start> <end+1> <0=hole, 1=busy, 2=done>\n"
-		"#	<blank line>\n"
-		"#\n\n",
-		f
-	);
-
-	hikset_foreach(fi_by_outname, file_info_store_list, f);
-
-	file_config_close(f, &fp);
-	fileinfo_dirty = FALSE;
-}
-
-/**
- * Store global file information cache if dirty.
- */
+	/*
+	 * We now persist seeded files in order to be able to resume seeding
+	 * after a crash and a restart, thereby ensuring continuity of the
+	 * user session.
+	 * 		--RAM, 2017-10-21
+	 */
+
+	if (FI_F_SEEDING == ((FI_F_SEEDING | FI_F_NOSHARE) & fi->flags))
+		goto persist;		/* Skip trailer writes, of course */
+
+	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
+		goto discard;
+
+	if (fi->use_swarming && fi->dirty) {
+		file_info_store_binary(fi, FALSE);
+	}
+
+persist:
+
+	/*
+	 * Keep entries for incomplete or not even started downloads so that the
+	 * download is started/resumed as soon as a search gains a source.
+	 */
+
+	if (0 == fi->refcount && fi->done == fi->size) {
+		filestat_t st;
+
+		if (-1 == stat(fi->pathname, &st))
+			goto discard;	/* Not referenced, and file no longer exists */
+	}
+
+	r.src = fi;
+	r.fi = NULL;
+	dbmw_write_nocache(db_fileinfo, fi->guid, VARLEN(r));
+	return;
+
+discard:
+	dbmw_delete(db_fileinfo, fi->guid);
+}
+
+/**
+ * Hash set iterator to remove records of forgotten fileinfos.
+ */
+static bool
+file_info_store_deleted(const void *key, void *unused_data)
+{
+	const struct guid *guid = key;
+
+	(void) unused_data;
+
+	dbmw_delete(db_fileinfo, guid);
+	atom_guid_free(guid);
+	return TRUE;
+}
+
+/**
+ * Hash set iterator to persist dirty fileinfos.
+ */
+static void
+file_info_store_dirty(const void *key, void *unused_data)
+{
+	fileinfo_t *fi = deconstify_pointer(key);
+
+	(void) unused_data;
+
+	file_info_store_one(fi);
+
+	/* Flushing the trailer marked the record dirty again */
+	hset_remove(fi_db_dirty, fi);
+}
+
+/**
+ * Persists the fileinfos that changed since the last call, and removes
+ * the records of the fileinfos that were discarded.
+ */
+void
+file_info_store(void)
+{
+	hset_t *dirty;
+	size_t deleted, written;
+
+	if (NULL == db_fileinfo)
+		return;
+
+	deleted = hset_foreach_remove(fi_db_deleted, file_info_store_deleted, NULL);
+
+	/*
+	 * Flushing trailers marks records dirty, so we iterate over the set of
+	 * dirty fileinfos after having replaced it with an empty one.
+	 */
+
+	dirty = fi_db_dirty;
+	written = hset_count(dirty);
+	fi_db_dirty = hset_create(HASH_KEY_SELF, 0);
+	hset_foreach(dirty, file_info_store_dirty, NULL);
+	hset_free_null(&dirty);
+
+	dbstore_sync_flush(db_fileinfo);
+
+	if (GNET_PROPERTY(fileinfo_debug) > 1) {
+		g_debug("FILEINFO stored %zu record%s, removed %zu, %zu total",
+			PLURAL(written), deleted, dbmw_count(db_fileinfo));
+	}
+}
+
+/**
+ * Store global file information cache if dirty.
+ */
 void
 file_info_store_if_dirty(void)
 {
-	if (fileinfo_dirty)
+	if (0 != hset_count(fi_db_dirty) || 0 != hset_count(fi_db_deleted))
 		file_info_store();
 }
 
@@ -2477,6 +2922,19 @@ fi_dispose(fileinfo_t *fi)
 	fi_free(fi);
 }
 
+/**
+ * Callback for hash set iterator. Used by file_info_close().
+ */
+static bool
+file_info_free_deleted_kv(const void *key, void *unused_data)
+{
+	const struct guid *guid = key;
+
+	(void) unused_data;
+	atom_guid_free(guid);
+	return TRUE;
+}
+
 /**
  * Callback for hash table iterator. Used by file_info_close().
  */
@@ -2648,6 +3106,12 @@ file_info_close(void)
 	hikset_free_null(&fi_by_guid);
 	hikset_free_null(&fi_by_outname);
 
+	hset_foreach_remove(fi_db_deleted, file_info_free_deleted_kv, NULL);
+	hset_free_null(&fi_db_deleted);
+	hset_free_null(&fi_db_dirty);
+	dbstore_close(db_fileinfo, settings_gnet_db_dir(), db_fileinfo_base);
+	db_fileinfo = NULL;
+
 	HFREE_NULL(tbuf.arena);
 }
 
@@ -2736,6 +3200,9 @@ transient:
 	if (NULL == xfi)
 		hikset_insert_key(fi_by_guid, &fi->guid);
 
+	if (0 == (fi->flags & FI_F_TRANSIENT))
+		fi_db_inserted(fi);
+
 	/*
 	 * Notify interested parties, update counters.
 	 */
@@ -2797,6 +3264,8 @@ file_info_hash_remove(fileinfo_t *fi)
 	if (fi->file_size_known)
 		file_info_hash_remove_name_size(fi);
 
+	fi_db_removed(fi);
+
 transient:
 	hikset_remove(fi_by_guid, fi->guid);
 
@@ -2830,7 +3299,7 @@ file_info_upload_stop(fileinfo_t *fi, const char *reason)
 		}
 
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		fi_db_mark_dirty(fi);
 	}
 }
 
@@ -2842,6 +3311,7 @@ file_info_resume(fileinfo_t *fi)
 	if (FI_F_PAUSED & fi->flags) {
 		fi->flags &= ~FI_F_PAUSED;
 		file_info_changed(fi);
+		fi_db_mark_dirty(fi);
 	}
 }
 
@@ -2853,7 +3323,7 @@ file_info_pause(fileinfo_t *fi)
 	if (!(FI_F_PAUSED & fi->flags)) {
 		fi->flags |= FI_F_PAUSED;
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		fi_db_mark_dirty(fi);
 	}
 }
 
@@ -3136,7 +3606,7 @@ fi_reset_chunks(fileinfo_t *fi)
 		fc->from = 0;
 		fc->to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->generation = 0;		/* Restarting from scratch... */
@@ -3165,424 +3635,439 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 		dl_file_chunk_check(fc);
 		g_assert(fc->from <= fc->to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		fi_chunk_append(fi, WCOPY(fc));
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
 }
 
 /**
- * Loads the fileinfo database from disk, and saves a copy in fileinfo.orig.
+ * Validate a fileinfo record loaded from the database, reconcile it with the
+ * trailer of the file and record it.
+ *
+ * @param fi			the loaded fileinfo, with its pathname set
+ * @param old_filename	if non-NULL, the unsanitized name of the file on disk
+ *
+ * @return the fileinfo kept, which may not be `fi' if a more recent trailer
+ * was found, or NULL if the record was discarded (and freed).
  */
-void G_COLD
-file_info_retrieve(void)
+static fileinfo_t *
+file_info_retrieved(fileinfo_t *fi, const char *old_filename)
 {
-	FILE *f;
-	char line[1024];
-	fileinfo_t *fi = NULL;
-	bool empty = TRUE;
-	bool last_was_truncated = FALSE;
-	file_path_t fp;
-	const char *old_filename = NULL;	/* In case we must rename the file */
-	const char *path = NULL;
-	const char *filename = NULL;
+	fileinfo_t *dfi;
+	bool upgraded;
+	bool reload_chunks = FALSE;
 
 	/*
-	 * We have a complex interaction here: each time a new entry within the
-	 * download mesh is added, file_info_try_to_swarm_with() will be
-	 * called.	Moreover, the download mesh is initialized before us.
-	 *
-	 * However, we cannot enqueue a download before the download module is
-	 * initialized. And we know it is initialized now because download_init()
-	 * calls us!
-	 *
-	 *		--RAM, 20/08/2002
+	 * There can't be duplicates!
 	 */
 
-	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
-
-	file_path_set(&fp, settings_config_dir(), file_info_file);
-	f = file_config_open_read(file_info_what, &fp, 1);
-	if (!f)
-		return;
+	dfi = hikset_lookup(fi_by_outname, fi->pathname);
+	if (NULL != dfi) {
+		g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
+			filepath_basename(fi->pathname));
+		goto discard;
+	}
 
-	while (fgets(line, sizeof(line), f)) {
-		int error;
-		bool truncated = FALSE, damaged;
-		const char *ep;
-		char *value;
-		uint64 v;
+	if (0 == fi->size) {
+		fi->file_size_known = FALSE;
+	}
 
-		/*
-		 * The following semi-complex logic attempts to determine whether
-		 * we filled the whole line buffer without reaching the end of the
-		 * physical line.
-		 *
-		 * When truncation occurs, we skip every following "line" we'd get
-		 * up to the point where we no longer need to truncate, at which time
-		 * we'll be re-synchronized on the real end of the line.
-		 */
+	/*
+	 * If we deserialized an older version, bring it up to date.
+	 */
 
-		truncated = !file_line_chomp_tail(ARYLEN(line), NULL);
+	upgraded = fi_upgrade_older_version(fi);
 
-		if (last_was_truncated) {
-			last_was_truncated = truncated;
-			g_warning("ignoring fileinfo line after truncation: '%s'", line);
-			continue;
-		} else if (truncated) {
-			last_was_truncated = TRUE;
-			g_warning("ignoring too long fileinfo line: '%s'", line);
-			continue;
-		}
+	/*
+	 * If we are processing a file being seeded, skip all the
+	 * CHNK, DONE and trailer consistency checks.
+	 *
+	 * If we are not recovering from a crash, seeded entries are
+	 * discarded.
+	 */
 
-		if (file_line_is_comment(line))
-			continue;
+	if (FI_F_SEEDING & fi->flags) {
+		if (crash_was_restarted()) {
+			filestat_t sb;
 
-		/*
-		 * Reaching an empty line means the end of the fileinfo description.
-		 */
+			if (NULL == fi->sha1) {
+				g_warning("%s(): missing SHA1 for seeded file %s",
+					G_STRFUNC, fi->pathname);
+				goto discard;		/* Fileinfo DB was corrupted, drop seed */
+			}
 
-		if ('\0' == *line && fi) {
-			fileinfo_t *dfi;
-			bool upgraded;
-			bool reload_chunks = FALSE;
+			if (!file_exists(fi->pathname)) {
+				g_warning("%s(): missing previously seeded file %s",
+					G_STRFUNC, fi->pathname);
+				goto discard;		/* User probably removed the file */
+			}
 
-			if (filename && path) {
-				char *pathname = make_pathname(path, filename);
-				fi->pathname = atom_str_get(pathname);
-				HFREE_NULL(pathname);
-			} else {
-				/* There's an incomplete fileinfo record */
-				goto reset;
+			if (-1 == stat(fi->pathname, &sb)) {
+				g_warning("%s(): cannot stat seeded file %s: %m",
+					G_STRFUNC, fi->pathname);
+				goto discard;
 			}
-			atom_str_free_null(&filename);
-			atom_str_free_null(&path);
 
 			/*
-			 * There can't be duplicates!
+			 * FIXME:
+			 * Would need to check that the file is still accurate if
+			 * the timestamp was changed since last modification.
+			 * For now just warn.
+			 * 		--RAM, 2017-10-23
 			 */
 
-			dfi = hikset_lookup(fi_by_outname, fi->pathname);
-			if (NULL != dfi) {
-				g_warning("discarding DUPLICATE fileinfo entry for \"%s\"",
-					filepath_basename(fi->pathname));
-				goto reset;
-			}
+			if (sb.st_mtime != fi->modified) {
+				bool accepted = huge_cached_is_uptodate(
+						fi->pathname, sb.st_size, sb.st_mtime);
 
-			if (0 == fi->size) {
-				fi->file_size_known = FALSE;
+				g_warning("%s(): modified seeded file %s: "
+					"last modified=%lu, file mtime=%lu; %s",
+					G_STRFUNC, fi->pathname,
+					(ulong) fi->modified, (ulong) sb.st_mtime,
+					accepted ? "resetting!" : "discarding!");
+
+				if (!accepted)
+					goto discard;
+
+				/* This stamp is necessary to be able to upload! */
+				fi->modified = sb.st_mtime;
+				fi->stamp = fi->modified;	/* Persist new value */
 			}
 
-			/*
-			 * If we deserialized an older version, bring it up to date.
-			 */
+			if (fi->tth != NULL)
+				file_info_recomputed_tth_internal(fi, fi->tth, FALSE);
 
-			upgraded = fi_upgrade_older_version(fi);
+			/* Seeding of file will be resumed */
+			goto ready;
+		}
 
-			/*
-			 * If we are processing a file being seeded, skip all the
-			 * CHNK, DONE and trailer consistency checks.
-			 *
-			 * If we are not recovering from a crash, seeded entries are
-			 * discarded.
-			 */
+		if (GNET_PROPERTY(share_debug)) {
+			g_info("SHARE discarding seeded file %s", fi->pathname);
+		}
 
-			if (FI_F_SEEDING & fi->flags) {
-				if (crash_was_restarted()) {
-					filestat_t sb;
+		/* Drop the seeded file now */
+		goto discard;
+	}
 
-					if (NULL == fi->sha1) {
-						g_warning("%s(): missing SHA1 for seeded file %s",
-							G_STRFUNC, fi->pathname);
-						goto reset;		/* Fileinfo DB was corrupted, drop seed */
-					}
+	/*
+	 * Allow reconstruction of missing information: if no CHNK
+	 * entry was found for the file, fake one, all empty, and reset
+	 * DONE and GENR to 0.
+	 *
+	 * If for instance the partition where temporary files are held
+	 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
+	 * will be enough to restart without losing the collected
+	 * files.
+	 *
+	 *		--RAM, 31/12/2003
+	 */
 
-					if (!file_exists(fi->pathname)) {
-						g_warning("%s(): missing previously seeded file %s",
-							G_STRFUNC, fi->pathname);
-						goto reset;		/* User probably removed the file */
-					}
+	if (0 == eslist_count(&fi->chunklist)) {
+		if (fi->file_size_known)
+			g_warning("no CHNK info for \"%s\"", fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	} else if (!file_info_check_chunklist(fi, FALSE)) {
+		if (fi->file_size_known)
+			g_warning("invalid set of CHNK info for \"%s\"",
+				fi->pathname);
+		fi_reset_chunks(fi);
+		reload_chunks = TRUE;	/* Will try to grab from trailer */
+	}
 
-					if (-1 == stat(fi->pathname, &sb)) {
-						g_warning("%s(): cannot stat seeded file %s: %m",
-							G_STRFUNC, fi->pathname);
-						goto reset;
-					}
+	g_assert(file_info_check_chunklist(fi, TRUE));
 
-					/*
-					 * FIXME:
-					 * Would need to check that the file is still accurate if
-					 * the timestamp was changed since last modification.
-					 * For now just warn.
-					 * 		--RAM, 2017-10-23
-					 */
+	/*
+	 * If DONE does not match the actual size described by the CHNK
+	 * set, them perhaps the fileinfo database was corrupted?
+	 */
 
-					if (sb.st_mtime != fi->modified) {
-						bool accepted = huge_cached_is_uptodate(
-								fi->pathname, sb.st_size, sb.st_mtime);
+	{
+		filesize_t done = fi->done;
 
-						g_warning("%s(): modified seeded file %s: "
-							"last modified=%lu, file mtime=%lu; %s",
-							G_STRFUNC, fi->pathname,
-							(ulong) fi->modified, (ulong) sb.st_mtime,
-							accepted ? "resetting!" : "discarding!");
+		file_info_merge_adjacent(fi); /* Recalculates also fi->done */
 
-						if (!accepted)
-							goto reset;
+		/*
+		 * If DONE was missing, fi->done will still be 0.
+		 * In that case, we don't really care since we'll have
+		 * recomputed fi->done in the call above.
+		 */
 
-						/* This stamp is necessary to be able to upload! */
-						fi->modified = sb.st_mtime;
-						fi->stamp = fi->modified;	/* Persist new value */
-					}
+		if (done != 0 && fi->done != done) {
+			g_warning("inconsistent DONE info for \"%s\": "
+				"read %s, computed %s",
+				fi->pathname, filesize_to_string(done),
+				filesize_to_string2(fi->done));
+			reload_chunks = TRUE;	/* Will try to grab from trailer */
+		}
+	}
 
-					if (fi->tth != NULL)
-						file_info_recomputed_tth_internal(fi, fi->tth, FALSE);
+	/*
+	 * If `old_filename' is not NULL, then we need to rename
+	 * the file bearing that name into the new (sanitized)
+	 * name, making sure there is no filename conflict.
+	 */
 
-					/* Seeding of file will be resumed */
-					goto ready;
-				}
+	if (NULL != old_filename) {
+		const char *new_pathname;
+		char *old_path;
+		bool renamed = TRUE;
 
-				if (GNET_PROPERTY(share_debug)) {
-					g_info("SHARE discarding seeded file %s", fi->pathname);
-				}
+		old_path = filepath_directory(fi->pathname);
+		new_pathname = file_info_new_outname(old_path,
+							filepath_basename(fi->pathname));
+		HFREE_NULL(old_path);
+		if (NULL == new_pathname)
+			goto discard;
 
-				/* Drop the seeded file now */
-				goto reset;
-			}
+		/*
+		 * If fi->done == 0, the file might not exist on disk.
+		 */
 
-			/*
-			 * Allow reconstruction of missing information: if no CHNK
-			 * entry was found for the file, fake one, all empty, and reset
-			 * DONE and GENR to 0.
-			 *
-			 * If for instance the partition where temporary files are held
-			 * is lost, a single "grep -v ^CHNK fileinfo > fileinfo.new"
-			 * will be enough to restart without losing the collected
-			 * files.
-			 *
-			 *		--RAM, 31/12/2003
-			 */
+		if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
+			renamed = FALSE;
 
-			if (0 == eslist_count(&fi->chunklist)) {
-				if (fi->file_size_known)
-					g_warning("no CHNK info for \"%s\"", fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			} else if (!file_info_check_chunklist(fi, FALSE)) {
-				if (fi->file_size_known)
-					g_warning("invalid set of CHNK info for \"%s\"",
-						fi->pathname);
-				fi_reset_chunks(fi);
-				reload_chunks = TRUE;	/* Will try to grab from trailer */
-			}
+		if (renamed) {
+			g_warning("renamed \"%s\" into sanitized \"%s\"",
+				fi->pathname, new_pathname);
+			atom_str_change(&fi->pathname, new_pathname);
+			fi_db_mark_dirty(fi);
+		} else {
+			g_warning("cannot rename \"%s\" into \"%s\": %m",
+				fi->pathname, new_pathname);
+		}
+		atom_str_free_null(&new_pathname);
+	}
 
-			g_assert(file_info_check_chunklist(fi, TRUE));
+	/*
+	 * Check file trailer information.	The main file is only written
+	 * infrequently and the file's trailer can have more up-to-date
+	 * information.
+	 */
 
-			/*
-			 * If DONE does not match the actual size described by the CHNK
-			 * set, them perhaps the fileinfo database was corrupted?
-			 */
+	dfi = file_info_retrieve_binary(fi->pathname);
 
-			{
-				filesize_t done = fi->done;
+	/*
+	 * If we resetted the CHNK list above, grab those from the
+	 * trailer: that cannot be worse than having to download
+	 * everything again...  If there was no valid trailer, all the
+	 * data are lost and the whole file will need to be grabbed again.
+	 */
 
-				file_info_merge_adjacent(fi); /* Recalculates also fi->done */
+	if (reload_chunks)
+		fi_db_mark_dirty(fi);
 
-				/*
-				 * If DONE was missing, fi->done will still be 0.
-				 * In that case, we don't really care since we'll have
-				 * recomputed fi->done in the call above.
-				 */
+	if (dfi != NULL && reload_chunks) {
+		fi_copy_chunks(fi, dfi);
+		if (0 != eslist_count(&fi->chunklist)) {
+			g_message("recovered %s downloaded bytes "
+				"from trailer of \"%s\"",
+				filesize_to_string(fi->done), fi->pathname);
+		}
+	} else if (reload_chunks)
+		g_warning("lost all CHNK info for \"%s\" -- downloading again",
+			fi->pathname);
 
-				if (done != 0 && fi->done != done) {
-					g_warning("inconsistent DONE info for \"%s\": "
-						"read %s, computed %s",
-						fi->pathname, filesize_to_string(done),
-						filesize_to_string2(fi->done));
-					reload_chunks = TRUE;	/* Will try to grab from trailer */
-				}
-			}
+	g_assert(file_info_check_chunklist(fi, TRUE));
 
-			/*
-			 * If `old_filename' is not NULL, then we need to rename
-			 * the file bearing that name into the new (sanitized)
-			 * name, making sure there is no filename conflict.
-			 */
+	/*
+	 * Special treatment for the GUID: if not present, it will be
+	 * added during retrieval, but it will be different for the
+	 * one in the fileinfo DB and the one on disk.  Set `upgraded'
+	 * to signal that, so that we resync the metainfo below.
+	 */
 
-			if (NULL != old_filename) {
-				const char *new_pathname;
-				char *old_path;
-				bool renamed = TRUE;
+	if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
+		upgraded = TRUE;
 
-				old_path = filepath_directory(fi->pathname);
-				new_pathname = file_info_new_outname(old_path,
-									filepath_basename(fi->pathname));
-				HFREE_NULL(old_path);
-				if (NULL == new_pathname)
-					goto reset;
+	/*
+	 * NOTE: The tigertree data is only stored in the trailer, not
+	 * in the common "fileinfo" file. Therefore, it MUST be fetched
+	 * from "dfi".
+	 */
 
-				/*
-				 * If fi->done == 0, the file might not exist on disk.
-				 */
+	if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
+		file_info_got_tigertree(fi,
+			dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
+	}
 
-				if (-1 == rename(fi->pathname, new_pathname) && 0 != fi->done)
-					renamed = FALSE;
+	if (dfi) {
+		fi->modified = dfi->modified;
+	}
 
-				if (renamed) {
-					g_warning("renamed \"%s\" into sanitized \"%s\"",
-						fi->pathname, new_pathname);
-					atom_str_change(&fi->pathname, new_pathname);
-				} else {
-					g_warning("cannot rename \"%s\" into \"%s\": %m",
-						fi->pathname, new_pathname);
-				}
-				atom_str_free_null(&new_pathname);
+	if (NULL == dfi) {
+		if (is_regular(fi->pathname)) {
+			g_warning("got metainfo in fileinfo cache, "
+				"but none in \"%s\"", fi->pathname);
+			upgraded = FALSE;			/* No need to flush twice */
+			file_info_store_binary(fi, TRUE);	/* Create metainfo */
+		} else {
+			file_info_merge_adjacent(fi);		/* Compute fi->done */
+			if (fi->done > 0) {
+				g_warning("discarding cached metainfo for \"%s\": "
+					"file had %s bytes downloaded "
+					"but is now gone!", fi->pathname,
+					filesize_to_string(fi->done));
+				goto discard;
 			}
+		}
+	} else if (dfi->generation > fi->generation) {
+		g_warning("found more recent metainfo in \"%s\"", fi->pathname);
+		fi_free(fi);
+		fi = dfi;
+		fi_db_mark_dirty(fi);
+	} else if (dfi->generation < fi->generation) {
+		g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
+		fi_free(dfi);
+		dfi = NULL;
+		upgraded = FALSE;				/* No need to flush twice */
+		file_info_store_binary(fi, TRUE);/* Resync metainfo */
+	} else {
+		g_assert(dfi->generation == fi->generation);
+		fi_free(dfi);
+		dfi = NULL;
+	}
 
-			/*
-			 * Check file trailer information.	The main file is only written
-			 * infrequently and the file's trailer can have more up-to-date
-			 * information.
-			 */
+	/*
+	 * Check whether entry is not another's duplicate.
+	 */
 
-			dfi = file_info_retrieve_binary(fi->pathname);
+	dfi = file_info_lookup_dup(fi);
 
-			/*
-			 * If we resetted the CHNK list above, grab those from the
-			 * trailer: that cannot be worse than having to download
-			 * everything again...  If there was no valid trailer, all the
-			 * data are lost and the whole file will need to be grabbed again.
-			 */
+	if (NULL != dfi) {
+		g_warning("found DUPLICATE entry for \"%s\" "
+			"(%s bytes) with \"%s\" (%s bytes)",
+			fi->pathname, filesize_to_string(fi->size),
+			dfi->pathname, filesize_to_string2(dfi->size));
+		goto discard;
+	}
 
-			if (dfi != NULL && reload_chunks) {
-				fi_copy_chunks(fi, dfi);
-				if (0 != eslist_count(&fi->chunklist)) {
-					g_message("recovered %s downloaded bytes "
-						"from trailer of \"%s\"",
-						filesize_to_string(fi->done), fi->pathname);
-				}
-			} else if (reload_chunks)
-				g_warning("lost all CHNK info for \"%s\" -- downloading again",
-					fi->pathname);
+	/*
+	 * If we had to upgrade the fileinfo, make sure we resync
+	 * the metadata on disk as well.
+	 */
 
-			g_assert(file_info_check_chunklist(fi, TRUE));
+	if (upgraded) {
+		g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
+		file_info_store_binary(fi, TRUE);		/* Resync metainfo */
+	}
 
-			/*
-			 * Special treatment for the GUID: if not present, it will be
-			 * added during retrieval, but it will be different for the
-			 * one in the fileinfo DB and the one on disk.  Set `upgraded'
-			 * to signal that, so that we resync the metainfo below.
-			 */
+	file_info_merge_adjacent(fi);
 
-			if (dfi && dfi->guid != fi->guid)		/* They're atoms... */
-				upgraded = TRUE;
+ready:
 
-			/*
-			 * NOTE: The tigertree data is only stored in the trailer, not
-			 * in the common "fileinfo" file. Therefore, it MUST be fetched
-			 * from "dfi".
-			 */
+	file_info_hash_insert(fi);
 
-			if (dfi && dfi->tigertree.leaves && NULL == fi->tigertree.leaves) {
-				file_info_got_tigertree(fi,
-					dfi->tigertree.leaves, dfi->tigertree.num_leaves, FALSE);
-			}
+	if (can_publish_partial_sha1 && fi->sha1 != NULL) {
+		publisher_add(fi->sha1);
+	}
 
-			if (dfi) {
-				fi->modified = dfi->modified;
-			}
+	/*
+	 * We could not add the aliases immediately because the file
+	 * is formatted with ALIA coming before SIZE.  To let fi_alias()
+	 * detect conflicting entries, we need to have a valid fi->size.
+	 * And since the `fi' is hashed, we can detect duplicates in
+	 * the `aliases' list itself as an added bonus.
+	 */
 
-			if (NULL == dfi) {
-				if (is_regular(fi->pathname)) {
-					g_warning("got metainfo in fileinfo cache, "
-						"but none in \"%s\"", fi->pathname);
-					upgraded = FALSE;			/* No need to flush twice */
-					file_info_store_binary(fi, TRUE);	/* Create metainfo */
-				} else {
-					file_info_merge_adjacent(fi);		/* Compute fi->done */
-					if (fi->done > 0) {
-						g_warning("discarding cached metainfo for \"%s\": "
-							"file had %s bytes downloaded "
-							"but is now gone!", fi->pathname,
-							filesize_to_string(fi->done));
-						goto reset;
-					}
-				}
-			} else if (dfi->generation > fi->generation) {
-				g_warning("found more recent metainfo in \"%s\"", fi->pathname);
-				fi_free(fi);
-				fi = dfi;
-			} else if (dfi->generation < fi->generation) {
-				g_warning("found OUTDATED metainfo in \"%s\"", fi->pathname);
-				fi_free(dfi);
-				dfi = NULL;
-				upgraded = FALSE;				/* No need to flush twice */
-				file_info_store_binary(fi, TRUE);/* Resync metainfo */
-			} else {
-				g_assert(dfi->generation == fi->generation);
-				fi_free(dfi);
-				dfi = NULL;
-			}
+	if (fi->alias) {
+		pslist_t *aliases, *sl;
 
-			/*
-			 * Check whether entry is not another's duplicate.
-			 */
+		/* For efficiency each alias has been prepended to
+		 * the list. To preserve the order between sessions,
+		 * the original list order is restored here. */
+		aliases = pslist_reverse(fi->alias);
+		fi->alias = NULL;
+		PSLIST_FOREACH(aliases, sl) {
+			const char *s = sl->data;
+			fi_alias(fi, s, TRUE);
+			atom_str_free_null(&s);
+		}
+		pslist_free_null(&aliases);
+	}
 
-			dfi = file_info_lookup_dup(fi);
+	return fi;
 
-			if (NULL != dfi) {
-				g_warning("found DUPLICATE entry for \"%s\" "
-					"(%s bytes) with \"%s\" (%s bytes)",
-					fi->pathname, filesize_to_string(fi->size),
-					dfi->pathname, filesize_to_string2(dfi->size));
-				goto reset;
-			}
+discard:
+	fi_free(fi);
+	return NULL;
+}
 
-			/*
-			 * If we had to upgrade the fileinfo, make sure we resync
-			 * the metadata on disk as well.
-			 */
+/**
+ * Loads the former ASCII fileinfo database, and saves a copy in fileinfo.orig.
+ *
+ * This is only used to populate the fileinfo records when the database is
+ * first created: all the entries loaded are then marked dirty.
+ */
+static void G_COLD
+file_info_retrieve_ascii(void)
+{
+	FILE *f;
+	char line[1024];
+	fileinfo_t *fi = NULL;
+	bool empty = TRUE;
+	bool last_was_truncated = FALSE;
+	file_path_t fp;
+	const char *old_filename = NULL;	/* In case we must rename the file */
+	const char *path = NULL;
+	const char *filename = NULL;
 
-			if (upgraded) {
-				g_warning("flushing upgraded metainfo in \"%s\"", fi->pathname);
-				file_info_store_binary(fi, TRUE);		/* Resync metainfo */
-			}
+	file_path_set(&fp, settings_config_dir(), file_info_file);
+	f = file_config_open_read(file_info_what, &fp, 1);
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		int error;
+		bool truncated = FALSE, damaged;
+		const char *ep;
+		char *value;
+		uint64 v;
 
-			file_info_merge_adjacent(fi);
+		/*
+		 * The following semi-complex logic attempts to determine whether
+		 * we filled the whole line buffer without reaching the end of the
+		 * physical line.
+		 *
+		 * When truncation occurs, we skip every following "line" we'd get
+		 * up to the point where we no longer need to truncate, at which time
+		 * we'll be re-synchronized on the real end of the line.
+		 */
 
-		ready:
+		truncated = !file_line_chomp_tail(ARYLEN(line), NULL);
 
-			file_info_hash_insert(fi);
+		if (last_was_truncated) {
+			last_was_truncated = truncated;
+			g_warning("ignoring fileinfo line after truncation: '%s'", line);
+			continue;
+		} else if (truncated) {
+			last_was_truncated = TRUE;
+			g_warning("ignoring too long fileinfo line: '%s'", line);
+			continue;
+		}
 
-			if (can_publish_partial_sha1 && fi->sha1 != NULL) {
-				publisher_add(fi->sha1);
-			}
+		if (file_line_is_comment(line))
+			continue;
 
-			/*
-			 * We could not add the aliases immediately because the file
-			 * is formatted with ALIA coming before SIZE.  To let fi_alias()
-			 * detect conflicting entries, we need to have a valid fi->size.
-			 * And since the `fi' is hashed, we can detect duplicates in
-			 * the `aliases' list itself as an added bonus.
-			 */
+		/*
+		 * Reaching an empty line means the end of the fileinfo description.
+		 */
 
-			if (fi->alias) {
-				pslist_t *aliases, *sl;
-
-				/* For efficiency each alias has been prepended to
-				 * the list. To preserve the order between sessions,
-				 * the original list order is restored here. */
-				aliases = pslist_reverse(fi->alias);
-				fi->alias = NULL;
-				PSLIST_FOREACH(aliases, sl) {
-					const char *s = sl->data;
-					fi_alias(fi, s, TRUE);
-					atom_str_free_null(&s);
-				}
-				pslist_free_null(&aliases);
+		if ('\0' == *line && fi) {
+			if (filename && path) {
+				char *pathname = make_pathname(path, filename);
+				fi->pathname = atom_str_get(pathname);
+				HFREE_NULL(pathname);
+			} else {
+				/* There's an incomplete fileinfo record */
+				goto reset;
 			}
+			atom_str_free_null(&filename);
+			atom_str_free_null(&path);
 
-			empty = FALSE;
+			if (NULL != file_info_retrieved(fi, old_filename))
+				empty = FALSE;
 			fi = NULL;
 			continue;
 		}
@@ -3799,7 +4284,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3833,6 +4318,91 @@ file_info_retrieve(void)
 	fclose(f);
 }
 
+/**
+ * Database iterator to load a fileinfo record.
+ *
+ * @return TRUE if the record must be removed from the database.
+ */
+static bool
+file_info_retrieve_record(void *key, void *value, size_t len, void *unused_u)
+{
+	struct fi_dbrecord *r = value;
+	fileinfo_t *fi;
+
+	g_assert(sizeof *r == len);
+	(void) unused_u;
+
+	fi = r->fi;
+	r->fi = NULL;				/* We now own the fileinfo */
+
+	if (NULL == fi)
+		return FALSE;			/* Unknown version, keep record as-is */
+
+	if (NULL == fi->pathname || !is_absolute_path(fi->pathname)) {
+		g_warning("discarding fileinfo record with invalid path \"%s\"",
+			NULL_STRING(fi->pathname));
+		fi_free(fi);
+		return TRUE;
+	}
+
+	fi = file_info_retrieved(fi, NULL);
+
+	if (NULL == fi)
+		return TRUE;
+
+	/*
+	 * If a more recent trailer gave us another GUID, the record must be
+	 * stored again under that new key.
+	 */
+
+	if (!guid_eq(key, fi->guid)) {
+		fi_db_mark_dirty(fi);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Loads all the fileinfo records.
+ */
+void G_COLD
+file_info_retrieve(void)
+{
+	/*
+	 * We have a complex interaction here: each time a new entry within the
+	 * download mesh is added, file_info_try_to_swarm_with() will be
+	 * called.	Moreover, the download mesh is initialized before us.
+	 *
+	 * However, we cannot enqueue a download before the download module is
+	 * initialized. And we know it is initialized now because download_init()
+	 * calls us!
+	 *
+	 *		--RAM, 20/08/2002
+	 */
+
+	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
+
+	/*
+	 * When the database was just created, import the former ASCII file.
+	 * Each entry becomes dirty, and will be written by file_info_store().
+	 */
+
+	if (fi_db_created) {
+		file_info_retrieve_ascii();
+		return;
+	}
+
+	fi_db_loading = TRUE;
+	dbmw_foreach_remove(db_fileinfo, file_info_retrieve_record, NULL);
+	fi_db_loading = FALSE;
+
+	if (GNET_PROPERTY(fileinfo_debug)) {
+		g_debug("FILEINFO loaded %zu record%s",
+			PLURAL(hikset_count(fi_by_outname)));
+	}
+}
+
 static bool
 file_info_name_is_uniq(const char *pathname)
 {
@@ -3944,7 +4514,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4147,12 +4717,12 @@ file_info_moved(fileinfo_t *fi, const char *pathname)
 
 		shared_file_set_modification_time(fi->sf, mtime);	/* Sets sf->mtime */
 		fi->modified = mtime;
-		fi->stamp = mtime;		/* Persisted as "TIME" in fileinfo ASCII DB */
+		fi->stamp = mtime;		/* Persisted in the fileinfo record */
  	}
 
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 	file_info_changed(fi);
-	fileinfo_dirty = TRUE;
+	fi_db_mark_dirty(fi);
 }
 
 /**
@@ -4384,6 +4954,54 @@ file_info_set_discard(fileinfo_t *fi, bool state)
 		fi->flags &= ~FI_F_DISCARD;
 }
 
+/**
+ * Merge adjacent chunks sharing the same status around the [from, to[ range,
+ * after its chunks were updated.
+ *
+ * This is the local version of file_info_merge_adjacent(), looking only at
+ * the chunks overlapping with or adjacent to the range.
+ */
+static void
+fi_merge_range(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	struct dl_file_chunk *fc1, *fc2, *prev;
+
+	fc1 = fi_chunk_lookup(fi, from);
+	g_return_unless(fc1 != NULL);
+
+	prev = fi_chunk_prev(fi, fc1);
+	if (prev != NULL)
+		fc1 = prev;
+
+	if (DL_CHUNK_DONE == fc1->status)
+		fc1->download = NULL;			/* Done, no longer reserved */
+
+	while (NULL != (fc2 = fi_chunk_next(fi, fc1)) && fc2->from <= to) {
+		dl_file_chunk_check(fc2);
+		g_assert(fc1->to == fc2->from);
+
+		if (DL_CHUNK_DONE == fc2->status)
+			fc2->download = NULL;		/* Done, no longer reserved */
+
+		/*
+		 * Never merge adjacent busy chunks, as in file_info_merge_adjacent().
+		 */
+
+		if (fc1->status == fc2->status && DL_CHUNK_BUSY != fc2->status) {
+			void *removed;
+
+			fc1->to = fc2->to;
+			removed = fi_chunk_remove_after(fi, fc1);
+			g_assert(removed == fc2);
+			dl_file_chunk_free(&fc2);
+		} else {
+			fc1 = fc2;
+		}
+	}
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+}
+
 /**
  * Go through the chunk list and merge adjacent chunks that share the
  * same status and download. Keeps the chunk list short and tidy.
@@ -4428,7 +5046,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 			void *removed;
 
 			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
@@ -4460,7 +5078,7 @@ file_info_size_unknown(fileinfo_t *fi)
 	if (0 == (fi->flags & FI_F_TRANSIENT)) {
 		file_info_hash_remove_name_size(fi);
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		fi_db_mark_dirty(fi);
 	}
 
 	fi->file_size_known = FALSE;
@@ -4499,7 +5117,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
 			fc->to = fi->done;
 
@@ -4510,7 +5128,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
 		}
@@ -4529,14 +5147,14 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
 	fi->use_swarming = TRUE;
 	fi->size = MAX(size, fi->done);
 	fi->dirty = TRUE;
-	fileinfo_dirty = TRUE;
+	fi_db_mark_dirty(fi);
 
 	if (0 == (FI_F_TRANSIENT & fi->flags)) {
 		file_info_hash_insert_name_size(fi);
@@ -4565,6 +5183,7 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 	int n, againcount = 0;
 	bool need_merging;
 	const struct download *newval;
+	filesize_t fc_to, orig_from = from;
 
 	download_check(d);
 	fi = d->file_info;
@@ -4633,10 +5252,18 @@ again:
 	 * because we may be writing data to an already "done" chunk, when a
 	 * previous chunk bumps into a done one.
 	 *		--RAM, 04/11/2002
+	 *
+	 * We start with the chunk holding `from', located through the chunk
+	 * tree, instead of scanning the list from its head.  Each time we
+	 * change the status of a chunk part, fi->done is adjusted by removing
+	 * what was previously done and adding what is now done.
 	 */
 
+	fc = fi_chunk_lookup(fi, from);
+	prevfc = NULL == fc ? NULL : fi_chunk_prev(fi, fc);
+
 	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
+		n = 0, sl = NULL == fc ? NULL : &fc->lk;
 		sl != NULL;
 		n++, prevfc = fc, sl = eslist_next(sl)
 	) {
@@ -4654,6 +5281,8 @@ again:
 			else if (DL_CHUNK_DONE == fc->status)
 				need_merging = TRUE;		/* Writing to completed chunk! */
 
+			if (DL_CHUNK_DONE == fc->status)
+				fi->done -= to - from;
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
 			fc->status = status;
@@ -4669,6 +5298,8 @@ again:
 			else if (DL_CHUNK_DONE == fc->status)
 				need_merging = TRUE;		/* Writing to completed chunk! */
 
+			if (DL_CHUNK_DONE == fc->status)
+				fi->done -= fc->to - from;
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
 			fc->status = status;
@@ -4679,8 +5310,10 @@ again:
 
 		} else if (fc->from == from && fc->to > to) {
 
-			if (DL_CHUNK_DONE == fc->status)
+			if (DL_CHUNK_DONE == fc->status) {
 				need_merging = TRUE;		/* Writing to completed chunk! */
+				fi->done -= to - from;
+			}
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
@@ -4704,7 +5337,7 @@ again:
 				fc->to = to;
 				fc->status = status;
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4717,40 +5350,50 @@ again:
 			 * New chunk [from, to] lies within ]fc->from, fc->to].
 			 */
 
-			if (DL_CHUNK_DONE == fc->status)
+			if (DL_CHUNK_DONE == fc->status) {
 				need_merging = TRUE;
+				fi->done -= to - from;
+			}
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
 
-			if (fc->to > to) {
-				nfc = dl_file_chunk_alloc();
-				nfc->from = to;
-				nfc->to = fc->to;
-				nfc->status = fc->status;
-				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+			/*
+			 * The chunk is shrunk first, so that the new chunks we insert
+			 * after it do not overlap with it.
+			 */
+
+			fc_to = fc->to;
+			fc->to = from;
+
+			nfc = dl_file_chunk_alloc();
+			nfc->from = from;
+			nfc->to = to;
+			nfc->status = status;
+			nfc->download = newval;
+			fi_chunk_insert_after(fi, fc, nfc);
+
+			if (fc_to > to) {
+				struct dl_file_chunk *ufc = dl_file_chunk_alloc();
 
-				if (DL_CHUNK_BUSY == nfc->status) {
+				ufc->from = to;
+				ufc->to = fc_to;
+				ufc->status = fc->status;
+				ufc->download = fc->download;
+
+				if (DL_CHUNK_BUSY == ufc->status) {
 					/*
 					 * Reserved chunk being aggressively stolen, hence its
 					 * upper-part ]to, fc->to] cannot be linearily downloaded.
 					 * Make it free so that the source owning the original
 					 * chunk is not suddenly seen as reserving two chunks!
 					 */
-					nfc->status = DL_CHUNK_EMPTY;
-					nfc->download = NULL;
+					ufc->status = DL_CHUNK_EMPTY;
+					ufc->download = NULL;
 				}
-			}
 
-			nfc = dl_file_chunk_alloc();
-			nfc->from = from;
-			nfc->to = to;
-			nfc->status = status;
-			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-
-			fc->to = from;
+				fi_chunk_insert_after(fi, nfc, ufc);
+			}
 
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4758,24 +5401,25 @@ again:
 
 		} else if (fc->from < from && fc->to < to) {
 
-			filesize_t tmp;
-
-			if (DL_CHUNK_DONE == fc->status)
+			if (DL_CHUNK_DONE == fc->status) {
 				need_merging = TRUE;
+				fi->done -= fc->to - from;
+			}
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
 
+			fc_to = fc->to;
+			fc->to = from;
+
 			nfc = dl_file_chunk_alloc();
 			nfc->from = from;
-			nfc->to = fc->to;
+			nfc->to = fc_to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
-			tmp = fc->to;
-			fc->to = from;
-			from = tmp;
+			from = fc_to;
 			g_assert(file_info_check_chunklist(fi, TRUE));
 			goto again;
 		}
@@ -4798,7 +5442,7 @@ again:
 	}
 
 	if (need_merging)
-		file_info_merge_adjacent(fi);		/* Also updates fi->done */
+		fi_merge_range(fi, orig_from, to);
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
@@ -4914,7 +5558,7 @@ restart:
 	}
 
 	file_info_merge_adjacent(fi);
-	fileinfo_dirty = TRUE;
+	fi_db_mark_dirty(fi);
 }
 
 /**
@@ -4930,10 +5574,12 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, from);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
-		if (from >= fc->from && to <= fc->to)
+		if (to <= fc->to)
 			return fc->status;
 	}
 
@@ -4962,43 +5608,37 @@ file_info_new_chunk_owner(const struct download *d,
 {
 	fileinfo_t *fi;
 	const struct download *old = NULL;
-	const slink_t *sl;
+	struct dl_file_chunk *fc;
+	const slink_t *sl = NULL;
 
 	download_check(d);
 	fi = d->file_info;
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
-
-		/*
-		 * We're looking for the first busy chunk intersecting with [from, to],
-		 * which happens when one of the segment bounds lies within the chunk.
-		 */
+	/*
+	 * We're looking for the first busy chunk intersecting with [from, to],
+	 * which happens when one of the segment bounds lies within the chunk.
+	 */
 
-		if (DL_CHUNK_BUSY != fc->status)
-			continue;
+	fc = fi_chunk_lookup(fi, from);
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		fc = fi_chunk_lookup(fi, to);
 
-		if (
-			(from >= fc->from && from < fc->to) ||
-			(to >= fc->from && to < fc->to)
-		) {
-			g_assert(fc->download != NULL);
-			download_check(fc->download);
-			g_assert(fc->download != d);
+	if (fc != NULL && DL_CHUNK_BUSY == fc->status) {
+		dl_file_chunk_check(fc);
+		g_assert(fc->download != NULL);
+		download_check(fc->download);
+		g_assert(fc->download != d);
 
-			old = fc->download;
-			fc->download = d;
-			break;
-		}
+		old = fc->download;
+		fc->download = d;
+		sl = &fc->lk;
 	}
 
 	if (old != NULL) {
 		for (sl = eslist_next(sl); sl != NULL; sl = eslist_next(sl)) {
-			struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+			fc = eslist_data(&fi->chunklist, sl);
 
 			dl_file_chunk_check(fc);
 
@@ -5022,10 +5662,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -5118,23 +5759,6 @@ fi_available_log(const fileinfo_t *fi)
 	}
 }
 
-/**
- * Compares two offered ranges so that two ranges are equal when they overlap.
- */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_file_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping chunks are equal */
-}
-
 /**
  * Wrapper around http_rangeset_lookup_over() to simplify code logic in
  * fi_pick_rarest_chunk().
@@ -5178,7 +5802,6 @@ fi_rangeset_lookup_over(const http_rangeset_t *offered,
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
 	http_rangeset_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
@@ -5233,21 +5856,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		}
 	}
 
-	/*
-	 * The `missing' red-black tree contains the file chunks that are still
-	 * empty and need to be downloaded.
-	 */
-
-	missing = rbtree_create(fi_chunk_overlap_cmp);
-
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
-	}
-
 	/*
 	 * Find the first missing chunk that is also offered, starting with the
 	 * rarest available chunk: the fi->available list is sorted by increasing
@@ -5285,13 +5893,17 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 
 		while (NULL != (r = fi_rangeset_lookup_over(offered, fa, &r_dflt, r))) {
 			struct dl_file_chunk *dfc;
-			struct dl_file_chunk crange;
 			filesize_t start, end;
 
-			crange.from = r->start;
-			crange.to = r->end + 1;
+			/*
+			 * Look for a missing chunk within the intersection of the
+			 * offered range and the rarest chunk.
+			 */
+
+			start = MAX(fa->from, r->start);
+			end   = MIN(fa->to,   r->end + 1);
 
-			dfc = rbtree_lookup(missing, &crange);
+			dfc = start < end ? fi_chunk_empty_over(fi, start, end) : NULL;
 
 			if (NULL == dfc)
 				continue;	/* Rare range not overlapping with missing range */
@@ -5454,7 +6066,7 @@ selected:
 				}
 
 				candidate = NULL;		/* Signals: nothing! */
-				goto nothing;
+				goto done;
 			}
 		}
 
@@ -5492,7 +6104,7 @@ selected:
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -5516,11 +6128,6 @@ selected:
 
 	/* FALL THROUGH */
 
-nothing:
-	rbtree_free_null(&missing);
-
-	/* FALL THROUGH */
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		if (candidate != NULL) {
@@ -5730,7 +6337,7 @@ selected:
 		nfc->status = DL_CHUNK_EMPTY;
 		fc->to = nfc->from;
 
-		eslist_insert_after(&fi->chunklist, fc, nfc);
+		fi_chunk_insert_after(fi, fc, nfc);
 		candidate = nfc;
 	}
 
@@ -6996,7 +7603,10 @@ fi_get_aliases(gnet_fi_t fih)
 void
 file_info_add_new_source(fileinfo_t *fi, struct download *d)
 {
+	file_info_check(fi);
+
 	fi->ntime = tm_time();
+	fi_db_mark_dirty(fi);		/* The "ntime" is part of the record */
 	file_info_add_source(fi, d);
 }
 
@@ -8598,8 +9208,26 @@ file_info_clear_completed(void)
 void G_COLD
 file_info_init(void)
 {
+	dbstore_kv_t kv = {
+		GUID_RAW_SIZE, NULL, sizeof(struct fi_dbrecord), FILEINFO_DB_MAXSIZE
+	};
+	dbstore_packing_t packing = {
+		serialize_fileinfo, deserialize_fileinfo, free_fileinfo
+	};
+
 	TOKENIZE_CHECK_SORTED(fi_tags);
 
+	/*
+	 * Records are serialized straight from the fileinfo, so they must not
+	 * be cached: hence the cache size of 0.
+	 */
+
+	fi_db_created = !dbstore_exists(settings_gnet_db_dir(), db_fileinfo_base);
+	db_fileinfo = dbstore_open(db_fileinfo_what, settings_gnet_db_dir(),
+		db_fileinfo_base, kv, packing, 0, guid_hash, guid_eq, FALSE);
+	fi_db_dirty = hset_create(HASH_KEY_SELF, 0);
+	fi_db_deleted = hset_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
+
 	fi_by_sha1     = hikset_create(offsetof(fileinfo_t, sha1),
 						HASH_KEY_FIXED, SHA1_RAW_SIZE);
 	fi_by_namesize = htable_create_any(namesize_hash, NULL, namesize_eq);
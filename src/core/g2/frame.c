@@ -169,6 +169,7 @@
 
 #include "lib/endian.h"
 #include "lib/halloc.h"
+#include "lib/misc.h"
 #include "lib/unsigned.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -246,155 +247,428 @@ g2_frame_read_length(struct frame_dctx *dctx, size_t bytes, size_t *length)
 }
 
 /**
- * Read specified amount of bytes into destination buffer.
+ * Decode the G2 packet starting at the supplied address into a flat frame.
  *
- * @param dctx		the deserialization context
- * @param dst		the detination buffer (must be large enough)
- * @param len		how many bytes to read
+ * When "validate" is TRUE, all the children are recursively decoded to make
+ * sure the whole packet is well-formed.  Otherwise, children are merely
+ * skipped over by looking at their header, which is only safe when the
+ * enclosing packet was validated beforehand.
  *
- * @return TRUE if OK.
- */
-static bool
-g2_frame_read_data(struct frame_dctx *dctx, void *dst, size_t len)
-{
-	const void *end;
-
-	end = const_ptr_add_offset(dctx->p, len);
-
-	g_assert(dst != NULL);
-	g_assert(size_is_positive(len));
-
-	if G_UNLIKELY(ptr_cmp(dctx->end, end) < 0)
-		return FALSE;
-
-	memcpy(dst, dctx->p, len);
-	dctx->p = end;
-	return TRUE;
-}
-
-/**
- * Recursively deserialize the G2 packet.
+ * @param p			start of the packet (its control byte)
+ * @param limit		first byte past the area in which the packet must fit
+ * @param f			the frame to fill
+ * @param validate	whether to validate all the children recursively
  *
- * @return NULL if an error occurred, the deserialized tree otherwise.
+ * @return TRUE if OK, FALSE if the packet is malformed.
  */
-static g2_tree_t *
-g2_frame_recursive_deserialize(struct frame_dctx *dctx)
+static bool
+g2_frame_decode(const void *p, const void *limit, g2_frame_t *f, bool validate)
 {
+	struct frame_dctx dctx;
 	uint8 control;
-	char name[G2_FRAME_NAME_LEN_MAX + 1];
-	size_t length, bytelen, namelen, remain, paylen;
-	g2_tree_t *node;
-	const void *start;
+	size_t length, bytelen, namelen;
+
+	dctx.p = p;
+	dctx.end = limit;
+	dctx.copy = FALSE;
 
 	/*
 	 * Decode the header: control byte, length, name.
 	 */
 
-	if (!g2_frame_read_byte(dctx, &control))
-		return NULL;
+	if (!g2_frame_read_byte(&dctx, &control))
+		return FALSE;
 
 	if (control & G2_FRAME_BE)
-		return NULL;				/* Only handle little-endian packets */
+		return FALSE;				/* Only handle little-endian packets */
 
 	if (0 == control)
-		return NULL;				/* End of stream */
+		return FALSE;				/* End of stream */
 
 	bytelen = G2_BYTELEN(control);
 	namelen = G2_NAMELEN(control);
 
 	if (0 != bytelen) {
-		if (!g2_frame_read_length(dctx, bytelen, &length))
-			return NULL;
+		if (!g2_frame_read_length(&dctx, bytelen, &length))
+			return FALSE;
 	} else {
 		length = 0;
 	}
 
-	if (!g2_frame_read_data(dctx, name, namelen))
-		return NULL;
+	if G_UNLIKELY(ptr_diff(dctx.end, dctx.p) < namelen)
+		return FALSE;
 
-	name[namelen] = '\0';
-	start = dctx->p;				/* First byte after header */
+	f->name = dctx.p;
+	f->namelen = namelen;
+	dctx.p = const_ptr_add_offset(dctx.p, namelen);
 
 	/*
-	 * Make sure the whole packet fits into what we were given to deserialize.
+	 * Make sure the whole packet fits into the area.
 	 */
 
-	remain = ptr_diff(dctx->end, dctx->p);
-	if (remain < length)
-		return NULL;
-
-	/*
-	 * OK, create the node.  We don't know whether there will be a payload yet.
-	 */
+	if (ptr_diff(dctx.end, dctx.p) < length)
+		return FALSE;
 
-	node = g2_tree_alloc_empty(name);
+	f->start = p;
+	f->end = const_ptr_add_offset(dctx.p, length);
+	f->limit = limit;
+	f->children = NULL;
 
 	/*
-	 * If it is a compound packet, deserialize its children.
+	 * If it is a compound packet, locate the end of the children stream,
+	 * where the payload starts.
 	 */
 
 	if (length != 0 && (control & G2_FRAME_CF)) {
-		struct frame_dctx childctx;
+		const void *q = dctx.p;
 		size_t children = 0;
 
-		childctx.p = dctx->p;
-		childctx.end = const_ptr_add_offset(dctx->p, length);
-		childctx.copy = dctx->copy;
-
-		while (ptr_cmp(childctx.p, childctx.end) < 0) {
-			const uint8 *cptr = childctx.p;		/* Control byte location */
-			g2_tree_t *child;
-
-			if (0 == *cptr) {		/* End of child straem */
-				childctx.p++;
+		while (ptr_cmp(q, f->end) < 0) {
+			if (0 == *(const uint8 *) q) {		/* End of child stream */
+				q = const_ptr_add_offset(q, 1);
 				break;
 			}
 
 			children++;
 
-			child = g2_frame_recursive_deserialize(&childctx);
-			if (NULL == child)
-				goto failure;
+			if (validate) {
+				g2_frame_t child;
+
+				if (!g2_frame_decode(q, f->end, &child, TRUE))
+					return FALSE;
+				q = child.end;
+			} else {
+				size_t clen, avail = ptr_diff(f->end, q);
 
-			g2_tree_add_child(node, child);
+				clen = g2_frame_whole_length(q, avail);
+				if (0 == clen || clen > avail)
+					return FALSE;
+				q = const_ptr_add_offset(q, clen);
+			}
 		}
 
 		if (0 == children)
-			goto failure;
+			return FALSE;
 
-		dctx->p = childctx.p;
+		f->children = dctx.p;
+		dctx.p = q;
+	}
 
-		/*
-		 * To restore the order of children in the tree, reverse the
-		 * children list since g2_tree_add_child() prepends to the list.
-		 */
+	f->paylen = ptr_diff(f->end, dctx.p);
+	f->payload = 0 == f->paylen ? NULL : dctx.p;
 
-		g2_tree_reverse_children(node);
+	return TRUE;
+}
+
+/**
+ * Parse the first G2 packet held in the supplied buffer into a flat frame.
+ *
+ * The whole packet is validated but nothing is allocated: the frame refers
+ * to the data in the buffer, and can be used to navigate through the packet
+ * via g2_frame_first_child(), g2_frame_lookup(), etc...
+ *
+ * @param buf			start of buffer where packet lies
+ * @param len			amount of data held in the buffer
+ * @param packet_len	if non-NULL, set with the amount of data consumed
+ * @param f				the frame to fill
+ *
+ * @return TRUE if packet was valid, FALSE if it was malformed or incompletely
+ * held in the buffer.
+ */
+bool
+g2_frame_parse(const void *buf, size_t len, size_t *packet_len, g2_frame_t *f)
+{
+	g_assert(buf != NULL);
+	g_assert(size_is_positive(len));
+	g_assert(f != NULL);
+
+	if (!g2_frame_decode(buf, const_ptr_add_offset(buf, len), f, TRUE)) {
+		f->start = NULL;
+		if (packet_len != NULL)
+			*packet_len = 0;
+		return FALSE;
 	}
 
-	/*
-	 * Read the payload, if any.
-	 */
+	f->limit = f->end;		/* The root packet has no siblings */
+
+	if (packet_len != NULL)
+		*packet_len = ptr_diff(f->end, buf);
+
+	return TRUE;
+}
+
+/**
+ * Fetch the first child of a packet.
+ *
+ * @param f			the parent frame
+ * @param child		the frame to fill with the first child
+ *
+ * @return TRUE if the packet had children, FALSE otherwise with the
+ * start of the child frame set to NULL.
+ */
+bool
+g2_frame_first_child(const g2_frame_t *f, g2_frame_t *child)
+{
+	g_assert(f != NULL);
+	g_assert(f->start != NULL);
+	g_assert(child != NULL);
+
+	if (
+		NULL == f->children ||
+		!g2_frame_decode(f->children, f->end, child, FALSE)
+	) {
+		child->start = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Move child frame to its next sibling, in place.
+ *
+ * @return TRUE if there was a next sibling, FALSE otherwise with the
+ * start of the frame set to NULL.
+ */
+bool
+g2_frame_next_sibling(g2_frame_t *child)
+{
+	const void *p;
+
+	g_assert(child != NULL);
+	g_assert(child->start != NULL);
+
+	p = child->end;
+
+	if (
+		ptr_cmp(p, child->limit) >= 0 ||
+		0 == *(const uint8 *) p ||				/* End of child stream */
+		!g2_frame_decode(p, child->limit, child, FALSE)
+	) {
+		child->start = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Move child frame to the next sibling bearing the same name, in place.
+ *
+ * @return TRUE if there was such a sibling, FALSE otherwise with the
+ * start of the frame set to NULL.
+ */
+bool
+g2_frame_next_twin(g2_frame_t *child)
+{
+	const char *name = child->name;
+	uint8 namelen = child->namelen;
+
+	while (g2_frame_next_sibling(child)) {
+		if (namelen == child->namelen && 0 == memcmp(name, child->name, namelen))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Check whether frame bears the specified name.
+ */
+bool
+g2_frame_has_name(const g2_frame_t *f, const char *name)
+{
+	g_assert(f != NULL);
+	g_assert(f->start != NULL);
+	g_assert(name != NULL);
+
+	return vstrlen(name) == f->namelen &&
+		0 == memcmp(f->name, name, f->namelen);
+}
+
+/**
+ * Copy the name of the frame into the supplied buffer, as a NUL-terminated
+ * string, truncating it if necessary.
+ *
+ * @return the start of the buffer.
+ */
+const char *
+g2_frame_node_name(const g2_frame_t *f, char *buf, size_t len)
+{
+	g_assert(f != NULL);
+	g_assert(f->start != NULL);
+	g_assert(buf != NULL);
+	g_assert(size_is_positive(len));
+
+	clamp_strncpy(buf, len, f->name, f->namelen);
+	return buf;
+}
+
+/**
+ * Fetch the payload of the frame.
+ *
+ * @param f			the frame we're querying
+ * @param paylen	if non-NULL, where the size of the payload is returned
+ *
+ * @return the start of the payload, NULL if none.
+ */
+const void *
+g2_frame_node_payload(const g2_frame_t *f, size_t *paylen)
+{
+	g_assert(f != NULL);
+	g_assert(f->start != NULL);
+
+	if (paylen != NULL)
+		*paylen = f->paylen;
 
-	paylen = length - ptr_diff(dctx->p, start);
+	return f->payload;
+}
 
-	if (!size_is_non_negative(paylen))
-		goto failure;				/* Length was bad, we got garbage */
+/**
+ * Fetch next component in path.
+ *
+ * @param path		pointer to the current position in path, updated
+ * @param len		where the length of the component is returned
+ *
+ * @return the start of the component, NULL if the end of path was reached.
+ */
+static const char *
+g2_frame_path_next(const char **path, size_t *len)
+{
+	const char *p = *path, *start;
 
-	g_assert(ptr_cmp(const_ptr_add_offset(dctx->p, paylen), dctx->end) <= 0);
+	while ('/' == *p)
+		p++;
+
+	if ('\0' == *p)
+		return NULL;
+
+	start = p;
+
+	while (*p != '\0' && *p != '/')
+		p++;
+
+	*path = p;
+	*len = p - start;
+	return start;
+}
+
+/**
+ * Is path component the "." or ".." special item?
+ */
+static inline bool
+g2_frame_path_is_dot(const char *tok, size_t len)
+{
+	return '.' == tok[0] && (1 == len || (2 == len && '.' == tok[1]));
+}
 
-	if (0 != paylen) {
-		g2_tree_set_payload(node, dctx->p, paylen, dctx->copy);
-		dctx->p = const_ptr_add_offset(dctx->p, paylen);
+/**
+ * Fetch the frame identified by its path.
+ *
+ * This is the flat counterpart of g2_tree_lookup(), with the same semantics
+ * save for the ".." path component: since frames do not know their parent,
+ * ".." is only allowed in the anchored prefix, where it is ignored.
+ *
+ * An anchored path (e.g. "/QH2/H") checks the name of the supplied frame,
+ * which must therefore be the root packet.
+ *
+ * @param root		the frame from which lookup starts
+ * @param path		the path to the packet to retrieve (eg: "/QH2/H")
+ * @param f			where the found frame is written
+ *
+ * @return TRUE if path was found, FALSE otherwise.
+ */
+bool
+g2_frame_lookup(const g2_frame_t *root, const char *path, g2_frame_t *f)
+{
+	g2_frame_t cur;
+	const char *tok;
+	size_t len;
+
+	g_assert(root != NULL);
+	g_assert(root->start != NULL);
+	g_assert(path != NULL);
+	g_assert(f != NULL);
+
+	cur = *root;
+
+	if ('/' == path[0]) {
+		for (;;) {
+			tok = g2_frame_path_next(&path, &len);
+			if (NULL == tok)				/* Looking for "/", the root */
+				goto found;
+			if G_UNLIKELY(g2_frame_path_is_dot(tok, len))
+				continue;					/* We're at the root */
+			if (len != cur.namelen || 0 != memcmp(tok, cur.name, len))
+				return FALSE;
+			break;							/* Root is properly named */
+		}
 	}
 
-	g_assert(ptr_cmp(dctx->p, dctx->end) <= 0);
+	while (NULL != (tok = g2_frame_path_next(&path, &len))) {
+		g2_frame_t c;
+
+		if G_UNLIKELY(g2_frame_path_is_dot(tok, len)) {
+			if (1 == len)
+				continue;					/* "." is the current node */
+			return FALSE;					/* ".." is not supported */
+		}
 
-	return node;
+		G2_FRAME_CHILD_FOREACH(&cur, &c) {
+			if (len == c.namelen && 0 == memcmp(tok, c.name, len))
+				break;
+		}
 
-failure:
-	g2_tree_free_null(&node);
-	return NULL;
+		if (NULL == c.start)
+			return FALSE;
+
+		cur = c;
+	}
+
+found:
+	*f = cur;
+	return TRUE;
+}
+
+/**
+ * Fetch the payload of a packet identified by its sub-path.
+ *
+ * See g2_frame_lookup() for the semantics of the supplied path.
+ *
+ * @param root		the frame from which lookup starts
+ * @param path		the path to the item to be retrieved (eg: "URN")
+ * @param paylen	if non-NULL, where the size of the payload is returned
+ *
+ * @return the start of the payload, NULL if none or if the item does not exist.
+ */
+const void *
+g2_frame_payload(const g2_frame_t *root, const char *path, size_t *paylen)
+{
+	g2_frame_t f;
+
+	if (!g2_frame_lookup(root, path, &f)) {
+		if (paylen != NULL)
+			*paylen = 0;
+		return NULL;
+	}
+
+	return g2_frame_node_payload(&f, paylen);
+}
+
+/**
+ * @return the amount of packets held in the frame, including itself.
+ */
+size_t
+g2_frame_node_count(const g2_frame_t *f)
+{
+	g2_frame_t c;
+	size_t count = 1;
+
+	G2_FRAME_CHILD_FOREACH(f, &c) {
+		count += g2_frame_node_count(&c);
+	}
+
+	return count;
 }
 
 /**
@@ -510,7 +784,11 @@ g2_frame_name(const void *buf, size_t len, size_t *nlen)
 /**
  * Deserialize the first G2 packet held in the supplied buffer.
  *
- * Payload data is NOT copied but points directly into the input buffer.
+ * Unless "copy" is set, payload data is NOT copied but points directly
+ * into the input buffer.
+ *
+ * Callers that only need to read a few items should rather use the flat
+ * frame returned by g2_frame_parse(), which does not allocate any memory.
  *
  * @param buf			start of buffer where packet lies
  * @param len			amount of data held in the buffer
@@ -523,22 +801,15 @@ g2_frame_name(const void *buf, size_t len, size_t *nlen)
 g2_tree_t *
 g2_frame_deserialize(const void *buf, size_t len, size_t *packet_len, bool copy)
 {
-	struct frame_dctx dctx;
-	g2_tree_t *t;
+	g2_frame_t f;
 
 	g_assert(buf != NULL);
 	g_assert(size_is_positive(len));
 
-	dctx.p = buf;
-	dctx.end = const_ptr_add_offset(buf, len);
-	dctx.copy = booleanize(copy);
-
-	t = g2_frame_recursive_deserialize(&dctx);
-
-	if (packet_len != NULL)
-		*packet_len = ptr_diff(dctx.p, buf);
+	if (!g2_frame_parse(buf, len, packet_len, &f))
+		return NULL;
 
-	return t;
+	return g2_tree_from_frame(&f, copy);
 }
 
 /**
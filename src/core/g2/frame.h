@@ -38,6 +38,28 @@
 #define G2_FRAME_CF				(1U << 2)	/**< The CF flag */
 #define G2_FRAME_BE				(1U << 1)	/**< The BE flag */
 
+/**
+ * A flat view of a serialized G2 packet.
+ *
+ * This refers to the serialized data in place: nothing is copied and no
+ * memory is allocated to navigate through the packet.  It remains valid
+ * as long as the underlying buffer is.
+ *
+ * Frames are filled by g2_frame_parse() for the root packet, which validates
+ * the whole packet, and then by g2_frame_first_child() and siblings for the
+ * nested packets.
+ */
+typedef struct g2_frame {
+	const char *name;		/**< Packet name (not NUL-terminated) */
+	const void *start;		/**< Start of packet (control byte), NULL if none */
+	const void *children;	/**< First child packet, NULL if none */
+	const void *payload;	/**< Start of payload, NULL if none */
+	const void *end;		/**< First byte after the packet */
+	const void *limit;		/**< End of the enclosing packet stream */
+	size_t paylen;			/**< Length of payload */
+	uint8 namelen;			/**< Length of name */
+} g2_frame_t;
+
 /*
  * Public interface.
  */
@@ -50,6 +72,23 @@ struct g2_tree *g2_frame_deserialize(const void *buf,
 size_t g2_frame_whole_length(const void *buf, size_t len);
 const char *g2_frame_name(const void *buf, size_t len, size_t *namelen);
 
+bool g2_frame_parse(const void *buf, size_t len, size_t *packet_len,
+	g2_frame_t *f);
+bool g2_frame_first_child(const g2_frame_t *f, g2_frame_t *child);
+bool g2_frame_next_sibling(g2_frame_t *child);
+bool g2_frame_next_twin(g2_frame_t *child);
+bool g2_frame_has_name(const g2_frame_t *f, const char *name);
+const char *g2_frame_node_name(const g2_frame_t *f, char *buf, size_t len);
+const void *g2_frame_node_payload(const g2_frame_t *f, size_t *paylen);
+bool g2_frame_lookup(const g2_frame_t *root, const char *path, g2_frame_t *f);
+const void *g2_frame_payload(const g2_frame_t *root, const char *path,
+	size_t *paylen);
+size_t g2_frame_node_count(const g2_frame_t *f);
+
+#define G2_FRAME_CHILD_FOREACH(f, c) \
+	for (g2_frame_first_child((f), (c)); \
+		(c)->start != NULL; g2_frame_next_sibling(c))
+
 #endif /* _core_g2_frame_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
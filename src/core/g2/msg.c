@@ -351,28 +351,19 @@ const char *
 g2_msg_search_get_text(const pmsg_t *mb)
 {
 	str_t *s = str_private(G_STRFUNC, 64);
-	const g2_tree_t *t;
-
-	t = g2_frame_deserialize(
-			pmsg_phys_base(mb), pmsg_written_size(mb), NULL, FALSE);
+	const char *payload;
+	size_t paylen;
+	g2_frame_t f;
 
-	if (NULL == t) {
+	if (!g2_frame_parse(pmsg_phys_base(mb), pmsg_written_size(mb), NULL, &f))
 		return NULL;
-	} else {
-		const char *payload;
-		size_t paylen;
 
-		payload = g2_tree_payload(t, "/Q2/DN", &paylen);
+	payload = g2_frame_payload(&f, "/Q2/DN", &paylen);
 
-		if (NULL == payload) {
-			g2_tree_free_null_const(&t);
-			return NULL;
-		}
-
-		str_cpy_len(s, payload, paylen);
-	}
+	if (NULL == payload)
+		return NULL;
 
-	g2_tree_free_null_const(&t);
+	str_cpy_len(s, payload, paylen);
 	return str_2c(s);
 }
 
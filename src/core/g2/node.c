@@ -268,17 +268,35 @@ g2_node_send_lni(gnutella_node_t *n)
 	g2_node_send(n, mb);
 }
 
+/**
+ * Dump the G2 message held in the node, for logging purposes.
+ */
+static void
+g2_node_dump_message(const gnutella_node_t *n)
+{
+	g2_tree_t *t;
+
+	/*
+	 * Handlers work on the flat frame, so we need to build the tree
+	 * only when we want to dump the message.
+	 */
+
+	t = g2_frame_deserialize(n->data, n->size, NULL, FALSE);
+	if (t != NULL) {
+		g2_tfmt_tree_dump(t, stderr, G2FMT_O_PAYLEN);
+		g2_tree_free_null(&t);
+	}
+}
+
 /**
  * Drop message received from given node.
  *
  * @param routine		routine where we're coming from (the one dropping)
  * @param n				source node of message
- * @param t				the message tree
  * @param reason		optional reason
  */
-static void G_PRINTF(4, 5)
-g2_node_drop(const char *routine, gnutella_node_t *n, const g2_tree_t *t,
-	const char *fmt, ...)
+static void G_PRINTF(3, 4)
+g2_node_drop(const char *routine, gnutella_node_t *n, const char *fmt, ...)
 {
 	if (GNET_PROPERTY(g2_debug) || GNET_PROPERTY(log_dropped_g2)) {
 		va_list args;
@@ -292,7 +310,7 @@ g2_node_drop(const char *routine, gnutella_node_t *n, const g2_tree_t *t,
 			buf[0] = '\0';
 
 		g_debug("%s(): dropping /%s from %s%s%s",
-			routine, g2_tree_name(t), node_infostr(n),
+			routine, g2_msg_raw_name(n->data, n->size), node_infostr(n),
 			NULL == fmt ? "" : ": ", buf);
 
 		va_end(args);
@@ -300,18 +318,17 @@ g2_node_drop(const char *routine, gnutella_node_t *n, const g2_tree_t *t,
 
 	gnet_stats_count_dropped(n, MSG_DROP_G2_UNEXPECTED);
 
-	if (GNET_PROPERTY(log_dropped_g2)) {
-		g2_tfmt_tree_dump(t, stderr, G2FMT_O_PAYLEN);
-	}
+	if (GNET_PROPERTY(log_dropped_g2))
+		g2_node_dump_message(n);
 }
 
 /**
  * Handle reception of a /PI
  */
 static void
-g2_node_handle_ping(gnutella_node_t *n, const g2_tree_t *t)
+g2_node_handle_ping(gnutella_node_t *n, const g2_frame_t *f)
 {
-	g2_tree_t *c;
+	g2_frame_t c;
 
 	/*
 	 * Throttle pings received from UDP.
@@ -327,13 +344,11 @@ g2_node_handle_ping(gnutella_node_t *n, const g2_tree_t *t)
 		/* FALL THROUGH */
 	}
 
-	c = g2_tree_first_child(t);
-
 	/*
 	 * If there is no payload, it's a keep-alive ping, send back a pong.
 	 */
 
-	if (NULL == c) {
+	if (!g2_frame_first_child(f, &c)) {
 		g2_node_send_pong(n);
 		return;
 	}
@@ -350,22 +365,25 @@ g2_node_handle_ping(gnutella_node_t *n, const g2_tree_t *t)
 	 * a mistake because we are a leaf node.
 	 */
 
-	g2_node_drop(G_STRFUNC, n, t, "has children and we are a leaf");
+	g2_node_drop(G_STRFUNC, n, "has children and we are a leaf");
 }
 
 /**
  * Handle reception of a /PO
  */
 static void
-g2_node_handle_pong(gnutella_node_t *n, const g2_tree_t *t)
+g2_node_handle_pong(gnutella_node_t *n, const g2_frame_t *f)
 {
 	/*
 	 * Pongs received from UDP must be RPC replies to pings.
 	 */
 
 	if (NODE_IS_UDP(n)) {
+		g2_tree_t *t = g2_tree_from_frame(f, FALSE);
+
 		if (!g2_rpc_answer(n, t))
-			g2_node_drop(G_STRFUNC, n, t, "coming from UDP");
+			g2_node_drop(G_STRFUNC, n, "coming from UDP");
+		g2_tree_free_null(&t);
 		return;
 	}
 
@@ -409,7 +427,7 @@ g2_node_handle_rpc_answer(gnutella_node_t *n,
 			if (G2_MSG_QA == type && guess_late_qa(n, t, NULL))
 				return;
 
-			g2_node_drop(G_STRFUNC, n, t, "coming from UDP");
+			g2_node_drop(G_STRFUNC, n, "coming from UDP");
 		}
 		return;
 	} else {
@@ -428,7 +446,35 @@ g2_node_handle_rpc_answer(gnutella_node_t *n,
 	 * We do not expect these from TCP, since they are UDP RPC replies.
 	 */
 
-	g2_node_drop(G_STRFUNC, n, t, "coming from TCP");
+	g2_node_drop(G_STRFUNC, n, "coming from TCP");
+}
+
+/**
+ * Parse a node payload to extract a node address + port.
+ *
+ * @param payload	the payload we wish to parse
+ * @param paylen	the payload length
+ * @param addr		where to write the address part
+ * @param port		where to write the port part
+ *
+ * @return TRUE if OK, FALSE if we could not extract anything.
+ */
+static bool
+g2_node_parse_address_payload(const char *payload, size_t paylen,
+	host_addr_t *addr, uint16 *port)
+{
+	/*
+	 * Only handle if we have an IP:port entry.
+	 * We only handle IPv4 because G2 does not support IPv6.
+	 */
+
+	if (6 == paylen) {		/* IPv4 + port */
+		*addr = host_addr_peek_ipv4(payload);
+		*port = peek_le16(&payload[4]);
+		return TRUE;
+	}
+
+	return FALSE;		/* Unrecognized payload length */
 }
 
 /**
@@ -448,40 +494,53 @@ g2_node_parse_address(const g2_tree_t *t, host_addr_t *addr, uint16 *port)
 
 	payload = g2_tree_node_payload(t, &paylen);
 
-	/*
-	 * Only handle if we have an IP:port entry.
-	 * We only handle IPv4 because G2 does not support IPv6.
-	 */
+	return g2_node_parse_address_payload(payload, paylen, addr, port);
+}
 
-	if (6 == paylen) {		/* IPv4 + port */
-		*addr = host_addr_peek_ipv4(payload);
-		*port = peek_le16(&payload[4]);
-		return TRUE;
-	}
+/**
+ * Parse the payload of given frame to extract a node address + port.
+ *
+ * @param f		the frame whose payload we wish to parse
+ * @param addr	where to write the address part
+ * @param port	where to write the port part
+ *
+ * @return TRUE if OK, FALSE if we could not extract anything.
+ */
+static bool
+g2_node_frame_address(const g2_frame_t *f, host_addr_t *addr, uint16 *port)
+{
+	const char *payload;
+	size_t paylen;
 
-	return FALSE;		/* Unrecognized payload length */
+	payload = g2_frame_node_payload(f, &paylen);
+
+	return g2_node_parse_address_payload(payload, paylen, addr, port);
 }
 
 /**
  * Handle reception of a /LNI
  */
 static void
-g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
+g2_node_handle_lni(gnutella_node_t *n, const g2_frame_t *f)
 {
-	g2_tree_t *c;
+	g2_frame_t c;
 
 	/*
 	 * Handle the children of /LNI.
 	 */
 
-	G2_TREE_CHILD_FOREACH(t, c) {
-		enum g2_lni_child ct = TOKENIZE(g2_tree_name(c), g2_lni_children);
+	G2_FRAME_CHILD_FOREACH(f, &c) {
+		char name[G2_FRAME_NAME_LEN_MAX + 1];
+		enum g2_lni_child ct;
 		const char *payload;
 		size_t paylen;
 
+		g2_frame_node_name(&c, ARYLEN(name));
+		ct = TOKENIZE(name, g2_lni_children);
+
 		switch (ct) {
 		case G2_LNI_GU:			/* the node's GUID */
-			payload = g2_tree_node_payload(c, &paylen);
+			payload = g2_frame_node_payload(&c, &paylen);
 			if (GUID_RAW_SIZE == paylen)
 				node_set_guid(n, (guid_t *) payload, TRUE);
 			break;
@@ -491,7 +550,7 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 				host_addr_t addr;
 				uint16 port;
 
-				if (g2_node_parse_address(c, &addr, &port)) {
+				if (g2_node_frame_address(&c, &addr, &port)) {
 					if (host_address_is_usable(addr))
 						n->gnet_addr = addr;
 					n->gnet_port = port;
@@ -500,7 +559,7 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 			break;
 
 		case G2_LNI_LS:			/* library statistics */
-			payload = g2_tree_node_payload(c, &paylen);
+			payload = g2_frame_node_payload(&c, &paylen);
 			if (paylen >= 8) {
 				uint32 files = peek_le32(payload);
 				uint32 kbytes = peek_le32(&payload[4]);
@@ -512,13 +571,13 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 			break;
 
 		case G2_LNI_V:			/* vendor code */
-			payload = g2_tree_node_payload(c, &paylen);
+			payload = g2_frame_node_payload(&c, &paylen);
 			if (paylen >= 4)
 				n->vcode.u32 = peek_be32(payload);
 			break;
 
 		case G2_LNI_UP:			/* uptime */
-			payload = g2_tree_node_payload(c, &paylen);
+			payload = g2_frame_node_payload(&c, &paylen);
 			if (paylen <= 4)
 				n->up_date = tm_time() - vlint_decode(payload, paylen);
 			break;
@@ -527,43 +586,43 @@ g2_node_handle_lni(gnutella_node_t *n, const g2_tree_t *t)
 }
 
 /**
- * Tree message iterator to handle "NH" nodes and extract their IP:port.
+ * Handle reception of a /KHL
  */
 static void
-g2_node_extract_nh(void *data, void *udata)
+g2_node_handle_khl(const g2_frame_t *f)
 {
-	const g2_tree_t *t = data;
+	g2_frame_t c;
 
-	(void) udata;
+	/*
+	 * Extract the neighbouring node info and insert them into our cache.
+	 */
 
-	if (0 == strcmp("NH", g2_tree_name(t))) {
+	G2_FRAME_CHILD_FOREACH(f, &c) {
 		host_addr_t addr;
 		uint16 port;
 
 		if (
-			g2_node_parse_address(t, &addr, &port) &&
+			g2_frame_has_name(&c, "NH") &&
+			g2_node_frame_address(&c, &addr, &port) &&
 			host_is_valid(addr, port)
 		) {
 			hcache_add_caught(HOST_G2HUB, addr, port, "/KHL/NH");
 		}
 	}
-}
-
-/**
- * Tree message iterator to handle "CH" nodes and extract their IP:port.
- */
-static void
-g2_node_extract_ch(void *data, void *udata)
-{
-	const g2_tree_t *t = data;
 
-	(void) udata;
+	/*
+	 * Extract cached hubs (necessarily not in the cluster of the hub sending
+	 * us the /KHL) and add them to the GUESS host cache.
+	 */
 
-	if (0 == strcmp("CH", g2_tree_name(t))) {
+	G2_FRAME_CHILD_FOREACH(f, &c) {
 		const char *payload;
 		size_t paylen;
 
-		payload = g2_tree_node_payload(t, &paylen);
+		if (!g2_frame_has_name(&c, "CH"))
+			continue;
+
+		payload = g2_frame_node_payload(&c, &paylen);
 
 		if (10 == paylen) {		/* IPv4:port + 32-bit timestamp */
 			host_addr_t addr = host_addr_peek_ipv4(payload);
@@ -576,32 +635,12 @@ g2_node_extract_ch(void *data, void *udata)
 }
 
 /**
- * Handle reception of a /KHL
- */
-static void
-g2_node_handle_khl(const g2_tree_t *t)
-{
-	/*
-	 * Extract the neighbouring node info and insert them into our cache.
-	 */
-
-	g2_tree_child_foreach(t, g2_node_extract_nh, NULL);
-
-	/*
-	 * Extract cached hubs (necessarily not in the cluster of the hub sending
-	 * us the /KHL) and add them to the GUESS host cache.
-	 */
-
-	g2_tree_child_foreach(t, g2_node_extract_ch, NULL);
-}
-
-/**
- * Extract min/max sizes from the payload of a /Q2/SZR tree node.
+ * Extract min/max sizes from the payload of a /Q2/SZR frame.
  *
  * @return TRUE if we successfully extracted the information.
  */
 static bool NON_NULL_PARAM((2, 3))
-g2_node_extract_size_request(const g2_tree_t *t, uint64 *min, uint64 *max)
+g2_node_extract_size_request(const g2_frame_t *f, uint64 *min, uint64 *max)
 {
 	const char *p;
 	size_t paylen;
@@ -610,7 +649,7 @@ g2_node_extract_size_request(const g2_tree_t *t, uint64 *min, uint64 *max)
 	 * The payload can be 2 32-bit or 2 64-bit values.
 	 */
 
-	p = g2_tree_node_payload(t, &paylen);
+	p = g2_frame_node_payload(f, &paylen);
 
 	if (8 == paylen) {
 		*min = (uint64) peek_le32(p);
@@ -626,18 +665,18 @@ g2_node_extract_size_request(const g2_tree_t *t, uint64 *min, uint64 *max)
 }
 
 /**
- * Extract interest flags from the payload of a /Q2/I tree node.
+ * Extract interest flags from the payload of a /Q2/I frame.
  *
  * @return the consolidated flags G2_Q2_F_* requested by the payload.
  */
 static uint32
-g2_node_extract_interest(const g2_tree_t *t)
+g2_node_extract_interest(const g2_frame_t *f)
 {
 	const char *p, *q, *end;
 	size_t paylen;
 	uint32 flags = 0;
 
-	p = q = g2_tree_node_payload(t, &paylen);
+	p = q = g2_frame_node_payload(f, &paylen);
 
 	if (NULL == p)
 		return 0;
@@ -665,7 +704,7 @@ g2_node_extract_interest(const g2_tree_t *t)
  * if it is a SHA1 (or bitprint, which contains a SHA1).
  */
 static void
-g2_node_extract_urn(const g2_tree_t *t, search_request_info_t *sri)
+g2_node_extract_urn(const g2_frame_t *f, search_request_info_t *sri)
 {
 	const char *p;
 	size_t paylen;
@@ -678,7 +717,7 @@ g2_node_extract_urn(const g2_tree_t *t, search_request_info_t *sri)
 	if (sri->exv_sha1cnt == N_ITEMS(sri->exv_sha1))
 		return;
 
-	p = g2_tree_node_payload(t, &paylen);
+	p = g2_frame_node_payload(f, &paylen);
 
 	if (NULL == p)
 		return;
@@ -723,13 +762,13 @@ g2_node_extract_urn(const g2_tree_t *t, search_request_info_t *sri)
  * if we have a valid address.
  */
 static void
-g2_node_extract_udp(const g2_tree_t *t, search_request_info_t *sri,
+g2_node_extract_udp(const g2_frame_t *f, search_request_info_t *sri,
 	const gnutella_node_t *n)
 {
 	const char *p;
 	size_t paylen;
 
-	p = g2_tree_node_payload(t, &paylen);
+	p = g2_frame_node_payload(f, &paylen);
 
 	/*
 	 * Only handle if we have an IP:port entry.
@@ -810,11 +849,11 @@ g2_node_intuit_media_type(const char *md)
  * Handle reception of a /Q2
  */
 static void
-g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
+g2_node_handle_q2(gnutella_node_t *n, const g2_frame_t *f)
 {
 	const guid_t *muid;
 	size_t paylen;
-	const g2_tree_t *c;
+	g2_frame_t c;
 	char *dn = NULL;
 	char *md = NULL;
 	uint32 iflags = 0;
@@ -829,7 +868,7 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 	 */
 
 	if (NODE_IS_UDP(n)) {
-		g2_node_drop(G_STRFUNC, n, t, "coming from UDP");
+		g2_node_drop(G_STRFUNC, n, "coming from UDP");
 		return;
 	}
 
@@ -837,10 +876,10 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 	 * The MUID of the query is the payload of the root node.
 	 */
 
-	muid = g2_tree_node_payload(t, &paylen);
+	muid = g2_frame_node_payload(f, &paylen);
 
 	if (paylen != GUID_RAW_SIZE) {
-		g2_node_drop(G_STRFUNC, n, t, "missing MUID");
+		g2_node_drop(G_STRFUNC, n, "missing MUID");
 		return;
 	}
 
@@ -883,13 +922,17 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 	 * Handle the children of /Q2.
 	 */
 
-	G2_TREE_CHILD_FOREACH(t, c) {
-		enum g2_q2_child ct = TOKENIZE(g2_tree_name(c), g2_q2_children);
+	G2_FRAME_CHILD_FOREACH(f, &c) {
+		char name[G2_FRAME_NAME_LEN_MAX + 1];
+		enum g2_q2_child ct;
 		const char *payload;
 
+		g2_frame_node_name(&c, ARYLEN(name));
+		ct = TOKENIZE(name, g2_q2_children);
+
 		switch (ct) {
 		case G2_Q2_DN:
-			payload = g2_tree_node_payload(c, &paylen);
+			payload = g2_frame_node_payload(&c, &paylen);
 			if (payload != NULL && NULL == dn) {
 				uint off = 0;
 				/* Not NUL-terminated, need to h_strndup() it */
@@ -905,12 +948,12 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 
 		case G2_Q2_I:
 			if (!has_interest)
-				iflags = g2_node_extract_interest(c);
+				iflags = g2_node_extract_interest(&c);
 			has_interest = TRUE;
 			break;
 
 		case G2_Q2_MD:
-			payload = g2_tree_node_payload(c, &paylen);
+			payload = g2_frame_node_payload(&c, &paylen);
 			if (payload != NULL && NULL == md) {
 				/* Not NUL-terminated, need to h_strndup() it */
 				md = h_strndup(payload, paylen);
@@ -922,17 +965,17 @@ g2_node_handle_q2(gnutella_node_t *n, const g2_tree_t *t)
 			break;
 
 		case G2_Q2_SZR:			/* Size limits */
-			if (g2_node_extract_size_request(c, &sri.minsize, &sri.maxsize))
+			if (g2_node_extract_size_request(&c, &sri.minsize, &sri.maxsize))
 				sri.size_restrictions = TRUE;
 			break;
 
 		case G2_Q2_UDP:
 			if (!sri.oob)
-				g2_node_extract_udp(c, &sri, n);
+				g2_node_extract_udp(&c, &sri, n);
 			break;
 
 		case G2_Q2_URN:
-			g2_node_extract_urn(c, &sri);
+			g2_node_extract_urn(&c, &sri);
 			break;
 		}
 	}
@@ -1019,14 +1062,21 @@ void
 g2_node_handle(gnutella_node_t *n)
 {
 	g2_tree_t *t;
+	g2_frame_t f;
 	size_t plen;
 	enum g2_msg type;
+	char name[G2_FRAME_NAME_LEN_MAX + 1];
 
 	node_check(n);
 	g_assert(NODE_TALKS_G2(n));
 
-	t = g2_frame_deserialize(n->data, n->size, &plen, FALSE);
-	if (NULL == t) {
+	/*
+	 * The message is parsed in place into a flat frame, which does not
+	 * allocate any memory.  A tree is only built for the handlers that
+	 * still need one.
+	 */
+
+	if (!g2_frame_parse(n->data, n->size, &plen, &f)) {
 		if (GNET_PROPERTY(g2_debug) > 0 || GNET_PROPERTY(log_bad_g2)) {
 			g_warning("%s(): cannot deserialize /%s from %s",
 				G_STRFUNC, g2_msg_raw_name(n->data, n->size), node_infostr(n));
@@ -1044,33 +1094,50 @@ g2_node_handle(gnutella_node_t *n)
 			dump_hex(stderr, "G2 Packet", n->data, n->size);
 		hostiles_dynamic_add(n->addr,
 			"cannot parse incoming messages", HSTL_GIBBERISH);
-		goto done;
+		return;
 	} else if (GNET_PROPERTY(g2_debug) > 19) {
 		g_debug("%s(): received packet from %s", G_STRFUNC, node_infostr(n));
-		g2_tfmt_tree_dump(t, stderr, G2FMT_O_PAYLEN);
+		g2_node_dump_message(n);
 	}
 
-	type = g2_msg_name_type(g2_tree_name(t));
+	type = g2_msg_name_type(g2_frame_node_name(&f, ARYLEN(name)));
 
 	switch (type) {
 	case G2_MSG_PI:
-		g2_node_handle_ping(n, t);
-		break;
+		g2_node_handle_ping(n, &f);
+		return;
 	case G2_MSG_PO:
-		g2_node_handle_pong(n, t);
-		break;
+		g2_node_handle_pong(n, &f);
+		return;
 	case G2_MSG_LNI:
-		g2_node_handle_lni(n, t);
-		break;
+		g2_node_handle_lni(n, &f);
+		return;
 	case G2_MSG_KHL:
-		g2_node_handle_khl(t);
+		g2_node_handle_khl(&f);
+		return;
+	case G2_MSG_Q2:
+		g2_node_handle_q2(n, &f);
+		return;
+	case G2_MSG_PUSH:
+	case G2_MSG_QA:
+	case G2_MSG_QKA:
+	case G2_MSG_QH2:
 		break;
+	default:
+		g2_node_drop(G_STRFUNC, n, "default");
+		return;
+	}
+
+	/*
+	 * These handlers still navigate through the message tree.
+	 */
+
+	t = g2_tree_from_frame(&f, FALSE);
+
+	switch (type) {
 	case G2_MSG_PUSH:
 		handle_push_request(n, t);
 		break;
-	case G2_MSG_Q2:
-		g2_node_handle_q2(n, t);
-		break;
 	case G2_MSG_QA:
 	case G2_MSG_QKA:
 		g2_node_handle_rpc_answer(n, t, type);
@@ -1079,11 +1146,9 @@ g2_node_handle(gnutella_node_t *n)
 		search_g2_results(n, t);
 		break;
 	default:
-		g2_node_drop(G_STRFUNC, n, t, "default");
-		break;
+		g_assert_not_reached();
 	}
 
-done:
 	g2_tree_free_null(&t);
 }
 
@@ -99,16 +99,16 @@
 #endif
 
 #include "tree.h"
+#include "frame.h"
 
-#include "lib/atoms.h"
 #include "lib/etree.h"
 #include "lib/halloc.h"
+#include "lib/misc.h"
 #include "lib/strtok.h"
 #include "lib/walloc.h"
 
 #ifdef TREE_TESTING
 #include "tfmt.h"
-#include "frame.h"
 #endif
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -120,11 +120,13 @@ enum g2_tree_magic { G2_TREE_MAGIC = 0x67f8b9e7 };
  */
 struct g2_tree {
 	enum g2_tree_magic magic;		/**< Magic number */
-	const char *name;				/**< Node name (atom) */
 	void *payload;					/**< Payload buffer, NULL if none */
 	size_t paylen;					/**< Payload length */
 	node_t node;					/**< Embedded tree node */
+	char name[G2_FRAME_NAME_LEN_MAX + 1];	/**< Node name */
 	unsigned copied:1;				/**< Whether payload was copied */
+	unsigned flat:1;				/**< Node part of a flat tree block */
+	unsigned block:1;				/**< Node is the start of the flat block */
 };
 
 static inline void
@@ -429,9 +431,13 @@ g2_tree_alloc_empty(const char *name)
 {
 	g2_tree_t *n;
 
+	g_assert(name != NULL);
+	g_assert_log(vstrlen(name) <= G2_FRAME_NAME_LEN_MAX,
+		"%s(): node name too long: \"%s\"", G_STRFUNC, name);
+
 	WALLOC0(n);
 	n->magic = G2_TREE_MAGIC;
-	n->name = atom_str_get(name);
+	clamp_strcpy(ARYLEN(n->name), name);
 
 	return n;
 }
@@ -445,11 +451,11 @@ g2_tree_free_node(void *data)
 	g2_tree_t *n = data;
 
 	g2_tree_check(n);
+	g_assert(!n->flat);
 
 	if (n->payload != NULL && n->copied)
 		hfree(n->payload);
 
-	atom_str_free_null(&n->name);
 	n->payload = NULL;
 	n->magic = 0;
 	WFREE(n);
@@ -517,6 +523,7 @@ g2_tree_set_payload(g2_tree_t *root, const void *payload,
 	size_t paylen, bool copy)
 {
 	g2_tree_check(root);
+	g_assert(!root->flat);
 
 	if (root->payload != NULL && root->copied)
 		hfree(root->payload);
@@ -546,6 +553,7 @@ g2_tree_append_payload(g2_tree_t *root, const void *payload, size_t paylen)
 	size_t newlen;
 
 	g2_tree_check(root);
+	g_assert(!root->flat);
 
 	newlen = root->paylen + paylen;
 
@@ -593,6 +601,7 @@ g2_tree_add_child(g2_tree_t *parent, g2_tree_t *child)
 
 	g2_tree_check(parent);
 	g2_tree_check(child);
+	g_assert(!parent->flat && !child->flat);
 
 	etree_init_root(&t, parent, FALSE, offsetof(g2_tree_t, node));
 	etree_prepend_child(&t, parent, child);
@@ -612,6 +621,99 @@ g2_tree_reverse_children(g2_tree_t *root)
 	etree_reverse_children(&t, root);
 }
 
+/**
+ * Flat tree construction context.
+ */
+struct g2_tree_flat {
+	g2_tree_t *nodes;				/**< The array of nodes */
+	size_t count;					/**< Amount of nodes in the array */
+	size_t next;					/**< Next node to fill */
+	const void *base;				/**< Start of serialized packet */
+	const char *data;				/**< Copied packet, NULL if not copying */
+};
+
+/**
+ * Recursively fill the flat tree from the frame.
+ *
+ * @return the node created for the frame.
+ */
+static g2_tree_t *
+g2_tree_flat_fill(struct g2_tree_flat *ctx, const g2_frame_t *f)
+{
+	g2_tree_t *n;
+	g2_frame_t c;
+	etree_t t;
+
+	g_assert(ctx->next < ctx->count);
+
+	n = &ctx->nodes[ctx->next++];
+	n->magic = G2_TREE_MAGIC;
+	n->flat = TRUE;
+	clamp_strncpy(ARYLEN(n->name), f->name, f->namelen);
+
+	if (f->payload != NULL) {
+		n->payload = NULL == ctx->data ?
+			deconstify_pointer(f->payload) :
+			deconstify_pointer(ctx->data + ptr_diff(f->payload, ctx->base));
+		n->paylen = f->paylen;
+	}
+
+	etree_init_root(&t, n, FALSE, offsetof(g2_tree_t, node));
+
+	G2_FRAME_CHILD_FOREACH(f, &c) {
+		etree_prepend_child(&t, n, g2_tree_flat_fill(ctx, &c));
+	}
+
+	etree_reverse_children(&t, n);
+
+	return n;
+}
+
+/**
+ * Build a tree out of a flat frame.
+ *
+ * The whole tree is allocated as a single memory block, which can only be
+ * freed as a whole via g2_tree_free_null() and cannot be modified.
+ *
+ * @param f		the (validated) frame of the packet
+ * @param copy	if TRUE, payload is copied, otherwise it refers to the frame
+ *
+ * @return a new G2 tree.
+ */
+g2_tree_t *
+g2_tree_from_frame(const g2_frame_t *f, bool copy)
+{
+	struct g2_tree_flat ctx;
+	size_t len, datalen;
+
+	g_assert(f != NULL);
+	g_assert(f->start != NULL);
+
+	ctx.count = g2_frame_node_count(f);
+	ctx.next = 0;
+	ctx.base = f->start;
+
+	len = ctx.count * sizeof ctx.nodes[0];
+	datalen = copy ? ptr_diff(f->end, f->start) : 0;
+
+	ctx.nodes = halloc0(len + datalen);
+
+	if (copy) {
+		char *data = ptr_add_offset(ctx.nodes, len);
+		memcpy(data, f->start, datalen);
+		ctx.data = data;
+	} else {
+		ctx.data = NULL;
+	}
+
+	g2_tree_flat_fill(&ctx, f);
+
+	g_assert(ctx.next == ctx.count);
+
+	ctx.nodes[0].block = TRUE;
+	return &ctx.nodes[0];
+}
+
 /**
  * Free sub-tree, destroying all its items and removing the reference in
  * the parent node, if any.
@@ -623,6 +725,20 @@ g2_tree_free(g2_tree_t *root)
 
 	g2_tree_check(root);
 
+	/*
+	 * A flat tree is allocated as a single block and can only be freed
+	 * as a whole, from its root.
+	 */
+
+	if (root->flat) {
+		g_assert_log(root->block,
+			"%s(): cannot free part of a flat tree", G_STRFUNC);
+
+		root->magic = 0;
+		hfree(root);
+		return;
+	}
+
 	etree_init_root(&t, root, FALSE, offsetof(g2_tree_t, node));
 	etree_sub_free(&t, root, g2_tree_free_node);
 }
@@ -63,6 +63,10 @@ void g2_tree_add_child(g2_tree_t *parent, g2_tree_t *child);
 void g2_tree_reverse_children(g2_tree_t *node);
 void g2_tree_free_null(g2_tree_t **root_ptr);
 
+struct g2_frame;
+
+g2_tree_t *g2_tree_from_frame(const struct g2_frame *f, bool copy);
+
 void g2_tree_enter_leave(g2_tree_t *root,
 	match_fn_t enter, data_fn_t leave, void *data);
 
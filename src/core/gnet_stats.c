@@ -46,6 +46,8 @@
 
 #include "lib/entropy.h"
 #include "lib/event.h"
+#include "lib/htable.h"
+#include "lib/pow2.h"
 #include "lib/random.h"
 #include "lib/sha1.h"
 #include "lib/spinlock.h"
@@ -59,6 +61,8 @@ static uint8 stats_lut[256];
 static gnet_stats_t gnet_stats;
 static gnet_stats_t gnet_tcp_stats;
 static gnet_stats_t gnet_udp_stats;
+static gnet_latency_stats_t gnet_latency;
+static htable_t *gnet_latency_vmsg;		/**< Vendor message name -> index */
 
 /*
  * Thread-safe locks.
@@ -175,6 +179,7 @@ gnet_stats_init(void)
 
     ZERO(&gnet_stats);
     ZERO(&gnet_udp_stats);
+	ZERO(&gnet_latency);
 }
 
 /**
@@ -934,6 +939,201 @@ gnet_stats_g2_count_flowc(const gnutella_node_t *n,
  *** Public functions (gnet.h)
  ***/
 
+/**
+ * @return the index of the latency histogram bucket for a duration.
+ */
+static inline uint
+gnet_latency_bucket(uint64 ns)
+{
+	int hb;
+
+	if (ns < GNET_LATENCY_SUB)
+		return ns;
+
+	hb = highest_bit_set64(ns);
+
+	if G_UNLIKELY(hb >= GNET_LATENCY_MAX_BITS)
+		return GNET_LATENCY_BUCKETS - 1;
+
+	return (hb - GNET_LATENCY_SUB_BITS + 1) * GNET_LATENCY_SUB +
+		((ns >> (hb - GNET_LATENCY_SUB_BITS)) & (GNET_LATENCY_SUB - 1));
+}
+
+/**
+ * @return the largest duration, in ns, falling in latency bucket `i'.
+ */
+static uint64
+gnet_latency_bucket_high(uint i)
+{
+	uint hb, sub;
+
+	g_assert(i < GNET_LATENCY_BUCKETS);
+
+	if (i < GNET_LATENCY_SUB)
+		return i;
+
+	if (GNET_LATENCY_BUCKETS - 1 == i)
+		return MAX_INT_VAL(uint64);
+
+	hb = i / GNET_LATENCY_SUB + GNET_LATENCY_SUB_BITS - 1;
+	sub = i % GNET_LATENCY_SUB;
+
+	return ((uint64) (GNET_LATENCY_SUB + sub + 1) <<
+		(hb - GNET_LATENCY_SUB_BITS)) - 1;
+}
+
+/**
+ * Record processing time in latency histogram.
+ */
+static void
+gnet_latency_record(gnet_latency_t *lat, uint64 ns)
+{
+	lat->count++;
+	lat->total += ns;
+	lat->bucket[gnet_latency_bucket(ns)]++;
+
+	if (ns > lat->max)
+		lat->max = ns;
+}
+
+/**
+ * Record processing time of message, given its statistics type.
+ */
+static void
+gnet_stats_latency_record(uint type, uint64 ns)
+{
+	g_assert(type < MSG_TYPE_COUNT);
+	g_assert(thread_is_main());
+
+	gnet_latency_record(&gnet_latency.msg[type], ns);
+	gnet_latency_record(&gnet_latency.msg[MSG_TOTAL], ns);
+}
+
+/**
+ * Record processing time of a Gnutella message.
+ *
+ * @param function		the Gnutella message function
+ * @param ns			processing time, in nanoseconds
+ */
+void
+gnet_stats_count_latency(uint8 function, uint64 ns)
+{
+	gnet_stats_latency_record(stats_lut[function], ns);
+}
+
+/**
+ * Record processing time of a G2 message.
+ *
+ * @param type			the G2 message type
+ * @param ns			processing time, in nanoseconds
+ */
+void
+gnet_stats_g2_count_latency(enum g2_msg type, uint64 ns)
+{
+	uint t = MSG_UNKNOWN;
+
+	if (type != G2_MSG_MAX)
+		t = stats_lut[type + MSG_G2_BASE];
+
+	gnet_stats_latency_record(t, ns);
+}
+
+/**
+ * Record processing time of a DHT message.
+ *
+ * @param opcode		the Kademlia message opcode
+ * @param ns			processing time, in nanoseconds
+ */
+void
+gnet_dht_stats_count_latency(kda_msg_t opcode, uint64 ns)
+{
+	uint t = MSG_UNKNOWN;
+
+	if (opcode <= KDA_MSG_MAX_ID)
+		t = stats_lut[opcode + MSG_DHT_BASE];
+
+	gnet_stats_latency_record(t, ns);
+}
+
+/**
+ * Record processing time of a vendor message, which is also accounted
+ * for under the MSG_VENDOR type by gnet_stats_count_latency().
+ *
+ * @param name			the vendor message name, a static string
+ * @param ns			processing time, in nanoseconds
+ */
+void
+gnet_stats_vmsg_count_latency(const char *name, uint64 ns)
+{
+	void *value;
+	uint i;
+
+	g_assert(name != NULL);
+	g_assert(thread_is_main());
+
+	if G_UNLIKELY(NULL == gnet_latency_vmsg)
+		gnet_latency_vmsg = htable_create(HASH_KEY_STRING, 0);
+
+	if (htable_lookup_extended(gnet_latency_vmsg, name, NULL, &value)) {
+		i = pointer_to_uint(value);
+	} else {
+		if G_UNLIKELY(gnet_latency.vmsg_count >= GNET_LATENCY_VMSG_MAX)
+			return;
+		i = gnet_latency.vmsg_count++;
+		gnet_latency.vmsg[i].name = name;
+		htable_insert(gnet_latency_vmsg, name, uint_to_pointer(i));
+	}
+
+	gnet_latency_record(&gnet_latency.vmsg[i].lat, ns);
+}
+
+/**
+ * Compute latency percentile.
+ *
+ * The value returned is the upper bound of the histogram bucket where the
+ * percentile falls, capped by the largest recorded value.
+ *
+ * @param lat		the latency histogram
+ * @param pct		the percentile wanted, between 0 and 100
+ *
+ * @return the percentile, in nanoseconds, 0 if there are no samples.
+ */
+uint64
+gnet_latency_percentile(const gnet_latency_t *lat, uint pct)
+{
+	uint64 target, seen = 0;
+	uint i;
+
+	g_assert(lat != NULL);
+	g_assert(pct <= 100);
+
+	if (0 == lat->count)
+		return 0;
+
+	target = (lat->count * pct + 99) / 100;
+	target = MAX(target, 1);
+
+	for (i = 0; i < GNET_LATENCY_BUCKETS; i++) {
+		seen += lat->bucket[i];
+		if (seen >= target)
+			return MIN(gnet_latency_bucket_high(i), lat->max);
+	}
+
+	return lat->max;
+}
+
+/**
+ * Get a copy of the message processing latency statistics.
+ */
+void
+gnet_stats_latency_get(gnet_latency_stats_t *s)
+{
+	g_assert(s != NULL);
+	g_assert(thread_is_main());
+
+	*s = gnet_latency;
+}
+
 void
 gnet_stats_get(gnet_stats_t *s)
 {
@@ -63,6 +63,11 @@ enum g2_msg;
 void gnet_stats_g2_count_sent(const gnutella_node_t *n,
 	enum g2_msg type, uint32 size);
 
+void gnet_stats_count_latency(uint8 function, uint64 ns);
+void gnet_stats_g2_count_latency(enum g2_msg type, uint64 ns);
+void gnet_dht_stats_count_latency(kda_msg_t opcode, uint64 ns);
+void gnet_stats_vmsg_count_latency(const char *name, uint64 ns);
+
 struct sha1;
 
 void gnet_stats_tcp_digest(struct sha1 *digest);
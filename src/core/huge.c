@@ -61,6 +61,7 @@
 #include "lib/hashing.h"
 #include "lib/header.h"
 #include "lib/hikset.h"
+#include "lib/once.h"
 #include "lib/parse.h"
 #include "lib/pattern.h"
 #include "lib/sha1.h"
@@ -1064,15 +1065,39 @@ huge_sha1_cache_prune(void)
 		cache_dump_schedule();
 }
 
+static once_flag_t huge_cache_loaded;
+
 /**
- * Initialize the HUGE layer.
+ * Create the in-memory SHA1 cache and fill it from the persistent one.
  */
-void
-huge_init(void)
+static void
+huge_load_cache_once(void)
 {
 	sha1_cache = hikset_create(		/* Keys are atoms */
 		offsetof(struct sha1_cache_entry, file_name), HASH_KEY_SELF, 0);
 	sha1_read_cache();
+}
+
+/**
+ * Load the persistent SHA1 cache into memory, once.
+ *
+ * Since this stat()s every cached file, it can be called beforehand from
+ * another thread so that the main thread does not have to wait for it
+ * in huge_init().  Nothing else must use the HUGE layer in the meantime.
+ */
+void
+huge_load_cache(void)
+{
+	ONCE_FLAG_RUNWAIT(huge_cache_loaded, huge_load_cache_once);
+}
+
+/**
+ * Initialize the HUGE layer.
+ */
+void
+huge_init(void)
+{
+	huge_load_cache();
 	has_http_urls = pattern_compile("http://", FALSE);
 }
 
@@ -47,6 +47,7 @@ struct header;
 struct sha1;
 
 void huge_init(void);		/**< Call this function at the beginning */
+void huge_load_cache(void);	/**< Can be called before, from any thread */
 void huge_close(void);		/**< Call this when servent is shutdown */
 
 /*
@@ -165,6 +165,23 @@ io_get_read_bytes(const void *opaque)
 	return ih->read_bytes;
 }
 
+/**
+ * Discard the first `offset' bytes of the socket's buffer, which have
+ * been parsed already.
+ */
+static void
+io_header_consumed(struct gnutella_socket *s, size_t offset)
+{
+	g_assert(offset <= s->pos);
+
+	if (0 == offset)
+		return;
+
+	if (s->pos != offset)
+		memmove(s->buf, &s->buf[offset], s->pos - offset);
+	s->pos -= offset;
+}
+
 /**
  * This routine is called to parse the input buffer (the socket's buffer),
  * a line at a time, until EOH is reached.
@@ -174,17 +191,25 @@ io_header_parse(struct io_header *ih)
 {
 	struct gnutella_socket *s = ih->socket;
 	header_t *header = ih->header;
-	size_t parsed;
+	size_t parsed, offset = 0;
 	int error;
 
 	/*
 	 * Read header a line at a time.  We have exacly s->pos chars to handle.
 	 * NB: we're using a goto label to loop over.
+	 *
+	 * Parsed lines are not removed from the socket's buffer one at a time,
+	 * which would move the remaining data for each line: we only skip them,
+	 * and the buffer is compacted once, before we return or hand over the
+	 * socket to one of the callbacks.
 	 */
 
 nextline:
-	switch (getline_read(ih->getline, s->buf, s->pos, &parsed)) {
+	switch (
+		getline_read(ih->getline, &s->buf[offset], s->pos - offset, &parsed)
+	) {
 	case READ_OVERFLOW:
+		io_header_consumed(s, offset);
 		g_warning("%s(): line too long, disconnecting from %s",
 			G_STRFUNC, host_addr_to_string(s->addr));
 		if (log_printable(LOG_STDERR)) {
@@ -196,12 +221,11 @@ nextline:
 		return;
 		/* NOTREACHED */
 	case READ_DONE:
-		if (s->pos != parsed)
-			memmove(s->buf, &s->buf[parsed], s->pos - parsed);
-		s->pos -= parsed;
+		offset += parsed;
+		g_assert(offset <= s->pos);
 		break;
 	case READ_MORE:		/* ok, but needs more data */
-		g_assert(parsed == s->pos);
+		g_assert(parsed == s->pos - offset);
 		s->pos = 0;
 		return;
 	}
@@ -248,6 +272,7 @@ nextline:
 
 		g_assert(s->gdk_tag);
 
+		io_header_consumed(s, offset);
 		socket_evt_clear(s);
 
 		ih->process_header(ih->resource, ih->header);
@@ -266,10 +291,13 @@ nextline:
 		break;
 	case HEAD_TOO_LARGE:
 	case HEAD_MANY_LINES:
+		io_header_consumed(s, offset);
+		offset = 0;
 		if (ih->error->header_error_tell)
 			(*ih->error->header_error_tell)(ih->resource, error);
 		/* FALL THROUGH */
 	case HEAD_EOH_REACHED:
+		io_header_consumed(s, offset);
 		g_warning("%s(): %s, disconnecting from %s",
 			G_STRFUNC, header_strerror(error), host_addr_to_string(s->addr));
 		if (log_printable(LOG_STDERR)) {
@@ -301,6 +329,8 @@ nextline:
 	 * We reached the end of headers.
 	 */
 
+	io_header_consumed(s, offset);
+
 	if ((ih->flags & IO_HEAD_ONLY) && s->pos) {
         if (GNET_PROPERTY(dbg)) {
             g_debug("remote %s sent extra bytes after headers",
@@ -33,6 +33,7 @@
 #include "search.h"				/* For lazy_safe_search() */
 #include "share.h"
 
+#include "lib/arena.h"
 #include "lib/ascii.h"
 #include "lib/atomic.h"
 #include "lib/atoms.h"
@@ -613,12 +614,17 @@ st_fill_qhv(const char *search_term, query_hashvec_t *qhv)
 	word_vec_t *wovec;
 	uint wocnt;
 	uint i;
+	arena_t *ar;
+	void *mark;
 
 	if (NULL == qhv)
 		return;
 
+	ar = arena_private();
+	mark = arena_save(ar);
+
 	search = UNICODE_CANONIZE(search_term);
-	wocnt = word_vec_make(search, &wovec);
+	wocnt = word_vec_arena_make(ar, search, &wovec);
 
 	for (i = 0; i < wocnt; i++) {
 		if (wovec[i].len >= QRP_MIN_WORD_LENGTH)
@@ -628,8 +634,7 @@ st_fill_qhv(const char *search_term, query_hashvec_t *qhv)
 	if (search != search_term)
 		HFREE_NULL(search);
 
-	if (wocnt > 0)
-		word_vec_free(wovec, wocnt);
+	arena_restore(ar, mark);
 }
 
 /**
@@ -702,6 +707,8 @@ st_run_search(
 	size_t minlen;
 	hset_t *already_matched = NULL;	/* entries that are already in the list */
 	st_filename_len_fn_t flen;
+	arena_t *ar;
+	void *mark;
 
 	g_assert(implies(SEARCH_ALIAS == mode, NULL == qhv));
 
@@ -777,10 +784,15 @@ st_run_search(
 	}
 
 	/*
-	 * Prepare matching patterns
+	 * Prepare matching patterns.
+	 *
+	 * The word vector and the pattern array only live for the duration
+	 * of this routine, so they are allocated from the thread's arena.
 	 */
 
-	wocnt = word_vec_make(search, &wovec);
+	ar = arena_private();
+	mark = arena_save(ar);
+	wocnt = word_vec_arena_make(ar, search, &wovec);
 
 	/*
 	 * Compute the query hashing information for query routing, if needed.
@@ -797,14 +809,13 @@ st_run_search(
 	}
 
 	if (wocnt == 0 || best_bin == NULL) {
-		if (wocnt > 0)
-			word_vec_free(wovec, wocnt);
+		arena_restore(ar, mark);
 		goto finish;
 	}
 
 	g_assert(best_bin_size > 0);	/* Allocated bin, it must hold something */
 
-	WALLOC0_ARRAY(pattern, wocnt);
+	ARENA_ALLOC0_ARRAY(ar, pattern, wocnt);
 
 	/*
 	 * Prepare matching optimization, an idea from Mike Green.
@@ -924,8 +935,7 @@ st_run_search(
 		pattern_free(pattern[i]);
 	}
 
-	WFREE_ARRAY(pattern, wocnt);
-	word_vec_free(wovec, wocnt);
+	arena_restore(ar, mark);		/* Frees word vector and pattern array */
 
 	/* FALL THROUGH */
 
@@ -9158,7 +9158,7 @@ node_patch_push_fw2fw(gnutella_node_t *n)
  * pointer became invalid if we removed the node already).
  */
 static bool
-node_parse(gnutella_node_t *n)
+node_parse_internal(gnutella_node_t *n)
 {
 	bool drop = FALSE;
 	bool has_ggep = FALSE;
@@ -9733,6 +9733,59 @@ clean_dest:
 	return TRUE;
 }
 
+/**
+ * Compute elapsed time since `t0', in nanoseconds.
+ */
+static uint64
+node_elapsed_ns(const tm_nano_t *t0)
+{
+	tm_nano_t t1;
+	long ns;
+
+	tm_precise_time(&t1);
+	ns = tm_precise_elapsed_ns(&t1, t0);
+
+	return MAX(0, ns);		/* Clock could have been adjusted backwards */
+}
+
+/**
+ * Processing of messages, timing how long it takes to process them.
+ *
+ * @attention
+ * NB: callers of this routine must not use the node structure upon return,
+ * since we may invalidate that node during the processing.
+ *
+ * @return TRUE if OK, FALSE if we BYE-ed the node (in which case the node
+ * pointer became invalid if we removed the node already).
+ */
+static bool
+node_parse(gnutella_node_t *n)
+{
+	uint8 function = gnutella_header_get_function(&n->header);
+	tm_nano_t t0;
+	bool ok;
+
+	tm_precise_time(&t0);
+	ok = node_parse_internal(n);
+	gnet_stats_count_latency(function, node_elapsed_ns(&t0));
+
+	return ok;
+}
+
+/**
+ * Handle G2 message held in the node, timing its processing.
+ */
+static void
+node_g2_handle(gnutella_node_t *n)
+{
+	enum g2_msg type = g2_msg_type(n->data, n->size);
+	tm_nano_t t0;
+
+	tm_precise_time(&t0);
+	g2_node_handle(n);
+	gnet_stats_g2_count_latency(type, node_elapsed_ns(&t0));
+}
+
 static void
 node_drain_hello(void *data, int source, inputevt_cond_t cond)
 {
@@ -9966,8 +10019,16 @@ node_udp_process(gnutella_node_t *n, const struct gnutella_socket *s,
 	 */
 
 	if (NODE_IS_DHT(n)) {
+		kda_msg_t opcode = KDA_MSG_MAX_ID + 1;
+		tm_nano_t t0;
+
+		if (len >= KDA_HEADER_SIZE)
+			opcode = kademlia_header_get_function(data);
+
 		node_add_rx_given(n, n->size + GTA_HEADER_SIZE);
+		tm_precise_time(&t0);
 		kmsg_received(data, len, s->addr, s->port, n);
+		gnet_dht_stats_count_latency(opcode, node_elapsed_ns(&t0));
 		return;
 	}
 
@@ -10121,7 +10182,7 @@ node_udp_g2_data_ind(rxdrv_t *unused_rx, pmsg_t *mb, const gnet_host_t *from)
 
 	/* Handle the G2 message we got from the UDP layer */
 
-	g2_node_handle(n);
+	node_g2_handle(n);
 
 done:
 	pmsg_free(mb);
@@ -11009,7 +11070,7 @@ node_g2_read(gnutella_node_t *n, pmsg_t *mb)
 
 	n->received++;
 	gnet_stats_count_received_payload(n, n->data);
-	g2_node_handle(n);
+	node_g2_handle(n);
 
 	/*
 	 * Reset parsing state for next frame.
@@ -59,6 +59,7 @@
 
 #include "g2/node.h"
 
+#include "lib/atomic.h"
 #include "lib/atoms.h"
 #include "lib/bg.h"
 #include "lib/cq.h"
@@ -69,6 +70,7 @@
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/mutex.h"
+#include "lib/op.h"
 #include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
@@ -76,6 +78,8 @@
 #include "lib/spinlock.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
 #include "lib/utf8.h"
@@ -193,6 +197,8 @@ struct routing_table {
 	unsigned compacted:1;	/**< Table was compacted */
 	unsigned cancelled:1;	/**< Must supersede with next version */
 	unsigned is_empty:1;	/**< Whether table is empty (all slots cleared) */
+	struct qrt_index_group *ixg;	/**< Leaf index group, NULL if none */
+	uint8 ixbit;			/**< Our bit within the leaf index group */
 	/**
 	 * Whether this routing table can route the given URN query.
 	 */
@@ -246,7 +252,28 @@ static struct routing_patch *routing_patch4;
 static struct routing_patch *routing_patch1;
 static struct routing_patch *routing_revpatch1;
 
+/*
+ * Lookup tables for the word-at-a-time table kernels, filled by qrp_init().
+ *
+ * qrt_quartets[b] spreads the 8 bits of `b' to the low bit of 8 quartets,
+ * bit 7 going to the upper quartet, as needed to emit 4-bit patches.
+ *
+ * qrt_byte_mask[b] is the 8-byte memory pattern holding 0xff for each bit
+ * set in `b', bit 7 mapping to the first byte, as needed to merge a
+ * compacted table into a non-compacted arena.
+ */
+static uint32 qrt_quartets[256];
+static uint64 qrt_byte_mask[256];
+
+#define QRT_BYTES_ONES	((op_t) -1 / 0xff)	/**< 0x01 in each byte of op_t */
+
+#define QRT_ONES64		UINT64_CONST(0x0101010101010101)
+#define QRT_LOW7_64		UINT64_CONST(0x7f7f7f7f7f7f7f7f)
+#define QRT_HIGH1_64	UINT64_CONST(0x8080808080808080)
+#define QRT_GATHER64	UINT64_CONST(0x0102040810204080)
+
 static void qrt_compress_cancel_all(void);
+static void qrt_index_remove(struct routing_table *rt);
 static void qrt_patch_compute(
 	struct routing_patch *rp, struct routing_patch **rpp);
 static uint32 qrt_dump(struct routing_table *rt, bool full);
@@ -507,7 +534,7 @@ qrt_compact(struct routing_table *rt)
 	int nsize;				/* New table size */
 	char *narena;			/* New arena */
 	int i;
-	uint mask;
+	uint64 inf;
 	uchar *p;
 	uchar *q;
 	uint32 token = 0;
@@ -523,9 +550,9 @@ qrt_compact(struct routing_table *rt)
 	}
 
 	nsize = rt->slots / 8;
-	narena = halloc0(nsize);
+	narena = halloc(nsize);
 	rt->set_count = 0;
-	q = ptr_add_offset(narena, nsize - 1);
+	inf = QRT_ONES64 * rt->infinity;
 
 	/*
 	 * Because we're compacting an ultranode -> leafnode routing table,
@@ -536,21 +563,27 @@ qrt_compact(struct routing_table *rt)
 	 * Compaction of byte 7 (the 8th byte) is done in bit 0.
 	 *
 	 * Therefore, the sequence of bits mimics the slots in the original table.
+	 *
+	 * We process 8 slots at a time: XOR-ing with "infinity" leaves non-zero
+	 * bytes for present slots, which we turn into 0x80 marks without any
+	 * carry across bytes.  The multiplication then gathers the 8 marks into
+	 * the top byte, the first slot ending up in bit 7.
 	 */
 
-	for (mask = 0, i = rt->slots - 1, p = &rt->arena[i]; i >= 0; i--, p--) {
-		if (*p != rt->infinity) {
-			mask |= 0x80;				/* Bit set to indicates presence */
-			rt->set_count++;
-		}
-		if (0 == (i & 0x7)) {			/* Reached "bit 0" */
-			*q-- = mask;
-			mask = 0;
-		} else
-			mask >>= 1;					/* Starting from end of table */
+	p = (uchar *) rt->arena;
+	q = (uchar *) narena;
+
+	for (i = 0; i < nsize; i++) {
+		uint64 y = peek_be64(p) ^ inf;
+		uint64 t;
+
+		t = (((y & QRT_LOW7_64) + QRT_LOW7_64) | y) & QRT_HIGH1_64;
+		*q++ = ((t >> 7) * QRT_GATHER64) >> 56;
+		rt->set_count += bits_set64(t);
+		p += 8;
 	}
 
-	g_assert((char *) (q+1) == narena);/* Filled 1st byte at last iteration */
+	g_assert(ptr_diff(q, narena) == UNSIGNED(nsize));
 
 	/*
 	 * Install new compacted arena in place of the non-compacted one.
@@ -664,6 +697,21 @@ qrt_patches_clear(void)
 	}
 }
 
+/**
+ * Compute the 8 patch quartets for a byte of a compacted routing table.
+ *
+ * @param obyte		the byte in the old table
+ * @param nbyte		the byte in the new table
+ *
+ * @return the 32-bit big-endian quartets for the 8 slots in the byte.
+ */
+static inline uint32
+qrt_diff_quartets(uint8 obyte, uint8 nbyte)
+{
+	/* 0x1 for removed slots, 0xf for added slots */
+	return qrt_quartets[obyte & ~nbyte] | qrt_quartets[nbyte & ~obyte] * 0xf;
+}
+
 /**
  * Compute 4-bit patch between two (compacted) routing tables.
  * When `old' is NULL, then we compare against a table filled with "infinity".
@@ -681,7 +729,7 @@ qrt_diff_4(struct routing_table *old, struct routing_table *new)
 	uchar *op;
 	uchar *np;
 	uchar *pp;
-	int i;
+	size_t i;
 	bool changed = FALSE;
 
 	g_assert(old == NULL || old->magic == QRP_ROUTE_MAGIC);
@@ -703,51 +751,61 @@ qrt_diff_4(struct routing_table *old, struct routing_table *new)
 	op = old ? old->arena : NULL;
 	np = new->arena;
 
-	for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-		uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-		uint8 nbyte = *np++;
-		int j;
-		uint8 v;
+	/*
+	 * In our compacted table, set bits indicate presence.
+	 * Thus, we need to build the patch quartets as:
+	 *
+	 *     old bit      new bit      patch
+	 *        0            0          0x0     (no change)
+	 *        0            1          0xf     (-1, from INFINITY=2 to 1)
+	 *        1            0          0x1     (+1, from 1 to INFINITY)
+	 *        1            1          0x0     (no change)
+	 *
+	 * Tables are mostly identical, so we compare whole words first and
+	 * immediately generate zero quartets when they are equal: each table
+	 * byte yields 4 patch bytes.  Otherwise, we expand each differing byte
+	 * through the qrt_quartets[] table.
+	 */
 
-		/*
-		 * Optimize computation: if bytes are equal, we can immediately
-		 * generate 8 quartets of 0, i.e. 4 bytes.
-		 */
+	bytes = new->slots / 8;
+
+	for (i = 0; i + OPSIZ <= UNSIGNED(bytes); i += OPSIZ) {
+		op_t ow = 0, nw;
+		uint k;
+
+		if (op != NULL)
+			memcpy(&ow, op, OPSIZ);
+		memcpy(&nw, np, OPSIZ);
 
-		if G_LIKELY(obyte == nbyte) {
-			*pp++ = 0;
-			*pp++ = 0;
-			*pp++ = 0;
-			*pp++ = 0;
+		if G_LIKELY(ow == nw) {
+			memset(pp, 0, 4 * OPSIZ);
+			pp += 4 * OPSIZ;
+			np += OPSIZ;
+			if (op != NULL)
+				op += OPSIZ;
 			continue;
 		}
 
-		/*
-		 * In our compacted table, set bits indicate presence.
-		 * Thus, we need to build the patch quartets as:
-		 *
-		 *     old bit      new bit      patch
-		 *        0            0          0x0     (no change)
-		 *        0            1          0xf     (-1, from INFINITY=2 to 1)
-		 *        1            0          0x1     (+1, from 1 to INFINITY)
-		 *        1            1          0x0     (no change)
-		 */
+		for (k = 0; k < OPSIZ; k++) {
+			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
+			uint8 nbyte = *np++;
 
-		for (v = 0, j = 7; j >= 0; j--) {
-			uint8 mask = 1 << j;
+			poke_be32(pp, qrt_diff_quartets(obyte, nbyte));
+			pp += 4;
+		}
 
-			if ((obyte & mask) ^ (nbyte & mask)) {	/* Bit `j' changed */
-				v |= (obyte & mask) ? 0x1 : 0xf;
-				changed = TRUE;
-			}
+		changed = TRUE;
+	}
 
-			if (j & 0x1)
-				v <<= 4;			/* We have upper half of octet (byte) */
-			else {
-				*pp++ = v;
-				v = 0;
-			}
-		}
+	for (/* empty */; i < UNSIGNED(bytes); i++) {
+		uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
+		uint8 nbyte = *np++;
+
+		poke_be32(pp, qrt_diff_quartets(obyte, nbyte));
+		pp += 4;
+
+		if (obyte != nbyte)
+			changed = TRUE;
 	}
 
 	g_assert(np == (new->arena + new->slots / 8));
@@ -783,8 +841,9 @@ qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 	uchar *op;
 	uchar *np;
 	uchar *pp;
-	int i;
-	bool changed = FALSE;
+	size_t i;
+	op_t diff = 0;
+	bool changed;
 
 	g_assert(old == NULL || old->magic == QRP_ROUTE_MAGIC);
 	g_assert(old == NULL || old->compacted);
@@ -815,30 +874,58 @@ qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 	 *        1            0           1     (fli to 0)
 	 *        1            1           0     (no change)
 	 *
-	 * This is the truth table of XOR.
+	 * This is the truth table of XOR, which we apply a word at a time.
 	 */
 
-	if (reverse) {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-			uint8 v = obyte ^ *np++;
+	bytes = new->slots / 8;
 
-			if G_LIKELY(0 == v) {
-				*pp++ = v;
-			} else {
-				*pp++ = reverse_byte(v);
-				changed = TRUE;
-			}
+	for (i = 0; i + OPSIZ <= UNSIGNED(bytes); i += OPSIZ) {
+		op_t ow = 0, nw, v;
+
+		if (op != NULL) {
+			memcpy(&ow, op, OPSIZ);
+			op += OPSIZ;
 		}
-	} else {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-			uint8 v = obyte ^ *np++;
+		memcpy(&nw, np, OPSIZ);
+		np += OPSIZ;
+
+		v = ow ^ nw;
+		memcpy(pp, &v, OPSIZ);
+		pp += OPSIZ;
+		diff |= v;
+	}
+
+	for (/* empty */; i < UNSIGNED(bytes); i++) {
+		uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
+		uint8 v = obyte ^ *np++;
+
+		*pp++ = v;
+		diff |= v;
+	}
+
+	changed = booleanize(diff != 0);
 
-			*pp++ = v;
+	/*
+	 * For G2, reverse the bits of the non-zero bytes, skipping over the
+	 * zero words which are by far the most common.
+	 */
+
+	if (reverse && changed) {
+		uchar *p = rp->arena;
 
-			if G_UNLIKELY(v != 0)
-				changed = TRUE;
+		for (i = 0; i < UNSIGNED(bytes); i++, p++) {
+			if (op_aligned(p) && i + OPSIZ <= UNSIGNED(bytes)) {
+				op_t w;
+
+				memcpy(&w, p, OPSIZ);
+				if G_LIKELY(0 == w) {
+					i += OPSIZ - 1;
+					p += OPSIZ - 1;
+					continue;
+				}
+			}
+			if (*p != 0)
+				*p = reverse_byte(*p);
 		}
 	}
 
@@ -867,6 +954,7 @@ struct qrt_compress_context {
 	enum qrt_compress_magic magic;	/**< Magic number */
 	struct routing_patch *rp;		/**< Routing table being compressed */
 	zlib_deflater_t *zd;			/**< Incremental deflater */
+	struct qrt_compress_job *job;	/**< Compression job in the worker pool */
 	bgdone_cb_t usr_done;			/**< User-defined callback */
 	void *usr_arg;					/**< Arg for user-defined callback */
 	uint allocated:1;				/**< Whether context was allocated */
@@ -874,6 +962,172 @@ struct qrt_compress_context {
 	uint finished:1;				/**< Task is finished */
 };
 
+/*
+ * Compression job, run in the background task worker pool.
+ *
+ * The actual deflation of the patch is done by a pooled task, so that the
+ * patches for all our connections can be compressed concurrently on all the
+ * cores, without starving the main thread.  The compression task running
+ * in the main thread merely waits for the job to complete and installs the
+ * result, so that completion and cancellation are still handled there.
+ *
+ * The job is handed back to the main thread once the pooled task is done
+ * with it.  If the compression task was cancelled in the meantime, the job
+ * is "detached" and is simply freed then.
+ */
+
+enum qrt_compress_job_magic {
+	QRT_COMPRESS_JOB_MAGIC = 0x23d5f7c1
+};
+
+struct qrt_compress_job {
+	enum qrt_compress_job_magic magic;	/**< Magic number */
+	struct routing_patch *rp;		/**< Routing patch being compressed (ref) */
+	zlib_deflater_t *zd;			/**< Incremental deflater */
+	bgtask_t *task;					/**< Compression task to wake up */
+	bgstatus_t status;				/**< Final status of the pooled task */
+	bool detached;					/**< Compression task is gone */
+	uint finished:1;				/**< Job is completed */
+};
+
+static inline void
+qrt_compress_job_check(const struct qrt_compress_job * const job)
+{
+	g_assert(job != NULL);
+	g_assert(QRT_COMPRESS_JOB_MAGIC == job->magic);
+}
+
+/**
+ * Free compression job, in the main thread.
+ */
+static void
+qrt_compress_job_free(struct qrt_compress_job *job)
+{
+	qrt_compress_job_check(job);
+	g_assert(thread_is_main());
+
+	if (job->zd != NULL)
+		zlib_deflater_free(job->zd, TRUE);
+	qrt_patch_unref(job->rp);
+	job->magic = 0;
+	WFREE(job);
+}
+
+/**
+ * Perform incremental compression in the worker pool.
+ */
+static bgret_t
+qrt_job_step_compress(struct bgtask *h, void *u, int ticks)
+{
+	struct qrt_compress_job *job = u;
+
+	qrt_compress_job_check(job);
+
+	if G_UNLIKELY(atomic_bool_get(&job->detached))
+		bg_task_exit(h, -1);		/* Nobody is interested in the result */
+
+	switch (zlib_deflate(job->zd, ticks * QRT_TICK_CHUNK)) {
+	case -1:					/* Error occurred */
+		return BGR_ERROR;
+	case 0:						/* Finished */
+		return BGR_DONE;
+	case 1:						/* More work required */
+		return BGR_MORE;
+	default:
+		g_assert_not_reached();	/* Bug in zlib_deflate() */
+	}
+
+	return BGR_ERROR;		/* Not reached */
+}
+
+/**
+ * Called in the worker thread when the compression job is finished.
+ */
+static void
+qrt_job_compress_done(struct bgtask *unused_h, void *u,
+	bgstatus_t status, void *unused_arg)
+{
+	struct qrt_compress_job *job = u;
+
+	(void) unused_h;
+	(void) unused_arg;
+	qrt_compress_job_check(job);
+
+	job->status = status;
+}
+
+/**
+ * Called in the main thread when the compression job has been handed back.
+ */
+static void
+qrt_compress_job_finished(void *data)
+{
+	struct qrt_compress_job *job = data;
+
+	qrt_compress_job_check(job);
+
+	if (job->detached) {
+		qrt_compress_job_free(job);
+		return;
+	}
+
+	job->finished = TRUE;
+	bg_task_wakeup(job->task);
+}
+
+/**
+ * Hand the compression job back to the main thread, once the pooled task
+ * no longer needs it.
+ */
+static void
+qrt_job_compress_release(void *u)
+{
+	struct qrt_compress_job *job = u;
+
+	qrt_compress_job_check(job);
+
+	teq_safe_post(THREAD_MAIN_ID, qrt_compress_job_finished, job);
+}
+
+/**
+ * Launch compression of the routing patch in the worker pool.
+ *
+ * @param ctx		the compression context
+ * @param h			the compression task, to wake up when the job is done
+ *
+ * @return TRUE if the job was launched.
+ */
+static bool
+qrt_compress_job_launch(struct qrt_compress_context *ctx, bgtask_t *h)
+{
+	struct qrt_compress_job *job;
+	bgstep_cb_t step = qrt_job_step_compress;
+	bgtask_t *task;
+
+	g_assert(NULL == ctx->job);
+	g_assert(ctx->zd != NULL);
+
+	WALLOC0(job);
+	job->magic = QRT_COMPRESS_JOB_MAGIC;
+	job->rp = qrt_patch_ref(ctx->rp);
+	job->zd = ctx->zd;
+	job->task = h;
+
+	task = bg_task_create_pooled("QRP patch deflation",
+		&step, 1, job, qrt_job_compress_release, qrt_job_compress_done, NULL);
+
+	if (NULL == task) {
+		job->zd = NULL;				/* Still owned by the context */
+		qrt_compress_job_free(job);
+		return FALSE;
+	}
+
+	ctx->zd = NULL;					/* Now owned by the job */
+	ctx->job = job;
+
+	return TRUE;
+}
+
 /**
  * Free compression context.
  *
@@ -893,6 +1147,21 @@ qrt_compress_free(void *u)
 		ctx->zd = NULL;
 	}
 
+	/*
+	 * If the compression job has not been handed back yet, detach it: it
+	 * will be freed when it comes back to the main thread.
+	 */
+
+	if (ctx->job != NULL) {
+		struct qrt_compress_job *job = ctx->job;
+
+		if (job->finished)
+			qrt_compress_job_free(job);
+		else
+			atomic_bool_set(&job->detached, TRUE);
+		ctx->job = NULL;
+	}
+
 	if (ctx->allocated) {
 		ctx->magic = 0;
 		WFREE(ctx);
@@ -908,20 +1177,43 @@ static bgret_t
 qrt_step_compress(struct bgtask *h, void *u, int ticks)
 {
 	struct qrt_compress_context *ctx = u;
+	zlib_deflater_t *zd;
 	int ret;
 	int chunklen;
 	int status = 0;
 
 	g_assert(ctx->magic == QRT_COMPRESS_MAGIC);
 
-	chunklen = ticks * QRT_TICK_CHUNK;
+	/*
+	 * The first time, attempt to delegate compression to the worker pool
+	 * and sleep until the job is completed.  If we cannot, we compress the
+	 * patch incrementally from here.
+	 */
 
-	if (qrp_debugging(4)) {
-		g_debug("QRP qrt_step_compress: ticks = %d => chunk = %d bytes",
-			ticks, chunklen);
+	if (0 == bg_task_seqno(h) && qrt_compress_job_launch(ctx, h)) {
+		bg_task_sleep(h);
+		return BGR_MORE;
 	}
 
-	ret = zlib_deflate(ctx->zd, chunklen);
+	if (ctx->job != NULL) {
+		struct qrt_compress_job *job = ctx->job;
+
+		qrt_compress_job_check(job);
+		g_assert(job->finished);
+
+		ret = BGS_OK == job->status ? 0 : -1;
+		zd = job->zd;
+	} else {
+		chunklen = ticks * QRT_TICK_CHUNK;
+
+		if (qrp_debugging(4)) {
+			g_debug("QRP qrt_step_compress: ticks = %d => chunk = %d bytes",
+				ticks, chunklen);
+		}
+
+		ret = zlib_deflate(ctx->zd, chunklen);
+		zd = ctx->zd;
+	}
 
 	switch (ret) {
 	case -1:					/* Error occurred */
@@ -937,22 +1229,20 @@ qrt_step_compress(struct bgtask *h, void *u, int ticks)
 			g_debug(
 				"QRP %s %p: len=%d, compressed=%d (ratio %.2f%%)",
 				qrp_patch_to_string(ctx->rp), ctx->rp, ctx->rp->len,
-				zlib_deflater_outlen(ctx->zd),
-				100.0 * (ctx->rp->len - zlib_deflater_outlen(ctx->zd)) /
+				zlib_deflater_outlen(zd),
+				100.0 * (ctx->rp->len - zlib_deflater_outlen(zd)) /
 					ctx->rp->len);
 		}
 
-		if (zlib_deflater_outlen(ctx->zd) < ctx->rp->len) {
+		if (zlib_deflater_outlen(zd) < ctx->rp->len) {
 			struct routing_patch *rp = ctx->rp;
 
 			g_assert(ROUTING_PATCH_MAGIC == rp->magic);
 			HFREE_NULL(rp->arena);
-			rp->len = zlib_deflater_outlen(ctx->zd);
-			rp->arena = hcopy(zlib_deflater_out(ctx->zd), rp->len);
+			rp->len = zlib_deflater_outlen(zd);
+			rp->arena = hcopy(zlib_deflater_out(zd), rp->len);
 			rp->compressed = TRUE;
 		}
-		zlib_deflater_free(ctx->zd, TRUE);
-		ctx->zd = NULL;
 		goto done;
 		/* NOTREACHED */
 	case 1:						/* More work required */
@@ -1035,8 +1325,9 @@ qrt_patch_compress(struct routing_patch *rp, bgtask_t *bt,
 
 	/*
 	 * Because compression is possibly a CPU-intensive operation, it
-	 * is dealt with a background task that will be scheduled at regular
-	 * intervals.
+	 * is dealt with a background task that will delegate the work to
+	 * the background task worker pool, or compress incrementally at
+	 * regular intervals if the pool is not available.
 	 */
 
 	if (NULL == cp) {
@@ -1127,6 +1418,7 @@ qrt_free(struct routing_table *rt)
 {
 	g_assert(rt->refcnt == 0);
 
+	qrt_index_remove(rt);
 	atom_sha1_free_null(&rt->digest);
 	HFREE_NULL(rt->arena);
 	HFREE_NULL(rt->name);
@@ -1165,16 +1457,40 @@ qrt_shrink_arena(char *arena, int old_slots, int new_slots, int inf_val)
 	 * any of the "factor" entries in the larger table contain something.
 	 */
 
-	for (i = 0, j = 0; i < new_slots && j < old_slots; i++, j += factor) {
-		int k;
-		int set = FALSE;
+	if (factor >= (int) OPSIZ) {
+		op_t inf = QRT_BYTES_ONES * (uchar) inf_val;
 
-		for (k = 0; k < factor && !set; k++) {
-			if ((uchar) arena[j + k] != inf_val)
-				set = TRUE;
+		/*
+		 * Compare whole words against "infinity": since the factor is a
+		 * power of 2 larger than the word size, it is a multiple of it.
+		 */
+
+		for (i = 0, j = 0; i < new_slots && j < old_slots; i++, j += factor) {
+			int k;
+			bool set = FALSE;
+
+			for (k = 0; k < factor && !set; k += OPSIZ) {
+				op_t w;
+
+				memcpy(&w, &arena[j + k], OPSIZ);
+				if (w != inf)
+					set = TRUE;
+			}
+
+			arena[i] = set ? 0 : inf_val;
 		}
+	} else {
+		for (i = 0, j = 0; i < new_slots && j < old_slots; i++, j += factor) {
+			int k;
+			bool set = FALSE;
+
+			for (k = 0; k < factor && !set; k++) {
+				if ((uchar) arena[j + k] != inf_val)
+					set = TRUE;
+			}
 
-		arena[i] = set ? 0 : inf_val;
+			arena[i] = set ? 0 : inf_val;
+		}
 	}
 
 	return hrealloc(arena, new_slots);
@@ -1249,13 +1565,24 @@ qrt_get_info(const struct routing_table *rt, qrt_info_t *qi)
 static bool
 qrt_is_empty(const struct routing_table *rt)
 {
-	int i, max;
-	uint8 *p;
+	size_t i, max;
+	const uint8 *p;
 
 	qrt_check(rt);
 	g_assert(rt->compacted);
 
-	for (max = rt->slots / 8, p = rt->arena, i = 0; i < max; i++) {
+	max = rt->slots / 8;
+	p = rt->arena;
+
+	for (i = 0; i + OPSIZ <= max; i += OPSIZ, p += OPSIZ) {
+		op_t w;
+
+		memcpy(&w, p, OPSIZ);
+		if (w != 0)
+			return FALSE;
+	}
+
+	for (/* empty */; i < max; i++) {
 		if (*p++ != 0)
 			return FALSE;
 	}
@@ -1263,6 +1590,336 @@ qrt_is_empty(const struct routing_table *rt)
 	return TRUE;
 }
 
+/***
+ *** Transposed index of the leaf routing tables.
+ ***/
+
+/*
+ * Rather than probing the table of each leaf for every query keyword, we
+ * keep for each table size a "slot -> set of leaves" index: leaf tables
+ * are transposed into groups of 64 leaves, each slot of a group holding
+ * the bitmask of the leaves having that slot set.  One probe per keyword
+ * and per group then tells us all the leaves which can be reached.
+ *
+ * A full group takes exactly the same amount of memory as the tables it
+ * covers.  To limit the waste of sparse groups, only tables up to
+ * QRT_INDEX_MAX_BITS are indexed, larger ones being probed directly.
+ */
+
+#define QRT_INDEX_WIDTH		64		/**< Leaves per index group */
+#define QRT_INDEX_MAX_BITS	18		/**< Largest indexed table (256K slots) */
+
+enum qrt_index_group_magic { QRT_INDEX_GROUP_MAGIC = 0x5e0c2b97 };
+
+struct qrt_index_group {
+	enum qrt_index_group_magic magic;
+	uint64 *col;			/**< For each slot, the leaves having it set */
+	struct routing_table *leaf[QRT_INDEX_WIDTH];	/**< Indexed tables */
+	uint64 used;			/**< Bits of the group in use */
+	uint64 match;			/**< Leaves matching query `stamp' */
+	uint stamp;				/**< Query for which `match' was computed */
+	int bits;				/**< Size of the indexed tables, in bits */
+};
+
+static inline void
+qrt_index_group_check(const struct qrt_index_group * const g)
+{
+	g_assert(g != NULL);
+	g_assert(QRT_INDEX_GROUP_MAGIC == g->magic);
+}
+
+static pslist_t *qrt_index[QRT_INDEX_MAX_BITS + 1];	/**< Groups, by size */
+static uint qrt_index_stamp;		/**< Current query, to invalidate matches */
+
+/**
+ * @return size of the column arena of an index group, in bytes.
+ */
+static inline size_t
+qrt_index_group_size(int bits)
+{
+	return ((size_t) 1 << bits) * sizeof(uint64);
+}
+
+/**
+ * Create a new empty index group for tables of 2^bits slots.
+ */
+static struct qrt_index_group *
+qrt_index_group_alloc(int bits)
+{
+	struct qrt_index_group *g;
+	size_t size = qrt_index_group_size(bits);
+
+	WALLOC0(g);
+	g->magic = QRT_INDEX_GROUP_MAGIC;
+	g->bits = bits;
+	g->col = halloc0(size);
+
+	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
+		GNET_PROPERTY(qrp_memory) + size);
+
+	return g;
+}
+
+/**
+ * Free index group.
+ */
+static void
+qrt_index_group_free(struct qrt_index_group *g)
+{
+	qrt_index_group_check(g);
+
+	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
+		GNET_PROPERTY(qrp_memory) - qrt_index_group_size(g->bits));
+
+	HFREE_NULL(g->col);
+	g->magic = 0;
+	WFREE(g);
+}
+
+/**
+ * Clear the column of the table held at `bit' in the index group.
+ */
+static void
+qrt_index_column_clear(struct qrt_index_group *g, uint bit)
+{
+	uint64 mask = ~(UINT64_CONST(1) << bit);
+	size_t i, n = (size_t) 1 << g->bits;
+
+	for (i = 0; i < n; i++)
+		g->col[i] &= mask;
+}
+
+/**
+ * Fill the column at `bit' in the index group from the routing table.
+ */
+static void
+qrt_index_column_fill(struct qrt_index_group *g, uint bit,
+	const struct routing_table *rt)
+{
+	uint64 mask = UINT64_CONST(1) << bit;
+	const uint8 *p = rt->arena;
+	int b, bytes = rt->slots / 8;
+
+	g_assert(rt->slots == 1 << g->bits);
+
+	for (b = 0; b < bytes; b++) {
+		uint8 entry;
+
+		/* Leaf tables are sparse: skip whole zero words */
+
+		if (op_aligned(&p[b]) && b + (int) OPSIZ <= bytes) {
+			op_t w;
+
+			memcpy(&w, &p[b], OPSIZ);
+			if (0 == w) {
+				b += OPSIZ - 1;
+				continue;
+			}
+		}
+
+		/* Bit 7 of the byte is the first slot */
+
+		for (entry = p[b]; entry != 0; /* empty */) {
+			int j = highest_bit_set(entry);
+
+			g->col[b * 8 + 7 - j] |= mask;
+			entry &= ~(1U << j);
+		}
+	}
+}
+
+/**
+ * Remove routing table from the leaf index, if present.
+ */
+static void
+qrt_index_remove(struct routing_table *rt)
+{
+	struct qrt_index_group *g = rt->ixg;
+
+	if (NULL == g)
+		return;
+
+	qrt_index_group_check(g);
+	g_assert(rt == g->leaf[rt->ixbit]);
+
+	qrt_index_column_clear(g, rt->ixbit);
+	g->leaf[rt->ixbit] = NULL;
+	g->used &= ~(UINT64_CONST(1) << rt->ixbit);
+	g->stamp = 0;
+	rt->ixg = NULL;
+
+	if (0 == g->used) {
+		qrt_index[g->bits] = pslist_remove(qrt_index[g->bits], g);
+		qrt_index_group_free(g);
+	}
+}
+
+/**
+ * Index (or re-index) the routing table of a leaf, once it has been
+ * fully received or patched.
+ *
+ * Empty tables and tables too large to be indexed are removed from the
+ * index, and will be probed directly.
+ */
+static void
+qrt_index_update(struct routing_table *rt)
+{
+	struct qrt_index_group *g = rt->ixg;
+	const pslist_t *sl;
+	uint bit;
+
+	qrt_check(rt);
+	g_assert(rt->compacted);
+
+	if (rt->is_empty || rt->bits > QRT_INDEX_MAX_BITS) {
+		qrt_index_remove(rt);
+		return;
+	}
+
+	if (g != NULL) {
+		qrt_index_group_check(g);
+		g_assert(g->bits == rt->bits);
+
+		qrt_index_column_clear(g, rt->ixbit);
+		goto fill;
+	}
+
+	PSLIST_FOREACH(qrt_index[rt->bits], sl) {
+		struct qrt_index_group *ig = sl->data;
+
+		if (ig->used != MAX_INT_VAL(uint64)) {
+			g = ig;
+			break;
+		}
+	}
+
+	if (NULL == g) {
+		g = qrt_index_group_alloc(rt->bits);
+		qrt_index[rt->bits] = pslist_prepend(qrt_index[rt->bits], g);
+	}
+
+	bit = ctz64(~g->used);
+	g->used |= UINT64_CONST(1) << bit;
+	g->leaf[bit] = rt;
+	rt->ixg = g;
+	rt->ixbit = bit;
+
+fill:
+	qrt_index_column_fill(g, rt->ixbit, rt);
+	g->stamp = 0;			/* Invalidate any cached match */
+}
+
+/**
+ * Compute the set of leaves in the index group to which a query can be
+ * routed.
+ *
+ * This applies the same rules as qrp_can_route_default() to all the leaves
+ * of the group at once, keeping the amount of keywords matched by each leaf
+ * in bit-sliced counters: bit i of cnt[k] is bit k of the hit count of the
+ * leaf at bit i.
+ *
+ * @return the bitmask of the matching leaves.
+ */
+static uint64
+qrt_index_match(const struct qrt_index_group *g, const query_hashvec_t *qhv)
+{
+	const struct query_hash *qh = qhv->vec;
+	uint64 cnt[8];				/* Since qhv->count is an uint8 */
+	uint64 urn = 0, ge = 0, eq = MAX_INT_VAL(uint64);
+	uint i, word = 0, need, levels = 0, shift = 32 - g->bits;
+	int k;
+
+	for (i = 0; i < qhv->count; i++) {
+		uint64 m = g->col[qh[i].hashcode >> shift];
+		uint64 carry;
+
+		/* Any URN present is enough to forward, as those are OR-ed */
+
+		if (QUERY_H_URN == qh[i].source) {
+			urn |= m;
+			continue;
+		}
+
+		word++;
+
+		for (k = 0, carry = m; carry != 0 && UNSIGNED(k) < levels; k++) {
+			uint64 t = cnt[k] & carry;
+			cnt[k] ^= carry;
+			carry = t;
+		}
+		if (carry != 0)
+			cnt[levels++] = carry;
+	}
+
+	/*
+	 * With some URNs but no word, only the leaves matching an URN qualify.
+	 * Otherwise, 2/3rd of the words must match if there are at least 3,
+	 * all of them otherwise: 3 * hit / word >= 2 means hit >= need below.
+	 */
+
+	if (qhv->has_urn && 0 == word)
+		return urn & g->used;
+
+	need = word < 3 ? word : (2 * word + 2) / 3;
+
+	for (k = N_ITEMS(cnt) - 1; k >= 0; k--) {
+		uint64 c = UNSIGNED(k) < levels ? cnt[k] : 0;
+
+		if (need & (1U << k)) {
+			eq &= c;
+		} else {
+			ge |= eq & c;
+			eq &= ~c;
+		}
+	}
+
+	return (urn | ge | eq) & g->used;
+}
+
+/**
+ * Check whether we can route the current query to an indexed leaf.
+ *
+ * The match for the whole index group of the leaf is computed once per
+ * query, identified by `qrt_index_stamp'.
+ */
+static inline bool
+qrt_index_can_route(const struct routing_table *rt, const query_hashvec_t *qhv)
+{
+	struct qrt_index_group *g = rt->ixg;
+
+	if (g->stamp != qrt_index_stamp) {
+		g->match = qrt_index_match(g, qhv);
+		g->stamp = qrt_index_stamp;
+	}
+
+	return 0 != (g->match & (UINT64_CONST(1) << rt->ixbit));
+}
+
+/**
+ * Dispose of the whole leaf index.
+ */
+static void
+qrt_index_close(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(qrt_index); i++) {
+		pslist_t *sl;
+
+		PSLIST_FOREACH(qrt_index[i], sl) {
+			struct qrt_index_group *g = sl->data;
+			uint j;
+
+			for (j = 0; j < N_ITEMS(g->leaf); j++) {
+				if (g->leaf[j] != NULL)
+					g->leaf[j]->ixg = NULL;
+			}
+			qrt_index_group_free(g);
+		}
+		pslist_free_null(&qrt_index[i]);
+	}
+}
+
 /***
  *** Merging of the leaf node QRP tables into `merged_table'.
  ***/
@@ -1425,28 +2082,55 @@ merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
 	 *
 	 * Furthermore, we avoid repeated RT_SLOT_READ() calls by accessing the
 	 * compacted table one byte at a time and then looping on each of its bits.
+	 * Since "0 OR x = x", whole zero words and zero bytes are skipped, which
+	 * is what leaf tables are mostly made of.
 	 */
 
-#define RT_FOR_EACH_BIT_SET(ON_CHANGE)				\
-for (b = 0, i = 0; b < bytes; b++) {				\
-	uint8 entry = rt->arena[b];						\
-	unsigned mask = 0x80;							\
-													\
-	do {											\
-		/* "0 OR x = x", hence skip unset bits */	\
-		if (entry & mask) {							\
-			ON_CHANGE								\
-		}											\
-		i++;										\
-		mask >>= 1;									\
-	} while (mask);									\
+#define RT_FOR_EACH_BIT_SET(ON_CHANGE)					\
+for (b = 0; b < bytes; b++) {							\
+	const uchar *p = &rt->arena[b];						\
+	uint8 entry;										\
+	unsigned mask = 0x80;								\
+														\
+	if (op_aligned(p) && b + (int) OPSIZ <= bytes) {	\
+		op_t w;											\
+		memcpy(&w, p, OPSIZ);							\
+		if (0 == w) {									\
+			b += OPSIZ - 1;								\
+			continue;									\
+		}												\
+	}													\
+	if (0 == (entry = *p))								\
+		continue;										\
+	i = b * 8;											\
+														\
+	do {												\
+		/* "0 OR x = x", hence skip unset bits */		\
+		if (entry & mask) {								\
+			ON_CHANGE									\
+		}												\
+		i++;											\
+		mask >>= 1;										\
+	} while (mask);										\
 }
 
 	switch (expand) {
 	case 1:
-		RT_FOR_EACH_BIT_SET(
-			arena[i] = 0;		/* less than "inf" => indicates presence */
-		);
+		/*
+		 * Each byte of the table covers 8 bytes of the arena, which we
+		 * clear at once through the qrt_byte_mask[] pattern.
+		 */
+		for (b = 0; b < bytes; b++) {
+			uint8 entry = rt->arena[b];
+			uint64 w;
+
+			if (0 == entry)
+				continue;
+
+			memcpy(&w, &arena[b * 8], sizeof w);
+			w &= ~qrt_byte_mask[entry];	/* 0 < "inf" => indicates presence */
+			memcpy(&arena[b * 8], &w, sizeof w);
+		}
 		break;
 	case 2:
 		RT_FOR_EACH_BIT_SET(
@@ -4947,9 +5631,20 @@ qrt_handle_patch(
 			rt->is_empty = TRUE;
 			qrt_dynamic_bind_empty(rt);
 		} else {
+			if (rt->is_empty)
+				qrt_dynamic_bind(rt);
 			rt->is_empty = FALSE;
 		}
 
+		/*
+		 * Leaf tables are transposed into the leaf index for routing.
+		 */
+
+		if (NODE_IS_LEAF(n))
+			qrt_index_update(rt);
+		else
+			qrt_index_remove(rt);
+
 		/*
 		 * Install the table in the node, if it was a new table.
 		 * Otherwise, we only finished patching it.
@@ -5064,6 +5759,28 @@ qrp_monitor(void *unused_obj)
 	return TRUE;		/* Keep calling */
 }
 
+/**
+ * Fill the lookup tables used by the table compaction, diff and merge
+ * kernels.
+ */
+static void G_COLD
+qrt_kernels_init(void)
+{
+	uint b;
+
+	for (b = 0; b < N_ITEMS(qrt_quartets); b++) {
+		uchar *m = (uchar *) &qrt_byte_mask[b];
+		int j;
+
+		for (j = 0; j < 8; j++) {
+			bool set = booleanize(b & (1U << j));
+
+			qrt_quartets[b] |= set ? (1U << (4 * j)) : 0;
+			m[7 - j] = set ? 0xff : 0x00;
+		}
+	}
+}
+
 /**
  * Initialize QRP.
  */
@@ -5081,6 +5798,8 @@ qrp_init(void)
 
 	test_hash();
 
+	qrt_kernels_init();
+
 	/*
 	 * Install the periodic monitoring callback.
 	 */
@@ -5115,6 +5834,7 @@ qrp_close(void)
 	if (merged_table)
 		qrt_unref(merged_table);
 
+	qrt_index_close();
 	HFREE_NULL(buffer.arena);
 }
 
@@ -5461,6 +6181,14 @@ qrt_build_query_target(
 
 	sha1_query = qhvec_has_urn(qhvec);
 
+	/*
+	 * New query for the leaf index: matches are lazily computed for
+	 * each index group as we encounter its first leaf.
+	 */
+
+	if G_UNLIKELY(0 == ++qrt_index_stamp)
+		qrt_index_stamp++;
+
 	/*
 	 * We need to special case processing of queries with TTL=1 so that they
 	 * get set to ultra peers that support last-hop QRP only if they can
@@ -5539,10 +6267,14 @@ qrt_build_query_target(
 
 		node_inc_qrp_query(dn);			/* We have a QRT, mark we try routing */
 
-		if (!(qhvec->has_urn ?
+		if (rt->ixg != NULL) {
+			if (!qrt_index_can_route(rt, qhvec))
+				continue;
+		} else if (!(qhvec->has_urn ?
 			  rt->can_route_urn(qhvec, rt) :
-			  rt->can_route(qhvec, rt)))
+			  rt->can_route(qhvec, rt))) {
 			continue;
+		}
 
 		if (!is_leaf)
 			goto can_send;			/* Avoid indentation of remaining code */
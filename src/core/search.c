@@ -7589,14 +7589,14 @@ struct query_context {
 };
 
 /**
- * Create new query context.
+ * Create new query context, allocated from the arena of the query.
  */
 static struct query_context *
 share_query_context_make(const search_request_info_t *sri)
 {
 	struct query_context *ctx;
 
-	WALLOC0(ctx);
+	ARENA_ALLOC0(sri->arena, ctx);
 	ctx->shared_files = hset_create(HASH_KEY_SELF, 0);
 	ctx->sri = sri;
 
@@ -7611,10 +7611,10 @@ share_query_context_free(struct query_context *ctx)
 {
 	/*
 	 * Don't free the `files' list, as we passed it to the query hit builder.
+	 * The context itself is released with the arena of the query.
 	 */
 
 	hset_free_null(&ctx->shared_files);
-	WFREE(ctx);
 }
 
 /**
@@ -8015,14 +8015,22 @@ search_request_get_flags(const gnutella_node_t *n)
  * Allocates a new structure to hold search request (query) information,
  * so that we can reuse in search_request() the preprocessing work done
  * via search_request_preprocess().
+ *
+ * The structure is allocated from the thread's arena, which is checkpointed
+ * beforehand: all the transient objects allocated in that arena whilst the
+ * query is processed are released at once by search_request_info_free_null().
  */
 search_request_info_t *
 search_request_info_alloc(void)
 {
 	search_request_info_t *sri;
+	arena_t *ar = arena_private();
+	void *mark = arena_save(ar);
 
-	WALLOC0(sri);
+	ARENA_ALLOC0(ar, sri);
 	sri->magic = SEARCH_REQUEST_INFO_MAGIC;
+	sri->arena = ar;
+	sri->arena_mark = mark;
 
 	return sri;
 }
@@ -8039,7 +8047,7 @@ search_request_info_free_null(search_request_info_t **sri_ptr)
 		search_request_info_check(sri);
 		atom_str_free_null(&sri->extended_query);
 		sri->magic = 0;
-		WFREE(sri);
+		arena_restore(sri->arena, sri->arena_mark);
 		*sri_ptr = NULL;
 	}
 }
@@ -111,6 +111,8 @@ struct nid;
 
 #include "extensions.h"		/* For MAX_EXTVEC */
 
+#include "lib/arena.h"
+
 enum search_request_info_magic { SEARCH_REQUEST_INFO_MAGIC = 0x030c7005 };
 
 /**
@@ -118,6 +120,8 @@ enum search_request_info_magic { SEARCH_REQUEST_INFO_MAGIC = 0x030c7005 };
  */
 struct search_request_info {
 	enum search_request_info_magic magic;
+	arena_t *arena;					/**< Arena holding per-query objects */
+	void *arena_mark;				/**< Arena checkpoint before allocation */
 	struct {
 		struct sha1 sha1;
 		bool matched;
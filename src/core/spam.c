@@ -43,6 +43,8 @@
 #include "settings.h"
 #include "nodes.h"
 
+#include "lib/acmatch.h"
+#include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/bit_array.h"
 #include "lib/file.h"
@@ -113,8 +115,23 @@ static const char spam_what[] = "Spam database";
 
 /****** END IDEAS ONLY ******/
 
+/**
+ * Filename patterns are not all matched for each filename.
+ *
+ * We extract from each regular expression a literal string that must be
+ * present in any matching filename, and these literals are compiled into
+ * a single Aho-Corasick automaton.  A filename is scanned once with that
+ * automaton and only the patterns whose literal was found (and whose size
+ * range matches) need to be evaluated with regexec().
+ *
+ * Patterns from which no literal can be extracted are kept in a separate
+ * list and are always evaluated.
+ */
 struct spam_lut {
-	pslist_t *sl_names;	/* List of struct namesize_item */
+	pslist_t *sl_names;		/* List of struct namesize_item */
+	pslist_t *sl_always;	/* Items without literal, always checked */
+	acmatch_t *matcher;		/* Automaton on the literals of other items */
+	size_t count;			/* Amount of items in sl_names */
 };
 
 static struct spam_lut spam_lut;
@@ -154,8 +171,172 @@ struct namesize_item {
 	regex_t		pattern;
 	filesize_t	min_size;
 	filesize_t	max_size;
+	size_t		index;		/* Item number, to evaluate it only once */
 };
 
+#define SPAM_LITERAL_MIN	2		/* Minimum useful literal length */
+#define SPAM_LITERAL_MAX	64		/* Maximum literal length we extract */
+
+/**
+ * Skip a bracket expression in a regular expression.
+ *
+ * @param p		points to the opening '['
+ *
+ * @return pointer to the closing ']', or to the trailing NUL if none.
+ */
+static const char *
+spam_regex_skip_bracket(const char *p)
+{
+	g_assert('[' == *p);
+
+	p++;
+	if ('^' == *p)
+		p++;
+	if (']' == *p)
+		p++;					/* Leading ']' is a literal */
+
+	while (*p != '\0' && *p != ']') {
+		if ('[' == *p && (':' == p[1] || '.' == p[1] || '=' == p[1])) {
+			char delim = p[1];
+			const char *q;
+
+			for (q = p + 2; *q != '\0'; q++) {
+				if (delim == q[0] && ']' == q[1])
+					break;
+			}
+			if ('\0' == *q)
+				return q;
+			p = q + 2;			/* Skip ":]" and friends */
+		} else {
+			p++;
+		}
+	}
+
+	return p;
+}
+
+/**
+ * Extract the longest literal string that any filename matching the
+ * extended regular expression must contain.
+ *
+ * The analysis is conservative: whenever we are not sure whether a
+ * character is required, we break the literal run there.  Sub-expressions
+ * within parenthesis are not analyzed, and a top-level alternative means
+ * there is no required literal.
+ *
+ * @param re	the extended regular expression
+ * @param buf	where the literal is written (not NUL-terminated)
+ * @param len	size of buffer
+ *
+ * @return the length of the literal, 0 if none was found.
+ */
+static size_t
+spam_regex_literal(const char *re, char *buf, size_t len)
+{
+	char cur[SPAM_LITERAL_MAX];
+	size_t curlen = 0, bestlen = 0;
+	bool last_literal = FALSE;		/* Whether last atom was in cur[] */
+	const char *p;
+	uint depth = 0;
+
+#define SPAM_BREAK_RUN							\
+G_STMT_START {									\
+	if (curlen > bestlen) {						\
+		bestlen = MIN(curlen, len);				\
+		memcpy(buf, cur, bestlen);				\
+	}											\
+	curlen = 0;									\
+} G_STMT_END
+
+	for (p = re; *p != '\0'; p++) {
+		char c = *p;
+
+		if (depth != 0) {
+			switch (c) {
+			case '(':	depth++; break;
+			case ')':	depth--; break;
+			case '\\':	if (p[1] != '\0') p++; break;
+			case '[':
+				p = spam_regex_skip_bracket(p);
+				if ('\0' == *p)
+					goto done;
+				break;
+			}
+			last_literal = FALSE;
+			continue;
+		}
+
+		switch (c) {
+		case '|':
+			return 0;			/* Top-level alternative */
+		case '(':
+			depth++;
+			/* FALL THROUGH */
+		case '.':
+		case '^':
+		case '$':
+			SPAM_BREAK_RUN;
+			last_literal = FALSE;
+			break;
+		case '[':
+			SPAM_BREAK_RUN;
+			last_literal = FALSE;
+			p = spam_regex_skip_bracket(p);
+			if ('\0' == *p)
+				goto done;
+			break;
+		case '*':
+		case '?':
+		case '{':
+			/* Previous atom is optional: remove it from the run */
+			if (last_literal) {
+				g_assert(curlen != 0);
+				curlen--;
+			}
+			SPAM_BREAK_RUN;
+			last_literal = FALSE;
+			if ('{' == c) {
+				while (*p != '\0' && *p != '}')
+					p++;
+				if ('\0' == *p)
+					goto done;
+			}
+			break;
+		case '+':
+			/* Previous atom is required, but can be repeated */
+			SPAM_BREAK_RUN;
+			last_literal = FALSE;
+			break;
+		case '\\':
+			c = *++p;
+			if ('\0' == c)
+				goto done;
+			if (is_ascii_alnum(c)) {
+				/* Back-reference or GNU extension, not a literal */
+				SPAM_BREAK_RUN;
+				last_literal = FALSE;
+				break;
+			}
+			/* FALL THROUGH */
+		default:
+			if (curlen < N_ITEMS(cur)) {
+				cur[curlen++] = c;
+				last_literal = TRUE;
+			} else {
+				last_literal = FALSE;	/* Prefix of run is still required */
+			}
+			break;
+		}
+	}
+
+done:
+	SPAM_BREAK_RUN;
+
+#undef SPAM_BREAK_RUN
+
+	return bestlen;
+}
+
 static bool
 spam_add_name_and_size(const char *name,
 	filesize_t min_size, filesize_t max_size)
@@ -177,9 +358,23 @@ spam_add_name_and_size(const char *name,
 		WFREE(item);
 		return TRUE;
 	} else {
+		char literal[SPAM_LITERAL_MAX];
+		size_t len;
+
 		item->min_size = min_size;
 		item->max_size = max_size;
+		item->index = spam_lut.count++;
 		spam_lut.sl_names = pslist_prepend(spam_lut.sl_names, item);
+
+		len = spam_regex_literal(name, ARYLEN(literal));
+
+		if (len < SPAM_LITERAL_MIN) {
+			spam_lut.sl_always = pslist_prepend(spam_lut.sl_always, item);
+		} else {
+			if (NULL == spam_lut.matcher)
+				spam_lut.matcher = acmatch_make(FALSE);
+			acmatch_add(spam_lut.matcher, literal, len, item);
+		}
 		return FALSE;
 	}
 }
@@ -400,6 +595,9 @@ spam_load(FILE *f)
 
 	spam_sha1_sync();
 
+	if (spam_lut.matcher != NULL)
+		acmatch_compile(spam_lut.matcher);
+
 	return item_count;
 }
 
@@ -496,9 +694,58 @@ spam_close(void)
 		WFREE(item);
 	}
 	pslist_free_null(&spam_lut.sl_names);
+	pslist_free_null(&spam_lut.sl_always);
+	acmatch_free_null(&spam_lut.matcher);
+	spam_lut.count = 0;
 	spam_sha1_close();
 }
 
+#define SPAM_CHECK_ITEMS	1024	/* Items tracked without allocating */
+
+/**
+ * Spam checking context.
+ *
+ * The items already evaluated are tracked per check since we can be
+ * called concurrently from several threads.
+ */
+struct spam_check {
+	const char *filename;
+	filesize_t size;
+	bit_array_t *evaluated;		/* Items evaluated, by item index */
+};
+
+/**
+ * Check whether item matches the filename and size.
+ */
+static bool
+spam_item_matches(const struct namesize_item *item,
+	const struct spam_check *ctx)
+{
+	if (bit_array_get(ctx->evaluated, item->index))
+		return FALSE;			/* Already evaluated for this filename */
+
+	bit_array_set(ctx->evaluated, item->index);
+
+	return
+		ctx->size >= item->min_size &&
+		ctx->size <= item->max_size &&
+		0 == regexec(&item->pattern, ctx->filename, 0, NULL, 0);
+}
+
+/**
+ * Aho-Corasick match callback: the literal of an item was found in the
+ * filename, evaluate the item.
+ *
+ * @return TRUE if the item matched, to stop the search.
+ */
+static bool
+spam_literal_found(void *value, size_t end, void *data)
+{
+	(void) end;
+
+	return spam_item_matches(value, data);
+}
+
 /**
  * Check the given filename against the spam database.
  *
@@ -508,23 +755,47 @@ spam_close(void)
 bool
 spam_check_filename_size(const char *filename, filesize_t size)
 {
+	bit_array_t evaluated[BIT_ARRAY_SIZE(SPAM_CHECK_ITEMS)];
+	struct spam_check ctx;
 	const pslist_t *sl;
+	bool found = FALSE;
 
 	g_return_val_if_fail(filename, FALSE);
 
-	PSLIST_FOREACH(spam_lut.sl_names, sl) {
-		const struct namesize_item *item = sl->data;
+	if (NULL == spam_lut.sl_names)
+		return FALSE;
 
-		g_assert(item);
-		if (
-			size >= item->min_size &&
-			size <= item->max_size &&
-			0 == regexec(&item->pattern, filename, 0, NULL, 0)
-		) {
-			return TRUE;
+	ctx.filename = filename;
+	ctx.size = size;
+
+	if G_LIKELY(spam_lut.count <= SPAM_CHECK_ITEMS)
+		ctx.evaluated = evaluated;
+	else
+		ctx.evaluated = halloc(BIT_ARRAY_BYTE_SIZE(spam_lut.count));
+
+	bit_array_init(ctx.evaluated, spam_lut.count);
+
+	if (
+		spam_lut.matcher != NULL &&
+		acmatch_search(spam_lut.matcher, filename, vstrlen(filename),
+			spam_literal_found, &ctx)
+	) {
+		found = TRUE;
+		goto done;
+	}
+
+	PSLIST_FOREACH(spam_lut.sl_always, sl) {
+		if (spam_item_matches(sl->data, &ctx)) {
+			found = TRUE;
+			break;
 		}
 	}
-	return FALSE;
+
+done:
+	if (ctx.evaluated != evaluated)
+		hfree(ctx.evaluated);
+
+	return found;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -46,8 +46,7 @@
 #include "thex.h"
 #include "thex_download.h"
 
-#include "xml/vxml.h"
-#include "xml/xnode.h"
+#include "xml/vxpull.h"
 
 #include "if/gnet_property_priv.h"
 
@@ -173,36 +172,43 @@ thex_download_data_ind(rxdrv_t *rx, pmsg_t *mb)
 }
 
 /* XML helper functions */
-static xnode_t *
-find_element_by_name(xnode_t *p, const char *name)
-{
-   xnode_t *xn;
-
-    for (xn = xnode_first_child(p); xn != NULL; xn = xnode_next_sibling(xn)) {
-        if (xnode_is_element(xn) && 0 == strcmp(xnode_element_name(xn), name))
-			return xn;
-    }
-    return NULL;
-}
 
+/**
+ * Fetch attribute of the current element, decoded into the supplied buffer.
+ *
+ * @return TRUE if attribute was found and fits in the buffer.
+ */
 static bool
-verify_element(xnode_t *node, const char *prop, const char *expect)
+thex_xml_prop_get(const vxpull_t *xp, const char *prop, char *buf, size_t len)
 {
-	const char *value;
+	vxpull_str_t value, name;
 
-	value = xnode_prop_get(node, prop);
-  	if (NULL == value) {
+	if (!vxpull_attr_get(xp, prop, &value)) {
 		if (GNET_PROPERTY(tigertree_debug)) {
-			g_debug("TTH couldn't find property \"%s\" of node \"%s\"",
-				prop, xnode_element_name(node));
+			name = vxpull_name(xp);
+			g_debug("TTH couldn't find property \"%s\" of node \"%.*s\"",
+				prop, (int) name.len, name.ptr);
 		}
 		return FALSE;
 	}
+
+	return vxpull_decode(value, buf, len) < len;
+}
+
+static bool
+verify_element(const vxpull_t *xp, const char *prop, const char *expect)
+{
+	char value[64];
+
+	if (!thex_xml_prop_get(xp, prop, ARYLEN(value)))
+		return FALSE;
+
 	if (0 != strcmp(value, expect)) {
 		if (GNET_PROPERTY(tigertree_debug)) {
-			g_debug("TTH property %s/%s doesn't match expected value \"%s\", "
-				"got \"%s\"",
-				xnode_element_name(node), prop, expect, value);
+			vxpull_str_t name = vxpull_name(xp);
+			g_debug("TTH property %.*s/%s doesn't match expected value "
+				"\"%s\", got \"%s\"",
+				(int) name.len, name.ptr, prop, expect, value);
 		}
 		return FALSE;
 	}
@@ -210,110 +216,151 @@ verify_element(xnode_t *node, const char *prop, const char *expect)
 	return TRUE;
 }
 
+/**
+ * Handle the "serializedtree" element of the THEX record.
+ *
+ * @return the hashtree ID on success, NULL on failure.
+ */
+static char *
+thex_download_serializedtree(struct thex_download *ctx, const vxpull_t *xp)
+{
+	vxpull_str_t value, name = vxpull_name(xp);
+	char *hashtree_id;
+	char depth[32];
+	int error;
+
+	if (!verify_element(xp, "type", THEX_TREE_TYPE))
+		return NULL;
+
+	if (!vxpull_attr_get(xp, "uri", &value)) {
+		if (GNET_PROPERTY(tigertree_debug)) {
+			g_debug("TTH couldn't find property \"uri\" of node \"%.*s\"",
+				(int) name.len, name.ptr);
+		}
+		return NULL;
+	}
+
+	hashtree_id = halloc(value.len + 1);
+	vxpull_decode(value, hashtree_id, value.len + 1);
+
+	if (!thex_xml_prop_get(xp, "depth", ARYLEN(depth))) {
+		HFREE_NULL(hashtree_id);
+		return NULL;
+	}
+
+	ctx->depth = parse_uint16(depth, NULL, 10, &error);
+	error |= ctx->depth > tt_full_depth(ctx->filesize);
+	if (error) {
+		ctx->depth = 0;
+		g_warning("TTH bad value for \"depth\" of node \"%.*s\": \"%s\"",
+			(int) name.len, name.ptr, depth);
+		HFREE_NULL(hashtree_id);
+	}
+
+	return hashtree_id;
+}
+
+/**
+ * Parse the THEX XML record, extracting the few attributes we need.
+ *
+ * The record is small and we only look at the attributes of the first
+ * "file", "digest" and "serializedtree" children of the root "hashtree"
+ * element, hence we use the pull parser instead of building an XML tree.
+ *
+ * @return the hashtree ID on success, NULL on failure.
+ */
 static char *
 thex_download_handle_xml(struct thex_download *ctx,
 	const char *data, size_t size)
 {
-	xnode_t *hashtree = NULL, *node;
 	char *hashtree_id = NULL;
 	bool success = FALSE;
-	vxml_parser_t *vp;
-	vxml_error_t e;
+	bool seen_file = FALSE, seen_digest = FALSE;
+	vxpull_t *xp;
+	vxpull_event_t ev;
 
 	if (size <= 0) {
 		if (GNET_PROPERTY(tigertree_debug)) {
 			g_debug("TTH XML record has no data");
 		}
-		goto finish;
+		return NULL;
 	}
 
 	/*
 	 * Parse the XML record.
+	 *
+	 * We go through the whole record even after having found all the
+	 * elements we need, to make sure it is valid XML.
 	 */
 
-	vp = vxml_parser_make("THEX record", VXML_O_STRIP_BLANKS);
-	vxml_parser_add_data(vp, data, size);
-	e = vxml_parse_tree(vp, &hashtree);
-	vxml_parser_free(vp);
+	xp = vxpull_make("THEX record", data, size, VXPULL_O_STRIP_BLANKS);
 
-	if (VXML_E_OK != e) {
-		if (GNET_PROPERTY(tigertree_debug)) {
-			g_warning("TTH cannot parse XML record: %s", vxml_strerror(e));
-			dump_hex(stderr, "XML record", data, size);
+	while (VXPULL_EOF != (ev = vxpull_next(xp))) {
+		vxpull_str_t name;
+
+		if (VXPULL_ERROR == ev) {
+			if (GNET_PROPERTY(tigertree_debug)) {
+				g_warning("TTH cannot parse XML record: %s",
+					vxpull_strerror(vxpull_error(xp)));
+				dump_hex(stderr, "XML record", data, size);
+			}
+			goto finish;
 		}
-		goto finish;
-	}
 
-	if (0 != strcmp("hashtree", xnode_element_name(hashtree))) {
-		if (GNET_PROPERTY(tigertree_debug)) {
-			g_debug("TTH couldn't find root hashtree element");
+		if (VXPULL_START != ev)
+			continue;
+
+		name = vxpull_name(xp);
+
+		if (1 == vxpull_depth(xp)) {
+			if (!vxpull_str_eq(name, "hashtree")) {
+				if (GNET_PROPERTY(tigertree_debug)) {
+					g_debug("TTH couldn't find root hashtree element");
+				}
+				goto finish;
+			}
+			continue;
+		}
+
+		if (2 != vxpull_depth(xp))
+			continue;
+
+		if (!seen_file && vxpull_str_eq(name, "file")) {
+			seen_file = TRUE;
+			if (!verify_element(xp, "size", filesize_to_string(ctx->filesize)))
+				goto finish;
+			if (!verify_element(xp, "segmentsize", THEX_SEGMENT_SIZE))
+				goto finish;
+		} else if (!seen_digest && vxpull_str_eq(name, "digest")) {
+			seen_digest = TRUE;
+			if (!verify_element(xp, "algorithm", THEX_HASH_ALGO))
+				goto finish;
+			if (!verify_element(xp, "outputsize", THEX_HASH_SIZE))
+				goto finish;
+		} else if (
+			NULL == hashtree_id && vxpull_str_eq(name, "serializedtree")
+		) {
+			hashtree_id = thex_download_serializedtree(ctx, xp);
+			if (NULL == hashtree_id)
+				goto finish;
 		}
-		goto finish;
 	}
 
-	node = find_element_by_name(hashtree, "file");
-	if (node) {
-		if (!verify_element(node, "size", filesize_to_string(ctx->filesize)))
-			goto finish;
-		if (!verify_element(node, "segmentsize", THEX_SEGMENT_SIZE))
-			goto finish;
-	} else {
+	if (!seen_file) {
 		if (GNET_PROPERTY(tigertree_debug)) {
 			g_debug("TTH couldn't find hashtree/file element");
 		}
 		goto finish;
 	}
 
-	node = find_element_by_name(hashtree, "digest");
-	if (node) {
-		if (!verify_element(node, "algorithm", THEX_HASH_ALGO))
-			goto finish;
-		if (!verify_element(node, "outputsize", THEX_HASH_SIZE))
-			goto finish;
-	} else {
+	if (!seen_digest) {
 		if (GNET_PROPERTY(tigertree_debug)) {
 			g_debug("TTH couldn't find hashtree/digest element");
 		}
-    	goto finish;
+		goto finish;
 	}
 
-	node = find_element_by_name(hashtree, "serializedtree");
-	if (node) {
-		const char *value;
-		int error;
-
-		if (!verify_element(node, "type", THEX_TREE_TYPE))
-    		goto finish;
-
-		value = xnode_prop_get(node, "uri");
-		if (NULL == value) {
-			if (GNET_PROPERTY(tigertree_debug)) {
-				g_debug("TTH couldn't find property \"uri\" of node \"%s\"",
-					xnode_element_name(node));
-			}
-			goto finish;
-		}
-		hashtree_id = h_strdup(value);
-
-		value = xnode_prop_get(node, "depth");
-		if (NULL == value) {
-			if (GNET_PROPERTY(tigertree_debug)) {
-				g_debug("TTH couldn't find property \"depth\" of node \"%s\"",
-					xnode_element_name(node));
-			}
-			goto finish;
-		}
-
-		ctx->depth = parse_uint16(value, NULL, 10, &error);
-		error |= ctx->depth > tt_full_depth(ctx->filesize);
-		if (error) {
-			ctx->depth = 0;
-			g_warning("TTH bad value for \"depth\" of node \"%s\": \"%s\"",
-				xnode_element_name(node), value);
-		}
-		if (error)
-			goto finish;
-	} else {
+	if (NULL == hashtree_id) {
 		if (GNET_PROPERTY(tigertree_debug))
 			g_debug("TTH couldn't find hashtree/serializedtree element");
 		goto finish;
@@ -324,7 +371,7 @@ thex_download_handle_xml(struct thex_download *ctx,
 finish:
 	if (!success)
 		HFREE_NULL(hashtree_id);
-	xnode_tree_free_null(&hashtree);
+	vxpull_free_null(&xp);
 
 	return hashtree_id;
 }
@@ -392,7 +392,14 @@ vmsg_handle(gnutella_node_t *n)
 	 */
 
 	if (found) {
+		tm_nano_t t0, t1;
+		long ns;
+
+		tm_precise_time(&t0);
 		(*vmsg.handler)(n, &vmsg, n->data + sizeof(*v), n->size - sizeof(*v));
+		tm_precise_time(&t1);
+		ns = tm_precise_elapsed_ns(&t1, &t0);
+		gnet_stats_vmsg_count_latency(vmsg.name, MAX(0, ns));
 	} else {
 		gnet_stats_count_dropped(n, MSG_DROP_UNKNOWN_TYPE);
 		if (GNET_PROPERTY(vmsg_debug) || GNET_PROPERTY(log_bad_gnutella))
@@ -88,6 +88,7 @@
 #include "lib/array_util.h"
 #include "lib/atoms.h"
 #include "lib/bstr.h"
+#include "lib/cbloom.h"
 #include "lib/cq.h"
 #include "lib/crash.h"
 #include "lib/dbmw.h"
@@ -115,6 +116,7 @@
 #define KBALL_FIRST		60		/**< First k-ball update after 1 minute */
 
 #define KEYS_DB_CACHE_SIZE	512	/**< Amount of keys to keep cached in RAM */
+#define KEYS_FILTER_FP		0.01	/**< False positive rate of pair filter */
 #define KEYS_SYNC_PERIOD	(60*1000)	/**< Sync DB every minute */
 
 /**
@@ -195,6 +197,15 @@ static dbmw_t *db_keydata;
 static char db_keybase[] = "dht_keys";
 static char db_keywhat[] = "DHT key data";
 
+/**
+ * Counting Bloom filter on all the (key, creator) pairs held in the keydata,
+ * to avoid reading the keydata from disk when the key does not hold a value
+ * from a given creator, which is the most frequent case.
+ *
+ * Only allocated when the keydata are not held in memory.
+ */
+static cbloom_t *keys_filter;
+
 static cevent_t *kball_ev;		/**< Event for periodic k-ball update */
 static cperiodic_t *keys_periodic_ev;
 static cperiodic_t *keys_sync_ev;
@@ -224,6 +235,66 @@ keys_exists(const kuid_t *key)
 	return hikset_contains(keys, key);
 }
 
+/**
+ * Fill buffer with the (key, creator) pair used as key in the filter.
+ */
+static void
+keys_filter_pair(char *buf, size_t len, const kuid_t *id, const kuid_t *cid)
+{
+	void *p;
+
+	g_assert(len >= 2 * KUID_RAW_SIZE);
+
+	p = mempcpy(buf, id, KUID_RAW_SIZE);
+	memcpy(p, cid, KUID_RAW_SIZE);
+}
+
+/**
+ * Record that key now holds a value from the creator.
+ */
+static void
+keys_filter_add(const kuid_t *id, const kuid_t *cid)
+{
+	char buf[2 * KUID_RAW_SIZE];
+
+	if (NULL == keys_filter)
+		return;
+
+	keys_filter_pair(ARYLEN(buf), id, cid);
+	cbloom_add(keys_filter, ARYLEN(buf));
+}
+
+/**
+ * Record that key no longer holds a value from the creator.
+ */
+static void
+keys_filter_remove(const kuid_t *id, const kuid_t *cid)
+{
+	char buf[2 * KUID_RAW_SIZE];
+
+	if (NULL == keys_filter)
+		return;
+
+	keys_filter_pair(ARYLEN(buf), id, cid);
+	cbloom_remove(keys_filter, ARYLEN(buf));
+}
+
+/**
+ * @return FALSE if key certainly holds no value from the creator, TRUE if
+ * it may hold one and we need to check the keydata.
+ */
+static bool
+keys_filter_contains(const kuid_t *id, const kuid_t *cid)
+{
+	char buf[2 * KUID_RAW_SIZE];
+
+	if (NULL == keys_filter)
+		return TRUE;
+
+	keys_filter_pair(ARYLEN(buf), id, cid);
+	return cbloom_contains(keys_filter, ARYLEN(buf));
+}
+
 /**
  * @return whether key is "store-loaded", i.e. if we are getting too many
  * STORE requests for it.
@@ -635,6 +706,14 @@ keys_has(const kuid_t *id, const kuid_t *cid, bool store)
 	if (store)
 		ki->store_requests++;
 
+	/*
+	 * Avoid reading the keydata, possibly from disk, when the filter
+	 * tells us the key holds no value from that creator.
+	 */
+
+	if (!keys_filter_contains(id, cid))
+		return 0;
+
 	kd = get_keydata(id, FALSE);
 	if (kd == NULL)
 		return 0;
@@ -692,6 +771,8 @@ keys_remove_value(const kuid_t *id, const kuid_t *cid, uint64 dbkey)
 	ARRAY_REMOVE(kd->dbkeys,   idx, kd->values);
 	ARRAY_REMOVE(kd->expire,   idx, kd->values);
 
+	keys_filter_remove(id, cid);
+
 	/*
 	 * We do not synchronously delete empty keys.
 	 *
@@ -925,6 +1006,7 @@ keys_add_value(const kuid_t *id, const kuid_t *cid,
 	ki->values++;
 
 	dbmw_write(db_keydata, id, PTRLEN(kd));
+	keys_filter_add(id, cid);
 
 	if (GNET_PROPERTY(dht_storage_debug) > 2)
 		g_debug("DHT STORE %s key %s now holds %d/%d value%s",
@@ -1670,6 +1752,14 @@ keys_init(void)
 		kv, packing, KEYS_DB_CACHE_SIZE, kuid_hash, kuid_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
 
+	/*
+	 * The filter is filled as values are reloaded by keys_init_keyinfo(),
+	 * and is useless when the keydata are held in memory.
+	 */
+
+	if (DBMAP_MAP != dbmw_map_type(db_keydata))
+		keys_filter = cbloom_make(VALUES_MAX_MANAGED, KEYS_FILTER_FP);
+
 	for (i = 0; i < N_ITEMS(decimation_factor); i++)
 		decimation_factor[i] = pow(KEYS_DECIMATION_BASE, i);
 
@@ -1842,6 +1932,7 @@ keys_close(void)
 
 	dbstore_close(db_keydata, settings_dht_db_dir(), db_keybase);
 	db_keydata = NULL;
+	cbloom_free_null(&keys_filter);
 
 	if (keys) {
 		hikset_foreach(keys, keys_free_kv, NULL);
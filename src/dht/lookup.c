@@ -85,6 +85,21 @@
 #define NL_FIND_DELAY		5000	/* 5 seconds, in ms */
 #define NL_VAL_DELAY		1000	/* 1 second, in ms */
 
+/**
+ * Adaptive parallelism and latency-aware contact selection.
+ *
+ * We keep a sliding window of the RTTs measured during lookups to derive
+ * the median and 90th percentile of the RPC latency.  Nodes whose reply has
+ * not come back after the p90 RTT are considered stragglers and we hedge by
+ * sending extra RPCs to the next candidates in the shortlist.
+ */
+#define NL_ALPHA_MAX		(2 * KDA_ALPHA)	/* Max adaptive parallelism */
+#define NL_SELECT_EXTRA		2		/* Extra candidates weighed per hop */
+#define NL_RTT_SAMPLES		128		/* RTT samples kept for percentiles */
+#define NL_RTT_MIN_SAMPLES	16		/* Min samples before hedging */
+#define NL_HEDGE_MIN		250		/* Min hedging delay, in ms */
+#define NL_HEDGE_MAX		KDA_ALPHA	/* Max hedged RPCs per hop */
+
 /**
  * Maximum number of nodes from a class C network that we can return in
  * the lookup path.  This is a way to fight against ID attacks (known as
@@ -118,6 +133,18 @@ static unsigned kball_dist_proba[KUID_RAW_BITSIZE];
 
 static double log2_frequency[KDA_K][KDA_K];
 
+/**
+ * RTT statistics collected from lookup replies, for all lookups.
+ */
+static struct lookup_rtt {
+	uint32 sample[NL_RTT_SAMPLES];	/**< Circular buffer of RTTs (ms) */
+	uint32 p50;						/**< Median RTT (ms) */
+	uint32 p90;						/**< 90th percentile RTT (ms) */
+	unsigned count;					/**< Amount of valid samples */
+	unsigned idx;					/**< Next slot to fill */
+	bool dirty;						/**< Percentiles need recomputing */
+} lookup_rtt;
+
 /**
  * Table keeping track of all the node lookup objects that we have created
  * and which are still running.
@@ -194,6 +221,7 @@ struct nlookup {
 	map_t *queried;				/**< Nodes already queried */
 	map_t *unsafe;				/**< Nodes deemed unsafe */
 	map_t *tokens;				/**< Collected security tokens */
+	map_t *sent;				/**< Send time of pending RPCs */
 	patricia_t *path;			/**< Lookup path followed */
 	patricia_t *ball;			/**< The k-closest nodes we've found so far */
 	cevent_t *expire_ev;		/**< Global expiration event for lookup */
@@ -231,7 +259,10 @@ struct nlookup {
 	int bw_outgoing;			/**< Amount of outgoing bandwidth used */
 	int bw_incoming;			/**< Amount of incoming bandwidth used */
 	int udp_drops;				/**< Amount of UDP packet drops */
+	int alpha;					/**< Current adaptive parallelism */
+	int rpc_hedged;				/**< Amount of hedging RPCs sent */
 	tm_t start;					/**< Start time */
+	cevent_t *hedge_ev;			/**< Straggler hedging event */
 	uint32 hops;				/**< Amount of hops in lookup so far */
 	uint32 flags;				/**< Operating flags */
 	/*
@@ -269,6 +300,7 @@ struct nlookup {
 #define NL_F_PASV_PROTECT	(1U << 5)	/**< Passive protection triggered */
 #define NL_F_ACTV_PROTECT	(1U << 6)	/**< Active protection triggered */
 #define NL_F_KBALL_CHECK	(1U << 7)	/**< Checked kball probability */
+#define NL_F_HEDGED			(1U << 8)	/**< Hedged stragglers at this hop */
 
 static inline void
 lookup_check(const nlookup_t *nl)
@@ -409,6 +441,60 @@ free_token(void *unused_key, void *value, void *unused_u)
 	lookup_token_free(ltok, TRUE);
 }
 
+/**
+ * Map iterator to free the recorded send times.
+ */
+static void
+lookup_sent_map_free(void *unused_key, void *value, void *unused_u)
+{
+	tm_t *sent = value;
+
+	(void) unused_key;
+	(void) unused_u;
+
+	WFREE(sent);
+}
+
+/**
+ * Record the time at which we are sending an RPC to the node.
+ */
+static void
+lookup_sent_record(nlookup_t *nl, const knode_t *kn)
+{
+	tm_t *sent;
+
+	g_assert(!map_contains(nl->sent, kn->id));
+
+	WALLOC(sent);
+	tm_now_exact(sent);
+	map_insert(nl->sent, kn->id, sent);
+}
+
+/**
+ * Forget the time at which we sent an RPC to the node.
+ *
+ * @param nl		the lookup
+ * @param kn		the node to which the RPC was sent
+ * @param when		if non-NULL, filled with the sending time
+ *
+ * @return TRUE if the sending time was known.
+ */
+static bool
+lookup_sent_remove(nlookup_t *nl, const knode_t *kn, tm_t *when)
+{
+	tm_t *sent = map_lookup(nl->sent, kn->id);
+
+	if (NULL == sent)
+		return FALSE;
+
+	map_remove(nl->sent, kn->id);
+	if (when != NULL)
+		*when = *sent;
+	WFREE(sent);
+
+	return TRUE;
+}
+
 /**
  * Destroy a KUID lookup.
  */
@@ -426,12 +512,14 @@ lookup_free(nlookup_t *nl)
 	map_foreach(nl->unsafe, knode_map_free, NULL);
 	map_foreach(nl->alternate, knode_map_free, NULL);
 	map_foreach(nl->pending, knode_map_free, NULL);
+	map_foreach(nl->sent, lookup_sent_map_free, NULL);
 	map_foreach(nl->fixed, knode_map_free, NULL);
 	patricia_foreach(nl->path, knode_patricia_free, NULL);
 	patricia_foreach(nl->ball, knode_patricia_free, NULL);
 
 	cq_cancel(&nl->expire_ev);
 	cq_cancel(&nl->delay_ev);
+	cq_cancel(&nl->hedge_ev);
 	kuid_atom_free_null(&nl->kuid);
 
 	map_destroy(nl->tokens);
@@ -440,6 +528,7 @@ lookup_free(nlookup_t *nl)
 	map_destroy(nl->unsafe);
 	map_destroy(nl->alternate);
 	map_destroy(nl->pending);
+	map_destroy(nl->sent);
 	map_destroy(nl->fixed);
 	patricia_destroy(nl->path);
 	patricia_destroy(nl->ball);
@@ -1048,6 +1137,7 @@ lookup_value_install_timer(nlookup_t *nl)
 
 	cq_cancel(&nl->expire_ev);
 	cq_cancel(&nl->delay_ev);
+	cq_cancel(&nl->hedge_ev);
 	nl->expire_ev = cq_main_insert(NL_MAX_FETCHTIME, lookup_value_expired, nl);
 }
 
@@ -2623,6 +2713,9 @@ log_status(nlookup_t *nl)
 		nl->rpc_timeouts, nl->rpc_bad, nl->rpc_replies);
 	g_debug("DHT LOOKUP[%s] B/W incoming=%d bytes, outgoing=%d bytes",
 		nid_to_string(&nl->lid), nl->bw_incoming, nl->bw_outgoing);
+	g_debug("DHT LOOKUP[%s] alpha=%d, hedged=%d, RTT p50=%u ms, p90=%u ms",
+		nid_to_string(&nl->lid), nl->alpha, nl->rpc_hedged,
+		lookup_rtt.p50, lookup_rtt.p90);
 	if (NULL == nl->closest) {
 		g_debug("DHT LOOKUP[%s] no current closest node",
 			nid_to_string(&nl->lid));
@@ -3452,6 +3545,94 @@ accepting:
 	return TRUE;
 }
 
+static int
+lookup_rtt_cmp(const void *a, const void *b)
+{
+	const uint32 *ra = a, *rb = b;
+
+	return CMP(*ra, *rb);
+}
+
+/**
+ * Record a new RTT measurement, in milliseconds.
+ */
+static void
+lookup_rtt_record(uint32 ms)
+{
+	lookup_rtt.sample[lookup_rtt.idx] = ms;
+	lookup_rtt.idx = (lookup_rtt.idx + 1) % N_ITEMS(lookup_rtt.sample);
+	if (lookup_rtt.count < N_ITEMS(lookup_rtt.sample))
+		lookup_rtt.count++;
+	lookup_rtt.dirty = TRUE;
+}
+
+/**
+ * Recompute RTT percentiles if new samples were recorded since last time.
+ */
+static void
+lookup_rtt_update(void)
+{
+	uint32 sorted[NL_RTT_SAMPLES];
+	unsigned n = lookup_rtt.count;
+
+	if (!lookup_rtt.dirty || 0 == n)
+		return;
+
+	memcpy(sorted, lookup_rtt.sample, n * sizeof sorted[0]);
+	vsort(sorted, n, sizeof sorted[0], lookup_rtt_cmp);
+
+	lookup_rtt.p50 = sorted[n / 2];
+	lookup_rtt.p90 = sorted[(n * 9) / 10];
+	lookup_rtt.dirty = FALSE;
+}
+
+/**
+ * Compute the expected latency of a reply from a node, in milliseconds.
+ *
+ * This is the known RTT of the node (or the median RTT when unknown),
+ * inflated by the inverse of the probability that the node is still alive:
+ * a node likely to time out is going to make us wait longer.
+ */
+static double
+lookup_expected_rtt(const knode_t *kn)
+{
+	double rtt, alive;
+
+	knode_check(kn);
+
+	rtt = 0 != kn->rtt ? kn->rtt : lookup_rtt.p50;
+	if (0 == rtt)
+		rtt = 1.0;		/* No RTT information yet, only liveness counts */
+
+	alive = knode_still_alive_probability(kn);
+
+	return rtt / MAX(alive, 0.05);
+}
+
+/**
+ * Compute the adaptive parallelism for the next hop.
+ *
+ * We start with KDA_ALPHA and scale it up by the inverse of the observed
+ * reply ratio, so that we can expect KDA_ALPHA replies per hop even when
+ * a fair amount of our RPCs time out.
+ */
+static int
+lookup_alpha(const nlookup_t *nl)
+{
+	int answered = nl->rpc_replies + nl->rpc_timeouts;
+	int alpha;
+
+	if (answered < KDA_ALPHA)
+		return KDA_ALPHA;
+
+	if (0 == nl->rpc_replies)
+		return NL_ALPHA_MAX;
+
+	alpha = (KDA_ALPHA * answered + nl->rpc_replies - 1) / nl->rpc_replies;
+
+	return CLAMP(alpha, KDA_ALPHA, NL_ALPHA_MAX);
+}
+
 /***
  *** RPC event callbacks for FIND_NODE and FIND_VALUE operations.
  *** See revent_pmsg_free() and revent_rpc_cb() to understand calling contexts.
@@ -3505,6 +3686,7 @@ lk_msg_dropped(void *obj, knode_t *kn, pmsg_t *unused_mb)
 		knode_refcnt_dec(kn);
 	if (map_remove(nl->pending, kn->id))
 		knode_refcnt_dec(kn);
+	lookup_sent_remove(nl, kn, NULL);
 
 	if (!(nl->flags & NL_F_SENDING)) {
 		lookup_shortlist_add(nl, kn);
@@ -3582,6 +3764,23 @@ lk_handling_rpc(void *obj, enum dht_rpc_ret type,
 	g_assert(removed);
 	knode_refcnt_dec(kn);		/* Was referenced in nl->pending */
 
+	/*
+	 * Sample the RTT of every reply, measured from the time the RPC was
+	 * sent: replies to hedged hops are precisely the slow ones, and must
+	 * be accounted for in the percentiles.
+	 */
+
+	{
+		tm_t sent;
+
+		if (lookup_sent_remove(nl, kn, &sent) && DHT_RPC_REPLY == type) {
+			tm_t now;
+
+			tm_now_exact(&now);
+			lookup_rtt_record(tm_elapsed_ms(&now, &sent));
+		}
+	}
+
 	/*
 	 * If we have a timeout and an alternate address known, try it:
 	 * the node is removed from the queried set and put back in the
@@ -3894,6 +4093,7 @@ lookup_send(nlookup_t *nl, knode_t *kn)
 
 	map_insert(nl->queried, kn->id, knode_refcnt_inc(kn));
 	map_insert(nl->pending, kn->id, knode_refcnt_inc(kn));
+	lookup_sent_record(nl, kn);
 
 	switch (nl->type) {
 	case LOOKUP_NODE:
@@ -3934,6 +4134,7 @@ lookup_requery(nlookup_t *nl, const knode_t *kn)
 	nl->rpc_latest_pending++;
 
 	map_insert(nl->pending, kn->id, knode_refcnt_inc(kn));
+	lookup_sent_record(nl, kn);
 	revent_find_node(deconstify_pointer(kn),
 		nl->kuid, nl->lid, &lookup_ops, nl->hops);
 }
@@ -3992,21 +4193,208 @@ lookup_async_iterate(nlookup_t *nl)
 	nl->delay_ev = cq_main_insert(1, lookup_delay_expired, nl);
 }
 
+struct lookup_candidate {
+	knode_t *kn;			/* Candidate node, in the shortlist */
+	double rtt;				/* Expected reply latency, in ms */
+};
+
+static int
+lookup_candidate_cmp(const void *a, const void *b)
+{
+	const struct lookup_candidate *ca = a, *cb = b;
+
+	return CMP(ca->rtt, cb->rtt);
+}
+
 /**
- * Iterate the lookup, once we have determined we must send more probes.
+ * Send up to ``count'' RPCs to the closest nodes in the shortlist that we
+ * have not queried yet.
+ *
+ * We weigh a few more candidates than needed and, besides the closest node
+ * which is always queried to guarantee progress, we favour the nodes from
+ * which we expect the fastest reply, based on their RTT and liveness.
+ *
+ * @return the amount of RPCs sent.
  */
-static void
-lookup_iterate(nlookup_t *nl)
+static int
+lookup_send_closest(nlookup_t *nl, int count)
 {
+	struct lookup_candidate cand[NL_ALPHA_MAX + NL_SELECT_EXTRA];
 	patricia_iter_t *iter;
 	pslist_t *to_remove = NULL;
 	pslist_t *ignored = NULL;
 	pslist_t *sl;
-	int i = 0;
-	int alpha = KDA_ALPHA;
+	int i, n = 0, sent = 0;
+	int wanted;
 	char reason[80];
 	int reason_len;
 
+	lookup_check(nl);
+	g_assert(count > 0 && count <= NL_ALPHA_MAX);
+
+	/*
+	 * Select the closest candidates from the shortlist, pruning the nodes
+	 * which are unsafe or which we already queried.
+	 */
+
+	wanted = count + NL_SELECT_EXTRA;
+	reason_len = GNET_PROPERTY(dht_lookup_debug) ? sizeof reason : 0;
+	iter = patricia_metric_iterator_lazy(nl->shortlist, nl->kuid, TRUE);
+
+	while (n < wanted && patricia_iter_has_next(iter)) {
+		knode_t *kn = patricia_iter_next_value(iter);
+
+		if (!knode_can_recontact(kn))
+			continue;
+
+		/*
+		 * Skip unsafe hosts.
+		 */
+
+		if (!lookup_node_is_safe(nl, kn, reason, reason_len)) {
+			if (GNET_PROPERTY(dht_lookup_debug)) {
+				g_debug("DHT LOOKUP[%s] ignoring %s: %s",
+					nid_to_string(&nl->lid), knode_to_string(kn), reason);
+			}
+			ignored = pslist_prepend(ignored, knode_refcnt_inc(kn));
+			to_remove = pslist_prepend(to_remove, kn);
+		} else if (map_contains(nl->queried, kn->id)) {
+			to_remove = pslist_prepend(to_remove, kn);
+		} else {
+			cand[n].kn = kn;
+			cand[n].rtt = lookup_expected_rtt(kn);
+			n++;
+		}
+	}
+
+	patricia_iterator_release(&iter);
+
+	/*
+	 * The closest candidate stays first, the others are sorted by increasing
+	 * expected latency.
+	 */
+
+	lookup_rtt_update();
+
+	if (n > 2)
+		vsort(&cand[1], n - 1, sizeof cand[0], lookup_candidate_cmp);
+
+	nl->flags |= NL_F_SENDING;		/* Protect against synchronous UDP drops */
+	nl->flags &= ~NL_F_UDP_DROP;	/* Clear condition */
+
+	for (i = 0; i < n && sent < count; i++) {
+		knode_t *kn = cand[i].kn;
+
+		lookup_send(nl, kn);
+		if (nl->flags & NL_F_UDP_DROP)
+			break;				/* Synchronous UDP drop detected */
+		sent++;
+		to_remove = pslist_prepend(to_remove, kn);
+	}
+
+	nl->flags &= ~NL_F_SENDING;
+
+	/*
+	 * Remove the nodes to whom we sent a message, or which we want to ignore.
+	 */
+
+	g_assert(0 == sent || to_remove != NULL);
+
+	PSLIST_FOREACH(to_remove, sl) {
+		knode_t *kn = sl->data;
+		lookup_shortlist_remove(nl, kn);
+	}
+	pslist_free(to_remove);
+
+	/*
+	 * Now explicitly free ignored hosts: because removal from the shortlist
+	 * will use knode_refcnt_dec(), which expects nodes to still be alive
+	 * after being removed (since they are moved to nl->queried usually),
+	 * all the ignored hosts were put into a list with their ref count
+	 * increased.
+	 */
+
+	PSLIST_FOREACH(ignored, sl) {
+		knode_t *kn = sl->data;
+		lookup_reset_closest(nl, kn);	/* In case kn was the closest node */
+		knode_free(kn);
+	}
+	pslist_free(ignored);
+
+	return sent;
+}
+
+/**
+ * Callout queue callback fired when RPCs from the latest hop are late.
+ *
+ * The RPCs still pending past the p90 RTT are stragglers: rather than
+ * waiting for them to come back or time out, we hedge by querying the
+ * next best candidates from the shortlist.
+ */
+static void
+lookup_hedge_expired(cqueue_t *cq, void *obj)
+{
+	nlookup_t *nl = obj;
+	int count, sent;
+
+	if (G_UNLIKELY(NULL == nlookups))
+		return;			/* Shutdown occurred */
+
+	lookup_check(nl);
+
+	cq_zero(cq, &nl->hedge_ev);
+
+	if (!dht_enabled() || lookup_is_fetching(nl))
+		return;
+
+	if (nl->flags & (NL_F_COMPLETED | NL_F_DELAYED | NL_F_HEDGED))
+		return;
+
+	if (0 == nl->rpc_latest_pending)
+		return;
+
+	count = MIN(nl->rpc_latest_pending, NL_HEDGE_MAX);
+
+	if (GNET_PROPERTY(dht_lookup_debug) > 1) {
+		g_debug("DHT LOOKUP[%s] hop %u has %d straggler%s past %u ms, "
+			"hedging with %d more RPC%s",
+			nid_to_string(&nl->lid), nl->hops,
+			PLURAL(nl->rpc_latest_pending), lookup_rtt.p90, PLURAL(count));
+	}
+
+	nl->flags |= NL_F_HEDGED;
+	sent = lookup_send_closest(nl, count);
+	nl->rpc_hedged += sent;
+}
+
+/**
+ * Install the straggler hedging timer for the latest hop, once we have
+ * enough RTT samples to know what a late reply is.
+ */
+static void
+lookup_hedge_install(nlookup_t *nl)
+{
+	lookup_check(nl);
+
+	cq_cancel(&nl->hedge_ev);
+	lookup_rtt_update();
+
+	if (lookup_rtt.count < NL_RTT_MIN_SAMPLES)
+		return;
+
+	nl->hedge_ev = cq_main_insert(MAX(lookup_rtt.p90, NL_HEDGE_MIN),
+		lookup_hedge_expired, nl);
+}
+
+/**
+ * Iterate the lookup, once we have determined we must send more probes.
+ */
+static void
+lookup_iterate(nlookup_t *nl)
+{
+	int i;
+	int alpha;
+
 	lookup_check(nl);
 
 	if (!dht_enabled()) {
@@ -4027,6 +4415,12 @@ lookup_iterate(nlookup_t *nl)
 		return;
 	}
 
+	/*
+	 * Adapt parallelism to the observed reply ratio.
+	 */
+
+	alpha = nl->alpha = lookup_alpha(nl);
+
 	/*
 	 * Enforce bounded parallelism here.
 	 */
@@ -4046,6 +4440,7 @@ lookup_iterate(nlookup_t *nl)
 	nl->hops++;
 	nl->rpc_latest_pending = 0;
 	nl->prev_closest = nl->closest;
+	nl->flags &= ~NL_F_HEDGED;
 
 	if (GNET_PROPERTY(dht_lookup_debug) > 2)
 		g_debug("DHT LOOKUP[%s] iterating to hop %u "
@@ -4064,71 +4459,11 @@ lookup_iterate(nlookup_t *nl)
 	}
 
 	/*
-	 * Select the alpha closest nodes from the shortlist and send them
+	 * Select the alpha best nodes from the shortlist and send them
 	 * the proper message (either FIND_NODE or FIND_VALUE).
 	 */
 
-	reason_len = GNET_PROPERTY(dht_lookup_debug) ? sizeof reason : 0;
-	iter = patricia_metric_iterator_lazy(nl->shortlist, nl->kuid, TRUE);
-
-	nl->flags |= NL_F_SENDING;		/* Protect against synchronous UDP drops */
-	nl->flags &= ~NL_F_UDP_DROP;	/* Clear condition */
-
-	while (i < alpha && patricia_iter_has_next(iter)) {
-		knode_t *kn = patricia_iter_next_value(iter);
-
-		if (!knode_can_recontact(kn))
-			continue;
-
-		/*
-		 * Skip unsafe hosts.
-		 */
-
-		if (!lookup_node_is_safe(nl, kn, reason, reason_len)) {
-			if (GNET_PROPERTY(dht_lookup_debug)) {
-				g_debug("DHT LOOKUP[%s] ignoring %s: %s",
-					nid_to_string(&nl->lid), knode_to_string(kn), reason);
-			}
-			ignored = pslist_prepend(ignored, knode_refcnt_inc(kn));
-		} else if (!map_contains(nl->queried, kn->id)) {
-			lookup_send(nl, kn);
-			if (nl->flags & NL_F_UDP_DROP)
-				break;				/* Synchronous UDP drop detected */
-			i++;
-		}
-
-		to_remove = pslist_prepend(to_remove, kn);
-	}
-
-	nl->flags &= ~NL_F_SENDING;
-	patricia_iterator_release(&iter);
-
-	/*
-	 * Remove the nodes to whom we sent a message, or which we want to ignore.
-	 */
-
-	g_assert(0 == i || to_remove != NULL);
-
-	PSLIST_FOREACH(to_remove, sl) {
-		knode_t *kn = sl->data;
-		lookup_shortlist_remove(nl, kn);
-	}
-	pslist_free(to_remove);
-
-	/*
-	 * Now explicitly free ignored hosts: because removal from the shortlist
-	 * will use knode_refcnt_dec(), which expects nodes to still be alive
-	 * after being removed (since they are moved to nl->queried usually),
-	 * all the ignored hosts were put into a list with their ref count
-	 * increased.
-	 */
-
-	PSLIST_FOREACH(ignored, sl) {
-		knode_t *kn = sl->data;
-		lookup_reset_closest(nl, kn);	/* In case kn was the closest node */
-		knode_free(kn);
-	}
-	pslist_free(ignored);
+	i = lookup_send_closest(nl, alpha);
 
 	/*
 	 * If we detected an UDP message dropping and did not send any
@@ -4161,7 +4496,10 @@ lookup_iterate(nlookup_t *nl)
 				nid_to_string(&nl->lid));
 
 		lookup_completed(nl);
+		return;
 	}
+
+	lookup_hedge_install(nl);
 }
 
 /**
@@ -4254,6 +4592,7 @@ lookup_create(const kuid_t *kuid, lookup_type_t type,
 	nl->queried = map_create_patricia(KUID_RAW_BITSIZE);
 	nl->unsafe = map_create_patricia(KUID_RAW_BITSIZE);
 	nl->pending = map_create_patricia(KUID_RAW_BITSIZE);
+	nl->sent = map_create_patricia(KUID_RAW_BITSIZE);
 	nl->alternate = map_create_patricia(KUID_RAW_BITSIZE);
 	nl->fixed = map_create_patricia(KUID_RAW_BITSIZE);
 	nl->tokens = map_create_patricia(KUID_RAW_BITSIZE);
@@ -4264,6 +4603,7 @@ lookup_create(const kuid_t *kuid, lookup_type_t type,
 	nl->arg = arg;
 	nl->expire_ev = cq_main_insert(NL_MAX_LIFETIME, lookup_expired, nl);
 	nl->max_common_bits = KDA_C + dht_get_kball_furthest();
+	nl->alpha = KDA_ALPHA;
 	tm_now_exact(&nl->start);
 
 	htable_insert(nlookups, &nl->lid, nl);
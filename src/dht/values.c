@@ -80,6 +80,7 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/bstr.h"
+#include "lib/cbloom.h"
 #include "lib/cq.h"
 #include "lib/crash.h"
 #include "lib/cstr.h"
@@ -122,11 +123,12 @@
 #define MIN_VALUES_NET	16		/**< Min # of values allowed per class C net */
 #define VALUES_KBALL	10		/**< Theoretical k-ball for max thresholds */
 
-#define MAX_VALUES		262144	/**< Max # of values we accept to manage */
+#define MAX_VALUES		VALUES_MAX_MANAGED	/**< Shortcut for this file */
 #define EXPIRE_PERIOD	30		/**< Asynchronous expire period: 30 secs */
 
 #define VALUES_DB_CACHE_SIZE 1024	/**< Amount of values to keep cached */
 #define RAW_DB_CACHE_SIZE	 512	/**< Amount of raw data to keep cached */
+#define EXPIRED_FILTER_FP	0.01	/**< False positive rate of expired filter */
 
 /**
  * Information about a value that is stored to disk and not kept in memory.
@@ -217,6 +219,14 @@ static dbmw_t *db_expired;
 static char db_expbase[] = "dht_expired";
 static char db_expwhat[] = "DHT expired values";
 
+/**
+ * Counting Bloom filter fronting the expired tuples database, so that we
+ * can tell we never expired a tuple without touching the disk.
+ *
+ * The database is created empty at each startup, hence so is the filter.
+ */
+static cbloom_t *expired_filter;
+
 static cperiodic_t *values_expire_ev;	/**< Value expire periodic event */
 
 /**
@@ -878,6 +888,10 @@ kuid_pair_was_expired(const kuid_t *key, const kuid_t *skey)
 		return FALSE;
 
 	kuid_pair_fill(ARYLEN(buf), key, skey);
+
+	if (!cbloom_contains(expired_filter, ARYLEN(buf)))
+		return FALSE;
+
 	return dbmw_exists(db_expired, buf);
 }
 
@@ -910,6 +924,7 @@ kuid_pair_has_expired(const kuid_t *key, const kuid_t *skey)
 
 	kuid_pair_fill(ARYLEN(buf), key, skey);
 	dbmw_write(db_expired, buf, NULL, 0);
+	cbloom_add(expired_filter, ARYLEN(buf));
 }
 
 /**
@@ -931,7 +946,19 @@ kuid_pair_was_republished(const kuid_t *key, const kuid_t *skey)
 		return;
 
 	kuid_pair_fill(ARYLEN(buf), key, skey);
-	dbmw_delete(db_expired, buf);
+
+	/*
+	 * We can only remove from the filter what was actually inserted,
+	 * hence the check against the database when the filter is positive.
+	 */
+
+	if (
+		cbloom_contains(expired_filter, ARYLEN(buf)) &&
+		dbmw_exists(db_expired, buf)
+	) {
+		dbmw_delete(db_expired, buf);
+		cbloom_remove(expired_filter, ARYLEN(buf));
+	}
 }
 
 /**
@@ -2169,6 +2196,9 @@ values_init(void)
 		expired_kv, no_packing, 0, kuid_pair_hash, kuid_pair_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
 
+	if (DBMAP_MAP != dbmw_map_type(db_expired))
+		expired_filter = cbloom_make(MAX_VALUES, EXPIRED_FILTER_FP);
+
 	values_per_ip = acct_net_create();
 	values_per_class_c = acct_net_create();
 	expired = hset_create_any(uint64_hash, NULL, uint64_eq);
@@ -2263,6 +2293,7 @@ values_close(void)
 	dbstore_close(db_rawdata, settings_dht_db_dir(), db_rawbase);
 	dbstore_delete(db_expired);
 	db_valuedata = db_rawdata = db_expired = NULL;
+	cbloom_free_null(&expired_filter);
 	acct_net_free_null(&values_per_ip);
 	acct_net_free_null(&values_per_class_c);
 	cq_periodic_remove(&values_expire_ev);
@@ -40,6 +40,8 @@
 #include "lib/bstr.h"
 #include "lib/pmsg.h"
 
+#define VALUES_MAX_MANAGED	262144	/**< Max # of values we accept to manage */
+
 /*
  * Public interface.
  */
@@ -25,6 +25,7 @@
 #ifndef _if_core_downloads_h_
 #define _if_core_downloads_h_
 
+#include "lib/erbtree.h"
 #include "lib/event.h"			/* For frequency_t */
 #include "lib/hashlist.h"
 #include "lib/htable.h"
@@ -104,7 +105,10 @@ struct dl_server {
 	uint speed_avg;			/**< Average (EMA) upload speed, in bytes/sec */
 	unsigned latency;		/**< HTTP latency, in ms (EMA) */
 	uint32 attrs;
+	uint32 pickup;			/**< Last pickup pass having visited server */
+	rbnode_t ready_node;	/**< Embedding in tree of servers with waiting list */
 	uint16 country;			/**< Country of origin -- encoded ISO3166 */
+	bool ready;				/**< Whether server is in the ready tree */
 };
 
 static inline bool
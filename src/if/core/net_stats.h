@@ -56,6 +56,38 @@ typedef struct gnet_stat {
 	uint64 general[GNR_TYPE_COUNT];
 } gnet_stats_t;
 
+/*
+ * Message processing latency histograms.
+ *
+ * Durations are kept in nanoseconds with a logarithmic resolution: each
+ * power of 2 is split into GNET_LATENCY_SUB linear sub-buckets, so that
+ * the relative error on the reported percentiles stays below 25%.
+ */
+
+#define GNET_LATENCY_SUB_BITS	2
+#define GNET_LATENCY_SUB		(1 << GNET_LATENCY_SUB_BITS)
+#define GNET_LATENCY_MAX_BITS	36		/**< Up to 2^36 ns, about 68 s */
+#define GNET_LATENCY_BUCKETS	\
+	((GNET_LATENCY_MAX_BITS - GNET_LATENCY_SUB_BITS + 1) * GNET_LATENCY_SUB)
+
+#define GNET_LATENCY_VMSG_MAX	64	/**< Max amount of vendor messages */
+
+typedef struct gnet_latency {
+	uint64 count;					/**< Amount of messages processed */
+	uint64 total;					/**< Total processing time, in ns */
+	uint64 max;						/**< Largest processing time, in ns */
+	uint64 bucket[GNET_LATENCY_BUCKETS];
+} gnet_latency_t;
+
+typedef struct gnet_latency_stats {
+	gnet_latency_t msg[MSG_TYPE_COUNT];		/**< By message type */
+	struct {
+		const char *name;					/**< Vendor message name */
+		gnet_latency_t lat;
+	} vmsg[GNET_LATENCY_VMSG_MAX];			/**< By vendor message */
+	uint vmsg_count;						/**< Amount of vmsg[] used */
+} gnet_latency_stats_t;
+
 typedef enum {
 	BW_GNET_IN,
 	BW_GNET_OUT,
@@ -87,6 +119,9 @@ void gnet_stats_tcp_get(gnet_stats_t *stats);
 void gnet_stats_udp_get(gnet_stats_t *stats);
 void gnet_get_bw_stats(gnet_bw_source type, gnet_bw_stats_t *stats);
 
+void gnet_stats_latency_get(gnet_latency_stats_t *stats);
+uint64 gnet_latency_percentile(const gnet_latency_t *lat, uint pct);
+
 #endif /* CORE_SOURCES */
 
 #endif /* _if_core_net_stats_h_ */
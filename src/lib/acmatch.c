@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Aho-Corasick multi-pattern string matcher.
+ *
+ * All the patterns are stored in a trie whose states are augmented with
+ * a failure link pointing to the state representing the longest proper
+ * suffix of the current state that is also a prefix of some pattern.
+ * The text is then scanned once, whatever the amount of patterns, and
+ * each time we reach a state where patterns end, the values associated
+ * with these patterns are reported.
+ *
+ * Patterns are first all added with acmatch_add(), then the automaton is
+ * built by acmatch_compile() and can be used with acmatch_search().  No
+ * pattern can be added after compilation.
+ *
+ * Transitions are stored as sorted arrays of edges, searched by dichotomy,
+ * except for the root state which has a direct lookup table since this is
+ * where the search spends most of its time on non-matching text.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "acmatch.h"
+
+#include "ascii.h"
+#include "halloc.h"
+#include "unsigned.h"
+#include "vsort.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define ACMATCH_ROOT	0		/**< Index of the root state */
+#define ACMATCH_NONE	0		/**< No edge / output (root is never a target) */
+
+enum acmatch_magic { ACMATCH_MAGIC = 0x4c3a9e15 };
+
+/**
+ * A state of the automaton.
+ */
+struct acmatch_state {
+	uint32 edges;				/**< First edge (list head when building) */
+	uint32 fail;				/**< Failure link */
+	uint32 out;					/**< First output + 1, ACMATCH_NONE if none */
+	uint32 dict;				/**< Next state with outputs on fail chain */
+	uint16 nedges;				/**< Amount of edges, once compiled */
+};
+
+/**
+ * A transition between two states.
+ */
+struct acmatch_edge {
+	uint32 target;				/**< Target state */
+	uint32 next;				/**< Next edge + 1 in list, when building */
+	uint8 c;					/**< Transition byte */
+};
+
+/**
+ * An output, i.e. a pattern ending at a given state.
+ */
+struct acmatch_output {
+	void *value;				/**< User value for the pattern */
+	uint32 next;				/**< Next output + 1 for the state */
+};
+
+/**
+ * The Aho-Corasick automaton.
+ */
+struct acmatch {
+	enum acmatch_magic magic;
+	struct acmatch_state *state;	/**< States, root first */
+	struct acmatch_edge *edge;		/**< Edges */
+	struct acmatch_output *output;	/**< Outputs */
+	uint32 *root;					/**< Root transitions, once compiled */
+	size_t states, states_max;		/**< Used and allocated states */
+	size_t edges, edges_max;		/**< Used and allocated edges */
+	size_t outputs, outputs_max;	/**< Used and allocated outputs */
+	unsigned icase:1;				/**< Whether matching ignores ASCII case */
+	unsigned compiled:1;			/**< Whether automaton was compiled */
+};
+
+static inline void
+acmatch_check(const struct acmatch * const am)
+{
+	g_assert(am != NULL);
+	g_assert(ACMATCH_MAGIC == am->magic);
+}
+
+/**
+ * Allocate a new state.
+ *
+ * @return the index of the new state.
+ */
+static uint32
+acmatch_new_state(acmatch_t *am)
+{
+	if (am->states == am->states_max) {
+		am->states_max = MAX(16, am->states_max * 2);
+		HREALLOC_ARRAY(am->state, am->states_max);
+	}
+
+	ZERO(&am->state[am->states]);
+	return am->states++;
+}
+
+/**
+ * Create a new Aho-Corasick automaton.
+ *
+ * @param icase		whether matching should ignore ASCII case
+ *
+ * @return a new automaton, to be freed with acmatch_free_null().
+ */
+acmatch_t *
+acmatch_make(bool icase)
+{
+	acmatch_t *am;
+
+	WALLOC0(am);
+	am->magic = ACMATCH_MAGIC;
+	am->icase = booleanize(icase);
+
+	(void) acmatch_new_state(am);		/* The root */
+
+	return am;
+}
+
+/**
+ * Free automaton and nullify its pointer.
+ */
+void
+acmatch_free_null(acmatch_t **am_ptr)
+{
+	acmatch_t *am = *am_ptr;
+
+	if (am != NULL) {
+		acmatch_check(am);
+		HFREE_NULL(am->state);
+		HFREE_NULL(am->edge);
+		HFREE_NULL(am->output);
+		HFREE_NULL(am->root);
+		am->magic = 0;
+		WFREE(am);
+		*am_ptr = NULL;
+	}
+}
+
+/**
+ * Lookup transition from a state whilst building the automaton.
+ *
+ * @return the target state, ACMATCH_NONE if there is no such transition.
+ */
+static uint32
+acmatch_build_goto(const acmatch_t *am, uint32 s, uint8 c)
+{
+	uint32 e;
+
+	for (e = am->state[s].edges; e != ACMATCH_NONE; e = am->edge[e - 1].next) {
+		const struct acmatch_edge *ae = &am->edge[e - 1];
+		if (ae->c == c)
+			return ae->target;
+	}
+
+	return ACMATCH_NONE;
+}
+
+/**
+ * Add a pattern to the automaton.
+ *
+ * The same pattern can be added several times with different values, in
+ * which case all the values will be reported on a match.
+ *
+ * @param am		the automaton (not compiled yet)
+ * @param pattern	the pattern bytes
+ * @param len		the length of the pattern, non-zero
+ * @param value		the value to report when the pattern matches
+ */
+void
+acmatch_add(acmatch_t *am, const void *pattern, size_t len, void *value)
+{
+	const uint8 *p = pattern;
+	uint32 s = ACMATCH_ROOT;
+	size_t i;
+
+	acmatch_check(am);
+	g_assert(!am->compiled);
+	g_assert(pattern != NULL);
+	g_assert(size_is_positive(len));
+
+	for (i = 0; i < len; i++) {
+		uint8 c = am->icase ? ascii_tolower(p[i]) : p[i];
+		uint32 t = acmatch_build_goto(am, s, c);
+
+		if (ACMATCH_NONE == t) {
+			struct acmatch_edge *ae;
+
+			t = acmatch_new_state(am);
+
+			if (am->edges == am->edges_max) {
+				am->edges_max = MAX(16, am->edges_max * 2);
+				HREALLOC_ARRAY(am->edge, am->edges_max);
+			}
+
+			ae = &am->edge[am->edges++];
+			ae->target = t;
+			ae->c = c;
+			ae->next = am->state[s].edges;
+			am->state[s].edges = am->edges;		/* Index + 1 */
+		}
+
+		s = t;
+	}
+
+	if (am->outputs == am->outputs_max) {
+		am->outputs_max = MAX(16, am->outputs_max * 2);
+		HREALLOC_ARRAY(am->output, am->outputs_max);
+	}
+
+	am->output[am->outputs].value = value;
+	am->output[am->outputs].next = am->state[s].out;
+	am->state[s].out = ++am->outputs;		/* Index + 1 */
+}
+
+/**
+ * Edge comparison, by transition byte.
+ */
+static int
+acmatch_edge_cmp(const void *a, const void *b)
+{
+	const struct acmatch_edge *ea = a, *eb = b;
+
+	return CMP(ea->c, eb->c);
+}
+
+/**
+ * Compile the automaton: compute failure links and flatten transitions.
+ *
+ * This must be called once all the patterns have been added, before
+ * searching.
+ */
+void
+acmatch_compile(acmatch_t *am)
+{
+	uint32 *queue;
+	struct acmatch_edge *edge;
+	size_t head = 0, tail = 0, n = 0, i;
+
+	acmatch_check(am);
+	g_assert(!am->compiled);
+
+	/*
+	 * Breadth-first traversal of the trie, computing the failure links.
+	 * Since failure links always point to shallower states, they are
+	 * known by the time we need them.
+	 */
+
+	HALLOC_ARRAY(queue, am->states);
+	queue[tail++] = ACMATCH_ROOT;
+
+	while (head < tail) {
+		uint32 s = queue[head++];
+		uint32 e;
+
+		for (e = am->state[s].edges; e != ACMATCH_NONE;) {
+			const struct acmatch_edge *ae = &am->edge[e - 1];
+			struct acmatch_state *st = &am->state[ae->target];
+			uint32 f;
+
+			if (ACMATCH_ROOT == s) {
+				f = ACMATCH_ROOT;
+			} else {
+				uint32 r = am->state[s].fail;
+
+				for (;;) {
+					f = acmatch_build_goto(am, r, ae->c);
+					if (f != ACMATCH_NONE || ACMATCH_ROOT == r)
+						break;
+					r = am->state[r].fail;
+				}
+			}
+
+			st->fail = f;
+			st->dict = am->state[f].out != ACMATCH_NONE ?
+				f : am->state[f].dict;
+
+			g_assert(tail < am->states);
+			queue[tail++] = ae->target;
+			e = ae->next;
+		}
+	}
+
+	g_assert(tail == am->states);
+	HFREE_NULL(queue);
+
+	/*
+	 * Flatten the transitions: edges of each state become contiguous
+	 * and sorted by byte, for dichotomic lookup.
+	 */
+
+	HALLOC_ARRAY(edge, MAX(1, am->edges));
+
+	for (i = 0; i < am->states; i++) {
+		struct acmatch_state *st = &am->state[i];
+		size_t start = n;
+		uint32 e;
+
+		for (e = st->edges; e != ACMATCH_NONE; e = am->edge[e - 1].next) {
+			g_assert(n < am->edges);
+			edge[n++] = am->edge[e - 1];
+		}
+
+		st->edges = start;
+		st->nedges = n - start;
+
+		vsort(&edge[start], st->nedges, sizeof edge[0], acmatch_edge_cmp);
+	}
+
+	HFREE_NULL(am->edge);
+	am->edge = edge;
+
+	/*
+	 * Direct lookup table for the root state.
+	 */
+
+	HALLOC0_ARRAY(am->root, 256);
+
+	for (i = 0; i < am->state[ACMATCH_ROOT].nedges; i++) {
+		const struct acmatch_edge *ae = &edge[i];
+		am->root[ae->c] = ae->target;
+	}
+
+	am->compiled = TRUE;
+}
+
+/**
+ * Lookup transition from a state in the compiled automaton.
+ *
+ * @return the target state, ACMATCH_NONE if there is no such transition.
+ */
+static inline uint32
+acmatch_goto(const acmatch_t *am, uint32 s, uint8 c)
+{
+	const struct acmatch_state *st = &am->state[s];
+	const struct acmatch_edge *e = &am->edge[st->edges];
+	size_t lo = 0, hi = st->nedges;
+
+	if (ACMATCH_ROOT == s)
+		return am->root[c];
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (e[mid].c == c)
+			return e[mid].target;
+		else if (e[mid].c < c)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return ACMATCH_NONE;
+}
+
+/**
+ * Report all the outputs of a state.
+ *
+ * @return TRUE if the callback requested that we stop.
+ */
+static bool
+acmatch_report(const acmatch_t *am, uint32 s, size_t end,
+	acmatch_cb_t cb, void *data)
+{
+	uint32 o;
+
+	for (o = am->state[s].out; o != ACMATCH_NONE; o = am->output[o - 1].next) {
+		if ((*cb)(am->output[o - 1].value, end, data))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Search text for all the patterns in a single pass.
+ *
+ * The callback is invoked for each pattern occurrence, in the order of
+ * their ending position in the text.
+ *
+ * @param am		the compiled automaton
+ * @param text		the text to scan
+ * @param len		length of the text
+ * @param cb		the callback to invoke on each match
+ * @param data		user-supplied data for the callback
+ *
+ * @return TRUE if the callback stopped the search, FALSE otherwise.
+ */
+bool
+acmatch_search(const acmatch_t *am, const void *text, size_t len,
+	acmatch_cb_t cb, void *data)
+{
+	const uint8 *p = text;
+	uint32 s = ACMATCH_ROOT;
+	size_t i;
+
+	acmatch_check(am);
+	g_assert(am->compiled);
+	g_assert(text != NULL || 0 == len);
+	g_assert(cb != NULL);
+
+	if G_UNLIKELY(0 == am->outputs)
+		return FALSE;
+
+	for (i = 0; i < len; i++) {
+		uint8 c = am->icase ? ascii_tolower(p[i]) : p[i];
+		uint32 t, d;
+
+		while (ACMATCH_NONE == (t = acmatch_goto(am, s, c))) {
+			if (ACMATCH_ROOT == s)
+				break;
+			s = am->state[s].fail;
+		}
+
+		s = t;		/* Back to the root if there was no transition */
+
+		if (am->state[s].out != ACMATCH_NONE) {
+			if (acmatch_report(am, s, i + 1, cb, data))
+				return TRUE;
+		}
+
+		for (d = am->state[s].dict; d != ACMATCH_ROOT; d = am->state[d].dict) {
+			if (acmatch_report(am, d, i + 1, cb, data))
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * @return the amount of patterns held in the automaton.
+ */
+size_t
+acmatch_count(const acmatch_t *am)
+{
+	acmatch_check(am);
+
+	return am->outputs;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Aho-Corasick multi-pattern string matcher.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _acmatch_h_
+#define _acmatch_h_
+
+typedef struct acmatch acmatch_t;
+
+/**
+ * Match callback.
+ *
+ * @param value		the value associated with the matching pattern
+ * @param end		offset in the text of the first byte after the match
+ * @param data		user-supplied data
+ *
+ * @return TRUE to stop the search, FALSE to continue with the next match.
+ */
+typedef bool (*acmatch_cb_t)(void *value, size_t end, void *data);
+
+/*
+ * Public interface.
+ */
+
+acmatch_t *acmatch_make(bool icase);
+void acmatch_free_null(acmatch_t **am_ptr);
+
+void acmatch_add(acmatch_t *am, const void *pattern, size_t len, void *value);
+void acmatch_compile(acmatch_t *am);
+bool acmatch_search(const acmatch_t *am, const void *text, size_t len,
+	acmatch_cb_t cb, void *data);
+size_t acmatch_count(const acmatch_t *am);
+
+#endif /* _acmatch_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -587,6 +587,7 @@ struct adns_helper_args {
 };
 
 #define ADNS_HELPER_STACK	THREAD_STACK_MIN
+#define ADNS_QUEUE_SIZE		64		/* Ring size of request / answer queues */
 
 /**
  * The ``main'' function of the adns helper thread (server).
@@ -764,8 +765,8 @@ adns_helper_init(void)
 	 */
 
 	waiter = waiter_make(NULL);
-	adns_req = aq_make();
-	adns_ans = aq_make();
+	adns_req = aq_make_ring(ADNS_QUEUE_SIZE, FALSE);
+	adns_ans = aq_make_ring(ADNS_QUEUE_SIZE, FALSE);
 	aq_waiter_add(adns_ans, waiter);
 	adns_reply_event_id = inputevt_add(waiter_fd(waiter), INPUT_EVENT_RX,
 			adns_reply_callback, waiter);
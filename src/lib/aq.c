@@ -90,6 +90,15 @@
  * the I/O callback.  If no further reference exists, it will be reclaimed when
  * the queue is destroyed.
  *
+ * Queues created with aq_make_ring() are backed by a bounded lock-free ring
+ * buffer, allowing concurrent producers and consumers to exchange data
+ * without taking the queue lock nor allocating memory.  The lock is only
+ * used to block consumers when the ring is empty, and to hold items put
+ * whilst the ring is full, so that writing to the queue still never blocks.
+ * Messages from a given producer are still read in the order they were
+ * enqueued but there is no ordering between items coming from different
+ * producers, as with the list-based queue.
+ *
  * @author Raphael Manfredi
  * @date 2013
  */
@@ -100,19 +109,42 @@
 #include "atomic.h"
 #include "cond.h"
 #include "eslist.h"
+#include "getcpucount.h"
+#include "halloc.h"
 #include "log.h"
 #include "mutex.h"
+#include "pow2.h"
 #include "stringify.h"
 #include "tm.h"
+#include "unsigned.h"
 #include "waiter.h"
 #include "walloc.h"
 
 #include "override.h"			/* Must be the last header included */
 
+#define AQ_RING_MAX		(1U << 30)	/* Maximum ring capacity */
+#define AQ_SPIN_LOOPS	128			/* Ring reads attempted before blocking */
+#define AQ_LINE_SIZE	64			/* Assumed size of a CPU cache line */
+
 enum async_queue_magic { ASYNC_QUEUE_MAGIC = 0x51647584 };
 
+/**
+ * A cell of the lock-free ring.
+ */
+struct aq_cell {
+	uint seq;						/* Sequence number of the cell */
+	void *data;						/* Data being exchanged */
+};
+
 /**
  * An asynchronous queue.
+ *
+ * The lock-free ring follows Dmitry Vyukov's bounded MPMC queue: each cell
+ * carries a sequence number telling whether it is ready to be written at
+ * position "pos" (seq == pos) or ready to be read at position "pos"
+ * (seq == pos + 1).  Producers and consumers claim a position by atomically
+ * bumping their own index, so they do not contend with each other unless
+ * the ring is full or empty.  The two indices lie in distinct cache lines.
  */
 struct async_queue {
 	enum async_queue_magic magic;	/* Magic number */
@@ -120,6 +152,17 @@ struct async_queue {
 	eslist_t queue;					/* The list implementing the queue */
 	mutex_t lock;					/* Thread-safe lock */
 	cond_t event;					/* To wait/signal events on queue */
+	struct aq_cell *ring;			/* Lock-free ring, NULL if none */
+	uint mask;						/* Ring capacity - 1 */
+	uint spin;						/* Ring reads attempted before blocking */
+	int queued;						/* Items in the list (ring overflow) */
+	int sleeping;					/* Consumers blocked on the condition */
+	bool waited;					/* Whether waiters were added */
+	char pad1[AQ_LINE_SIZE];
+	uint tail;						/* Next ring position to write */
+	char pad2[AQ_LINE_SIZE - sizeof(uint)];
+	uint head;						/* Next ring position to read */
+	char pad3[AQ_LINE_SIZE - sizeof(uint)];
 };
 
 static inline void
@@ -173,6 +216,148 @@ aq_make_full(bool signals)
 	return aq;
 }
 
+/**
+ * Create a new asynchronous queue backed by a lock-free ring.
+ *
+ * The ring can hold up to "capacity" items (rounded up to the next power
+ * of 2) before additional items spill over to a locked list.
+ *
+ * When atomic operations are not available, this creates a plain queue.
+ *
+ * @param capacity		the ring capacity
+ * @param signals		whether to process signals whilst waiting
+ */
+aqueue_t *
+aq_make_ring(size_t capacity, bool signals)
+{
+	aqueue_t *aq;
+	uint i, n;
+
+	g_assert(size_is_positive(capacity));
+	g_assert(capacity <= AQ_RING_MAX);
+
+	aq = aq_make_full(signals);
+
+	if (!atomic_ops_available())
+		return aq;
+
+	n = next_pow2(MAX(capacity, 2));
+	HALLOC_ARRAY(aq->ring, n);
+	aq->mask = n - 1;
+	aq->spin = getcpucount() > 1 ? AQ_SPIN_LOOPS : 0;
+
+	for (i = 0; i < n; i++) {
+		aq->ring[i].seq = i;
+		aq->ring[i].data = NULL;
+	}
+
+	atomic_mb();
+	return aq;
+}
+
+/**
+ * Attempt to write data in the ring.
+ *
+ * @return TRUE if data was written, FALSE if the ring was full.
+ */
+static bool
+aq_ring_put(aqueue_t *aq, void *data)
+{
+	struct aq_cell *cell;
+	uint pos = atomic_uint_get(&aq->tail);
+
+	for (;;) {
+		int d;
+
+		cell = &aq->ring[pos & aq->mask];
+		d = (int) (atomic_uint_get(&cell->seq) - pos);
+
+		if (0 == d) {
+			if (atomic_uint_xchg_if_eq(&aq->tail, pos, pos + 1))
+				break;
+			pos = atomic_uint_get(&aq->tail);
+		} else if (d < 0) {
+			return FALSE;		/* Ring is full */
+		} else {
+			pos = atomic_uint_get(&aq->tail);
+		}
+	}
+
+	cell->data = data;
+	atomic_uint_set(&cell->seq, pos + 1);	/* Publish data to readers */
+
+	return TRUE;
+}
+
+/**
+ * Attempt to read data from the ring.
+ *
+ * @return TRUE if data was read and written in "data", FALSE if ring empty.
+ */
+static bool
+aq_ring_get(aqueue_t *aq, void **data)
+{
+	struct aq_cell *cell;
+	uint pos = atomic_uint_get(&aq->head);
+
+	for (;;) {
+		int d;
+
+		cell = &aq->ring[pos & aq->mask];
+		d = (int) (atomic_uint_get(&cell->seq) - (pos + 1));
+
+		if (0 == d) {
+			if (atomic_uint_xchg_if_eq(&aq->head, pos, pos + 1))
+				break;
+			pos = atomic_uint_get(&aq->head);
+		} else if (d < 0) {
+			return FALSE;		/* Ring is empty */
+		} else {
+			pos = atomic_uint_get(&aq->head);
+		}
+	}
+
+	*data = cell->data;
+	atomic_uint_set(&cell->seq, pos + aq->mask + 1);	/* Free cell */
+
+	return TRUE;
+}
+
+/**
+ * Approximate amount of items held in the ring.
+ */
+static inline uint
+aq_ring_count(const aqueue_t *aq)
+{
+	int d;
+
+	if (NULL == aq->ring)
+		return 0;
+
+	d = (int) (atomic_uint_get(&aq->tail) - atomic_uint_get(&aq->head));
+	return MAX(0, d);
+}
+
+/**
+ * Wake up a blocked consumer or notify waiters after data was written
+ * to the ring.
+ *
+ * Consumers increase the "sleeping" count before checking the ring a last
+ * time under the lock: since we check that count after publishing our data,
+ * either they see the data or we see them and signal the condition.
+ */
+static void
+aq_ring_notify(aqueue_t *aq)
+{
+	atomic_mb();
+
+	if (0 != atomic_int_get(&aq->sleeping) || atomic_bool_get(&aq->waited)) {
+		mutex_lock(&aq->lock);
+		cond_signal(&aq->event, &aq->lock);
+		mutex_unlock(&aq->lock);
+	}
+}
+
 /**
  * Add a waiter object to the queue.
  *
@@ -184,6 +369,7 @@ aq_waiter_add(aqueue_t *aq, waiter_t *w)
 {
 	aq_check(aq);
 
+	atomic_bool_set(&aq->waited, TRUE);
 	cond_waiter_add(&aq->event, w);
 }
 
@@ -215,16 +401,20 @@ aq_free_item(void *item, void *unused_data)
 static void
 aq_free(aqueue_t *aq)
 {
+	size_t count;
+
 	aq_check(aq);
 	g_assert(0 == aq->refcnt);
 
-	if G_UNLIKELY(0 != eslist_count(&aq->queue)) {
-		size_t count = eslist_count(&aq->queue);
+	count = eslist_count(&aq->queue) + aq_ring_count(aq);
+
+	if G_UNLIKELY(0 != count) {
 		s_carp("%s() freeing asynchronous queue still holding %zu item%s",
 			G_STRFUNC, PLURAL(count));
 	}
 
 	eslist_foreach(&aq->queue, aq_free_item, NULL);
+	HFREE_NULL(aq->ring);
 	mutex_destroy(&aq->lock);
 	cond_destroy(&aq->event);
 
@@ -281,6 +471,9 @@ aq_destroy_null(aqueue_t **aq_ptr)
 
 /**
  * Explicitly lock the queue to perform several operations atomically.
+ *
+ * This only applies to the list-based queues since ring operations do not
+ * take the lock.
  */
 void
 aq_lock(aqueue_t *aq)
@@ -312,6 +505,9 @@ aq_count(const aqueue_t *aq)
 
 	aq_check(aq);
 
+	if (aq->ring != NULL)
+		return aq_ring_count(aq) + atomic_int_get(&waq->queued);
+
 	mutex_lock(&waq->lock);
 	count = eslist_count(&aq->queue);
 	mutex_unlock(&waq->lock);
@@ -319,6 +515,90 @@ aq_count(const aqueue_t *aq)
 	return count;
 }
 
+/**
+ * Shift next item from the list, with the queue locked.
+ *
+ * @return TRUE if we got an item, its data being returned in "data".
+ */
+static bool
+aq_list_shift(aqueue_t *aq, void **data)
+{
+	struct async_queue_item *aqi;
+
+	assert_mutex_is_owned(&aq->lock);
+
+	aqi = eslist_shift(&aq->queue);
+	if (NULL == aqi)
+		return FALSE;
+
+	atomic_int_dec(&aq->queued);
+	*data = aqi->data;
+	WFREE(aqi);
+
+	return TRUE;
+}
+
+/**
+ * Get next item from the queue, with the queue locked.
+ *
+ * The ring is read first since whilst items are pending in the list, all
+ * new items are appended to the list, to preserve ordering.
+ *
+ * @return TRUE if we got an item, its data being returned in "data".
+ */
+static bool
+aq_get_locked(aqueue_t *aq, void **data)
+{
+	if (aq->ring != NULL && aq_ring_get(aq, data))
+		return TRUE;
+
+	return aq_list_shift(aq, data);
+}
+
+/**
+ * Get next item from the queue, without blocking.
+ *
+ * The lock is only taken when items are pending in the list.
+ *
+ * @return TRUE if we got an item, its data being returned in "data".
+ */
+static bool
+aq_get(aqueue_t *aq, void **data)
+{
+	bool got;
+
+	if (aq->ring != NULL) {
+		if (aq_ring_get(aq, data))
+			return TRUE;
+		if (0 == atomic_int_get(&aq->queued))
+			return FALSE;
+	}
+
+	mutex_lock(&aq->lock);
+	got = aq_get_locked(aq, data);
+	mutex_unlock(&aq->lock);
+
+	return got;
+}
+
+/**
+ * Spin for a while trying to get data from the ring before blocking.
+ *
+ * @return TRUE if we got an item, its data being returned in "data".
+ */
+static bool
+aq_spin(aqueue_t *aq, void **data)
+{
+	uint i;
+
+	for (i = 0; i < aq->spin; i++) {
+		if (aq_get(aq, data))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 /**
  * Put new data in the queue.
  *
@@ -338,13 +618,28 @@ aq_put(aqueue_t *aq, void *data)
 
 	aq_check(aq);
 
+	/*
+	 * When the ring is full, items overflow to the list and the ring is
+	 * not used until the list has been emptied, so that items remain
+	 * ordered for each producer.
+	 */
+
+	if (
+		aq->ring != NULL && 0 == atomic_int_get(&aq->queued) &&
+		aq_ring_put(aq, data)
+	) {
+		aq_ring_notify(aq);
+		return aq_count(aq);
+	}
+
 	WALLOC0(aqi);
 	aqi->data = data;
 
 	mutex_lock(&aq->lock);
 
 	eslist_append(&aq->queue, aqi);
-	count = eslist_count(&aq->queue);
+	atomic_int_inc(&aq->queued);
+	count = eslist_count(&aq->queue) + aq_ring_count(aq);
 	cond_signal(&aq->event, &aq->lock);
 
 	mutex_unlock(&aq->lock);
@@ -369,7 +664,6 @@ aq_put(aqueue_t *aq, void *data)
 void *
 aq_timed_remove(aqueue_t *aq, const tm_t *timeout)
 {
-	struct async_queue_item *aqi = NULL;
 	void *data = NULL;
 	bool has_data = TRUE;
 	tm_t end;
@@ -377,23 +671,19 @@ aq_timed_remove(aqueue_t *aq, const tm_t *timeout)
 	aq_check(aq);
 	g_assert(timeout != NULL);
 
-	tm_now_exact(&end);
-	tm_add(&end, timeout);
-
-	mutex_lock(&aq->lock);
-	while (has_data && 0 == eslist_count(&aq->queue))
-		has_data = cond_wait_until_clean(&aq->event, &aq->lock, &end);
+	if (!aq_spin(aq, &data)) {
+		tm_now_exact(&end);
+		tm_add(&end, timeout);
 
-	if (has_data)
-		aqi = eslist_shift(&aq->queue);
-	mutex_unlock(&aq->lock);
+		mutex_lock(&aq->lock);
+		atomic_int_inc(&aq->sleeping);
+		while (has_data && !aq_get_locked(aq, &data))
+			has_data = cond_wait_until_clean(&aq->event, &aq->lock, &end);
+		atomic_int_dec(&aq->sleeping);
+		mutex_unlock(&aq->lock);
+	}
 
 	if (has_data) {
-		g_assert(aqi != NULL);
-
-		data = aqi->data;
-		WFREE(aqi);
-
 		if G_UNLIKELY(NULL == data) {
 			s_carp("%s(): found NULL data exchanged with non-blocking reads",
 				G_STRFUNC);
@@ -416,23 +706,20 @@ aq_timed_remove(aqueue_t *aq, const tm_t *timeout)
 void *
 aq_remove(aqueue_t *aq)
 {
-	struct async_queue_item *aqi;
 	void *data;
 
 	aq_check(aq);
 
+	if (aq_spin(aq, &data))
+		return data;
+
 	mutex_lock(&aq->lock);
-	while (0 == eslist_count(&aq->queue))
+	atomic_int_inc(&aq->sleeping);
+	while (!aq_get_locked(aq, &data))
 		cond_wait_clean(&aq->event, &aq->lock);
-
-	aqi = eslist_shift(&aq->queue);
+	atomic_int_dec(&aq->sleeping);
 	mutex_unlock(&aq->lock);
 
-	g_assert(aqi != NULL);
-
-	data = aqi->data;
-	WFREE(aqi);
-
 	return data;
 }
 
@@ -449,19 +736,11 @@ aq_remove(aqueue_t *aq)
 void *
 aq_remove_try(aqueue_t *aq)
 {
-	struct async_queue_item *aqi;
 	void *data = NULL;
 
 	aq_check(aq);
 
-	mutex_lock(&aq->lock);
-	aqi = eslist_shift(&aq->queue);
-	mutex_unlock(&aq->lock);
-
-	if (aqi != NULL) {
-		data = aqi->data;
-		WFREE(aqi);
-
+	if (aq_get(aq, &data)) {
 		if G_UNLIKELY(NULL == data) {
 			s_carp("%s(): found NULL data exchanged with non-blocking reads",
 				G_STRFUNC);
@@ -45,6 +45,7 @@ struct tmval;
 
 aqueue_t *aq_make(void);
 aqueue_t *aq_make_full(bool signals);
+aqueue_t *aq_make_ring(size_t capacity, bool signals);
 aqueue_t *aq_refcnt_inc(aqueue_t *aq);
 bool aq_refcnt_dec(aqueue_t *aq);
 void aq_destroy_null(aqueue_t **aq_ptr) NON_NULL_PARAM((1));
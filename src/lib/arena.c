@@ -0,0 +1,390 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Scoped arena allocator for transient objects.
+ *
+ * An arena hands out memory by bumping a pointer within large blocks.
+ * Objects are never freed individually: instead, the allocation state is
+ * checkpointed with arena_save() and everything allocated since then is
+ * released at once by arena_restore().  Checkpoints must be restored in
+ * the reverse order they were taken.
+ *
+ * This is meant for the short-lived objects created whilst processing a
+ * single message, where going through walloc() and halloc() for each of
+ * them and freeing them one by one is pure overhead.  Objects that need
+ * to outlive the scope can be promoted to the heap via arena_promote().
+ *
+ * Each thread can get its own arena via arena_private(), hence arenas
+ * are not thread-safe and must not be shared between threads.
+ *
+ * Contrary to the chunk allocator (ckalloc), an arena grows as needed by
+ * stacking new blocks, and keeps a few blocks around for reuse so that
+ * the steady state does not involve any system call.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "arena.h"
+
+#include "halloc.h"
+#include "thread.h"
+#include "unsigned.h"
+#include "vmm.h"
+#include "walloc.h"
+
+#include "override.h"	/* Must be the last header included */
+
+#define ARENA_BLOCK_SIZE	(64 * 1024)	/**< Size of regular blocks */
+#define ARENA_SPARE_MAX		4			/**< Max amount of spare blocks kept */
+
+/**
+ * Memory alignment constraints.
+ */
+#define ARENA_ALIGNBYTES	MEM_ALIGNBYTES
+#define ARENA_MASK			(ARENA_ALIGNBYTES - 1)
+#define arena_round(s) \
+	((size_t) (((size_t) (s) + ARENA_MASK) & ~ARENA_MASK))
+
+/**
+ * An arena block, whose header is followed by the allocation space.
+ */
+struct arena_block {
+	struct arena_block *prev;	/**< Previous block in the stack */
+	char *end;					/**< First byte past the block */
+	size_t size;				/**< Total block size, header included */
+};
+
+#define ARENA_BLOCK_HEADER		arena_round(sizeof(struct arena_block))
+
+#define arena_block_start(b)	((char *) (b) + ARENA_BLOCK_HEADER)
+
+enum arena_magic { ARENA_MAGIC = 0x1d6e30b7 };
+
+/**
+ * The arena object.
+ */
+struct arena {
+	enum arena_magic magic;
+	struct arena_block *head;	/**< Current block, top of the stack */
+	struct arena_block *spare;	/**< Spare regular blocks, for reuse */
+	char *avail;				/**< First free byte in current block */
+	char *end;					/**< First byte past the current block */
+	uint spare_count;			/**< Amount of spare blocks */
+};
+
+static inline void
+arena_check(const struct arena * const ar)
+{
+	g_assert(ar != NULL);
+	g_assert(ARENA_MAGIC == ar->magic);
+}
+
+/**
+ * Does block hold the given address?
+ *
+ * The first byte past the block is considered part of it, since this is
+ * the allocation pointer we save when the block is full.
+ */
+static inline bool
+arena_block_holds(const struct arena_block *b, const void *p)
+{
+	return ptr_cmp(p, arena_block_start(b)) >= 0 && ptr_cmp(p, b->end) <= 0;
+}
+
+/**
+ * Push a new block on the arena, able to hold at least `len' bytes.
+ */
+static void
+arena_block_push(arena_t *ar, size_t len)
+{
+	struct arena_block *b;
+	size_t size = size_saturate_add(len, ARENA_BLOCK_HEADER);
+
+	if G_LIKELY(size <= ARENA_BLOCK_SIZE) {
+		if (ar->spare != NULL) {
+			b = ar->spare;
+			ar->spare = b->prev;
+			ar->spare_count--;
+			goto push;
+		}
+		size = ARENA_BLOCK_SIZE;
+	} else {
+		size = round_pagesize(size);
+	}
+
+	b = vmm_alloc(size);
+	b->size = size;
+	b->end = ptr_add_offset(b, size);
+
+push:
+	b->prev = ar->head;
+	ar->head = b;
+	ar->avail = arena_block_start(b);
+	ar->end = b->end;
+}
+
+/**
+ * Pop the current block from the arena.
+ *
+ * Regular blocks are kept for reuse, up to ARENA_SPARE_MAX of them.
+ */
+static void
+arena_block_pop(arena_t *ar)
+{
+	struct arena_block *b = ar->head;
+
+	g_assert(b != NULL);
+
+	ar->head = b->prev;
+
+	if (ARENA_BLOCK_SIZE == b->size && ar->spare_count < ARENA_SPARE_MAX) {
+		b->prev = ar->spare;
+		ar->spare = b;
+		ar->spare_count++;
+	} else {
+		vmm_free(b, b->size);
+	}
+
+	if (ar->head != NULL) {
+		ar->avail = ar->end = ar->head->end;
+	} else {
+		ar->avail = ar->end = NULL;
+	}
+}
+
+/**
+ * Create a new empty arena.
+ */
+arena_t *
+arena_make(void)
+{
+	arena_t *ar;
+
+	WALLOC0(ar);
+	ar->magic = ARENA_MAGIC;
+
+	return ar;
+}
+
+/**
+ * Free the arena and all the memory it holds, nullifying its pointer.
+ */
+void
+arena_free_null(arena_t **ar_ptr)
+{
+	arena_t *ar = *ar_ptr;
+
+	if (ar != NULL) {
+		struct arena_block *b, *prev;
+
+		arena_check(ar);
+
+		while (ar->head != NULL)
+			arena_block_pop(ar);
+
+		for (b = ar->spare; b != NULL; b = prev) {
+			prev = b->prev;
+			vmm_free(b, b->size);
+		}
+
+		ar->magic = 0;
+		WFREE(ar);
+		*ar_ptr = NULL;
+	}
+}
+
+/**
+ * Reclaim a thread-private arena when the thread is exiting.
+ */
+static void
+arena_private_reclaim(void *data, void *unused)
+{
+	arena_t *ar = data;
+
+	(void) unused;
+
+	arena_free_null(&ar);
+}
+
+/**
+ * Get the arena dedicated to the calling thread, creating it as needed.
+ *
+ * The arena will be reclaimed automatically when the thread exits.
+ * Its memory should not be given to foreign threads.
+ *
+ * @return the thread-private arena.
+ */
+arena_t *
+arena_private(void)
+{
+	arena_t *ar;
+
+	ar = thread_private_get(G_STRFUNC);
+
+	if G_LIKELY(ar != NULL) {
+		arena_check(ar);
+		return ar;
+	}
+
+	ar = NOT_LEAKING(arena_make());
+	thread_private_add_extended(G_STRFUNC, ar, arena_private_reclaim, NULL);
+
+	return ar;
+}
+
+/**
+ * Checkpoint current allocation context.
+ *
+ * @return current allocation pointer, to "save" the allocation context.
+ */
+void *
+arena_save(const arena_t *ar)
+{
+	arena_check(ar);
+
+	return ar->avail;
+}
+
+/**
+ * Restore allocation context to the saved pointer, in essence freeing
+ * all the memory allocated since the arena_save() checkpoint.
+ */
+void
+arena_restore(arena_t *ar, void *saved)
+{
+	arena_check(ar);
+
+	while (ar->head != NULL && !arena_block_holds(ar->head, saved))
+		arena_block_pop(ar);
+
+	if (ar->head != NULL) {
+		ar->avail = saved;
+	} else {
+		g_assert_log(NULL == saved,
+			"%s(): checkpoint %p not within arena %p",
+			G_STRFUNC, saved, ar);
+	}
+}
+
+/**
+ * Allocate `len' bytes from the arena.
+ *
+ * The memory cannot be freed individually, only via arena_restore().
+ *
+ * @return pointer to the allocated memory, suitably aligned.
+ */
+void *
+arena_alloc(arena_t *ar, size_t len)
+{
+	void *p;
+
+	arena_check(ar);
+
+	len = arena_round(len);
+
+	if G_UNLIKELY(NULL == ar->avail || ptr_diff(ar->end, ar->avail) < len)
+		arena_block_push(ar, len);
+
+	p = ar->avail;
+	ar->avail += len;
+
+	return p;
+}
+
+/**
+ * Allocate `len' bytes from the arena, zeroed.
+ */
+void *
+arena_alloc0(arena_t *ar, size_t len)
+{
+	void *p = arena_alloc(ar, len);
+
+	memset(p, 0, len);
+	return p;
+}
+
+/**
+ * Allocate a copy of the `size' bytes starting at `p' from the arena.
+ */
+void *
+arena_copy(arena_t *ar, const void *p, size_t size)
+{
+	void *cp = arena_alloc(ar, size);
+
+	memcpy(cp, p, size);
+	return cp;
+}
+
+/**
+ * Duplicate a string into the arena.
+ */
+char *
+arena_strdup(arena_t *ar, const char *str)
+{
+	return NULL == str ? NULL : arena_copy(ar, str, vstrlen(str) + 1);
+}
+
+/**
+ * @return whether the address belongs to memory currently held by the arena.
+ */
+bool
+arena_contains(const arena_t *ar, const void *p)
+{
+	const struct arena_block *b;
+
+	arena_check(ar);
+
+	for (b = ar->head; b != NULL; b = b->prev) {
+		if (ptr_cmp(p, arena_block_start(b)) >= 0 && ptr_cmp(p, b->end) < 0)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Promote an object allocated in the arena to the heap, so that it
+ * can outlive the current allocation scope.
+ *
+ * @param ar		the arena where object was allocated
+ * @param p			start of the object
+ * @param size		size of the object
+ *
+ * @return a copy of the object, to be freed with hfree().
+ */
+void *
+arena_promote(const arena_t *ar, const void *p, size_t size)
+{
+	g_assert(arena_contains(ar, p));
+
+	return hcopy(p, size);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Scoped arena allocator for transient objects.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _arena_h_
+#define _arena_h_
+
+struct arena;
+typedef struct arena arena_t;
+
+/*
+ * Public interface.
+ */
+
+arena_t *arena_make(void);
+void arena_free_null(arena_t **ar_ptr);
+arena_t *arena_private(void);
+
+void *arena_save(const arena_t *ar);
+void arena_restore(arena_t *ar, void *saved);
+
+void *arena_alloc(arena_t *ar, size_t len) G_MALLOC G_NON_NULL;
+void *arena_alloc0(arena_t *ar, size_t len) G_MALLOC G_NON_NULL;
+void *arena_copy(arena_t *ar, const void *p, size_t size) G_MALLOC;
+char *arena_strdup(arena_t *ar, const char *str) G_MALLOC;
+
+bool arena_contains(const arena_t *ar, const void *p);
+void *arena_promote(const arena_t *ar, const void *p, size_t size);
+
+#define ARENA_ALLOC(a,p)			\
+G_STMT_START {						\
+	p = arena_alloc((a), sizeof *p);	\
+} G_STMT_END
+
+#define ARENA_ALLOC0(a,p)			\
+G_STMT_START {						\
+	p = arena_alloc0((a), sizeof *p);	\
+} G_STMT_END
+
+#define ARENA_ALLOC_ARRAY(a,p,n)				\
+G_STMT_START {									\
+	p = arena_alloc((a), (n) * sizeof p[0]);	\
+} G_STMT_END
+
+#define ARENA_ALLOC0_ARRAY(a,p,n)				\
+G_STMT_START {									\
+	p = arena_alloc0((a), (n) * sizeof p[0]);	\
+} G_STMT_END
+
+#endif /* _arena_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -531,13 +531,28 @@ atom_dealloc(atom_t *a, size_t size)
 typedef size_t (*len_func_t)(const void *v);
 typedef const char *(*str_func_t)(const void *v);
 
+/**
+ * Atoms of a given type are spread among several shards, each protected by
+ * its own lock, so that threads creating or releasing atoms of the same type
+ * do not all contend on a single lock.  The shard holding an atom is chosen
+ * from the hashed atom value.
+ */
+#define ATOM_SHARD_BITS		4
+#define ATOM_SHARDS			(1U << ATOM_SHARD_BITS)
+
+/**
+ * An atom table shard.
+ */
+struct atom_shard {
+	spinlock_t lock;			/**< Lock protecting the hash table */
+	htable_t *table;			/**< Table of atoms: "atom value" -> size */
+};
+
 /**
  * Description of atom types.
  */
 typedef struct atom_desc {
-	spinlock_t lock;			/**< Lock protecting the hash table */
 	const char *type;			/**< Type of atoms */
-	htable_t *table;			/**< Table of atoms: "atom value" -> size */
 	hash_fn_t hash_func;		/**< Hashing function for atoms */
 	eq_fn_t eq_func;			/**< Atom equality function */
 	len_func_t len_func;		/**< Atom length function */
@@ -579,24 +594,27 @@ static const char *packed_host_addr_str(const void *v);
 #define pha_eq		packed_host_addr_equal
 #define pha_len		packed_host_addr_len
 #define pha_str		packed_host_addr_str
-#define S			SPINLOCK_INIT
-#define N			NULL
 
 /**
  * The set of all atom types we know about.
  */
 static atom_desc_t atoms[] = {
-	{ S, "String", N, str_hash,    str_eq,     str_xlen,   str_str  }, /* 0 */
-	{ S, "GUID",   N, guid_hash,   guid_eq,    guid_len,   guid_str }, /* 1 */
-	{ S, "SHA1",   N, sha1_hash,   sha1_eq,	   sha1_len,   sha1_str }, /* 2 */
-	{ S, "TTH",    N, tth_hash,    tth_eq,	   tth_len,    tth_str },  /* 3 */
-	{ S, "uint64", N, uint64_hash, uint64_eq,  uint64_len, uint64_str},/* 4 */
-	{ S, "filesize", N, fs_hash,   fs_eq,      fs_len,     fs_str },   /* 5 */
-	{ S, "uint32", N, uint32_hash, uint32_eq,  uint32_len, uint32_str},/* 6 */
-	{ S, "host",   N, gnh_hash,    gnh_eq,     gnh_len,    gnh_str },  /* 7 */
-	{ S, "addr",   N, pha_hash,    pha_eq,     pha_len,    pha_str },  /* 8 */
+	{ "String",   str_hash,    str_eq,     str_xlen,   str_str    }, /* 0 */
+	{ "GUID",     guid_hash,   guid_eq,    guid_len,   guid_str   }, /* 1 */
+	{ "SHA1",     sha1_hash,   sha1_eq,	   sha1_len,   sha1_str   }, /* 2 */
+	{ "TTH",      tth_hash,    tth_eq,	   tth_len,    tth_str    }, /* 3 */
+	{ "uint64",   uint64_hash, uint64_eq,  uint64_len, uint64_str }, /* 4 */
+	{ "filesize", fs_hash,     fs_eq,      fs_len,     fs_str     }, /* 5 */
+	{ "uint32",   uint32_hash, uint32_eq,  uint32_len, uint32_str }, /* 6 */
+	{ "host",     gnh_hash,    gnh_eq,     gnh_len,    gnh_str    }, /* 7 */
+	{ "addr",     pha_hash,    pha_eq,     pha_len,    pha_str    }, /* 8 */
 };
 
+/**
+ * The atom tables, for each atom type, initialized by atoms_init().
+ */
+static struct atom_shard atom_shards[NUM_ATOM_TYPES][ATOM_SHARDS];
+
 #undef str_hash
 #undef str_eq
 #undef fs_hash
@@ -611,8 +629,23 @@ static atom_desc_t atoms[] = {
 #undef pha_eq
 #undef pha_len
 #undef pha_str
-#undef S
-#undef N
+
+/**
+ * @return the shard where atom of given type and value is held.
+ */
+static inline struct atom_shard *
+atom_shard(enum atom_type type, const void *key)
+{
+	uint32 h = (*atoms[type].hash_func)(key);
+
+	/*
+	 * Use the upper bits of the multiplicative hash, which are the best
+	 * mixed ones, to avoid correlation with the buckets in the table.
+	 */
+
+	return &atom_shards[type]
+		[(uint32) (h * GOLDEN_RATIO_32) >> (32 - ATOM_SHARD_BITS)];
+}
 
 /**
  * @return length of string + trailing NUL.
@@ -980,8 +1013,14 @@ atoms_init_once(void)
 
 	for (i = 0; i < N_ITEMS(atoms); i++) {
 		atom_desc_t *ad = &atoms[i];
+		uint j;
 
-		ad->table = htable_create_any(ad->hash_func, NULL, ad->eq_func);
+		for (j = 0; j < ATOM_SHARDS; j++) {
+			struct atom_shard *as = &atom_shards[i][j];
+
+			spinlock_init(&as->lock);
+			as->table = htable_create_any(ad->hash_func, NULL, ad->eq_func);
+		}
 	}
 
 	/*
@@ -1028,12 +1067,21 @@ atoms_init(void)
 bool
 atom_exists(enum atom_type type, const void *key)
 {
+	struct atom_shard *as;
+	bool exists;
+
 	g_assert(key != NULL);
+	g_assert(UNSIGNED(type) < N_ITEMS(atoms));
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_contains(atoms[type].table, key);
+	as = atom_shard(type, key);
+	ATOM_TABLE_LOCK(as);
+	exists = htable_contains(as->table, key);
+	ATOM_TABLE_UNLOCK(as);
+
+	return exists;
 }
 
 /**
@@ -1044,26 +1092,33 @@ atom_exists(enum atom_type type, const void *key)
 bool
 atom_is_atom(enum atom_type type, const void *key)
 {
+	struct atom_shard *as;
 	const void *atom;
+	bool found;
 
 	g_assert(key != NULL);
+	g_assert(UNSIGNED(type) < N_ITEMS(atoms));
 
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		return FALSE;
 
-	return htable_lookup_extended(atoms[type].table, key, &atom, NULL)
-		&& key == atom;
+	as = atom_shard(type, key);
+	ATOM_TABLE_LOCK(as);
+	found = htable_lookup_extended(as->table, key, &atom, NULL);
+	ATOM_TABLE_UNLOCK(as);
+
+	return found && key == atom;
 }
 
 /**
  * Increment / decrement the atom reference count.
  *
- * Must be called with the table description locked.
+ * Must be called with the table shard locked.
  *
  * @return new reference count.
  */
 static inline size_t
-atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
+atom_refcnt_add(struct atom_shard *as, const void *key, void *value, int delta)
 {
 	if (4 == sizeof(void *)) {
 		/* 32-bit machine, we can directly update the atom_info structure */
@@ -1077,7 +1132,7 @@ atom_refcnt_add(const atom_desc_t *ad, const void *key, void *value, int delta)
 			v += delta;
 		else
 			v -= -delta;	/* Necessary since int may be smaller than long */
-		htable_insert(ad->table, key, ulong_to_pointer(v));
+		htable_insert(as->table, key, ulong_to_pointer(v));
 		return ATOM_REFCNT(v);
 	}
 }
@@ -1092,6 +1147,7 @@ const void *
 atom_get(enum atom_type type, const void *key)
 {
 	atom_desc_t *ad;
+	struct atom_shard *as;
 	const void *orig_key;
 	void *value;
 	size_t size;
@@ -1107,10 +1163,11 @@ atom_get(enum atom_type type, const void *key)
 	if G_UNLIKELY(!ONCE_DONE(atoms_inited))
 		atoms_init();
 
-	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	ad = &atoms[type];
+	as = atom_shard(type, key);		/* Where this atom is held */
+	ATOM_TABLE_LOCK(as);
 
-	if (htable_lookup_extended(ad->table, key, &orig_key, &value)) {
+	if (htable_lookup_extended(as->table, key, &orig_key, &value)) {
 		size_t refcnt;
 
 		size = atom_info_length(value);
@@ -1123,9 +1180,9 @@ atom_get(enum atom_type type, const void *key)
 
 		g_assert(atom_info_refcnt(value) > 0);
 
-		refcnt = atom_refcnt_add(ad, orig_key, value, +1);
+		refcnt = atom_refcnt_add(as, orig_key, value, +1);
 		ATOM_TRACK_REFCNT(orig_key, +1, refcnt);
-		ATOM_TABLE_UNLOCK(ad);
+		ATOM_TABLE_UNLOCK(as);
 
 		return orig_key;
 	} else {
@@ -1156,13 +1213,13 @@ atom_get(enum atom_type type, const void *key)
 			WALLOC(ai);
 			ai->len = size;
 			ai->refcnt = 1;
-			htable_insert(ad->table, atom_arena(a), ai);
+			htable_insert(as->table, atom_arena(a), ai);
 		} else {
 			ulong v = ATOM_INFO(size) + 1;	/* +1 means refcnt is 1 */
-			htable_insert(ad->table, atom_arena(a), ulong_to_pointer(v));
+			htable_insert(as->table, atom_arena(a), ulong_to_pointer(v));
 		}
 
-		ATOM_TABLE_UNLOCK(ad);
+		ATOM_TABLE_UNLOCK(as);
 
 		return atom_arena(a);
 	}
@@ -1176,6 +1233,7 @@ void
 atom_free(enum atom_type type, const void *key)
 {
 	atom_desc_t *ad;
+	struct atom_shard *as;
 	size_t size;
 	atom_t *a;
 	bool found;
@@ -1187,10 +1245,11 @@ atom_free(enum atom_type type, const void *key)
 	g_assert(UNSIGNED(type) < N_ITEMS(atoms));
 	ATOM_TRACK_IS_LOCKED();
 
-	ad = &atoms[type];		/* Where atoms of this type are held */
-	ATOM_TABLE_LOCK(ad);
+	ad = &atoms[type];
+	as = atom_shard(type, key);		/* Where this atom is held */
+	ATOM_TABLE_LOCK(as);
 
-	found = htable_lookup_extended(ad->table, key, &orig_key, &value);
+	found = htable_lookup_extended(as->table, key, &orig_key, &value);
 
 	g_assert_log(found,
 		"attempting to free unknown %s atom at %p", ad->type, key);
@@ -1211,7 +1270,7 @@ atom_free(enum atom_type type, const void *key)
 	 */
 
 	if (1 == refcnt) {
-		htable_remove(ad->table, key);
+		htable_remove(as->table, key);
 		if (4 == sizeof(void *)) {
 			/* 32-bit machine */
 			struct atom_info *ai = value;
@@ -1220,11 +1279,11 @@ atom_free(enum atom_type type, const void *key)
 		atom_unprotect(a, size);
 		atom_dealloc(a, size);
 	} else {
-		size_t rcnt = atom_refcnt_add(ad, key, value, -1);
+		size_t rcnt = atom_refcnt_add(as, key, value, -1);
 		ATOM_TRACK_REFCNT(key, -1, rcnt);
 	}
 
-	ATOM_TABLE_UNLOCK(ad);
+	ATOM_TABLE_UNLOCK(as);
 }
 
 #ifdef TRACK_ATOMS
@@ -1471,11 +1530,16 @@ atoms_close(void)
 
 	for (i = 0; i < N_ITEMS(atoms); i++) {
 		atom_desc_t *ad = &atoms[i];
+		uint j;
 
-		ATOM_TABLE_LOCK(ad);
-		htable_foreach(ad->table, atom_warn_free, ad);
-		htable_free_null(&ad->table);
-		ATOM_TABLE_UNLOCK(ad);
+		for (j = 0; j < ATOM_SHARDS; j++) {
+			struct atom_shard *as = &atom_shards[i][j];
+
+			ATOM_TABLE_LOCK(as);
+			htable_foreach(as->table, atom_warn_free, ad);
+			htable_free_null(&as->table);
+			ATOM_TABLE_UNLOCK(as);
+		}
 	}
 }
 
@@ -97,6 +97,13 @@
  * makes it more complex and tedious to write, but it gives nice multiplexing
  * in an execution thread for "heavy" computations.
  *
+ * Tasks whose steps are thread-safe can be created via bg_task_create_pooled()
+ * to run in a pool of worker threads instead, each worker having its own
+ * scheduler.  Idle workers steal runnable tasks from the run queue of busy
+ * workers, so that independent computations can use all the available cores.
+ * Steps, signal handlers and the "done" callback of such tasks are invoked
+ * from the worker thread currently running the task.
+ *
  * @author Raphael Manfredi
  * @date 2002-2003, 2013
  */
@@ -105,11 +112,15 @@
 
 #include "bg.h"
 
+#include "atomic.h"
 #include "atoms.h"
+#include "cond.h"
 #include "cq.h"
 #include "elist.h"
 #include "entropy.h"
 #include "eslist.h"
+#include "getcpucount.h"
+#include "latprof.h"
 #include "log.h"			/* For s_debug() and friends */
 #include "misc.h"
 #include "mutex.h"
@@ -119,6 +130,7 @@
 #include "stacktrace.h"
 #include "str.h"
 #include "stringify.h"		/* For short_time_ascii() and plural() */
+#include "thread.h"
 #include "tm.h"
 #include "walloc.h"
 
@@ -130,6 +142,10 @@
 #define BG_TICK_IDLE	1000			/**< Tick every second when idle */
 #define BG_TICK_BUSY	250				/**< Tick every 250 ms when busy */
 
+#define BG_POOL_MAX		8				/**< Max amount of pool workers */
+#define BG_POOL_LIFE	200000UL		/**< In usecs, pool scheduler life */
+#define BG_POOL_WAIT	5				/**< Secs to wait for pool at exit */
+
 #define BG_JUMP_END		1
 #define BG_JUMP_CANCEL	2
 
@@ -149,6 +165,10 @@ enum bgsched_magic {
  * in a thread, it can only be called for that thread.  This constraint is
  * needed to be able to know on which thread a task is running, to handle
  * cancellation from foreign threads.
+ *
+ * Schedulers belonging to the worker pool can see their runnable tasks
+ * migrate to another pool scheduler, but a task is only ever run by the
+ * thread of the scheduler to which it is currently attached.
  */
 struct bgsched {
 	enum bgsched_magic magic;	/**< Magic number */
@@ -166,6 +186,7 @@ struct bgsched {
 	cperiodic_t *pev;			/**< Ticker periodic event */
 	mutex_t lock;				/**< Thread-safe lock */
 	link_t lnk;					/**< Links all active schedulers */
+	bool pooled;				/**< Whether scheduler belongs to the pool */
 };
 
 static inline void
@@ -271,6 +292,7 @@ bg_task_is_daemon(const bgtask_t * const bt)
  * Operating flags.
  */
 enum {
+	TASK_F_KERNEL		= 1 << 9,	/**< Task handled by its scheduler loop */
 	TASK_F_USERMODE		= 1 << 8,	/**< Task is in "user" mode, running code */
 	TASK_F_CANCELLING	= 1 << 7,	/**< Task handling cancel request */
 	TASK_F_DAEMON		= 1 << 6,	/**< Task is a daemon */
@@ -298,6 +320,28 @@ static bgsched_t *bg_sched;			/**< Main (default) scheduler */
 static elist_t bg_sched_list = ELIST_INIT(offsetof(bgsched_t, lnk));
 static spinlock_t bg_sched_list_slk = SPINLOCK_INIT;
 
+/**
+ * The worker pool, created on demand by bg_task_create_pooled().
+ *
+ * Workers waiting for work sleep on the condition variable.  The `kicks'
+ * generation number is incremented each time new work can be picked up,
+ * so that workers do not miss wakeups happening whilst they were busy.
+ */
+static struct bg_pool {
+	bgsched_t *sched[BG_POOL_MAX];	/**< Scheduler of each worker */
+	uint count;						/**< Amount of workers (0 = per CPU) */
+	uint running;					/**< Amount of workers still running */
+	uint idle;						/**< Amount of idle workers */
+	uint kicks;						/**< Work notification generation */
+	bool exiting;					/**< Set when workers must exit */
+	mutex_t lock;					/**< Protects idle, kicks and exiting */
+	cond_t cond;					/**< Where idle workers wait */
+} bg_pool = {
+	{ NULL }, 0, 0, 0, 0, FALSE, MUTEX_INIT, COND_INIT
+};
+
+static once_flag_t bg_pool_inited;
+
 #define BG_SCHED_LIST_LOCK		spinlock(&bg_sched_list_slk)
 #define BG_SCHED_LIST_UNLOCK	spinunlock(&bg_sched_list_slk)
 
@@ -430,6 +474,7 @@ bg_task_operating_flags_str(const bgtask_t *bt)
 		int mask;
 		const char c;
 	} flags[] = {
+		{ TASK_F_KERNEL,		'K' },
 		{ TASK_F_CANCELLING,	'C' },
 		{ TASK_F_DAEMON,		'D' },
 		{ TASK_F_RUNNABLE,		'R' },
@@ -657,6 +702,9 @@ bg_sched_remove(bgtask_t *bt)
 /**
  * Pick next task to schedule in the scheduler.
  *
+ * The picked task is flagged TASK_F_KERNEL until bg_sched_release() is
+ * called, once the scheduler is completely done processing it.
+ *
  * @return new task to schedule, or NULL if there are no more tasks.
  */
 static bgtask_t *
@@ -675,6 +723,8 @@ bg_sched_pick(bgsched_t *bs)
 	if (0 != eslist_count(&bs->runq)) {
 		bt = eslist_head(&bs->runq);
 		bg_task_check(bt);
+		g_assert(!(bt->flags & TASK_F_KERNEL));
+		bt->flags |= TASK_F_KERNEL;
 	} else {
 		bt = NULL;
 	}
@@ -683,6 +733,26 @@ bg_sched_pick(bgsched_t *bs)
 	return bt;
 }
 
+/**
+ * Signal that the scheduler is done with the task it picked.
+ *
+ * Until then, the task must remain attached to the scheduler: even when
+ * it is no longer running, the scheduling loop can still be updating its
+ * step and sequence number, terminating it or putting it to sleep.
+ */
+static void
+bg_sched_release(bgsched_t *bs, bgtask_t *bt)
+{
+	bg_sched_check(bs);
+	g_assert(bt != NULL);		/* Can be dead, but not reclaimed yet */
+	g_assert(bt->flags & TASK_F_KERNEL);
+	g_assert(bt->sched == bs);
+
+	BG_SCHED_LOCK(bs);
+	bt->flags &= ~TASK_F_KERNEL;
+	BG_SCHED_UNLOCK(bs);
+}
+
 /**
  * Compute elapsed time since task started its scheduling period.
  */
@@ -809,7 +879,7 @@ bg_sched_sleep(bgtask_t *bt)
 
 	bs = bt->sched;
 	bg_sched_check(bs);
-	g_assert(bs->runcount > 0);
+	g_assert(bs->runcount > 0 || (bt->flags & TASK_F_EXITED));
 
 	bg_task_trace(bt, G_STRFUNC, FALSE);
 
@@ -834,6 +904,19 @@ bg_sched_sleep(bgtask_t *bt)
 	BG_SCHED_UNLOCK(bs);
 }
 
+/**
+ * Notify idle pool workers that there is new work they could pick up.
+ */
+static void
+bg_pool_kick(void)
+{
+	mutex_lock(&bg_pool.lock);
+	bg_pool.kicks++;
+	if (0 != bg_pool.idle)
+		cond_broadcast(&bg_pool.cond, &bg_pool.lock);
+	mutex_unlock(&bg_pool.lock);
+}
+
 /**
  * Remove task from the sleep queue and insert it to the runqueue.
  */
@@ -859,6 +942,9 @@ bg_sched_wakeup(bgtask_t *bt)
 	bg_sched_add(bt);
 
 	BG_SCHED_UNLOCK(bs);
+
+	if (bs->pooled)
+		bg_pool_kick();
 }
 
 /**
@@ -1902,9 +1988,6 @@ bg_task_wakeup(bgtask_t *bt)
 	bg_task_check(bt);
 	g_assert(bt->refcnt >= 1);
 
-	bs = bt->sched;
-	bg_sched_check(bs);
-
 	bg_task_trace(bt, G_STRFUNC, TRUE);
 
 	/*
@@ -1912,9 +1995,16 @@ bg_task_wakeup(bgtask_t *bt)
 	 * the scheduler at the same time someone would want to call this routine,
 	 * we need to hold the lock for the scheduler throughout the execution,
 	 * the leading precondition (about the task being sleeping) included.
+	 *
+	 * The scheduler is read with the task locked since a pooled task can
+	 * migrate to another scheduler.
 	 */
 
 	BG_TASK_LOCK(bt);		/* Strict lock order: task first, then scheduler */
+
+	bs = bt->sched;
+	bg_sched_check(bs);
+
 	BG_SCHED_LOCK(bs);
 
 	bg_task_is_sleeping(bt, G_STRFUNC);
@@ -2175,17 +2265,32 @@ bg_sched_timer(void *arg)
 	 */
 
 	while (bs->runcount > 0 && remain > 0) {
+		int runcount = bs->runcount;
+
+		/*
+		 * Tasks of a pool scheduler can be concurrently stolen by idle
+		 * workers, hence we may find no more task to run.
+		 */
+
+		if G_UNLIKELY(0 == runcount)
+			break;
+
 		/*
 		 * Compute how much time we can spend for this task.
 		 */
 
-		target = bs->max_life / bs->runcount;
+		target = bs->max_life / runcount;
 		target = MIN(target, remain);
 
 		bg_assert_consistent_runcount(bs, G_STRFUNC, "picking");
 
 		bt = bg_sched_pick(bs);
 
+		if G_UNLIKELY(NULL == bt) {
+			g_assert(bs->pooled);
+			break;
+		}
+
 		bg_task_check(bt);			/* runcount > 0 => there is a task */
 		g_assert(bt->flags & TASK_F_RUNNABLE);
 
@@ -2201,7 +2306,7 @@ bg_sched_timer(void *arg)
 
 		if (bt->uflags & TASK_UF_CANCELLED) {
 			bg_task_cancel(bt);
-			continue;
+			goto ended;
 		}
 
 		/*
@@ -2287,7 +2392,7 @@ bg_sched_timer(void *arg)
 			if (BG_JUMP_CANCEL == status) {
 				g_assert(bt->uflags & TASK_UF_CANCELLED);
 				bg_task_cancel(bt);
-				continue;
+				goto ended;
 			}
 
 			if (bg_debug > 0 && remain < bt->elapsed) {
@@ -2296,7 +2401,7 @@ bg_sched_timer(void *arg)
 			}
 			remain -= MIN(remain, bt->elapsed);
 			bg_task_terminate(bt);
-			continue;
+			goto ended;
 		}
 
 		/*
@@ -2356,7 +2461,18 @@ bg_sched_timer(void *arg)
 
 		g_assert(bt->step < bt->stepcnt);
 
-		ret = (*bt->stepvec[bt->step])(bt, bt->ucontext, ticks);
+		if G_UNLIKELY(latprof_is_enabled()) {
+			bgstep_cb_t step = bt->stepvec[bt->step];
+			tm_t t0, t1;
+
+			tm_now_exact(&t0);
+			ret = (*step)(bt, bt->ucontext, ticks);
+			tm_now_exact(&t1);
+			latprof_record(LATPROF_BGSTEP, func_to_pointer(step),
+				tm_elapsed_us(&t1, &t0));
+		} else {
+			ret = (*bt->stepvec[bt->step])(bt, bt->ucontext, ticks);
+		}
 
 		/*
 		 * We stopped running the task, we're now in "kernel" mode.
@@ -2382,7 +2498,7 @@ bg_sched_timer(void *arg)
 
 		if (bt->uflags & TASK_UF_CANCELLED) {
 			bg_task_cancel(bt);
-			continue;
+			goto ended;
 		}
 
 		if (bg_debug > 4) {
@@ -2450,7 +2566,7 @@ bg_sched_timer(void *arg)
 		}
 
 	ended:
-		continue;		/* Cannot put an empty label */
+		bg_sched_release(bs, bt);
 	}
 
 	if (0 != eslist_count(&bs->dead_tasks))
@@ -2632,6 +2748,328 @@ bg_sched_destroy_null(bgsched_t **bs_ptr)
 	}
 }
 
+/**
+ * Try to steal a runnable task from the run queue of a pool scheduler.
+ *
+ * The victim scheduler may be concurrently running, hence we must not steal
+ * the task it has picked: from the time it is picked until the scheduling
+ * loop is done with its post-step processing, the task is flagged with
+ * TASK_F_KERNEL, even though it is no longer running.
+ *
+ * Tasks being cancelled or requesting to go to sleep are left alone.
+ *
+ * All the locks are only tried, so that we never wait: we are idle anyway
+ * and will try again later if we could not steal anything.
+ *
+ * @param bs		the scheduler from which we want to steal
+ * @param thief		the scheduler to which the stolen task is moved
+ *
+ * @return the stolen task, NULL if nothing could be stolen.
+ */
+static bgtask_t *
+bg_sched_steal(bgsched_t *bs, bgsched_t *thief)
+{
+	bgtask_t *bt, *stolen = NULL;
+
+	bg_sched_check(bs);
+	bg_sched_check(thief);
+	g_assert(bs->pooled);
+	g_assert(thief->pooled);
+
+	if (!mutex_trylock(&bs->lock))
+		return NULL;		/* Busy, try elsewhere */
+
+	ESLIST_FOREACH_DATA(&bs->runq, bt) {
+		bg_task_check(bt);
+
+		if (!BG_TASK_TRYLOCK(bt))
+			continue;
+
+		if (
+			(bt->flags & TASK_F_RUNNABLE) &&
+			0 == (bt->flags & (TASK_F_KERNEL | TASK_F_RUNNING |
+				TASK_F_CANCELLING | TASK_F_EXITED | TASK_F_DAEMON)) &&
+			0 == (bt->uflags & (TASK_UF_CANCELLED | TASK_UF_SLEEP_REQ))
+		) {
+			stolen = bt;
+			break;
+		}
+
+		BG_TASK_UNLOCK(bt);
+	}
+
+	if (stolen != NULL) {
+		if (mutex_trylock(&thief->lock)) {
+			eslist_remove(&bs->runq, stolen);
+			bs->runcount--;
+			stolen->sched = thief;
+			eslist_append(&thief->runq, stolen);
+			thief->runcount++;
+			BG_SCHED_UNLOCK(thief);
+			BG_TASK_UNLOCK(stolen);
+		} else {
+			BG_TASK_UNLOCK(stolen);
+			stolen = NULL;
+		}
+	}
+
+	BG_SCHED_UNLOCK(bs);
+
+	return stolen;
+}
+
+/**
+ * Attempt to steal a runnable task from another pool worker.
+ *
+ * @param bs		the scheduler of the idle worker
+ * @param id		index of that worker in the pool
+ *
+ * @return TRUE if a task was moved to our scheduler.
+ */
+static bool
+bg_pool_steal(bgsched_t *bs, uint id)
+{
+	uint i;
+
+	for (i = 1; i < bg_pool.count; i++) {
+		bgsched_t *victim = bg_pool.sched[(id + i) % bg_pool.count];
+		bgtask_t *bt;
+
+		bt = bg_sched_steal(victim, bs);
+
+		if (NULL == bt)
+			continue;
+
+		if (bg_debug > 2) {
+			s_debug("BGTASK \"%s\" %p migrated from %s to %s scheduler",
+				bt->name, bt, victim->name, bs->name);
+		}
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Pool worker thread.
+ */
+static void *
+bg_pool_main(void *arg)
+{
+	uint id = pointer_to_int(arg);
+	bgsched_t *bs = bg_pool.sched[id];
+
+	bg_sched_check(bs);
+
+	thread_set_name(bs->name);
+
+	for (;;) {
+		uint kicks = atomic_uint_get(&bg_pool.kicks);
+		int n;
+
+		if (atomic_bool_get(&bg_pool.exiting))
+			break;
+
+		n = bg_sched_run(bs);
+
+		if (n != 0) {
+			/*
+			 * If we have more than one runnable task, other workers
+			 * sitting idle could take some of them.
+			 */
+
+			if (n > 1 && 0 != atomic_uint_get(&bg_pool.idle))
+				bg_pool_kick();
+
+			thread_check_suspended();
+			continue;
+		}
+
+		if (bg_pool_steal(bs, id))
+			continue;
+
+		mutex_lock(&bg_pool.lock);
+		if (kicks == bg_pool.kicks && !bg_pool.exiting) {
+			bg_pool.idle++;
+			cond_wait_clean(&bg_pool.cond, &bg_pool.lock);
+			bg_pool.idle--;
+		}
+		mutex_unlock(&bg_pool.lock);
+	}
+
+	if (bg_debug)
+		s_debug("BGTASK pool worker %s exiting", thread_name());
+
+	mutex_lock(&bg_pool.lock);
+	bg_pool.running--;
+	cond_broadcast(&bg_pool.cond, &bg_pool.lock);
+	mutex_unlock(&bg_pool.lock);
+
+	return NULL;
+}
+
+/**
+ * Create the worker pool, one worker per CPU up to BG_POOL_MAX, unless
+ * another size was configured via bg_pool_set_size().
+ */
+static void
+bg_pool_init(void)
+{
+	long cpus = getcpucount();
+	uint i;
+
+	if (0 == bg_pool.count)
+		bg_pool.count = MAX(1, MIN(cpus, BG_POOL_MAX));
+
+	for (i = 0; i < bg_pool.count; i++) {
+		bgsched_t *bs = bg_sched_create(str_smsg("pool #%u", i), BG_POOL_LIFE);
+
+		bs->pooled = TRUE;
+		bg_pool.sched[i] = bs;
+	}
+
+	bg_pool.running = bg_pool.count;
+
+	for (i = 0; i < bg_pool.count; i++) {
+		thread_create(bg_pool_main, int_to_pointer(i),
+			THREAD_F_DETACH | THREAD_F_NO_CANCEL |
+				THREAD_F_NO_POOL | THREAD_F_PANIC,
+			THREAD_STACK_MIN);
+	}
+
+	if (bg_debug) {
+		s_debug("BGTASK started pool of %u worker%s",
+			PLURAL(bg_pool.count));
+	}
+}
+
+/**
+ * Configure the amount of workers in the pool, up to BG_POOL_MAX.
+ *
+ * This must be called before the first pooled task is created, since the
+ * pool is started at that time.  A count of 0 restores the default, which
+ * is one worker per CPU.
+ */
+void
+bg_pool_set_size(uint count)
+{
+	g_assert_log(!ONCE_DONE(bg_pool_inited),
+		"%s(): worker pool already started", G_STRFUNC);
+
+	bg_pool.count = MIN(count, BG_POOL_MAX);
+}
+
+/**
+ * @return the amount of workers in the pool, 0 if the pool is not running.
+ */
+uint
+bg_pool_size(void)
+{
+	return ONCE_DONE(bg_pool_inited) && !bg_pool.exiting ? bg_pool.count : 0;
+}
+
+/**
+ * Create a new background task running in the worker pool.
+ *
+ * This is the same as bg_task_create() but the task is attached to the
+ * least loaded scheduler of the worker pool, which is created on first
+ * use.  The task may later migrate to another worker when that worker
+ * becomes idle, but it is only ever run by one thread at a time.
+ *
+ * All the task's steps, its signal handlers and its "done" callback must
+ * therefore be thread-safe, since they will run in one of the pool threads,
+ * concurrently with the main thread and the other pooled tasks.
+ *
+ * @param name			Task name (for tracing)
+ * @param steps			Work to perform (copied)
+ * @param stepcnt		Number of steps
+ * @param ucontext		User context
+ * @param ucontext_free	Free routine for context
+ * @param done_cb		Notification callback when done
+ * @param done_arg		Callback argument
+ *
+ * @returns an opaque handle, NULL if the pool is shutting down.
+ */
+bgtask_t *
+bg_task_create_pooled(
+	const char *name,
+	const bgstep_cb_t *steps, int stepcnt,
+	void *ucontext, bgclean_cb_t ucontext_free,
+	bgdone_cb_t done_cb, void *done_arg)
+{
+	bgsched_t *bs = NULL;
+	bgtask_t *bt;
+	int min = INT_MAX;
+	uint i;
+
+	if G_UNLIKELY(atomic_bool_get(&bg_pool.exiting))
+		return NULL;
+
+	ONCE_FLAG_RUN(bg_pool_inited, bg_pool_init);
+
+	for (i = 0; i < bg_pool.count; i++) {
+		int n = bg_sched_runcount(bg_pool.sched[i]);
+
+		if (n < min) {
+			min = n;
+			bs = bg_pool.sched[i];
+		}
+	}
+
+	bt = bg_task_create_internal(bs, name, steps, stepcnt,
+		ucontext, ucontext_free, done_cb, done_arg, TRUE);
+
+	if (bt != NULL)
+		bg_pool_kick();
+
+	return bt;
+}
+
+/**
+ * Stop the worker pool, destroying the pool schedulers once all the
+ * workers have exited.
+ */
+static void
+bg_pool_close(void)
+{
+	tm_t end;
+	uint i;
+
+	if (!ONCE_DONE(bg_pool_inited))
+		return;
+
+	tm_now_exact(&end);
+	end.tv_sec += BG_POOL_WAIT;
+
+	mutex_lock(&bg_pool.lock);
+
+	bg_pool.exiting = TRUE;
+	bg_pool.kicks++;
+	cond_broadcast(&bg_pool.cond, &bg_pool.lock);
+
+	while (0 != bg_pool.running) {
+		if (!cond_wait_until_clean(&bg_pool.cond, &bg_pool.lock, &end))
+			break;
+	}
+
+	mutex_unlock(&bg_pool.lock);
+
+	/*
+	 * If some workers are stuck in a task step, we cannot destroy their
+	 * scheduler since they are still using it.
+	 */
+
+	if (0 != bg_pool.running) {
+		s_warning("%s(): %u pool worker%s still running, leaving pool alone",
+			G_STRFUNC, PLURAL(bg_pool.running));
+		return;
+	}
+
+	for (i = 0; i < bg_pool.count; i++)
+		bg_sched_destroy_null(&bg_pool.sched[i]);
+}
+
 struct bg_info_list_vars {
 	pslist_t *sl;
 	bgsched_t *bs;
@@ -2836,6 +3274,7 @@ bg_init(void)
 void
 bg_close(void)
 {
+	bg_pool_close();
 	bg_sched_destroy_null(&bg_sched);
 	bg_closed = TRUE;
 }
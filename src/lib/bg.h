@@ -193,6 +193,17 @@ bgtask_t *bg_daemon_create(
 	bgclean_cb_t item_free,
 	bgnotify_cb_t notify);
 
+bgtask_t *bg_task_create_pooled(
+	const char *name,
+	const bgstep_cb_t *steps, int stepcnt,
+	void *ucontext,
+	bgclean_cb_t ucontext_free,
+	bgdone_cb_t done_cb,
+	void *done_arg);
+
+void bg_pool_set_size(uint count);
+uint bg_pool_size(void);
+
 void bg_daemon_enqueue(bgtask_t *h, void *item);
 void bg_task_run(bgtask_t *bt);
 
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Counting Bloom filter.
+ *
+ * A Bloom filter answers set membership queries with no false negatives
+ * and a tunable rate of false positives, using much less memory than the
+ * set itself.  It is meant to front a slower lookup (typically a disk
+ * database) so that the vast majority of misses can be answered without
+ * touching the backing store.
+ *
+ * Each slot is a 4-bit counter instead of a single bit so that items can
+ * also be removed.  Counters saturate at 15 and are never decremented
+ * afterwards, which can only increase the false positive rate, never
+ * create false negatives.
+ *
+ * Callers must only remove items they have previously added, or the
+ * filter could start reporting false negatives.
+ *
+ * The k slots of an item are derived from two independent hash values
+ * through double hashing: slot(i) = h1 + i * h2.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include <math.h>		/* For log() */
+
+#include "cbloom.h"
+
+#include "hashing.h"
+#include "pow2.h"
+#include "vmm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define CBLOOM_MIN_SLOTS	1024	/**< Minimum amount of counters */
+#define CBLOOM_MAX_HASHES	16		/**< Maximum amount of hash functions */
+#define CBLOOM_COUNTER_MAX	0xfU	/**< Saturated 4-bit counter */
+#define CBLOOM_LN2			0.69314718055994530942	/**< ln(2) */
+
+enum cbloom_magic { CBLOOM_MAGIC = 0x2b51e0c7 };
+
+/**
+ * A counting Bloom filter.
+ */
+struct cbloom {
+	enum cbloom_magic magic;
+	uint8 *counters;			/**< Packed 4-bit counters, 2 per byte */
+	size_t size;				/**< Size of counters[] in bytes */
+	size_t count;				/**< Amount of items held (approximate) */
+	uint32 mask;				/**< Slot mask (amount of slots - 1) */
+	uint8 hashes;				/**< Amount of hash functions (k) */
+};
+
+static inline void
+cbloom_check(const struct cbloom * const cb)
+{
+	g_assert(cb != NULL);
+	g_assert(CBLOOM_MAGIC == cb->magic);
+}
+
+/**
+ * Create a new counting Bloom filter.
+ *
+ * @param items		the expected maximum amount of items in the filter
+ * @param fp		the desired false positive rate at that load (e.g. 0.01)
+ *
+ * @return a new filter, to be freed with cbloom_free_null().
+ */
+cbloom_t *
+cbloom_make(size_t items, double fp)
+{
+	cbloom_t *cb;
+	double m, k;
+	uint32 slots;
+
+	g_assert(items != 0);
+	g_assert(fp > 0.0 && fp < 1.0);
+
+	/*
+	 * Optimal amount of slots is m = -n ln(p) / ln(2)^2, and the optimal
+	 * amount of hash functions is then k = (m / n) ln(2).
+	 *
+	 * We round the amount of slots up to a power of two so that we can
+	 * mask the hash values.
+	 */
+
+	m = -1.0 * items * log(fp) / (CBLOOM_LN2 * CBLOOM_LN2);
+	m = MIN(m, 2147483648.0);		/* Max 2^31 slots, i.e. 1 GiB */
+	slots = next_pow2(MAX((uint32) m, CBLOOM_MIN_SLOTS));
+	k = (double) slots / items * CBLOOM_LN2;
+
+	WALLOC0(cb);
+	cb->magic = CBLOOM_MAGIC;
+	cb->mask = slots - 1;
+	cb->hashes = CLAMP((uint8) (k + 0.5), 1, CBLOOM_MAX_HASHES);
+	cb->size = slots / 2;
+	cb->counters = vmm_alloc0(cb->size);
+
+	return cb;
+}
+
+/**
+ * Free filter and nullify its pointer.
+ */
+void
+cbloom_free_null(cbloom_t **cb_ptr)
+{
+	cbloom_t *cb = *cb_ptr;
+
+	if (cb != NULL) {
+		cbloom_check(cb);
+
+		vmm_free(cb->counters, cb->size);
+		cb->magic = 0;
+		WFREE(cb);
+		*cb_ptr = NULL;
+	}
+}
+
+/**
+ * Compute the two hash values from which the k slots of a key derive.
+ */
+static inline void
+cbloom_hash(const void *key, size_t len, uint32 *h1, uint32 *h2)
+{
+	*h1 = binary_hash(key, len);
+	*h2 = binary_hash2(key, len) | 1;	/* Odd, to visit distinct slots */
+}
+
+static inline uint8
+cbloom_get(const cbloom_t *cb, uint32 slot)
+{
+	uint8 c = cb->counters[slot >> 1];
+
+	return (slot & 1) ? c >> 4 : c & 0xf;
+}
+
+static inline void
+cbloom_set(cbloom_t *cb, uint32 slot, uint8 value)
+{
+	uint8 *c = &cb->counters[slot >> 1];
+
+	if (slot & 1)
+		*c = (*c & 0x0f) | (value << 4);
+	else
+		*c = (*c & 0xf0) | value;
+}
+
+/**
+ * Add key to the filter.
+ *
+ * @param cb		the counting Bloom filter
+ * @param key		start of the key
+ * @param len		length of the key
+ */
+void
+cbloom_add(cbloom_t *cb, const void *key, size_t len)
+{
+	uint32 h1, h2, i;
+
+	cbloom_check(cb);
+
+	cbloom_hash(key, len, &h1, &h2);
+
+	for (i = 0; i < cb->hashes; i++) {
+		uint32 slot = (h1 + i * h2) & cb->mask;
+		uint8 c = cbloom_get(cb, slot);
+
+		if (c < CBLOOM_COUNTER_MAX)
+			cbloom_set(cb, slot, c + 1);
+	}
+
+	cb->count++;
+}
+
+/**
+ * Remove key from the filter.
+ *
+ * The key must have been added to the filter previously.
+ *
+ * @param cb		the counting Bloom filter
+ * @param key		start of the key
+ * @param len		length of the key
+ *
+ * @return FALSE if the key was certainly not in the filter, in which
+ * case the filter is left untouched.
+ */
+bool
+cbloom_remove(cbloom_t *cb, const void *key, size_t len)
+{
+	uint32 h1, h2, i;
+
+	cbloom_check(cb);
+
+	if (!cbloom_contains(cb, key, len))
+		return FALSE;
+
+	cbloom_hash(key, len, &h1, &h2);
+
+	for (i = 0; i < cb->hashes; i++) {
+		uint32 slot = (h1 + i * h2) & cb->mask;
+		uint8 c = cbloom_get(cb, slot);
+
+		/* A saturated counter lost track of its count, leave it alone */
+
+		if (c < CBLOOM_COUNTER_MAX)
+			cbloom_set(cb, slot, c - 1);
+	}
+
+	if (cb->count != 0)
+		cb->count--;
+
+	return TRUE;
+}
+
+/**
+ * Check whether key may be present in the filter.
+ *
+ * @param cb		the counting Bloom filter
+ * @param key		start of the key
+ * @param len		length of the key
+ *
+ * @return FALSE if key is definitely absent, TRUE if it may be present.
+ */
+bool
+cbloom_contains(const cbloom_t *cb, const void *key, size_t len)
+{
+	uint32 h1, h2, i;
+
+	cbloom_check(cb);
+
+	cbloom_hash(key, len, &h1, &h2);
+
+	for (i = 0; i < cb->hashes; i++) {
+		uint32 slot = (h1 + i * h2) & cb->mask;
+
+		if (0 == cbloom_get(cb, slot))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Clear the filter, removing all the items.
+ */
+void
+cbloom_clear(cbloom_t *cb)
+{
+	cbloom_check(cb);
+
+	memset(cb->counters, 0, cb->size);
+	cb->count = 0;
+}
+
+/**
+ * @return the approximate amount of items held in the filter.
+ */
+size_t
+cbloom_count(const cbloom_t *cb)
+{
+	cbloom_check(cb);
+
+	return cb->count;
+}
+
+/**
+ * @return amount of memory used by the filter, in bytes.
+ */
+size_t
+cbloom_memory(const cbloom_t *cb)
+{
+	cbloom_check(cb);
+
+	return cb->size + sizeof *cb;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Counting Bloom filter.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _cbloom_h_
+#define _cbloom_h_
+
+typedef struct cbloom cbloom_t;
+
+/*
+ * Public interface.
+ */
+
+cbloom_t *cbloom_make(size_t items, double fp);
+void cbloom_free_null(cbloom_t **cb_ptr);
+
+void cbloom_add(cbloom_t *cb, const void *key, size_t len);
+bool cbloom_remove(cbloom_t *cb, const void *key, size_t len);
+bool cbloom_contains(const cbloom_t *cb, const void *key, size_t len);
+void cbloom_clear(cbloom_t *cb);
+size_t cbloom_count(const cbloom_t *cb);
+size_t cbloom_memory(const cbloom_t *cb);
+
+#endif /* _cbloom_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -42,6 +42,7 @@
 #include "entropy.h"
 #include "hashing.h"		/* For integer_hash_fast() */
 #include "hset.h"
+#include "latprof.h"
 #include "log.h"
 #include "mutex.h"
 #include "once.h"
@@ -62,6 +63,7 @@
 #define CQ_IDLE_PERIOD	1	/* Minimal period in seconds for idle callbacks */
 
 static size_t cq_run_idle(cqueue_t *cq);
+static void cq_periodic_trampoline(cqueue_t *cq, void *data);
 
 static uint32 cq_debug_ptr_default;
 static const uint32 *cq_debug_ptr = &cq_debug_ptr_default;
@@ -1172,7 +1174,24 @@ cq_expire_internal(cqueue_t *cq, cevent_t *ev)
 	g_assert(fn != NULL);
 
 	CQ_UNLOCK(cq);
-	(*fn)(cq, arg);		/* Callback invoked with queue unlocked */
+
+	/*
+	 * Periodic events are profiled by cq_periodic_trampoline(), which
+	 * knows about the user callback.
+	 */
+
+	if G_UNLIKELY(latprof_is_enabled() && fn != cq_periodic_trampoline) {
+		tm_t start, end;
+
+		tm_now_exact(&start);
+		(*fn)(cq, arg);
+		tm_now_exact(&end);
+		latprof_record(LATPROF_CALLOUT, func_to_pointer(fn),
+			tm_elapsed_us(&end, &start));
+	} else {
+		(*fn)(cq, arg);	/* Callback invoked with queue unlocked */
+	}
+
 	CQ_LOCK(cq);
 
 	if (!cq->cq_call_extended) {
@@ -1792,7 +1811,17 @@ cq_periodic_trampoline(cqueue_t *cq, void *data)
 	 * periodic event is deferred until we come back from the user call.
 	 */
 
-	reschedule = (*cp->event)(cp->arg);
+	if G_UNLIKELY(latprof_is_enabled()) {
+		tm_t start, end;
+
+		tm_now_exact(&start);
+		reschedule = (*cp->event)(cp->arg);
+		tm_now_exact(&end);
+		latprof_record(LATPROF_PERIODIC, func_to_pointer(cp->event),
+			tm_elapsed_us(&end, &start));
+	} else {
+		reschedule = (*cp->event)(cp->arg);
+	}
 
 	if (cp->to_free || !reschedule) {
 		cq_periodic_free(cp, TRUE);
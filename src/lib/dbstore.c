@@ -443,4 +443,28 @@ dbstore_unlink(const char *dir, const char *base)
 	HFREE_NULL(path);
 }
 
+/**
+ * Check whether SDBM files are present in "dir".
+ *
+ * @param dir				the directory where SDBM files are stored
+ * @param base				the base name of SDBM files
+ *
+ * @return TRUE if the ".pag" file of the database exists.
+ */
+bool
+dbstore_exists(const char *dir, const char *base)
+{
+	char *path, *file;
+	bool exists;
+
+	path = make_pathname(dir, base);
+	file = h_strconcat(path, DBM_PAGFEXT, NULL_PTR);
+	exists = file_exists(file);
+
+	HFREE_NULL(file);
+	HFREE_NULL(path);
+
+	return exists;
+}
+
 /* vi: set ts=4 sw=4 cindent: */
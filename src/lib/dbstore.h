@@ -87,6 +87,7 @@ void dbstore_delete(dbmw_t *dw);
 void dbstore_compact(dbmw_t *dw);
 void dbstore_move(const char *src, const char *dst, const char *base);
 void dbstore_unlink(const char *dir, const char *base);
+bool dbstore_exists(const char *dir, const char *base);
 
 #endif /* _dbstore_h_ */
 
@@ -38,13 +38,11 @@
 #include "ascii.h"
 #include "atoms.h"
 #include "buf.h"
-#include "getline.h"		/* For MAX_LINE_SIZE */
 #include "halloc.h"
-#include "hstrfn.h"
-#include "htable.h"
 #include "log.h"			/* For log_file_printable() */
 #include "misc.h"
-#include "slist.h"
+#include "once.h"
+#include "phash.h"
 #include "str.h"
 #include "stringify.h"
 #include "unsigned.h"
@@ -55,66 +53,185 @@
 enum header_magic { HEADER_MAGIC = 0x71b8484fU };
 
 /*
- * The `headers' field is a hash table indexed by field name (case-insensitive).
- * Each value (str_t *) holds a private copy of the string making that header,
- * with all continuations removed (leading spaces collapsed into one), and
- * indentical fields concatenated using ", " separators, per RFC2616.
+ * Header lines are copied once, as they are appended, into chunks of memory
+ * owned by the header object.  Chunks are never moved nor resized, so each
+ * line can be described by pointers to the field name and value spans
+ * within that memory, the ':' separator being replaced by a NUL to end the
+ * field name.  Parsing therefore does not allocate anything per line,
+ * unless the line does not fit in the current chunk.
  *
- * The `fields' field holds a list of all the fields, in the order they
- * appeared.  The value is a header_field_t structure.  It allows one to
- * dump the header exactly as it was read.
+ * The `lines' array lists all the lines in the order they appeared, so that
+ * one can dump the header exactly as it was read.  Continuation lines have
+ * no field name and follow the line they continue.
+ *
+ * Lines for the same field are chained together, and the first of them,
+ * the "head", is the one found by lookups.  When the field value spans
+ * several lines, the value returned by header_get() is built on demand:
+ * continuations are joined with a single space, and identical fields are
+ * concatenated using ", " separators, per RFC2616.
+ *
+ * Well-known field names, those consulted by the application, are mapped to
+ * an index via a perfect hash, computed whilst the field name is parsed.
+ * The head line of these fields is recorded in the `known' array, so that
+ * looking them up costs a hash computation and a single comparison.  Other
+ * field names are looked up by scanning the lines.
  */
 
-struct header {
-	enum header_magic magic;
-	htable_t *headers;			/**< Indexed by name (case-insensitively) */
-	slist_t *fields;			/**< Ordered list of header_field_t */
-	int flags;					/**< Various operating flags */
-	int size;					/**< Total header size, in bytes */
-	int num_lines;				/**< Total header lines seen */
-	int refcnt;					/**< Reference count on the structure */
+/**
+ * A chunk of memory holding header lines.
+ */
+struct header_chunk {
+	struct header_chunk *next;	/**< Next chunk in list */
+	size_t size;				/**< Size of data area */
+	size_t used;				/**< Amount of data used */
 };
 
-static inline void
-header_check(const header_t * const h)
-{
-	g_assert(h != NULL);
-	g_assert(HEADER_MAGIC == h->magic);
-	g_assert(h->refcnt > 0);
-}
+#define HEADER_CHUNK_SIZE	1024	/**< Default size of data area */
+#define HEADER_CHUNK_OFFSET	\
+	((sizeof(struct header_chunk) + MEM_ALIGNBYTES - 1) & ~(MEM_ALIGNBYTES - 1))
 
-enum header_field { HEADER_FIELD_MAGIC = 0x6e29aad7U };
+#define header_chunk_data(c)	((char *) ptr_add_offset((c), HEADER_CHUNK_OFFSET))
 
 /**
- * A header field.
- *
- * It holds the field name, and all the lines that make up that field.
- * The first line has the field name and the ":" stripped, as well as
- * all the leading spaces.  Continuations also have their leading spaces
- * stripped out.
+ * A header line.
  *
  * For instance, assume the following header field:
  *
  *    - X-Comment: first line
  *         and continuation of first line
  *
- * Then the structure would contain, with () denoting a list:
+ * Then we would have two lines:
  *
- *    - name = "X-Comment"
- *    - lines = ("first line", "and continuation of first line")
+ *    - name = "X-Comment", value = "first line"
+ *    - name = NULL, value = "and continuation of first line"
+ */
+typedef struct header_line {
+	const char *name;			/**< Field name, NULL for continuations */
+	char *value;				/**< Value, leading spaces stripped */
+	str_t *joined;				/**< For head line: full value, if built */
+	size_t value_len;			/**< Length of value */
+	int head;					/**< Index of head line for this field */
+	int next;					/**< Next line for same field, -1 if none */
+	int tail;					/**< For head line: last line for field */
+	bool more;					/**< For head line: value spans many lines */
+} header_line_t;
+
+/**
+ * Well-known header fields, looked up via a perfect hash.
+ */
+static const char * const header_known[] = {
+	"Accept",
+	"Accept-Encoding",
+	"Accept-Language",
+	"Alt-Location",
+	"Alternate-Location",
+	"Bye-Packet",
+	"Connection",
+	"Content-Encoding",
+	"Content-Length",
+	"Content-Range",
+	"Content-Type",
+	"Crawler",
+	"Date",
+	"Ext",
+	"FP-Auth-Challenge",
+	"GUID",
+	"Host",
+	"If-Modified-Since",
+	"Last-Modified",
+	"Listen-Ip",
+	"Location",
+	"Node",
+	"Node-IPv6",
+	"Pong-Caching",
+	"Range",
+	"Referer",
+	"Remote-IP",
+	"Retry-After",
+	"ST",
+	"Server",
+	"Transfer-Encoding",
+	"Upgrade",
+	"Uptime",
+	"User-Agent",
+	"Vendor-Message",
+	"X-Alt",
+	"X-Auth-Challenge",
+	"X-Available",
+	"X-Available-Ranges",
+	"X-Content-URN",
+	"X-Degree",
+	"X-Downloaded",
+	"X-Dynamic-Querying",
+	"X-Ext-Probes",
+	"X-FW-Node-Info",
+	"X-Falt",
+	"X-Features",
+	"X-GUID",
+	"X-Gnutella-Alternate-Location",
+	"X-Gnutella-Content-URN",
+	"X-Guess",
+	"X-Host",
+	"X-Hostname",
+	"X-Hub",
+	"X-Listen-Ip",
+	"X-Live-Since",
+	"X-Max-Ttl",
+	"X-My-Address",
+	"X-Nalt",
+	"X-Node",
+	"X-Node-IPv6",
+	"X-Push-Proxies",
+	"X-Push-Proxy",
+	"X-Pushproxies",
+	"X-Query-Routing",
+	"X-Queue",
+	"X-Queued",
+	"X-Remote-Ip",
+	"X-Thex-URI",
+	"X-Token",
+	"X-Try",
+	"X-Try-Hubs",
+	"X-Try-Ultrapeers",
+	"X-Ultrapeer",
+	"X-Ultrapeer-Needed",
+	"X-Ultrapeer-Query-Routing",
+};
+
+#define HEADER_KNOWN_COUNT	N_ITEMS(header_known)
+
+#define HEADER_PHASH_BITS	9
+#define HEADER_PHASH_SIZE	(1U << HEADER_PHASH_BITS)
+
+/**
+ * The perfect hash table: maps a slot to a well-known field index + 1,
+ * 0 meaning an empty slot.
  */
+static uint8 header_phash[HEADER_PHASH_SIZE];
+static uint8 header_known_len[HEADER_KNOWN_COUNT];
+static uint32 header_phash_seed;
+static once_flag_t header_phash_inited;
 
-typedef struct {
-	enum header_field magic;
-	char *name;					/**< Field name */
-	slist_t *lines;				/**< List of lines making this header */
-} header_field_t;
+struct header {
+	enum header_magic magic;
+	struct header_chunk *chunks;	/**< Memory holding the lines */
+	header_line_t *lines;			/**< Lines, in the order they appeared */
+	uint8 known[HEADER_KNOWN_COUNT];	/**< Well-known field head line + 1 */
+	int count;						/**< Amount of lines recorded */
+	int capacity;					/**< Allocated size of lines[] */
+	int last;						/**< Last field line recorded, -1 if none */
+	int flags;						/**< Various operating flags */
+	int size;						/**< Total header size, in bytes */
+	int num_lines;					/**< Total header lines seen */
+	int refcnt;						/**< Reference count on the structure */
+};
 
 static inline void
-header_field_check(const header_field_t * const hf)
+header_check(const header_t * const h)
 {
-	g_assert(hf != NULL);
-	g_assert(HEADER_FIELD_MAGIC == hf->magic);
+	g_assert(h != NULL);
+	g_assert(HEADER_MAGIC == h->magic);
+	g_assert(h->refcnt > 0);
 }
 
 /***
@@ -161,124 +278,64 @@ header_num_lines(const header_t *h)
 }
 
 /***
- *** header_field object
+ *** Perfect hashing of well-known field names.
  ***/
 
 /**
- * Create a new empty header field, whose name is `name'.
- * A private copy of `name' is done.
+ * Case-insensitive hashing step.
  */
-static header_field_t *
-hfield_make(const char *name)
+static inline uint32
+header_phash_mix(uint32 h, uchar c)
 {
-	header_field_t *h;
-
-	WALLOC0(h);
-	h->magic = HEADER_FIELD_MAGIC;
-	h->name = h_strdup(name);
-
-	return h;
+	return phash_mix_fold(h, c);
 }
 
-static void
-hfield_free_item(void *p)
+static inline uint
+header_phash_slot(uint32 h)
 {
-	HFREE_NULL(p);
+	return phash_slot(h, HEADER_PHASH_BITS);
 }
 
 /**
- * Dispose of the header field.
+ * Compute the perfect hash seed and fill the slot table.
  */
 static void
-hfield_free(header_field_t *h)
+header_phash_init_once(void)
 {
-	header_field_check(h);
+	STATIC_ASSERT(HEADER_KNOWN_COUNT < MAX_INT_VAL(uint8));
+	STATIC_ASSERT(HEAD_MAX_LINES <= MAX_INT_VAL(uint8));
 
-	slist_free_all(&h->lines, hfield_free_item);
-	HFREE_NULL(h->name);
-	h->magic = 0;
-	WFREE(h);
+	header_phash_seed = phash_build(header_known, HEADER_KNOWN_COUNT,
+		HEADER_PHASH_BITS, TRUE, header_phash, header_known_len);
 }
 
 /**
- * Append line of text to given header field.
- * A private copy of the data is made.
- */
-static void
-hfield_append(header_field_t *h, const char *text)
-{
-	header_field_check(h);
-
-	if (!h->lines) {
-		h->lines = slist_new();
-	}
-	slist_append(h->lines, h_strdup(text));
-}
-
-/**
- * Dump field on specified file descriptor.
+ * Find the well-known field index given the field name and its hash.
+ *
+ * @param name		the field name (need not be NUL-terminated)
+ * @param len		length of field name
+ * @param h			perfect hash value of the name
+ *
+ * @return well-known field index, -1 if the name is not a well-known one.
  */
-static void
-hfield_dump(const header_field_t *h, FILE *out)
+static inline int
+header_phash_lookup(const char *name, size_t len, uint32 h)
 {
-	slist_iter_t *iter;
-	bool first;
-
-	header_field_check(h);
-	g_assert(h->lines);
-
-	fprintf(out, "%s: ", h->name);
+	uint i = header_phash[header_phash_slot(h)];
 
-	first = TRUE;
-	iter = slist_iter_on_head(h->lines);
-	for (/* NOTHING */; slist_iter_has_item(iter); slist_iter_next(iter)) {
-		const char *s;
+	if (0 == i || header_known_len[i - 1] != len)
+		return -1;
 
-		if (first)
-			first = FALSE;
-		else
-			fputs("    ", out);			/* Continuation line */
+	if (0 == ascii_strncasecmp(header_known[i - 1], name, len))
+		return i - 1;
 
-		s = slist_iter_current(iter);
-		if (is_printable_iso8859_string(s)) {
-			fputs(s, out);
-		} else {
-			char buf[80];
-			const char *p = s;
-			int c;
-			size_t len = vstrlen(s);
-			str_bprintf(ARYLEN(buf), "<%u non-printable byte%s>",
-				(unsigned) PLURAL(len));
-			fputs(buf, out);
-			while ((c = *p++)) {
-				if (is_ascii_print(c) || is_ascii_space(c))
-					fputc(c, out);
-				else
-					fputc('.', out);	/* Less visual clutter than '?' */
-			}
-		}
-		fputc('\n', out);
-	}
-	slist_iter_free(&iter);
+	return -1;
 }
 
 /***
  *** header object
  ***/
 
-static htable_t *
-header_get_table(header_t *o)
-{
-	header_check(o);
-
-	if (NULL == o->headers) {
-		o->headers = htable_create_any(ascii_strcase_hash,
-			NULL, ascii_strcase_eq);
-	}
-
-	return o->headers;
-}
-
 /**
  * Create a new header object.
  */
@@ -287,28 +344,15 @@ header_make(void)
 {
 	header_t *o;
 
+	once_flag_run(&header_phash_inited, header_phash_init_once);
+
 	WALLOC0(o);
 	o->magic = HEADER_MAGIC;
 	o->refcnt = 1;
+	o->last = -1;
 	return o;
 }
 
-/**
- * Frees the key/values from the headers hash.
- */
-static bool
-free_header_data(const void *key, void *value, void *unused_udata)
-{
-	void *k;
-
-	(void) unused_udata;
-
-	k = deconstify_pointer(key);
-	hfree(k);					/* XXX if shared, don't do that */
-	str_destroy(value);
-	return TRUE;
-}
-
 /**
  * Take an extra reference on the header object.
  * @return the header object.
@@ -336,6 +380,8 @@ header_free(header_t *o)
 	}
 
 	header_reset(o);
+	HFREE_NULL(o->chunks);		/* Regular chunk kept by header_reset() */
+	HFREE_NULL(o->lines);
 	o->magic = 0;
 	WFREE(o);
 }
@@ -356,118 +402,253 @@ header_free_null(header_t **o_ptr)
 
 /**
  * Reset header object, for new header parsing.
+ *
+ * A regular chunk and the lines array are kept for reuse.
  */
 void
 header_reset(header_t *o)
 {
+	struct header_chunk *c, *next;
+	int i;
+
 	header_check(o);
 
-	if (o->headers != NULL) {
-		htable_foreach_remove(o->headers, free_header_data, NULL);
-		htable_free_null(&o->headers);
+	for (i = 0; i < o->count; i++) {
+		str_destroy_null(&o->lines[i].joined);
+	}
+
+	for (c = o->chunks; c != NULL; c = next) {
+		next = c->next;
+		if (NULL == next && HEADER_CHUNK_SIZE == c->size) {
+			c->used = 0;
+			o->chunks = c;
+		} else {
+			hfree(c);
+			o->chunks = NULL;
+		}
 	}
-	slist_free_all(&o->fields, cast_to_free_fn(hfield_free));
+
+	ZERO(&o->known);
+	o->count = 0;
+	o->last = -1;
 	o->flags = o->size = o->num_lines = 0;
 }
 
 /**
- * Get field value, or NULL if not present.  The value returned is a
- * pointer to the internals of the header structure, so it must not be
- * kept around.
+ * Allocate room for `len' bytes in the header chunks.
+ *
+ * @return pointer to the allocated memory, which will not move until
+ * the header is reset or freed.
  */
-char *
-header_get(const header_t *o, const char *field)
+static char *
+header_chunk_alloc(header_t *o, size_t len)
 {
-	str_t *v;
+	struct header_chunk *c = o->chunks;
+	char *p;
 
-	header_check(o);
+	if (NULL == c || c->size - c->used < len) {
+		size_t size = MAX(len, HEADER_CHUNK_SIZE);
 
-	if (o->headers) {
-		v = htable_lookup(o->headers, deconstify_char(field));
-	} else {
-		v = NULL;
+		c = halloc(HEADER_CHUNK_OFFSET + size);
+		c->size = size;
+		c->used = 0;
+		c->next = o->chunks;
+		o->chunks = c;
 	}
-	return str_2c(v);
+
+	p = header_chunk_data(c) + c->used;
+	c->used += len;
+
+	return p;
 }
 
 /**
- * Get field value, or NULL if not present.  The value returned is a
- * pointer to the internals of the header structure, so it must not be
- * kept around.
+ * Record new header line.
  *
- * If the len_ptr pointer is not NULL, it is filled with the length
- * of the header string.
+ * @param o		the header object
+ * @param name	the field name, NULL for a continuation line
+ * @param value	the value, held in the header chunks
+ *
+ * @return the index of the new line.
  */
-char *
-header_get_extended(const header_t *o, const char *field, size_t *len_ptr)
+static int
+header_line_add(header_t *o, const char *name, char *value)
 {
-	str_t *v;
-
-	header_check(o);
+	header_line_t *l;
+	int i;
 
-	if (o->headers) {
-		v = htable_lookup(o->headers, deconstify_char(field));
-	} else {
-		v = NULL;
-	}
-	if (v && len_ptr != NULL) {
-		*len_ptr = str_len(v);
+	if G_UNLIKELY(o->count == o->capacity) {
+		o->capacity = 0 == o->capacity ? 16 : 2 * o->capacity;
+		HREALLOC_ARRAY(o->lines, o->capacity);
 	}
-	return str_2c(v);
+
+	i = o->count++;
+	l = &o->lines[i];
+	l->name = name;
+	l->value = value;
+	l->value_len = vstrlen(value);
+	l->joined = NULL;
+	l->head = i;
+	l->next = -1;
+	l->tail = i;
+	l->more = FALSE;
+
+	return i;
 }
 
 /**
- * Add header line to the `headers' hash for specified field name.
- * A private copy of the `field' name and of the `text' data is made.
+ * Find the head line of a field.
+ *
+ * @param o		the header object
+ * @param name	the field name (need not be NUL-terminated)
+ * @param len	length of field name
+ * @param id	the well-known field index, -1 if not a well-known field
+ *
+ * @return the index of the head line, -1 if the field is not present.
  */
-static void
-add_header(header_t *o, const char *field, const char *text)
+static int
+header_line_find(const header_t *o, const char *name, size_t len, int id)
 {
-	htable_t *ht;
-	str_t *v;
+	int i;
 
-	header_check(o);
+	if (id >= 0)
+		return (int) o->known[id] - 1;
+
+	for (i = 0; i < o->count; i++) {
+		const header_line_t *l = &o->lines[i];
 
-	ht = header_get_table(o);
-	v = htable_lookup(ht, field);
-	if (v) {
 		/*
-		 * Header already exists, according to RFC2616 we need to append
-		 * the value, comma-separated.
+		 * Only probe l->name[len] once we know the first ``len'' bytes
+		 * match those of ``name'', which holds no NUL: it cannot be past
+		 * the end of a shorter field name.
 		 */
 
-		STR_CAT(v, ", ");
-		str_cat(v, text);
+		if (
+			l->head == i &&
+			0 == ascii_strncasecmp(l->name, name, len) &&
+			'\0' == l->name[len]
+		)
+			return i;
+	}
 
-	} else {
-		char *key;
+	return -1;
+}
 
-		/*
-		 * Create a new header entry in the hash table.
-		 */
+/**
+ * Build the full value of a field spanning several lines.
+ */
+static str_t *
+header_line_join(const header_t *o, int head)
+{
+	str_t *s = str_new(0);
+	int i;
+
+	for (i = head; i >= 0; i = o->lines[i].next) {
+		const header_line_t *l = &o->lines[i];
+		int j;
+
+		if (i != head)
+			STR_CAT(s, ", ");
+		str_cat_len(s, l->value, l->value_len);
+
+		for (j = i + 1; j < o->count && NULL == o->lines[j].name; j++) {
+			const header_line_t *cl = &o->lines[j];
 
-		key = h_strdup(field);
-		v = str_new_from(text);
-		htable_insert(ht, key, v);
+			str_putc(s, ' ');
+			str_cat_len(s, cl->value, cl->value_len);
+		}
 	}
+
+	return s;
 }
 
 /**
- * Add continuation line to the `headers' hash for specified field name.
- * A private copy of the data is made.
+ * Lookup field value.
+ *
+ * @param o			the header object
+ * @param field		the field name
+ * @param len_ptr	if not NULL, where the length of the value is written
+ *
+ * @return the field value, NULL if not present.
  */
-static void
-add_continuation(header_t *o, const char *field, const char *text)
+static char *
+header_lookup(const header_t *o, const char *field, size_t *len_ptr)
 {
-	str_t *v;
+	const char *p = field;
+	header_line_t *l;
+	uint32 h = header_phash_seed;
+	int i, c;
 
 	header_check(o);
-	g_assert(o->headers);
 
-	v = htable_lookup(o->headers, field);
-	g_assert(v != NULL);
-	str_putc(v, ' ');
-	str_cat(v, text);
+	while ((c = *p++))
+		h = header_phash_mix(h, c);
+
+	i = header_line_find(o, field, p - field - 1,
+		header_phash_lookup(field, p - field - 1, h));
+
+	if (i < 0)
+		return NULL;
+
+	l = &o->lines[i];
+
+	if G_LIKELY(!l->more) {
+		if (len_ptr != NULL)
+			*len_ptr = l->value_len;
+		return l->value;
+	}
+
+	/*
+	 * The joined value is a cache, built on first access.
+	 */
+
+	if (NULL == l->joined) {
+		header_line_t *wl = deconstify_pointer(l);
+		wl->joined = header_line_join(o, i);
+	}
+
+	if (len_ptr != NULL)
+		*len_ptr = str_len(l->joined);
+
+	return str_2c(l->joined);
+}
+
+/**
+ * Get field value, or NULL if not present.  The value returned is a
+ * pointer to the internals of the header structure, so it must not be
+ * kept around.
+ */
+char *
+header_get(const header_t *o, const char *field)
+{
+	return header_lookup(o, field, NULL);
+}
+
+/**
+ * Get field value, or NULL if not present.  The value returned is a
+ * pointer to the internals of the header structure, so it must not be
+ * kept around.
+ *
+ * If the len_ptr pointer is not NULL, it is filled with the length
+ * of the header string.
+ */
+char *
+header_get_extended(const header_t *o, const char *field, size_t *len_ptr)
+{
+	return header_lookup(o, field, len_ptr);
+}
+
+/**
+ * Flag that the value of the field whose head line is given now spans
+ * several lines, invalidating any joined value we built.
+ */
+static void
+header_line_more(header_t *o, int head)
+{
+	header_line_t *l = &o->lines[head];
+
+	l->more = TRUE;
+	str_destroy_null(&l->joined);
 }
 
 /**
@@ -479,10 +660,10 @@ add_continuation(header_t *o, const char *field, const char *text)
 int
 header_append(header_t *o, const char *text, int len)
 {
-	char buf[MAX_LINE_SIZE];
 	const char *p = text;
 	uchar c;
-	header_field_t *hf;
+	char *line;
+	int i;
 
 	header_check(o);
 	g_assert(len >= 0);
@@ -515,6 +696,8 @@ header_append(header_t *o, const char *text, int len)
 
 	c = *p;
 	if (is_ascii_space(c)) {
+		size_t vlen;
+		int head;
 
 		/*
 		 * It's a continuation.
@@ -523,7 +706,7 @@ header_append(header_t *o, const char *text, int len)
 		 * an unexpected continuation line.
 		 */
 
-		if (NULL == o->fields)
+		if (o->last < 0)
 			return HEAD_CONTINUATION;		/* Unexpected continuation */
 
 		/*
@@ -557,22 +740,26 @@ header_append(header_t *o, const char *text, int len)
 			return HEAD_OK;
 
 		/*
-		 * Save the continuation line by appending into the last header
-		 * field we handled.
+		 * Save the continuation line, which will follow the last header
+		 * field we handled (or its previous continuations) in the lines.
 		 */
 
-		hf = slist_tail(o->fields);
-		hfield_append(hf, p);
-		add_continuation(o, hf->name, p);
-		o->size += len - (p - text);	/* Count only effective text */
+		vlen = len - (p - text);
+		line = header_chunk_alloc(o, vlen + 1);
+		memcpy(line, p, vlen);
+		line[vlen] = '\0';
 
-		/*
-		 * Also append the data in the hash table.
-		 */
+		head = o->lines[o->last].head;
+		i = header_line_add(o, NULL, line);
+		o->lines[i].head = head;
+		header_line_more(o, head);
+		o->size += vlen;				/* Count only effective text */
 
 	} else {
-		char *b;
 		bool seen_space = FALSE;
+		uint32 h = header_phash_seed;
+		size_t nlen = 0;
+		int head, id;
 
 		/*
 		 * It's a new header line.
@@ -584,13 +771,13 @@ header_append(header_t *o, const char *text, int len)
 		 * Parse header field.  Must be composed of ascii chars only.
 		 * (no control characters, no space, no ISO Latin or other extension).
 		 * The field name ends with ':', after possible white spaces.
+		 *
+		 * We compute the perfect hash of the field name as we go.
 		 */
 
-		for (b = buf, c = *p; c; c = *(++p)) {
-			if (c == ':') {
-				*b++ = '\0';			/* Reached end of field */
-				break;					/* Done, buf[] holds field name */
-			}
+		for (c = *p; c; c = *(++p)) {
+			if (c == ':')
+				break;					/* Reached end of field */
 			if (is_ascii_space(c)) {
 				seen_space = TRUE;		/* Only trailing spaces allowed */
 				continue;
@@ -602,29 +789,31 @@ header_append(header_t *o, const char *text, int len)
 				o->flags |= HEAD_F_SKIP;
 				return HEAD_BAD_CHARS;
 			}
-			*b++ = c;
+			h = header_phash_mix(h, c);
+			nlen++;
 		}
 
 		/*
-		 * If buf[] does not end with a NUL, we did not fully recognize
+		 * If we did not stop on the ':' marker, we did not fully recognize
 		 * the header: we reached the end of the line without encountering
-		 * the ':' marker.
-		 *
-		 * If the buffer starts with a NUL char, it's also clearly malformed.
+		 * it.  An empty field name is also clearly malformed.
 		 */
 
-		g_assert(b > buf || (b == buf && *text == '\0'));
-
-		if (b == buf || *(b-1) != '\0') {
+		if (0 == nlen || c != ':') {
 			o->flags |= HEAD_F_SKIP;
 			return HEAD_MALFORMED;
 		}
 
 		/*
-		 * We have a valid header field in buf[].
+		 * We have a valid header field: copy the whole line, ending the
+		 * field name with a NUL, which overwrites either the ':' or the
+		 * first trailing space.
 		 */
 
-		hf = hfield_make(buf);
+		line = header_chunk_alloc(o, len + 1);
+		memcpy(line, text, len);
+		line[len] = '\0';
+		line[nlen] = '\0';
 
 		/*
 		 * Strip leading spaces in the value.
@@ -636,25 +825,56 @@ header_append(header_t *o, const char *text, int len)
 		p = skip_ascii_spaces(p);
 
 		/*
-		 * Record field value.
+		 * Record field value, chaining it to previous lines for the
+		 * same field, if any.
 		 */
 
-		hfield_append(hf, p);
-		add_header(o, buf, p);
-		if (!o->fields) {
-			o->fields = slist_new();
+		id = header_phash_lookup(line, nlen, h);
+		head = header_line_find(o, line, nlen, id);
+		i = header_line_add(o, line, line + (p - text));
+
+		if (head >= 0) {
+			header_line_t *hl = &o->lines[head];
+
+			o->lines[hl->tail].next = i;
+			o->lines[i].head = head;
+			hl->tail = i;
+			header_line_more(o, head);
+		} else if (id >= 0) {
+			o->known[id] = i + 1;
 		}
-		slist_append(o->fields, hf);
+
+		o->last = i;
 		o->size += len - (p - text);	/* Count only effective text */
 	}
 
 	return HEAD_OK;
 }
 
+/**
+ * Dump header value on specified file.
+ */
 static void
-header_dump_item(void *p, void *user_data)
+header_dump_value(FILE *out, const char *s)
 {
-	hfield_dump(p, user_data);
+	if (is_printable_iso8859_string(s)) {
+		fputs(s, out);
+	} else {
+		char buf[80];
+		const char *p = s;
+		int c;
+		size_t len = vstrlen(s);
+		str_bprintf(ARYLEN(buf), "<%u non-printable byte%s>",
+			(unsigned) PLURAL(len));
+		fputs(buf, out);
+		while ((c = *p++)) {
+			if (is_ascii_print(c) || is_ascii_space(c))
+				fputc(c, out);
+			else
+				fputc('.', out);	/* Less visual clutter than '?' */
+		}
+	}
+	fputc('\n', out);
 }
 
 /**
@@ -664,14 +884,24 @@ header_dump_item(void *p, void *user_data)
 void
 header_dump(FILE *out, const header_t *o, const char *trailer)
 {
+	int i;
+
 	header_check(o);
 
 	if (!log_file_printable(out))
 		return;
 
-	if (o->fields) {
-		slist_foreach(o->fields, header_dump_item, out);
+	for (i = 0; i < o->count; i++) {
+		const header_line_t *l = &o->lines[i];
+
+		if (l->name != NULL)
+			fprintf(out, "%s: ", l->name);
+		else
+			fputs("    ", out);			/* Continuation line */
+
+		header_dump_value(out, l->value);
 	}
+
 	if (trailer)
 		fprintf(out, "%s\n", trailer);
 }
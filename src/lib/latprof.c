@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Latency profiling of callout queue events and background task steps.
+ *
+ * When enabled, the callout queue and the background task scheduler report
+ * the time spent in each callback they dispatch.  Durations are aggregated
+ * per callback routine: amount of calls, total time, worst time (and when
+ * it happened) and a histogram in decades of microseconds.
+ *
+ * This is meant to spot the callback responsible for an occasional stall
+ * of a thread, the main thread in particular.  Routines are only identified
+ * by their address when recording, and are turned into symbolic names when
+ * the information is retrieved.
+ *
+ * Profiling is disabled by default and can be turned on and off at any
+ * time.  When disabled, the only overhead for the dispatchers is the test
+ * of the enabling flag.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "latprof.h"
+
+#include "atoms.h"
+#include "htable.h"
+#include "mutex.h"
+#include "pslist.h"
+#include "stacktrace.h"
+#include "tm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+/**
+ * Aggregated statistics for a callback routine.
+ */
+struct latprof_entry {
+	const void *fn;				/**< Callback routine */
+	enum latprof_kind kind;		/**< Kind of callback */
+	uint64 count;				/**< Amount of calls */
+	uint64 total;				/**< Total run time, in usecs */
+	ulong max;					/**< Worst run time, in usecs */
+	time_t max_stamp;			/**< When worst run time happened */
+	uint64 hist[LATPROF_BUCKETS];	/**< Run time histogram */
+};
+
+static bool latprof_enabled;	/**< Whether profiling is on */
+static htable_t *latprof_table;	/**< Maps routine -> struct latprof_entry */
+static mutex_t latprof_lock = MUTEX_INIT;
+
+#define LATPROF_LOCK		mutex_lock(&latprof_lock)
+#define LATPROF_UNLOCK		mutex_unlock(&latprof_lock)
+
+/**
+ * @return whether latency profiling is enabled.
+ */
+bool
+latprof_is_enabled(void)
+{
+	return latprof_enabled;
+}
+
+/**
+ * Turn latency profiling on or off.
+ *
+ * Turning it off keeps the statistics collected so far.
+ */
+void
+latprof_enable(bool on)
+{
+	LATPROF_LOCK;
+	if (on && NULL == latprof_table)
+		latprof_table = htable_create(HASH_KEY_SELF, 0);
+	latprof_enabled = on;
+	LATPROF_UNLOCK;
+}
+
+static void
+latprof_entry_free(const void *key, void *value, void *data)
+{
+	struct latprof_entry *le = value;
+
+	(void) key;
+	(void) data;
+
+	WFREE(le);
+}
+
+/**
+ * Clear all the statistics collected so far.
+ */
+void
+latprof_reset(void)
+{
+	LATPROF_LOCK;
+	if (latprof_table != NULL) {
+		htable_foreach(latprof_table, latprof_entry_free, NULL);
+		htable_clear(latprof_table);
+	}
+	LATPROF_UNLOCK;
+}
+
+/**
+ * Compute histogram bucket for a duration.
+ */
+static inline uint
+latprof_bucket(ulong us)
+{
+	uint i;
+
+	for (i = 0; i < LATPROF_BUCKETS - 1; i++) {
+		if (us < latprof_bucket_limit(i))
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * @return the (excluded) upper limit of histogram bucket `i', in usecs,
+ * the last bucket having no upper limit.
+ */
+ulong
+latprof_bucket_limit(uint i)
+{
+	static const ulong limit[LATPROF_BUCKETS - 1] = {
+		10UL, 100UL, 1000UL, 10000UL, 100000UL, 1000000UL,
+	};
+
+	g_assert(i < LATPROF_BUCKETS);
+
+	return i < N_ITEMS(limit) ? limit[i] : MAX_INT_VAL(ulong);
+}
+
+/**
+ * Record the run time of a callback.
+ *
+ * @param kind		kind of callback
+ * @param fn		the callback routine
+ * @param us		time spent running the callback, in usecs
+ */
+void
+latprof_record(enum latprof_kind kind, const void *fn, ulong us)
+{
+	struct latprof_entry *le;
+
+	g_assert(UNSIGNED(kind) < LATPROF_KIND_COUNT);
+
+	LATPROF_LOCK;
+
+	if G_UNLIKELY(!latprof_enabled)
+		goto done;					/* Turned off whilst callback ran */
+
+	le = htable_lookup(latprof_table, fn);
+
+	if G_UNLIKELY(NULL == le) {
+		WALLOC0(le);
+		le->fn = fn;
+		le->kind = kind;
+		htable_insert(latprof_table, fn, le);
+	}
+
+	le->count++;
+	le->total += us;
+	le->hist[latprof_bucket(us)]++;
+
+	if (us > le->max) {
+		le->max = us;
+		le->max_stamp = tm_time();
+	}
+
+done:
+	LATPROF_UNLOCK;
+}
+
+/**
+ * @return English description of the kind of callback.
+ */
+const char *
+latprof_kind_to_string(enum latprof_kind kind)
+{
+	switch (kind) {
+	case LATPROF_CALLOUT:	return "callout";
+	case LATPROF_PERIODIC:	return "periodic";
+	case LATPROF_BGSTEP:	return "bgstep";
+	case LATPROF_KIND_COUNT: break;
+	}
+
+	return "unknown";
+}
+
+static void
+latprof_info_get(const void *key, void *value, void *data)
+{
+	struct latprof_entry *le = value;
+	pslist_t **sl_ptr = data;
+	latprof_info_t *li;
+
+	(void) key;
+
+	WALLOC0(li);
+	li->magic = LATPROF_INFO_MAGIC;
+	li->kind = le->kind;
+	li->count = le->count;
+	li->total = le->total;
+	li->max = le->max;
+	li->max_stamp = le->max_stamp;
+	li->fn = le->fn;
+	memcpy(li->hist, le->hist, sizeof li->hist);
+
+	*sl_ptr = pslist_prepend(*sl_ptr, li);
+}
+
+/**
+ * Retrieve latency profiling information.
+ *
+ * @return list of latprof_info_t that must be freed by calling the
+ * latprof_info_list_free_null() routine.
+ */
+pslist_t *
+latprof_info_list(void)
+{
+	pslist_t *sl = NULL, *l;
+
+	LATPROF_LOCK;
+	if (latprof_table != NULL)
+		htable_foreach(latprof_table, latprof_info_get, &sl);
+	LATPROF_UNLOCK;
+
+	/*
+	 * Resolve routine names outside of the critical section.
+	 */
+
+	PSLIST_FOREACH(sl, l) {
+		latprof_info_t *li = l->data;
+
+		li->name = atom_str_get(stacktrace_routine_name(li->fn, FALSE));
+	}
+
+	return sl;
+}
+
+static void
+latprof_info_free(void *data, void *udata)
+{
+	latprof_info_t *li = data;
+
+	latprof_info_check(li);
+	(void) udata;
+
+	atom_str_free_null(&li->name);
+	WFREE(li);
+}
+
+/**
+ * Free list created by latprof_info_list() and nullify pointer.
+ */
+void
+latprof_info_list_free_null(pslist_t **sl_ptr)
+{
+	pslist_t *sl = *sl_ptr;
+
+	pslist_foreach(sl, latprof_info_free, NULL);
+	pslist_free_null(sl_ptr);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
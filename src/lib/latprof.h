@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Latency profiling of callout queue events and background task steps.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _latprof_h_
+#define _latprof_h_
+
+/**
+ * Kinds of profiled callbacks.
+ */
+enum latprof_kind {
+	LATPROF_CALLOUT = 0,		/**< Callout queue event */
+	LATPROF_PERIODIC,			/**< Periodic callout queue event */
+	LATPROF_BGSTEP,				/**< Background task step */
+
+	LATPROF_KIND_COUNT
+};
+
+/**
+ * Histogram buckets, in decades of microseconds: the first bucket is for
+ * durations below 10 us, the last one for durations of 1 s and above.
+ */
+#define LATPROF_BUCKETS		7
+
+enum latprof_info_magic { LATPROF_INFO_MAGIC = 0x3a6f2d95 };
+
+/**
+ * Profiling information that can be retrieved for a callback.
+ */
+typedef struct {
+	enum latprof_info_magic magic;
+	const void *fn;				/**< Callback routine */
+	const char *name;			/**< Callback routine name (atom) */
+	enum latprof_kind kind;		/**< Kind of callback */
+	uint64 count;				/**< Amount of calls */
+	uint64 total;				/**< Total run time, in usecs */
+	ulong max;					/**< Worst run time, in usecs */
+	time_t max_stamp;			/**< When worst run time happened */
+	uint64 hist[LATPROF_BUCKETS];	/**< Run time histogram */
+} latprof_info_t;
+
+static inline void
+latprof_info_check(const latprof_info_t * const li)
+{
+	g_assert(li != NULL);
+	g_assert(LATPROF_INFO_MAGIC == li->magic);
+}
+
+/*
+ * Public interface.
+ */
+
+struct pslist;
+
+bool latprof_is_enabled(void);
+void latprof_enable(bool on);
+void latprof_reset(void);
+void latprof_record(enum latprof_kind kind, const void *fn, ulong us);
+
+const char *latprof_kind_to_string(enum latprof_kind kind);
+ulong latprof_bucket_limit(uint i);
+
+struct pslist *latprof_info_list(void);
+void latprof_info_list_free_null(struct pslist **sl_ptr);
+
+#endif /* _latprof_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
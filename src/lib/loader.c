@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Dependency graph of loading routines.
+ *
+ * A loader is a set of named routines, each of which can only run once
+ * the routines it depends on have completed.  Dependencies must have been
+ * added to the loader beforehand, which guarantees that the graph has no
+ * cycle.
+ *
+ * Routines flagged with LOADER_F_THREAD only touch state that nobody else
+ * is using before they complete, and can therefore run concurrently in the
+ * background worker pool as soon as their dependencies are satisfied.
+ *
+ * The other routines are run by the thread calling loader_run(), in the
+ * order in which they were added, each one waiting for its dependencies
+ * to complete, so that the usual sequential initialization order is kept.
+ *
+ * When all the routines have run, the time spent in each of them is logged,
+ * unless the loader is profiled, in which case the resources used by each
+ * routine are recorded as steps of the profiled phase instead.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "loader.h"
+
+#include "atomic.h"
+#include "bg.h"
+#include "cond.h"
+#include "halloc.h"
+#include "log.h"
+#include "mutex.h"
+#include "stringify.h"		/* For PLURAL() */
+#include "thread.h"
+#include "tm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+enum loader_state {
+	LOADER_WAITING = 0,		/**< Waiting to be run */
+	LOADER_RUNNING,			/**< Running in a worker thread */
+	LOADER_DONE				/**< Completed */
+};
+
+/**
+ * A loading routine.
+ */
+struct loader_item {
+	const char *name;			/**< Routine name (static string) */
+	loader_fn_t fn;				/**< Routine to run */
+	struct loader *owner;		/**< Loader to which item belongs */
+	struct loader_item **deps;	/**< Items we depend on */
+	uint ndeps;					/**< Amount of dependencies */
+	uint32 flags;				/**< Operating flags */
+	enum loader_state state;	/**< Running state (locked) */
+	bool threaded;				/**< Whether routine ran in a worker thread */
+	tm_nano_t start;			/**< When routine started */
+	tm_nano_t end;				/**< When routine completed */
+};
+
+enum loader_magic { LOADER_MAGIC = 0x0a9e6c5d };
+
+/**
+ * The loader object.
+ */
+struct loader {
+	enum loader_magic magic;
+	const char *name;			/**< Loader name (static string) */
+	struct loader_item **items;	/**< Items, in insertion order */
+	uint count;					/**< Amount of items */
+	uint capacity;				/**< Allocated size of items[] */
+	uint running;				/**< Items running in worker threads */
+	phaseprof_phase_t phase;	/**< Profiled phase, if `profiled' */
+	bool profiled;				/**< Whether routines are profiled */
+	mutex_t lock;				/**< Protects item states and `running' */
+	cond_t done;				/**< Signaled when a worker item completes */
+};
+
+static inline void
+loader_check(const struct loader * const ld)
+{
+	g_assert(ld != NULL);
+	g_assert(LOADER_MAGIC == ld->magic);
+}
+
+#define LOADER_LOCK(l)		mutex_lock(&(l)->lock)
+#define LOADER_UNLOCK(l)	mutex_unlock(&(l)->lock)
+
+/**
+ * Create a new empty loader.
+ *
+ * @param name		the loader name, for logging (static string)
+ */
+loader_t *
+loader_make(const char *name)
+{
+	loader_t *ld;
+
+	WALLOC0(ld);
+	ld->magic = LOADER_MAGIC;
+	ld->name = name;
+	mutex_init(&ld->lock);
+	cond_init(&ld->done, &ld->lock);
+
+	return ld;
+}
+
+/**
+ * Record the resources used by each routine as steps of a profiled phase.
+ *
+ * @param ld		the loader
+ * @param phase		the phase to which routines belong
+ */
+void
+loader_profile(loader_t *ld, phaseprof_phase_t phase)
+{
+	loader_check(ld);
+
+	ld->phase = phase;
+	ld->profiled = TRUE;
+}
+
+/**
+ * Free the loader, nullifying its pointer.
+ */
+void
+loader_free_null(loader_t **ld_ptr)
+{
+	loader_t *ld = *ld_ptr;
+
+	if (ld != NULL) {
+		uint i;
+
+		loader_check(ld);
+		g_assert(0 == ld->running);
+
+		for (i = 0; i < ld->count; i++) {
+			struct loader_item *li = ld->items[i];
+
+			HFREE_NULL(li->deps);
+			WFREE(li);
+		}
+
+		HFREE_NULL(ld->items);
+		mutex_destroy(&ld->lock);
+		cond_destroy(&ld->done);
+		ld->magic = 0;
+		WFREE(ld);
+		*ld_ptr = NULL;
+	}
+}
+
+/**
+ * Find item by name.
+ *
+ * @return the item, NULL if not found.
+ */
+static struct loader_item *
+loader_lookup(const loader_t *ld, const char *name)
+{
+	uint i;
+
+	for (i = 0; i < ld->count; i++) {
+		if (0 == strcmp(name, ld->items[i]->name))
+			return ld->items[i];
+	}
+
+	return NULL;
+}
+
+/**
+ * Add a new loading routine.
+ *
+ * The trailing arguments are the names of the routines this one depends
+ * on, which must have been added already, ending with a NULL.
+ *
+ * @param ld		the loader
+ * @param name		the routine name, for logging (static string)
+ * @param fn		the routine to run
+ * @param flags		operating flags
+ */
+void
+loader_add(loader_t *ld, const char *name, loader_fn_t fn, uint32 flags, ...)
+{
+	struct loader_item *li;
+	const char *dep;
+	va_list args;
+	uint n = 0;
+
+	loader_check(ld);
+	g_assert(name != NULL);
+	g_assert(fn != NULL);
+	g_assert_log(NULL == loader_lookup(ld, name),
+		"%s(): duplicate \"%s\" in %s loader", G_STRFUNC, name, ld->name);
+
+	WALLOC0(li);
+	li->name = name;
+	li->fn = fn;
+	li->flags = flags;
+	li->owner = ld;
+
+	va_start(args, flags);
+	while (NULL != va_arg(args, const char *))
+		n++;
+	va_end(args);
+
+	if (n != 0) {
+		HALLOC_ARRAY(li->deps, n);
+
+		va_start(args, flags);
+		while (NULL != (dep = va_arg(args, const char *))) {
+			struct loader_item *d = loader_lookup(ld, dep);
+
+			g_assert_log(d != NULL,
+				"%s(): \"%s\" depends on unknown \"%s\" in %s loader",
+				G_STRFUNC, name, dep, ld->name);
+
+			li->deps[li->ndeps++] = d;
+		}
+		va_end(args);
+	}
+
+	if (ld->count == ld->capacity) {
+		ld->capacity = MAX(16, 2 * ld->capacity);
+		HREALLOC_ARRAY(ld->items, ld->capacity);
+	}
+
+	ld->items[ld->count++] = li;
+}
+
+/**
+ * Can item be run?
+ *
+ * @return TRUE if all its dependencies completed.
+ */
+static bool
+loader_item_ready(const struct loader_item *li)
+{
+	uint i;
+
+	for (i = 0; i < li->ndeps; i++) {
+		if (li->deps[i]->state != LOADER_DONE)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Run the item's routine in the current thread.
+ */
+static void
+loader_item_run(struct loader_item *li)
+{
+	const loader_t *ld = li->owner;
+	phaseprof_mark_t m;
+
+	if (ld->profiled)
+		phaseprof_mark(&m);
+
+	tm_precise_time(&li->start);
+	(*li->fn)();
+	tm_precise_time(&li->end);
+
+	if (ld->profiled)
+		phaseprof_record(ld->phase, li->name, &m);
+}
+
+/**
+ * Background task step running the item's routine in the worker pool.
+ */
+static bgret_t
+loader_item_step(bgtask_t *unused_bt, void *data, int unused_ticks)
+{
+	struct loader_item *li = data;
+
+	(void) unused_bt;
+	(void) unused_ticks;
+
+	loader_item_run(li);
+
+	return BGR_DONE;
+}
+
+/**
+ * Called in the worker thread when the item's task is done.
+ */
+static void
+loader_item_done(bgtask_t *unused_bt, void *data,
+	bgstatus_t status, void *unused_arg)
+{
+	struct loader_item *li = data;
+
+	(void) unused_bt;
+	(void) unused_arg;
+
+	g_assert_log(BGS_OK == status,
+		"%s(): \"%s\" in %s loader ended with status %s",
+		G_STRFUNC, li->name, li->owner->name, bgstatus_to_string(status));
+}
+
+/**
+ * Called in the worker thread when the item's task no longer needs it,
+ * to signal its completion to the thread running the loader.
+ */
+static void
+loader_item_release(void *data)
+{
+	struct loader_item *li = data;
+	loader_t *ld = li->owner;
+
+	LOADER_LOCK(ld);
+	g_assert(LOADER_RUNNING == li->state);
+	li->state = LOADER_DONE;
+	ld->running--;
+	cond_signal(&ld->done, &ld->lock);
+	LOADER_UNLOCK(ld);
+}
+
+/**
+ * Hand the item over to the worker pool.
+ *
+ * @return TRUE if the item was launched.
+ */
+static bool
+loader_item_launch(struct loader_item *li)
+{
+	loader_t *ld = li->owner;
+	bgstep_cb_t step = loader_item_step;
+	bgtask_t *bt;
+
+	g_assert(mutex_is_owned(&ld->lock));
+
+	li->state = LOADER_RUNNING;
+	li->threaded = TRUE;
+	ld->running++;
+
+	bt = bg_task_create_pooled(li->name, &step, 1, li, loader_item_release,
+		loader_item_done, NULL);
+
+	if G_UNLIKELY(NULL == bt) {
+		li->state = LOADER_WAITING;
+		li->threaded = FALSE;
+		ld->running--;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Log the time spent in each routine.
+ *
+ * When the loader is profiled, only the overall time is logged since the
+ * details are part of the phase profile.
+ */
+static void
+loader_report(const loader_t *ld, const tm_nano_t *start, const tm_nano_t *end)
+{
+	uint i, threaded = 0;
+
+	for (i = 0; i < ld->count; i++) {
+		if (ld->items[i]->threaded)
+			threaded++;
+	}
+
+	s_info("%s loader ran %u routine%s (%u in worker threads) in %'lu ms",
+		ld->name, PLURAL(ld->count), threaded,
+		(ulong) tm_precise_elapsed_ns(end, start) / 1000000);
+
+	if (ld->profiled)
+		return;
+
+	for (i = 0; i < ld->count; i++) {
+		const struct loader_item *li = ld->items[i];
+
+		s_info("%s loader: %-20s %7.3f ms at +%.3f ms%s",
+			ld->name, li->name,
+			tm_precise_elapsed_ns(&li->end, &li->start) / 1e6,
+			tm_precise_elapsed_ns(&li->start, start) / 1e6,
+			li->threaded ? " (thread)" : "");
+	}
+}
+
+/**
+ * Run all the loading routines, returning when they have all completed.
+ *
+ * Routines flagged with LOADER_F_THREAD are started in the worker pool as
+ * soon as their dependencies are satisfied.  The others are run by the
+ * calling thread, in the order they were added.
+ */
+void
+loader_run(loader_t *ld)
+{
+	tm_nano_t start, end;
+	uint next = 0;			/* Next item to run in this thread */
+
+	loader_check(ld);
+
+	tm_precise_time(&start);
+
+	LOADER_LOCK(ld);
+
+	for (;;) {
+		struct loader_item *li = NULL;
+		uint i;
+
+		/*
+		 * Launch all the threaded items we can.
+		 */
+
+		for (i = 0; i < ld->count; i++) {
+			struct loader_item *w = ld->items[i];
+
+			if (
+				LOADER_WAITING == w->state &&
+				(w->flags & LOADER_F_THREAD) &&
+				loader_item_ready(w)
+			)
+				loader_item_launch(w);
+		}
+
+		/*
+		 * Locate next item that we have to run ourselves.  Threaded items
+		 * that we could not launch are run here as well.
+		 */
+
+		while (next < ld->count && ld->items[next]->state != LOADER_WAITING)
+			next++;
+
+		for (i = next; i < ld->count; i++) {
+			struct loader_item *w = ld->items[i];
+
+			if (LOADER_WAITING != w->state)
+				continue;
+
+			if (0 == (w->flags & LOADER_F_THREAD) || loader_item_ready(w)) {
+				li = w;
+				break;
+			}
+		}
+
+		if (NULL == li && 0 == ld->running)
+			break;		/* All done */
+
+		if (li != NULL && loader_item_ready(li)) {
+			li->state = LOADER_RUNNING;
+			LOADER_UNLOCK(ld);
+			loader_item_run(li);
+			LOADER_LOCK(ld);
+			li->state = LOADER_DONE;
+			continue;
+		}
+
+		/*
+		 * Wait for a worker to complete something we depend on.
+		 */
+
+		g_assert(ld->running != 0);
+
+		cond_wait(&ld->done, &ld->lock);
+	}
+
+	LOADER_UNLOCK(ld);
+
+	tm_precise_time(&end);
+	loader_report(ld, &start, &end);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Dependency graph of loading routines.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _loader_h_
+#define _loader_h_
+
+#include "phaseprof.h"
+
+struct loader;
+typedef struct loader loader_t;
+
+typedef void (*loader_fn_t)(void);
+
+/**
+ * Loader flags.
+ */
+#define LOADER_F_THREAD		(1U << 0)	/**< Can run in a worker thread */
+
+/*
+ * Public interface.
+ */
+
+loader_t *loader_make(const char *name);
+void loader_free_null(loader_t **ld_ptr);
+void loader_profile(loader_t *ld, phaseprof_phase_t phase);
+
+void loader_add(loader_t *ld, const char *name, loader_fn_t fn,
+	uint32 flags, ...) G_NULL_TERMINATED;
+void loader_run(loader_t *ld);
+
+#endif /* _loader_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,737 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Profiling of the startup and shutdown steps.
+ *
+ * Each step of a phase is bracketed by a snapshot of the process resource
+ * usage counters taken with phaseprof_mark() before the step, and by a call
+ * to phaseprof_record() after the step, which records the difference.
+ *
+ * For each step we record the wall-clock time, the CPU time, the amount of
+ * bytes read and written, and the amount of memory allocations made.
+ * These are process-wide counters: for steps running concurrently in
+ * several threads, the CPU time, I/O and allocations of the other threads
+ * are accounted for as well.  I/O counters are only available when the
+ * kernel exposes them through /proc/self/io.
+ *
+ * The phase totals are saved in a history file at the end of each phase,
+ * along with the slowest steps, to make regressions between successive
+ * runs and versions visible.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "phaseprof.h"
+
+#include "atomic.h"
+#include "fd.h"
+#include "file.h"
+#include "gentime.h"
+#include "halloc.h"
+#include "hstrfn.h"
+#include "log.h"
+#include "misc.h"				/* For compact_size() */
+#include "parse.h"
+#include "product.h"
+#include "spinlock.h"
+#include "str.h"
+#include "stringify.h"			/* For PLURAL() */
+#include "timestamp.h"
+#include "xmalloc.h"
+#include "zalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define PHASEPROF_STEPS_MAX	128		/**< Max amount of steps per phase */
+#define PHASEPROF_TOP		3		/**< Slowest steps saved in history */
+#define PHASEPROF_HISTORY	64		/**< Max amount of entries in history */
+
+static const char phaseprof_file[] = "startup_profile";
+static const char phaseprof_what[] = "startup profile history";
+
+/**
+ * Resources used by a step.
+ */
+struct phaseprof_step {
+	const char *name;		/**< Step name (static string) */
+	uint64 offset_ns;		/**< Start time, relative to phase start */
+	uint64 wall_ns;			/**< Wall-clock time spent */
+	double cpu;				/**< CPU time used, in seconds */
+	uint64 io_read;			/**< Bytes read */
+	uint64 io_written;		/**< Bytes written */
+	uint64 allocs;			/**< Memory allocations made */
+};
+
+enum phaseprof_state {
+	PHASEPROF_IDLE = 0,		/**< Phase not started yet */
+	PHASEPROF_RUNNING,		/**< Recording steps */
+	PHASEPROF_ENDED			/**< Phase completed, profile is frozen */
+};
+
+/**
+ * Profile of a phase.
+ */
+static struct phaseprof {
+	struct phaseprof_step steps[PHASEPROF_STEPS_MAX];
+	struct phaseprof_step total;	/**< Whole phase */
+	phaseprof_mark_t start;			/**< Counters at start of phase */
+	gentime_t when;					/**< When phase started */
+	uint count;						/**< Amount of recorded steps */
+	uint dropped;					/**< Steps not recorded, for lack of room */
+	enum phaseprof_state state;
+	bool has_previous;				/**< Whether previous run is known */
+	char prev_version[32];			/**< Version of previous run */
+	uint64 prev_wall_ms;			/**< Wall-clock time of previous run */
+	uint64 prev_cpu_ms;				/**< CPU time of previous run */
+} phaseprof[PHASEPROF_PHASES];
+
+static spinlock_t phaseprof_slk = SPINLOCK_INIT;
+
+#define PHASEPROF_LOCK		spinlock(&phaseprof_slk)
+#define PHASEPROF_UNLOCK	spinunlock(&phaseprof_slk)
+
+static bool phaseprof_io_missing;	/**< Set when /proc/self/io is unusable */
+
+/**
+ * Bytes we read from /proc/self/io, which are not accounted as process I/O.
+ */
+static struct phaseprof_io_stats {
+	AU64(self_read);
+} phaseprof_io_stats;
+
+static inline void
+phaseprof_phase_check(const phaseprof_phase_t phase)
+{
+	g_assert(UNSIGNED(phase) < PHASEPROF_PHASES);
+}
+
+/**
+ * @return the name of the phase.
+ */
+const char *
+phaseprof_phase_name(phaseprof_phase_t phase)
+{
+	switch (phase) {
+	case PHASEPROF_STARTUP:		return "startup";
+	case PHASEPROF_SHUTDOWN:	return "shutdown";
+	case PHASEPROF_PHASES:		break;
+	}
+
+	return "unknown";
+}
+
+/**
+ * Parse the value of the named field from /proc/self/io.
+ *
+ * @return the field value, 0 if not found.
+ */
+static uint64
+phaseprof_io_field(const char *buf, const char *field)
+{
+	const char *p = strstr(buf, field);
+	uint64 v;
+	int error;
+
+	if (NULL == p)
+		return 0;
+
+	p += vstrlen(field);
+	while (' ' == *p)
+		p++;
+
+	v = parse_uint64(p, NULL, 10, &error);
+
+	return 0 == error ? v : 0;
+}
+
+/**
+ * Fetch the amount of bytes read and written so far by the process.
+ *
+ * @return TRUE if the counters are available.
+ */
+static bool
+phaseprof_io(uint64 *rd, uint64 *wr)
+{
+	char buf[512];
+	uint64 self;
+	ssize_t r;
+	int fd;
+
+	if (phaseprof_io_missing)
+		return FALSE;
+
+	fd = file_open_silent("/proc/self/io", O_RDONLY, 0);
+	if (-1 == fd) {
+		phaseprof_io_missing = TRUE;
+		return FALSE;
+	}
+
+	r = read(fd, buf, sizeof buf - 1);
+	fd_close(&fd);
+
+	if (r <= 0) {
+		phaseprof_io_missing = TRUE;
+		return FALSE;
+	}
+
+	buf[r] = '\0';
+	*rd = phaseprof_io_field(buf, "rchar:");
+	*wr = phaseprof_io_field(buf, "wchar:");
+
+	/*
+	 * The counters include what we previously read from /proc/self/io, but
+	 * not this read, which completes after the counters were formatted.
+	 */
+
+	self = AU64_VALUE(&phaseprof_io_stats.self_read);
+	*rd = *rd > self ? *rd - self : 0;
+	AU64_ADD(&phaseprof_io_stats.self_read, r);
+
+	return TRUE;
+}
+
+/**
+ * Take a snapshot of the process resource usage counters.
+ */
+void
+phaseprof_mark(phaseprof_mark_t *m)
+{
+	uint64 xallocs, zallocs;
+
+	g_assert(m != NULL);
+
+	tm_precise_time(&m->wall);
+	m->cpu = tm_cputime(NULL, NULL);
+
+	if (!phaseprof_io(&m->io_read, &m->io_written))
+		m->io_read = m->io_written = 0;
+
+	xmalloc_usage(&xallocs, NULL);
+	zalloc_usage(&zallocs, NULL);
+	m->allocs = xallocs + zallocs;
+}
+
+/**
+ * @return difference between two counters, 0 if the counter went backwards.
+ */
+static inline uint64
+phaseprof_diff(uint64 end, uint64 start)
+{
+	return end > start ? end - start : 0;
+}
+
+/**
+ * Fill step with the resources used between two snapshots.
+ *
+ * @param ps		the step to fill
+ * @param name		the step name
+ * @param origin	snapshot taken at the start of the phase
+ * @param start		snapshot taken at the start of the step
+ * @param end		snapshot taken at the end of the step
+ */
+static void
+phaseprof_step_fill(struct phaseprof_step *ps, const char *name,
+	const phaseprof_mark_t *origin,
+	const phaseprof_mark_t *start, const phaseprof_mark_t *end)
+{
+	ps->name = name;
+	ps->offset_ns = tm_precise_elapsed_ns(&start->wall, &origin->wall);
+	ps->wall_ns = tm_precise_elapsed_ns(&end->wall, &start->wall);
+	ps->cpu = end->cpu - start->cpu;
+	ps->io_read = phaseprof_diff(end->io_read, start->io_read);
+	ps->io_written = phaseprof_diff(end->io_written, start->io_written);
+	ps->allocs = phaseprof_diff(end->allocs, start->allocs);
+}
+
+/**
+ * Start profiling a phase.
+ */
+void
+phaseprof_begin(phaseprof_phase_t phase)
+{
+	struct phaseprof *pp;
+	phaseprof_mark_t start;
+
+	phaseprof_phase_check(phase);
+
+	phaseprof_mark(&start);
+	pp = &phaseprof[phase];
+
+	PHASEPROF_LOCK;
+	g_assert_log(PHASEPROF_IDLE == pp->state,
+		"%s(): %s phase already profiled",
+		G_STRFUNC, phaseprof_phase_name(phase));
+	pp->start = start;
+	pp->when = gentime_now();
+	pp->state = PHASEPROF_RUNNING;
+	PHASEPROF_UNLOCK;
+}
+
+/**
+ * Record a step of the phase, which started when the snapshot was taken.
+ *
+ * Steps recorded before the phase was started or after it ended are
+ * silently ignored.
+ *
+ * @param phase		the phase to which step belongs
+ * @param step		the step name (static string)
+ * @param start		snapshot taken at the start of the step
+ */
+void
+phaseprof_record(phaseprof_phase_t phase,
+	const char *step, const phaseprof_mark_t *start)
+{
+	struct phaseprof *pp;
+	phaseprof_mark_t end;
+
+	phaseprof_phase_check(phase);
+	g_assert(step != NULL);
+	g_assert(start != NULL);
+
+	phaseprof_mark(&end);
+	pp = &phaseprof[phase];
+
+	PHASEPROF_LOCK;
+	if (PHASEPROF_RUNNING == pp->state) {
+		if (pp->count < N_ITEMS(pp->steps)) {
+			phaseprof_step_fill(&pp->steps[pp->count++], step,
+				&pp->start, start, &end);
+		} else {
+			pp->dropped++;
+		}
+	}
+	PHASEPROF_UNLOCK;
+}
+
+/**
+ * End the profiling of a phase, freezing its profile.
+ */
+void
+phaseprof_end(phaseprof_phase_t phase)
+{
+	struct phaseprof *pp;
+	phaseprof_mark_t end;
+
+	phaseprof_phase_check(phase);
+
+	phaseprof_mark(&end);
+	pp = &phaseprof[phase];
+
+	PHASEPROF_LOCK;
+	g_assert_log(PHASEPROF_RUNNING == pp->state,
+		"%s(): %s phase not being profiled",
+		G_STRFUNC, phaseprof_phase_name(phase));
+	phaseprof_step_fill(&pp->total, phaseprof_phase_name(phase),
+		&pp->start, &pp->start, &end);
+	pp->state = PHASEPROF_ENDED;
+	PHASEPROF_UNLOCK;
+}
+
+/**
+ * @return whether the profiling of the phase has ended.
+ */
+bool
+phaseprof_is_ended(phaseprof_phase_t phase)
+{
+	phaseprof_phase_check(phase);
+
+	return PHASEPROF_ENDED == phaseprof[phase].state;
+}
+
+static inline uint64
+phaseprof_ms(uint64 ns)
+{
+	return ns / 1000000;
+}
+
+static inline uint64
+phaseprof_cpu_ms(double cpu)
+{
+	return cpu <= 0.0 ? 0 : (uint64) (cpu * 1000.0);
+}
+
+/**
+ * Compute percentage of change between old and new value.
+ */
+static double
+phaseprof_change(uint64 old, uint64 new)
+{
+	if (0 == old)
+		return 0.0;
+
+	return 100.0 * ((double) new - (double) old) / (double) old;
+}
+
+/**
+ * Log the profile of a phase to the specified log agent.
+ *
+ * Once the phase has ended, its profile is frozen and can be safely read
+ * without taking any lock.
+ */
+void
+phaseprof_report_log(phaseprof_phase_t phase, logagent_t *la)
+{
+	const struct phaseprof *pp;
+	const char *name = phaseprof_phase_name(phase);
+	const struct phaseprof_step *t;
+	uint i;
+
+	phaseprof_phase_check(phase);
+
+	pp = &phaseprof[phase];
+
+	if (PHASEPROF_ENDED != pp->state) {
+		log_info(la, "%s profile not available yet", name);
+		return;
+	}
+
+	t = &pp->total;
+
+	log_info(la, "%s took %'lu ms (%'lu ms CPU), %s read, %s written, "
+		"%'lu allocation%s, %u step%s",
+		name, (ulong) phaseprof_ms(t->wall_ns),
+		(ulong) phaseprof_cpu_ms(t->cpu),
+		phaseprof_io_missing ? "n/a" : compact_size(t->io_read, FALSE),
+		phaseprof_io_missing ? "n/a" : compact_size2(t->io_written, FALSE),
+		(ulong) t->allocs, plural(t->allocs), PLURAL(pp->count));
+
+	if (pp->dropped != 0) {
+		log_info(la, "%s profile lacks %u step%s for lack of room",
+			name, PLURAL(pp->dropped));
+	}
+
+	if (pp->has_previous) {
+		uint64 wall = phaseprof_ms(t->wall_ns);
+		uint64 cpu = phaseprof_cpu_ms(t->cpu);
+
+		log_info(la, "%s previously took %'lu ms (%'lu ms CPU) "
+			"with version %s: %+.1f%% wall, %+.1f%% CPU",
+			name, (ulong) pp->prev_wall_ms, (ulong) pp->prev_cpu_ms,
+			pp->prev_version,
+			phaseprof_change(pp->prev_wall_ms, wall),
+			phaseprof_change(pp->prev_cpu_ms, cpu));
+	}
+
+	log_info(la, "%s %-20s %10s %10s %10s %9s %9s %9s",
+		name, "step", "at ms", "wall ms", "CPU ms",
+		"read", "written", "allocs");
+
+	for (i = 0; i < pp->count; i++) {
+		const struct phaseprof_step *ps = &pp->steps[i];
+
+		log_info(la, "%s %-20s %10.3f %10.3f %10.3f %9s %9s %'9lu",
+			name, ps->name, ps->offset_ns / 1e6, ps->wall_ns / 1e6,
+			ps->cpu * 1000.0,
+			phaseprof_io_missing ? "-" : compact_size(ps->io_read, FALSE),
+			phaseprof_io_missing ? "-" : compact_size2(ps->io_written, FALSE),
+			(ulong) ps->allocs);
+	}
+}
+
+/**
+ * Fill path structure for the history file.
+ */
+static void
+phaseprof_history_path(file_path_t *fp, const char *dir)
+{
+	file_path_set(fp, dir, phaseprof_file);
+}
+
+/**
+ * Split history entry into its phase name, timestamp and remaining fields.
+ *
+ * @param line		the history line, which is modified
+ * @param stamp		where the timestamp is written
+ * @param rest		where the pointer to the remaining fields is written
+ *
+ * @return the phase name, NULL if the line is not a valid entry.
+ */
+static const char *
+phaseprof_history_split(char *line, time_t *stamp, const char **rest)
+{
+	char *p = strchr(line, ' ');
+	const char *end;
+	uint64 v;
+	int error;
+
+	if (NULL == p)
+		return NULL;
+
+	*p++ = '\0';
+	v = parse_uint64(p, &end, 10, &error);
+	if (error != 0 || ' ' != *end)
+		return NULL;
+
+	*stamp = (time_t) v;
+	*rest = end + 1;
+
+	return line;
+}
+
+/**
+ * Parse the numerical value of a "name=value" field from a history entry.
+ *
+ * @return the value, 0 if the field was not found.
+ */
+static uint64
+phaseprof_history_field(const char *fields, const char *name)
+{
+	const char *p = strstr(fields, name);
+	uint64 v;
+	int error;
+
+	if (NULL == p)
+		return 0;
+
+	v = parse_uint64(p + vstrlen(name), NULL, 10, &error);
+
+	return 0 == error ? v : 0;
+}
+
+/**
+ * Remember the previous run of the phase from its history entry.
+ *
+ * @param pp		the phase profile
+ * @param fields	the entry fields, starting with the version
+ */
+static void
+phaseprof_history_previous(struct phaseprof *pp, const char *fields)
+{
+	const char *end = strchr(fields, ' ');
+
+	if (NULL == end)
+		return;
+
+	clamp_strncpy(ARYLEN(pp->prev_version), fields, end - fields);
+	pp->prev_wall_ms = phaseprof_history_field(end, " wall=");
+	pp->prev_cpu_ms = phaseprof_history_field(end, " cpu=");
+	pp->has_previous = TRUE;
+}
+
+/**
+ * Format the slowest steps of a phase, as a comma-separated list of
+ * "name:ms" items.
+ */
+static void
+phaseprof_history_top(const struct phaseprof *pp, char *buf, size_t len)
+{
+	bool taken[PHASEPROF_STEPS_MAX];
+	size_t w = 0;
+	uint n;
+
+	ZERO(&taken);
+	buf[0] = '\0';
+
+	for (n = 0; n < PHASEPROF_TOP && n < pp->count; n++) {
+		const struct phaseprof_step *slowest = NULL;
+		uint i, k = 0;
+
+		for (i = 0; i < pp->count; i++) {
+			const struct phaseprof_step *ps = &pp->steps[i];
+
+			if (taken[i])
+				continue;
+
+			if (NULL == slowest || ps->wall_ns > slowest->wall_ns) {
+				slowest = ps;
+				k = i;
+			}
+		}
+
+		taken[k] = TRUE;
+		w += str_bprintf(&buf[w], len - w, "%s%s:%lu",
+			0 == n ? "" : ",", slowest->name,
+			(ulong) phaseprof_ms(slowest->wall_ns));
+	}
+
+	if (0 == w)
+		clamp_strcpy(buf, len, "-");
+}
+
+/**
+ * Append the profile of the phase to the history file, located in the
+ * given directory, keeping only the most recent entries.
+ *
+ * The previous entry for the phase, if any, is remembered so that the
+ * report can show how the phase performed compared to the previous run.
+ */
+void
+phaseprof_history_save(phaseprof_phase_t phase, const char *dir)
+{
+	struct phaseprof *pp;
+	const struct phaseprof_step *t;
+	char *lines[PHASEPROF_HISTORY];
+	char line[1024], version[64], top[256];
+	uint i, n = 0;
+	file_path_t fp;
+	FILE *f;
+
+	phaseprof_phase_check(phase);
+	g_assert(dir != NULL);
+
+	pp = &phaseprof[phase];
+	g_assert(PHASEPROF_ENDED == pp->state);
+
+	phaseprof_history_path(&fp, dir);
+
+	/*
+	 * Load the existing entries, keeping room for the new one.
+	 */
+
+	f = file_config_open_read_norename(phaseprof_what, &fp, 1);
+
+	if (f != NULL) {
+		while (fgets(ARYLEN(line), f)) {
+			char tmp[sizeof line];
+			const char *name, *rest;
+			time_t stamp;
+
+			if (!file_line_chomp_tail(ARYLEN(line), NULL))
+				continue;		/* Truncated, ignore */
+
+			if (file_line_is_skipable(line))
+				continue;
+
+			clamp_strcpy(ARYLEN(tmp), line);
+			name = phaseprof_history_split(tmp, &stamp, &rest);
+
+			if (NULL == name)
+				continue;
+
+			if (0 == strcmp(name, phaseprof_phase_name(phase)))
+				phaseprof_history_previous(pp, rest);
+
+			if (N_ITEMS(lines) - 1 == n) {
+				HFREE_NULL(lines[0]);
+				memmove(&lines[0], &lines[1], (n - 1) * sizeof lines[0]);
+				n--;
+			}
+
+			lines[n++] = h_strdup(line);
+		}
+		fclose(f);
+	}
+
+	/*
+	 * Format the new entry.
+	 */
+
+	if (0 != product_build()) {
+		str_bprintf(ARYLEN(version), "%s-%u",
+			product_version(), product_build());
+	} else {
+		clamp_strcpy(ARYLEN(version), product_version());
+	}
+
+	t = &pp->total;
+	phaseprof_history_top(pp, ARYLEN(top));
+
+	str_bprintf(ARYLEN(line),
+		"%s %lu %s wall=%lu cpu=%lu read=%lu written=%lu allocs=%lu "
+		"steps=%u top=%s",
+		phaseprof_phase_name(phase), (ulong) gentime_time(pp->when), version,
+		(ulong) phaseprof_ms(t->wall_ns), (ulong) phaseprof_cpu_ms(t->cpu),
+		(ulong) t->io_read, (ulong) t->io_written, (ulong) t->allocs,
+		pp->count, top);
+
+	lines[n++] = h_strdup(line);
+
+	/*
+	 * Rewrite the history.
+	 */
+
+	f = file_config_open_write(phaseprof_what, &fp);
+
+	if (f != NULL) {
+		file_config_preamble(f, "Startup and shutdown profiles");
+
+		fputs(	"#\n# Format is:\n"
+				"#   phase timestamp version wall=ms cpu=ms read=bytes "
+					"written=bytes\n"
+				"#     allocs=count steps=count top=step:ms,...\n"
+				"#\n\n",
+				f);
+
+		for (i = 0; i < n; i++) {
+			fputs(lines[i], f);
+			fputc('\n', f);
+		}
+
+		file_config_close(f, &fp);
+	}
+
+	for (i = 0; i < n; i++)
+		HFREE_NULL(lines[i]);
+}
+
+/**
+ * Log the profile history, located in the given directory, to the
+ * specified log agent.
+ */
+void
+phaseprof_history_log(const char *dir, logagent_t *la)
+{
+	char line[1024];
+	file_path_t fp;
+	FILE *f;
+	uint n = 0;
+
+	g_assert(dir != NULL);
+
+	phaseprof_history_path(&fp, dir);
+	f = file_config_open_read_norename(phaseprof_what, &fp, 1);
+
+	if (f != NULL) {
+		while (fgets(ARYLEN(line), f)) {
+			const char *name, *rest;
+			time_t stamp;
+
+			if (!file_line_chomp_tail(ARYLEN(line), NULL))
+				continue;
+
+			if (file_line_is_skipable(line))
+				continue;
+
+			name = phaseprof_history_split(line, &stamp, &rest);
+
+			if (NULL == name)
+				continue;
+
+			log_info(la, "%-8s %s %s", name, timestamp_to_string(stamp), rest);
+			n++;
+		}
+		fclose(f);
+	}
+
+	if (0 == n)
+		log_info(la, "no %s", phaseprof_what);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Profiling of the startup and shutdown steps.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _phaseprof_h_
+#define _phaseprof_h_
+
+#include "tm.h"
+
+/**
+ * Profiled phases.
+ */
+typedef enum phaseprof_phase {
+	PHASEPROF_STARTUP = 0,		/**< Process initialization */
+	PHASEPROF_SHUTDOWN,			/**< Process shutdown */
+
+	PHASEPROF_PHASES
+} phaseprof_phase_t;
+
+/**
+ * A snapshot of the process resource usage counters.
+ */
+typedef struct phaseprof_mark {
+	tm_nano_t wall;				/**< Wall-clock time */
+	double cpu;					/**< CPU time used by process, in seconds */
+	uint64 io_read;				/**< Bytes read by process */
+	uint64 io_written;			/**< Bytes written by process */
+	uint64 allocs;				/**< Allocations made by process */
+} phaseprof_mark_t;
+
+struct logagent;
+
+/*
+ * Public interface.
+ */
+
+const char *phaseprof_phase_name(phaseprof_phase_t phase);
+
+void phaseprof_mark(phaseprof_mark_t *m);
+void phaseprof_begin(phaseprof_phase_t phase);
+void phaseprof_record(phaseprof_phase_t phase,
+	const char *step, const phaseprof_mark_t *start);
+void phaseprof_end(phaseprof_phase_t phase);
+bool phaseprof_is_ended(phaseprof_phase_t phase);
+
+void phaseprof_report_log(phaseprof_phase_t phase, struct logagent *la);
+void phaseprof_history_save(phaseprof_phase_t phase, const char *dir);
+void phaseprof_history_log(const char *dir, struct logagent *la);
+
+#endif /* _phaseprof_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Perfect hashing of small static keyword tables.
+ *
+ * Keywords that need to be recognized on hot paths, such as well-known
+ * header fields or GGEP IDs, can be hashed with FNV-1a whilst they are
+ * being read, the hash value then selecting a slot in a collision-free
+ * table which is built once with phash_build().
+ *
+ * Callers hash with phash_mix() or phash_mix_fold(), starting with the
+ * seed returned by phash_build(), and use phash_slot() to locate the
+ * candidate keyword, which must still be compared to the hashed one.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "phash.h"
+
+#include "override.h"	/* Must be the last header included */
+
+/**
+ * Compute the perfect hash seed for a keyword table and fill its slots.
+ *
+ * We look for the first seed for which no two keywords map to the same
+ * slot, so the outcome is deterministic.
+ *
+ * @param keys		the keywords
+ * @param count		amount of keywords, must be less than 255
+ * @param bits		log2 of the slot table size
+ * @param fold		whether keywords are hashed regardless of ASCII case
+ * @param slots		the slot table (2^bits entries), filled with the index
+ *					of the keyword in `keys' plus 1, 0 meaning an empty slot
+ * @param lengths	if non-NULL, filled with the length of each keyword
+ *
+ * @return the seed to start hashing with.
+ */
+uint32
+phash_build(const char * const *keys, size_t count,
+	uint bits, bool fold, uint8 *slots, uint8 *lengths)
+{
+	uint32 seed;
+	size_t i;
+
+	g_assert(keys != NULL);
+	g_assert(slots != NULL);
+	g_assert(count < MAX_INT_VAL(uint8));
+	g_assert(bits > 0 && bits < 32);
+	g_assert(count <= (1U << bits));
+
+	for (seed = 0x811c9dc5U; /* empty */; seed++) {
+		memset(slots, 0, (1U << bits) * sizeof slots[0]);
+
+		for (i = 0; i < count; i++) {
+			const char *p = keys[i];
+			uint32 h = seed;
+			uint slot;
+			int c;
+
+			while ((c = *p++))
+				h = fold ? phash_mix_fold(h, c) : phash_mix(h, c);
+
+			slot = phash_slot(h, bits);
+			if (slots[slot] != 0)
+				break;				/* Collision, try next seed */
+			slots[slot] = i + 1;
+		}
+
+		if (count == i)
+			break;
+	}
+
+	if (lengths != NULL) {
+		for (i = 0; i < count; i++) {
+			size_t len = vstrlen(keys[i]);
+
+			g_assert(len <= MAX_INT_VAL(uint8));
+			lengths[i] = len;
+		}
+	}
+
+	return seed;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
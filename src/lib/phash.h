@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Perfect hashing of small static keyword tables.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _phash_h_
+#define _phash_h_
+
+#include "common.h"
+
+#include "ascii.h"
+
+#define PHASH_FNV_PRIME		0x01000193U
+
+/**
+ * FNV-1a hashing step.
+ */
+static inline uint32
+phash_mix(uint32 h, uchar c)
+{
+	return (h ^ c) * PHASH_FNV_PRIME;
+}
+
+/**
+ * Case-insensitive FNV-1a hashing step.
+ */
+static inline uint32
+phash_mix_fold(uint32 h, uchar c)
+{
+	return (h ^ ascii_tolower(c)) * PHASH_FNV_PRIME;
+}
+
+/**
+ * @return the slot of hash value `h' in a table of 2^bits entries.
+ */
+static inline uint
+phash_slot(uint32 h, uint bits)
+{
+	return h >> (32 - bits);
+}
+
+/*
+ * Public interface.
+ */
+
+uint32 phash_build(const char * const *keys, size_t count,
+	uint bits, bool fold, uint8 *slots, uint8 *lengths);
+
+#endif /* _phash_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -36,6 +36,7 @@
 #include "atio.h"
 #include "atomic.h"
 #include "barrier.h"
+#include "bg.h"
 #include "compat_poll.h"
 #include "compat_sleep_ms.h"
 #include "cond.h"
@@ -94,7 +95,7 @@ static void G_NORETURN
 usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-hejsvwxABCDEFHIKMNOPQRSUVWX]\n"
+		"Usage: %s [-hejsvwxABCDEFGHIKMNOPQRSUVWX]\n"
 		"       [-a type] [-b size] [-c CPU]\n"
 		"       [-f count] [-n count] [-r percent] [-t ms] [-T msecs]\n"
 		"       [-z fn1,fn2...]\n"
@@ -119,6 +120,7 @@ usage(void)
 		"  -D : test synchronization dams\n"
 		"  -E : test thread signals\n"
 		"  -F : test thread fork\n"
+		"  -G : test background task worker pool\n"
 		"  -H : test thread interrupts\n"
 		"  -I : test inter-thread waiter signaling\n"
 		"  -K : test thread cancellation\n"
@@ -1131,19 +1133,22 @@ aqt_processor(void *arg)
 }
 
 static void
-test_aqueue(bool emulated)
+test_aqueue_one(bool emulated, bool ring)
 {
 	aqueue_t *r, *a;
 	struct aqt_arg arg;
 	int t;
 	uint i;
 
-	TESTING(G_STRFUNC);
-
-	emit("%s() starting...", G_STRFUNC);
+	emit("%s() starting with %s queues...", G_STRFUNC, ring ? "ring" : "list");
 
-	arg.r = r = aq_make_full(emulated);		/* requests */
-	arg.a = a = aq_make_full(emulated);		/* answers */
+	if (ring) {
+		arg.r = r = aq_make_ring(2, emulated);	/* requests */
+		arg.a = a = aq_make_ring(2, emulated);	/* answers */
+	} else {
+		arg.r = r = aq_make_full(emulated);		/* requests */
+		arg.a = a = aq_make_full(emulated);		/* answers */
+	}
 
 	t = thread_create(aqt_processor, &arg, THREAD_F_PANIC, 0);
 
@@ -1170,6 +1175,94 @@ test_aqueue(bool emulated)
 	emit("%s() all done.", G_STRFUNC);
 }
 
+#define AQM_PRODUCERS	4
+#define AQM_CONSUMERS	4
+#define AQM_ITEMS		100000
+
+static void *
+aqm_producer(void *arg)
+{
+	aqueue_t *q = arg;
+	ulong i;
+
+	for (i = 1; i <= AQM_ITEMS; i++)
+		aq_put(q, ulong_to_pointer(i));
+
+	return NULL;
+}
+
+static void *
+aqm_consumer(void *arg)
+{
+	aqueue_t *q = arg;
+	ulong sum = 0;
+
+	for (;;) {
+		ulong v = pointer_to_ulong(aq_remove(q));
+
+		if (0 == v)
+			break;			/* NULL signals end of processing */
+		sum += v;
+	}
+
+	return ulong_to_pointer(sum);
+}
+
+static void
+test_aqueue_mpmc(bool emulated)
+{
+	aqueue_t *q;
+	int p[AQM_PRODUCERS], c[AQM_CONSUMERS];
+	ulong sum = 0, expected;
+	uint i;
+
+	emit("%s() starting with %d producers and %d consumers...",
+		G_STRFUNC, AQM_PRODUCERS, AQM_CONSUMERS);
+
+	q = aq_make_ring(64, emulated);
+
+	for (i = 0; i < N_ITEMS(c); i++) {
+		c[i] = thread_create(aqm_consumer, q, THREAD_F_PANIC, 0);
+	}
+	for (i = 0; i < N_ITEMS(p); i++) {
+		p[i] = thread_create(aqm_producer, q, THREAD_F_PANIC, 0);
+	}
+
+	for (i = 0; i < N_ITEMS(p); i++) {
+		if (-1 == thread_join(p[i], NULL))
+			s_error("cannot join with producer thread: %m");
+	}
+	for (i = 0; i < N_ITEMS(c); i++) {
+		aq_put(q, NULL);		/* Signals end to one consumer */
+	}
+	for (i = 0; i < N_ITEMS(c); i++) {
+		void *result;
+
+		if (-1 == thread_join(c[i], &result))
+			s_error("cannot join with consumer thread: %m");
+		sum += pointer_to_ulong(result);
+	}
+
+	aq_refcnt_dec(q);
+
+	expected = AQM_PRODUCERS * ((ulong) AQM_ITEMS * (AQM_ITEMS + 1) / 2);
+
+	if (sum != expected)
+		s_error("%s(): got sum %lu, expected %lu", G_STRFUNC, sum, expected);
+
+	emit("%s() all done.", G_STRFUNC);
+}
+
+static void
+test_aqueue(bool emulated)
+{
+	TESTING(G_STRFUNC);
+
+	test_aqueue_one(emulated, FALSE);
+	test_aqueue_one(emulated, TRUE);
+	test_aqueue_mpmc(emulated);
+}
+
 static qlock_t qsync_plain = QLOCK_PLAIN_INIT;
 static qlock_t qsync_recursive = QLOCK_RECURSIVE_INIT;
 
@@ -2329,6 +2422,147 @@ test_evq(unsigned repeat)
 	}
 }
 
+#define BGPOOL_TASKS	16		/* Amount of pooled tasks */
+#define BGPOOL_STEPS	64		/* Amount of steps per task */
+#define BGPOOL_SLOW		5		/* Duration of slow task steps, in ms */
+
+struct bgpool_task {
+	int id;						/* Task ID, #0 being the slow task */
+	int busy;					/* Amount of threads running a step */
+	int calls[BGPOOL_STEPS];	/* Amount of times each step was run */
+	uint stid[BGPOOL_STEPS];	/* Thread which ran each step */
+};
+
+static int bgpool_done;
+
+static bgret_t
+bgpool_step(bgtask_t *bt, void *arg, int ticks)
+{
+	struct bgpool_task *bp = arg;
+	int step = bg_task_step(bt);
+
+	(void) ticks;
+
+	g_assert(step >= 0 && step < BGPOOL_STEPS);
+	g_assert(0 == bg_task_seqno(bt));
+
+	g_assert_log(0 == atomic_int_inc(&bp->busy),
+		"%s(): task #%d step #%d entered concurrently in %s",
+		G_STRFUNC, bp->id, step, thread_name());
+
+	g_assert_log(0 == atomic_int_inc(&bp->calls[step]),
+		"%s(): task #%d step #%d run again in %s, first ran in %s",
+		G_STRFUNC, bp->id, step, thread_name(),
+		thread_id_name(bp->stid[step]));
+
+	bp->stid[step] = thread_small_id();
+
+	if (0 == bp->id)
+		thread_sleep_ms(BGPOOL_SLOW);
+
+	atomic_int_dec(&bp->busy);
+
+	return BGR_NEXT;
+}
+
+static void
+bgpool_task_free(void *arg)
+{
+	struct bgpool_task *bp = arg;
+
+	WFREE(bp);
+}
+
+static void
+bgpool_task_done(bgtask_t *bt, void *arg, bgstatus_t status, void *unused)
+{
+	struct bgpool_task *bp = arg;
+	uint i, threads = 0;
+	hset_t *seen;
+
+	(void) bt;
+	(void) unused;
+
+	g_assert_log(BGS_OK == status,
+		"%s(): task #%d ended with %s",
+		G_STRFUNC, bp->id, bgstatus_to_string(status));
+
+	seen = hset_create(HASH_KEY_SELF, 0);
+
+	for (i = 0; i < BGPOOL_STEPS; i++) {
+		g_assert_log(1 == atomic_int_get(&bp->calls[i]),
+			"%s(): task #%d step #%u run %d times",
+			G_STRFUNC, bp->id, i, atomic_int_get(&bp->calls[i]));
+
+		if (!hset_contains(seen, uint_to_pointer(bp->stid[i]))) {
+			hset_insert(seen, uint_to_pointer(bp->stid[i]));
+			threads++;
+		}
+	}
+
+	hset_free_null(&seen);
+
+	emit("task #%d ran its %d steps in %u thread%s",
+		bp->id, BGPOOL_STEPS, PLURAL(threads));
+
+	atomic_int_inc(&bgpool_done);
+}
+
+static void
+test_bgpool(unsigned repeat)
+{
+	bgstep_cb_t steps[BGPOOL_STEPS];
+	uint i;
+
+	TESTING(G_STRFUNC);
+
+	for (i = 0; i < N_ITEMS(steps); i++)
+		steps[i] = bgpool_step;
+
+	/*
+	 * Make sure several workers compete for the tasks, even on a single CPU,
+	 * so that idle workers steal tasks from the one running the slow task.
+	 */
+
+	bg_pool_set_size(MAX(4, cpu_count));
+
+	while (repeat--) {
+		int n;
+
+		atomic_int_set(&bgpool_done, 0);
+
+		for (i = 0; i < BGPOOL_TASKS; i++) {
+			struct bgpool_task *bp;
+			bgtask_t *bt;
+
+			WALLOC0(bp);
+			bp->id = i;
+
+			bt = bg_task_create_pooled(str_smsg("bgpool #%u", i),
+				steps, N_ITEMS(steps), bp, bgpool_task_free,
+				bgpool_task_done, NULL);
+
+			g_assert(bt != NULL);
+		}
+
+		emit("%u tasks running in a pool of %u worker%s",
+			BGPOOL_TASKS, PLURAL(bg_pool_size()));
+
+		/*
+		 * The slow task alone needs BGPOOL_STEPS * BGPOOL_SLOW ms to complete.
+		 */
+
+		for (n = 0; atomic_int_get(&bgpool_done) != BGPOOL_TASKS; n++) {
+			if (n > 60000)
+				s_error("%s(): only %d/%d tasks completed after 60 secs",
+					G_STRFUNC, atomic_int_get(&bgpool_done), BGPOOL_TASKS);
+			thread_sleep_ms(1);
+		}
+
+		emit("all %u tasks completed", BGPOOL_TASKS);
+	}
+}
+
 #define INTERRUPTS	5	/* Amount of interrupts we're sending */
 
 static int interrupt_count;
@@ -2505,9 +2739,9 @@ main(int argc, char **argv)
 	bool inter = FALSE, forking = FALSE, aqueue = FALSE, rwlock = FALSE;
 	bool signals = FALSE, barrier = FALSE, overflow = FALSE, memory = FALSE;
 	bool stats = FALSE, teq = FALSE, cancel = FALSE, dam = FALSE, evq = FALSE;
-	bool interrupts = FALSE, qlock = FALSE;
+	bool interrupts = FALSE, qlock = FALSE, bgpool = FALSE;
 	unsigned repeat = 1, play_time = 0;
-	const char options[] = "a:b:c:ef:hjn:r:st:vwxz:ABCDEFHIKMNOPQRST:UVWX";
+	const char options[] = "a:b:c:ef:hjn:r:st:vwxz:ABCDEFGHIKMNOPQRST:UVWX";
 
 	progstart(argc, argv);
 	thread_set_main(TRUE);		/* We're the main thread, we can block */
@@ -2533,6 +2767,9 @@ main(int argc, char **argv)
 		case 'F':			/* test thread_fork() */
 			forking = TRUE;
 			break;
+		case 'G':			/* test background task pool */
+			bgpool = TRUE;
+			break;
 		case 'H':			/* test thread interrupts */
 			interrupts = TRUE;
 			break;
@@ -2729,6 +2966,9 @@ main(int argc, char **argv)
 	if (evq)
 		test_evq(repeat);
 
+	if (bgpool)
+		test_bgpool(repeat);
+
 	/*
 	 * Print final statistics.
 	 */
@@ -74,6 +74,7 @@
 #include "htable.h"
 #include "mempcpy.h"
 #include "misc.h"
+#include "op.h"
 #include "path.h"
 #include "pslist.h"
 #include "random.h"
@@ -971,6 +972,88 @@ utf8_char_len_probe(const char *s)
 	return 0xE0 == uc ? 3 : 4;
 }
 
+#if CHAR_BIT == 8
+#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
+#else
+#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
+#endif
+
+/*
+ * Word-at-a-time scanning of ASCII runs, to quickly skip over the parts
+ * of queries and filenames that do not require any UTF-8 decoding.
+ */
+#define UTF8_ONEMASK	((op_t) -1 / 0xff)		/* 0x01010101 on 32-bit machine */
+#define UTF8_HIGHMASK	(UTF8_ONEMASK * 0x80)	/* 0x80808080 on 32-bit machine */
+
+#define UTF8_HAS_NUL_BYTE(x)	(((x) - UTF8_ONEMASK) & (~(x)) & UTF8_HIGHMASK)
+#define UTF8_HAS_HIGH_BYTE(x)	((x) & UTF8_HIGHMASK)
+
+/**
+ * Compute length of the leading ASCII run in a NUL-terminated string.
+ *
+ * Reading a whole aligned word can never cross a page boundary, hence
+ * it is safe to look at the bytes following the trailing NUL.
+ *
+ * @param s		the NUL-terminated string
+ *
+ * @return the amount of leading non-NUL ASCII characters.
+ */
+static inline size_t
+utf8_ascii_span(const char *s)
+{
+	const char *p = s;
+
+	while (!op_aligned(p)) {
+		if (!IS_NON_NUL_ASCII(p))
+			return p - s;
+		p++;
+	}
+
+	for (;;) {
+		op_t w = *(const op_t *) p;
+
+		if G_UNLIKELY(UTF8_HAS_HIGH_BYTE(w) || UTF8_HAS_NUL_BYTE(w))
+			break;
+		p += OPSIZ;
+	}
+
+	while (IS_NON_NUL_ASCII(p))
+		p++;
+
+	return p - s;
+}
+
+/**
+ * Compute length of the leading ASCII run in a buffer, NUL bytes included.
+ *
+ * @param s		the start of the buffer
+ * @param len	the length of the buffer
+ *
+ * @return the amount of leading ASCII characters, at most `len'.
+ */
+static inline size_t
+utf8_ascii_prefix(const char *s, size_t len)
+{
+	const char *p = s, *end = s + len;
+
+	while (p != end && !op_aligned(p)) {
+		if (0 != (*p & 0x80))
+			return p - s;
+		p++;
+	}
+
+	while (ptr_diff(end, p) >= OPSIZ) {
+		if G_UNLIKELY(UTF8_HAS_HIGH_BYTE(*(const op_t *) p))
+			break;
+		p += OPSIZ;
+	}
+
+	while (p != end && 0 == (*p & 0x80))
+		p++;
+
+	return p - s;
+}
+
 /**
  * Determine whether a string is UTF-8 encoded.
  *
@@ -981,12 +1064,17 @@ utf8_char_len_probe(const char *s)
 bool
 utf8_is_valid_string(const char *src)
 {
-	const char *s;
-	uint clen;
+	const char *s = src;
+
+	for (;;) {
+		uint clen;
 
-	for (s = src; '\0' != *s; s += clen) {
+		s += utf8_ascii_span(s);
+		if ('\0' == *s)
+			break;
 		if (0 == (clen = utf8_char_len(s)))
 			return FALSE;
+		s += clen;
 	}
 
 	return TRUE;
@@ -1004,6 +1092,12 @@ utf8_is_valid_data(const char *src, size_t len)
 	while (len > 0) {
 		size_t clen;
 
+		clen = utf8_ascii_prefix(src, len);
+		len -= clen;
+		src += clen;
+		if (0 == len)
+			break;
+
 		clen = utf8_skip(*src);
 		if (clen > len || 0 == utf8_char_len(src))
 			break;
@@ -2650,19 +2744,10 @@ charset_to_utf8(const char *cs, const char *src, size_t src_len)
 	return result;
 }
 
-#if CHAR_BIT == 8
-#define IS_NON_NUL_ASCII(p) (*(const int8 *) (p) > 0)
-#else
-#define IS_NON_NUL_ASCII(p) (!(*(p) & ~0x7f) && (*(p) > 0))
-#endif
-
 bool
 is_ascii_string(const char *s)
 {
-	while (IS_NON_NUL_ASCII(s))
-		++s;
-
-	return '\0' == *s;
+	return '\0' == s[utf8_ascii_span(s)];
 }
 
 static inline const char *
@@ -5672,6 +5757,105 @@ utf32_canonize(const uint32 *src0)
 	return dst;
 }
 
+/*
+ * Canonization of ASCII characters.
+ *
+ * Most queries and filenames are plain ASCII, for which utf32_canonize()
+ * boils down to case folding and filtering: no ASCII character has a
+ * decomposition and they all belong to the same Unicode block.  The outcome
+ * of these steps is precomputed for each ASCII character so that pure ASCII
+ * strings can be canonized in a single pass, without any UTF-32 conversion.
+ */
+enum utf8_ascii_canon {
+	UTF8_AC_SKIP = 0,		/**< Character is removed */
+	UTF8_AC_KEEP,			/**< Character is kept, after case folding */
+	UTF8_AC_CONTROL,		/**< Character is kept, space state unchanged */
+	UTF8_AC_SPACE			/**< Character is a space separator */
+};
+
+static struct utf8_ascii_canon_entry {
+	uint8 type;				/**< A UTF8_AC_* value */
+	char c;					/**< Case-folded character */
+} utf8_ascii_canon[0x80];
+
+/**
+ * Build the ASCII canonization table, from the general Unicode routines.
+ */
+static void G_COLD
+utf8_ascii_canon_init(void)
+{
+	uint32 c;
+
+	for (c = 1; c < N_ITEMS(utf8_ascii_canon); c++) {
+		struct utf8_ascii_canon_entry *e = &utf8_ascii_canon[c];
+		uint32 folded, uc;
+		size_t n;
+		bool space;
+
+		n = utf32_case_fold_char(c, &folded, 1);
+		g_assert(1 == n);
+		g_assert(folded < N_ITEMS(utf8_ascii_canon));
+		g_assert(NULL == utf32_decompose_lookup(folded, TRUE));
+		g_assert(utf32_block_id(folded) == utf32_block_id(0x20));
+
+		e->c = folded;
+		space = TRUE;
+		uc = utf32_filter_char(folded, &space, FALSE);
+
+		if (0 != uc) {
+			g_assert(uc == folded);
+			e->type = space ? UTF8_AC_CONTROL : UTF8_AC_KEEP;
+		} else {
+			space = FALSE;
+			uc = utf32_filter_char(folded, &space, FALSE);
+			g_assert(0 == uc || 0x20 == uc);
+			e->type = 0 == uc ? UTF8_AC_SKIP : UTF8_AC_SPACE;
+		}
+	}
+}
+
+/**
+ * Canonize a pure ASCII string, as utf32_canonize() would.
+ *
+ * @param src	the ASCII string
+ * @param len	the length of the string
+ *
+ * @return the canonized string, halloc()-ed.
+ */
+static char *
+utf8_canonize_ascii(const char *src, size_t len)
+{
+	bool space = TRUE;		/* prevent adding leading space */
+	char *dst, *p;
+	size_t i;
+
+	p = dst = halloc(len + 1);
+
+	for (i = 0; i < len; i++) {
+		const struct utf8_ascii_canon_entry *e =
+			&utf8_ascii_canon[(uchar) src[i]];
+
+		switch ((enum utf8_ascii_canon) e->type) {
+		case UTF8_AC_KEEP:
+			space = FALSE;
+			/* FALLTHRU */
+		case UTF8_AC_CONTROL:
+			*p++ = e->c;
+			break;
+		case UTF8_AC_SPACE:
+			if (!space && i + 1 != len)
+				*p++ = ' ';
+			space = TRUE;
+			break;
+		case UTF8_AC_SKIP:
+			break;
+		}
+	}
+	*p = '\0';
+
+	return dst;
+}
+
 /**
  * Apply the NFKD/NFC algo to have nomalized keywords (string is halloc()-ed)
  */
@@ -5679,9 +5863,14 @@ char *
 utf8_canonize(const char *src)
 {
 	uint32 *dst32;
+	size_t len;
 
 	g_assert(utf8_is_valid_string(src));
 
+	len = utf8_ascii_span(src);
+	if ('\0' == src[len] && unicode_compose_init_passed)
+		return utf8_canonize_ascii(src, len);
+
 	{
 		size_t n;
 		uint32 buf[1024];
@@ -5842,6 +6031,7 @@ unicode_compose_init(void)
 		}
 	}
 
+	utf8_ascii_canon_init();
 	unicode_compose_init_passed = TRUE;
 }
 
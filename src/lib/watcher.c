@@ -27,8 +27,23 @@
  *
  * File watcher.
  *
- * Periodically monitors file and invoke processing callback
- * should the file change.
+ * Monitors files and invokes a processing callback should the file change.
+ *
+ * When inotify is available, the directories holding the monitored files
+ * are watched and changes are reported as soon as the kernel notifies us.
+ * We watch the directory rather than the file itself so that files that
+ * are replaced by renaming a new version over them are still caught.
+ * Symbolic links are polled instead: their directory only reports changes
+ * to the link itself, not to the file it points to.
+ *
+ * Files we cannot watch that way are periodically checked for a change
+ * in their modification time, and the periodic check is only installed
+ * when there is at least one such file.
+ *
+ * Files can be registered from any thread, but the callbacks are always
+ * invoked from the main thread, which must also be the one initializing
+ * the layer via watcher_init().  Callbacks are invoked without holding
+ * any lock, hence they can register or unregister files.
  *
  * @author Raphael Manfredi
  * @date 2004
@@ -36,31 +51,61 @@
 
 #include "common.h"
 
+#ifdef HAS_INOTIFY
+#include <sys/inotify.h>
+#endif
+
 #include "watcher.h"
 
 #include "atoms.h"
 #include "cq.h"
+#include "fd.h"
 #include "halloc.h"
 #include "hikset.h"
+#include "hstrfn.h"
+#include "htable.h"
+#include "inputevt.h"
+#include "log.h"
+#include "mutex.h"
 #include "once.h"
 #include "path.h"
+#include "pslist.h"
 #include "walloc.h"
 
 #include "override.h"		/* Must be the last header included */
 
 #define MONITOR_PERIOD_MS	(30*1000)	/**< 30 seconds */
 
+struct watched_dir;
+
 /**
  * A monitored file.
  */
 struct monitored {
 	const char *filename;	/**< Filename to monitor */
+	const char *basename;	/**< Basename part of the filename */
 	time_t mtime;			/**< Last known modified time */
 	watcher_cb_t cb;		/**< Callback to invoke on change */
 	void *udata;			/**< User supplied data to hand-out to callback */
+	struct watched_dir *dir;	/**< Watched directory, NULL if polled */
+};
+
+/**
+ * A change detected whilst holding the lock, notified once it is released.
+ */
+struct watcher_change {
+	const char *filename;	/**< Changed file (atom) */
+	watcher_cb_t cb;		/**< Callback to invoke */
+	void *udata;			/**< User supplied data for the callback */
 };
 
 static hikset_t *monitored;	/**< filename -> struct monitored */
+static cperiodic_t *watcher_poll_ev;	/**< Periodic polling event */
+static size_t watcher_polled;			/**< Amount of polled files */
+static mutex_t watcher_mtx = MUTEX_INIT;
+
+#define WATCHER_LOCK		mutex_lock(&watcher_mtx)
+#define WATCHER_UNLOCK		mutex_unlock(&watcher_mtx)
 
 /**
  * Compute the modified time of the file on disk.
@@ -77,41 +122,415 @@ watcher_mtime(const char *filename)
 }
 
 /**
- * Check each registered file for change -- hash table iterator callback.
+ * Check file for change, recording it if it was modified.
+ *
+ * @param m			the monitored file
+ * @param changes	where detected changes are prepended
  */
 static void
-watcher_check_mtime(void *value, void *unused_udata)
+watcher_check_mtime(struct monitored *m, pslist_t **changes)
 {
-	struct monitored *m = value;
 	time_t new_mtime;
 
-	(void) unused_udata;
-
 	new_mtime = watcher_mtime(m->filename);
 
 	if (new_mtime > m->mtime) {
+		struct watcher_change *c;
+
 		m->mtime = new_mtime;
-		(*m->cb)(m->filename, m->udata);
+
+		WALLOC(c);
+		c->filename = atom_str_get(m->filename);
+		c->cb = m->cb;
+		c->udata = m->udata;
+		*changes = pslist_prepend(*changes, c);
 	}
 }
 
+/**
+ * Invoke the callbacks for the changes collected under the lock, which
+ * must no longer be held, and free the list.
+ *
+ * A callback can unregister other files, whose pending change is then
+ * dropped since their user data may be gone.
+ */
+static void
+watcher_notify(pslist_t *changes)
+{
+	pslist_t *sl;
+
+	g_assert(!mutex_is_owned(&watcher_mtx));
+
+	changes = pslist_reverse(changes);	/* Notify in detection order */
+
+	PSLIST_FOREACH(changes, sl) {
+		struct watcher_change *c = sl->data;
+		struct monitored *m;
+		bool valid;
+
+		WATCHER_LOCK;
+		m = hikset_lookup(monitored, c->filename);
+		valid = m != NULL && m->cb == c->cb && m->udata == c->udata;
+		WATCHER_UNLOCK;
+
+		if (valid)
+			(*c->cb)(c->filename, c->udata);
+
+		atom_str_free_null(&c->filename);
+		WFREE(c);
+	}
+
+	pslist_free(changes);
+}
+
+/**
+ * Check each polled file for change -- hash table iterator callback.
+ */
+static void
+watcher_poll_mtime(void *value, void *data)
+{
+	struct monitored *m = value;
+
+	if (NULL == m->dir)
+		watcher_check_mtime(m, data);
+}
+
 /**
  * Callout queue periodic event to perform periodic monitoring of the
- * registered files.
+ * registered files which cannot be watched otherwise.
  */
 static bool
 watcher_timer(void *unused_udata)
 {
+	pslist_t *changes = NULL;
+
 	(void) unused_udata;
 
 	if G_UNLIKELY(NULL == monitored)
 		return FALSE;	/* Stop calling, layer disabled */
 
-	hikset_foreach(monitored, watcher_check_mtime, NULL);
+	WATCHER_LOCK;
+	hikset_foreach(monitored, watcher_poll_mtime, &changes);
+	WATCHER_UNLOCK;
+
+	watcher_notify(changes);
 
 	return TRUE;		/* Keep calling */
 }
 
+/**
+ * Record that a new file has to be polled.
+ */
+static void
+watcher_poll_add(struct monitored *m)
+{
+	g_assert(NULL == m->dir);
+
+	if (0 == watcher_polled++) {
+		g_assert(NULL == watcher_poll_ev);
+		watcher_poll_ev =
+			cq_periodic_main_add(MONITOR_PERIOD_MS, watcher_timer, NULL);
+	}
+}
+
+/**
+ * Record that a file no longer has to be polled.
+ */
+static void
+watcher_poll_remove(struct monitored *m)
+{
+	g_assert(NULL == m->dir);
+	g_assert(watcher_polled != 0);
+
+	if (0 == --watcher_polled)
+		cq_periodic_remove(&watcher_poll_ev);
+}
+
+#ifdef HAS_INOTIFY
+
+#define WATCHER_INOTIFY_MASK	(IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB)
+
+/**
+ * A directory watched via inotify.
+ */
+struct watched_dir {
+	const char *path;		/**< Directory path (atom) */
+	pslist_t *files;		/**< Monitored files in that directory */
+	int wd;					/**< The inotify watch descriptor */
+};
+
+static int watcher_fd = -1;			/**< The inotify descriptor */
+static unsigned watcher_evid;		/**< I/O event ID for the descriptor */
+static hikset_t *watcher_dirs;		/**< path -> struct watched_dir */
+static htable_t *watcher_wds;		/**< wd -> struct watched_dir */
+
+/**
+ * Free watched directory, which must no longer hold any file.
+ */
+static void
+watcher_dir_free(struct watched_dir *d)
+{
+	g_assert(NULL == d->files);
+
+	if (hikset_lookup(watcher_dirs, d->path) == d)
+		hikset_remove(watcher_dirs, d->path);
+	htable_remove(watcher_wds, int_to_pointer(d->wd));
+	atom_str_free_null(&d->path);
+	WFREE(d);
+}
+
+/**
+ * Start watching the directory of the monitored file.
+ *
+ * @return TRUE if the file is now watched, FALSE if it must be polled.
+ */
+static bool
+watcher_inotify_add(struct monitored *m)
+{
+	struct watched_dir *d;
+	filestat_t buf;
+	char *path;
+
+	if (-1 == watcher_fd)
+		return FALSE;
+
+	/*
+	 * Changes made to the target of a symbolic link are reported in the
+	 * directory of the target, not in the one holding the link, and the
+	 * link can be changed to point elsewhere: poll it, stat() following
+	 * the link to the current target.
+	 */
+
+	if (0 == lstat(m->filename, &buf) && S_ISLNK(buf.st_mode))
+		return FALSE;
+
+	path = filepath_directory(m->filename);
+	if (NULL == path)
+		path = h_strdup(".");
+
+	d = hikset_lookup(watcher_dirs, path);
+
+	if (NULL == d) {
+		int wd = inotify_add_watch(watcher_fd, path, WATCHER_INOTIFY_MASK);
+
+		if (-1 == wd) {
+			s_warning("%s(): cannot watch \"%s\", will poll \"%s\": %m",
+				G_STRFUNC, path, m->filename);
+			HFREE_NULL(path);
+			return FALSE;
+		}
+
+		/*
+		 * The same directory can be reached through different paths,
+		 * in which case the kernel hands us the existing descriptor.
+		 */
+
+		d = htable_lookup(watcher_wds, int_to_pointer(wd));
+
+		if (NULL == d) {
+			WALLOC0(d);
+			d->path = atom_str_get(path);
+			d->wd = wd;
+			hikset_insert_key(watcher_dirs, &d->path);
+			htable_insert(watcher_wds, int_to_pointer(wd), d);
+		}
+	}
+
+	HFREE_NULL(path);
+
+	d->files = pslist_prepend(d->files, m);
+	m->dir = d;
+
+	return TRUE;
+}
+
+/**
+ * Stop watching monitored file.
+ */
+static void
+watcher_inotify_remove(struct monitored *m)
+{
+	struct watched_dir *d = m->dir;
+
+	g_assert(d != NULL);
+
+	d->files = pslist_remove(d->files, m);
+	m->dir = NULL;
+
+	if (NULL == d->files) {
+		inotify_rm_watch(watcher_fd, d->wd);
+		watcher_dir_free(d);
+	}
+}
+
+/**
+ * Check all the watched files, after an event queue overflow.
+ */
+static void
+watcher_inotify_check_all(void *value, void *data)
+{
+	struct monitored *m = value;
+
+	if (m->dir != NULL)
+		watcher_check_mtime(m, data);
+}
+
+/**
+ * Handle event on a watched directory.
+ *
+ * @param ev		the inotify event
+ * @param changes	where detected changes are prepended
+ */
+static void
+watcher_inotify_event(const struct inotify_event *ev, pslist_t **changes)
+{
+	struct watched_dir *d;
+	const pslist_t *sl;
+
+	if G_UNLIKELY(ev->mask & IN_Q_OVERFLOW) {
+		hikset_foreach(monitored, watcher_inotify_check_all, changes);
+		return;
+	}
+
+	d = htable_lookup(watcher_wds, int_to_pointer(ev->wd));
+	if (NULL == d)
+		return;		/* Watch already removed */
+
+	/*
+	 * If the directory itself went away, fall back to polling its files.
+	 */
+
+	if G_UNLIKELY(ev->mask & IN_IGNORED) {
+		pslist_t *files = d->files;
+
+		d->files = NULL;
+		watcher_dir_free(d);
+
+		PSLIST_FOREACH(files, sl) {
+			struct monitored *m = sl->data;
+
+			m->dir = NULL;
+			watcher_poll_add(m);
+		}
+		pslist_free_null(&files);
+		return;
+	}
+
+	if (0 == ev->len)
+		return;
+
+	PSLIST_FOREACH(d->files, sl) {
+		struct monitored *m = sl->data;
+
+		if (0 == strcmp(m->basename, ev->name)) {
+			watcher_check_mtime(m, changes);
+			break;
+		}
+	}
+}
+
+/**
+ * I/O callback invoked when the inotify descriptor is readable.
+ */
+static void
+watcher_inotify_read(void *unused_data, int fd, inputevt_cond_t cond)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	pslist_t *changes = NULL;
+
+	(void) unused_data;
+
+	if G_UNLIKELY(cond & INPUT_EVENT_EXCEPTION) {
+		s_warning("%s(): exception on inotify descriptor", G_STRFUNC);
+		return;
+	}
+
+	WATCHER_LOCK;
+
+	for (;;) {
+		ssize_t r = read(fd, u.buf, sizeof u.buf);
+		const char *p, *end;
+
+		if (r <= 0)
+			break;
+
+		end = &u.buf[r];
+
+		for (p = u.buf; p < end; /* empty */) {
+			const struct inotify_event *ev = (const void *) p;
+
+			watcher_inotify_event(ev, &changes);
+			p += sizeof *ev + ev->len;
+		}
+	}
+
+	WATCHER_UNLOCK;
+
+	watcher_notify(changes);
+}
+
+/**
+ * Initialize inotify support.
+ */
+static void
+watcher_inotify_init(void)
+{
+	watcher_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (-1 == watcher_fd) {
+		s_warning("%s(): cannot initialize inotify, will poll files: %m",
+			G_STRFUNC);
+		return;
+	}
+
+	watcher_dirs = hikset_create(
+		offsetof(struct watched_dir, path), HASH_KEY_STRING, 0);
+	watcher_wds = htable_create(HASH_KEY_SELF, 0);
+	watcher_evid = inputevt_add(watcher_fd, INPUT_EVENT_RX,
+		watcher_inotify_read, NULL);
+}
+
+/**
+ * Shutdown inotify support, once all the files have been removed.
+ */
+static void
+watcher_inotify_close(void)
+{
+	if (-1 == watcher_fd)
+		return;
+
+	g_assert(0 == hikset_count(watcher_dirs));
+
+	inputevt_remove(&watcher_evid);
+	fd_close(&watcher_fd);
+	hikset_free_null(&watcher_dirs);
+	htable_free_null(&watcher_wds);
+}
+
+#else	/* !HAS_INOTIFY */
+
+static inline bool
+watcher_inotify_add(struct monitored *m)
+{
+	(void) m;
+	return FALSE;
+}
+
+static inline void
+watcher_inotify_remove(struct monitored *m)
+{
+	(void) m;
+	g_assert_not_reached();
+}
+
+static inline void watcher_inotify_init(void) {}
+static inline void watcher_inotify_close(void) {}
+
+#endif	/* HAS_INOTIFY */
+
 /**
  * Register new file to be monitored.
  *
@@ -132,16 +551,24 @@ watcher_register(const char *filename, watcher_cb_t cb, void *udata)
 
 	watcher_init();		/* Auto-initialization */
 
+	WATCHER_LOCK;
+
+	if (hikset_contains(monitored, filename))
+		watcher_unregister(filename);
+
 	WALLOC0(m);
 	m->filename = atom_str_get(filename);
+	m->basename = filepath_basename(m->filename);
 	m->cb = cb;
 	m->udata = udata;
 	m->mtime = watcher_mtime(filename);
 
-	if (hikset_contains(monitored, filename))
-		watcher_unregister(filename);
+	if (!watcher_inotify_add(m))
+		watcher_poll_add(m);
 
 	hikset_insert_key(monitored, &m->filename);
+
+	WATCHER_UNLOCK;
 }
 
 /**
@@ -167,6 +594,11 @@ watcher_register_path(const file_path_t *fp, watcher_cb_t cb, void *udata)
 static void
 watcher_free(struct monitored *m)
 {
+	if (m->dir != NULL)
+		watcher_inotify_remove(m);
+	else
+		watcher_poll_remove(m);
+
 	atom_str_free(m->filename);
 	WFREE(m);
 }
@@ -182,12 +614,16 @@ watcher_unregister(const char *filename)
 	g_return_unless(monitored != NULL);
 	g_assert(filename != NULL);
 
+	WATCHER_LOCK;
+
 	m = hikset_lookup(monitored, filename);
 
 	g_assert(m != NULL);
 
 	hikset_remove(monitored, m->filename);
 	watcher_free(m);
+
+	WATCHER_UNLOCK;
 }
 
 /**
@@ -214,7 +650,7 @@ watcher_init_once(void)
 {
 	monitored = hikset_create(
 		offsetof(struct monitored, filename), HASH_KEY_STRING, 0);
-	cq_periodic_main_add(MONITOR_PERIOD_MS, watcher_timer, NULL);
+	watcher_inotify_init();
 }
 
 /**
@@ -246,8 +682,11 @@ free_monitored_kv(void *value, void *unused_udata)
 void
 watcher_close(void)
 {
+	WATCHER_LOCK;
 	hikset_foreach(monitored, free_monitored_kv, NULL);
 	hikset_free_null(&monitored);
+	watcher_inotify_close();
+	WATCHER_UNLOCK;
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -35,6 +35,7 @@
 
 #include "wordvec.h"
 
+#include "arena.h"
 #include "halloc.h"
 #include "hstrfn.h"
 #include "htable.h"
@@ -107,26 +108,39 @@ word_vec_zrealloc(word_vec_t *wv, int ncount)
 }
 
 /**
- * Given a query string, return a dynamically built word vector, along
- * with the amount of items held into that vector.
- * Words are broken on non-alphanumeric boundaries.
+ * Build the word vector for a query string.
  *
- * @returns the amount of valid items in the built vector, and fill `wovec'
- * with the pointer to the allocated vector.  If there are no items, there
- * is no vector returned.
+ * When an arena is supplied, both the vector and the words are allocated
+ * from it and nothing needs to be freed by the caller: words point within
+ * a copy of the query made in the arena.  Otherwise, everything is
+ * allocated from the heap and must be released with word_vec_free().
+ *
+ * @param ar		the arena to allocate from (NULL for the heap)
+ * @param query_str	the query string
+ * @param wovec		where the allocated vector is returned
+ *
+ * @returns the amount of valid items in the built vector.
  */
-uint
-word_vec_make(const char *query_str, word_vec_t **wovec)
+static uint
+word_vec_build(arena_t *ar, const char *query_str, word_vec_t **wovec)
 {
 	uint n = 0;
 	htable_t *seen_word = NULL;
 	uint nv = WOVEC_DFLT;
-	word_vec_t *wv = zalloc(wovec_zone);
+	word_vec_t *wv;
 	const char *start = NULL;
-	char * const query_dup = h_strdup(query_str);
+	char *query_dup;
 	char *query;
 	uchar c;
 
+	if (ar != NULL) {
+		ARENA_ALLOC_ARRAY(ar, wv, nv);
+		query_dup = arena_strdup(ar, query_str);
+	} else {
+		wv = zalloc(wovec_zone);
+		query_dup = h_strdup(query_str);
+	}
+
 	g_assert(wovec != NULL);
 
 	for (query = query_dup; /* empty */; query++) {
@@ -179,15 +193,23 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 
 				if G_UNLIKELY(n == nv) {		/* Filled all the slots */
 					nv *= 2;
-					if (n > WOVEC_DFLT)
+					if (ar != NULL) {
+						word_vec_t *owv = wv;
+						ARENA_ALLOC_ARRAY(ar, wv, nv);
+						memcpy(wv, owv, n * sizeof wv[0]);
+					} else if (n > WOVEC_DFLT)
 						HREALLOC_ARRAY(wv, nv);
 					else
 						wv = word_vec_zrealloc(wv, nv);
 				}
 				entry = &wv[n++];
 				entry->len = query - start;
-				entry->word = walloc(entry->len + 1);	/* For trailing NUL */
-				memcpy(entry->word, start, entry->len + 1); /* Includes NUL */
+				if (ar != NULL) {
+					entry->word = deconstify_char(start);	/* In arena */
+				} else {
+					entry->word = walloc(entry->len + 1);	/* For NUL */
+					memcpy(entry->word, start, entry->len + 1); /* With NUL */
+				}
 
 				entry->amount = 1;
 
@@ -207,6 +229,12 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 	}
 
 	htable_free_null(&seen_word);	/* Key pointers belong to vector */
+
+	if (ar != NULL) {
+		*wovec = n != 0 ? wv : NULL;
+		return n;
+	}
+
 	if (n)
 		*wovec = wv;
 	else
@@ -215,6 +243,35 @@ word_vec_make(const char *query_str, word_vec_t **wovec)
 	return n;
 }
 
+/**
+ * Given a query string, return a dynamically built word vector, along
+ * with the amount of items held into that vector.
+ * Words are broken on non-alphanumeric boundaries.
+ *
+ * @returns the amount of valid items in the built vector, and fill `wovec'
+ * with the pointer to the allocated vector.  If there are no items, there
+ * is no vector returned.
+ */
+uint
+word_vec_make(const char *query_str, word_vec_t **wovec)
+{
+	return word_vec_build(NULL, query_str, wovec);
+}
+
+/**
+ * Same as word_vec_make() but allocate everything from the given arena.
+ *
+ * The returned vector must NOT be freed via word_vec_free(): it is released
+ * along with the arena scope in which it was built.
+ */
+uint
+word_vec_arena_make(arena_t *ar, const char *query_str, word_vec_t **wovec)
+{
+	g_assert(ar != NULL);
+
+	return word_vec_build(ar, query_str, wovec);
+}
+
 /**
  * Release a word vector, containing `n' items.
  */
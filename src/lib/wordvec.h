@@ -49,7 +49,11 @@ typedef struct {				/**< Query word vector */
 void word_vec_init(void);
 void word_vec_close(void);
 
+struct arena;
+
 uint word_vec_make(const char *query, word_vec_t **wovec);
+uint word_vec_arena_make(struct arena *ar,
+	const char *query, word_vec_t **wovec);
 void word_vec_free(word_vec_t *wovec, uint n);
 
 #endif	/* _wordvec_h_ */
@@ -7028,6 +7028,23 @@ xmalloc_stats_digest(sha1_t *digest)
 	SHA1_COMPUTE_NONCE(xstats, &n, digest);
 }
 
+/**
+ * Fetch the allocation counters, for profiling purposes.
+ *
+ * @param allocations	if non-NULL, set to the total amount of allocations
+ * @param memory		if non-NULL, set to the user memory currently allocated
+ */
+void
+xmalloc_usage(uint64 *allocations, size_t *memory)
+{
+	XSTATS_LOCK;
+	if (allocations != NULL)
+		*allocations = xstats.allocations;
+	if (memory != NULL)
+		*memory = xstats.user_memory;
+	XSTATS_UNLOCK;
+}
+
 /**
  * Dump xmalloc usage statistics to specified logging agent.
  */
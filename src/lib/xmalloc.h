@@ -171,6 +171,7 @@ void xmalloc_dump_freelist_log(struct logagent *la);
 size_t xmalloc_freelist_check(struct logagent *la, unsigned flags);
 
 void xmalloc_stats_digest(struct sha1 *digest);
+void xmalloc_usage(uint64 *allocations, size_t *memory);
 
 void xgc(void);
 void xmalloc_long_term(void);
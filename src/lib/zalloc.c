@@ -4013,6 +4013,23 @@ zalloc_stats_digest(sha1_t *digest)
 	SHA1_COMPUTE_NONCE(zstats, &n, digest);
 }
 
+/**
+ * Fetch the allocation counters, for profiling purposes.
+ *
+ * @param allocations	if non-NULL, set to the total amount of allocations
+ * @param memory		if non-NULL, set to the user memory currently allocated
+ */
+void
+zalloc_usage(uint64 *allocations, size_t *memory)
+{
+	ZSTATS_LOCK;
+	if (allocations != NULL)
+		*allocations = zstats.allocations;
+	if (memory != NULL)
+		*memory = zstats.user_memory;
+	ZSTATS_UNLOCK;
+}
+
 /**
  * Dump zone status to specified log agent.
  */
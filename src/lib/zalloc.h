@@ -100,6 +100,7 @@ void zgc(bool overloaded);
 void zalloc_long_term(void);
 
 void zalloc_stats_digest(struct sha1 *digest);
+void zalloc_usage(uint64 *allocations, size_t *memory);
 
 void zinit(void);
 void zclose(void);
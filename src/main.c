@@ -71,6 +71,7 @@
 #include "core/hosts.h"
 #include "core/hsep.h"
 #include "core/http.h"
+#include "core/huge.h"
 #include "core/ignore.h"
 #include "core/inet.h"
 #include "core/ipp_cache.h"
@@ -135,6 +136,7 @@
 #include "lib/inputevt.h"
 #include "lib/iso3166.h"
 #include "lib/launch.h"
+#include "lib/loader.h"
 #include "lib/log.h"
 #include "lib/map.h"
 #include "lib/mem.h"
@@ -146,6 +148,7 @@
 #include "lib/palloc.h"
 #include "lib/parse.h"
 #include "lib/patricia.h"
+#include "lib/phaseprof.h"
 #include "lib/pattern.h"
 #include "lib/pow2.h"
 #include "lib/product.h"
@@ -186,6 +189,7 @@
 #include "upnp/upnp.h"
 
 #include "xml/vxml.h"
+#include "xml/vxpull.h"
 
 #include "ui/gtk/gui.h"
 
@@ -251,6 +255,7 @@ enum main_arg {
 	main_arg_gdb_on_crash,
 	main_arg_geometry,
 	main_arg_help,
+	main_arg_log_startup_profile,
 	main_arg_log_stderr,
 	main_arg_log_stdout,
 	main_arg_log_supervise,
@@ -314,6 +319,8 @@ static struct option {
 #endif	/* HAS_FORK */
 	OPTION(geometry,		TEXT, "Placement of the main GUI window."),
 	OPTION(help, 			NONE, "Print this message."),
+	OPTION(log_startup_profile, NONE,
+		"Log startup and shutdown profiling reports."),
 	OPTION(log_stderr,		PATH, "Log standard output to a file."),
 	OPTION(log_stdout,		PATH, "Log standard error output to a file."),
 	OPTION(log_supervise,	PATH, "Log for the supervisor process."),
@@ -663,6 +670,20 @@ handle_user_shutdown_request(enum shutdown_mode mode)
 	}
 }
 
+/**
+ * End the profiling of a phase, appending its profile to the history and
+ * logging it when --log-startup-profile was given.
+ */
+static void G_COLD
+main_profile_end(phaseprof_phase_t phase)
+{
+	phaseprof_end(phase);
+	phaseprof_history_save(phase, settings_config_dir());
+
+	if (OPT(log_startup_profile))
+		phaseprof_report_log(phase, log_agent_stderr_get());
+}
+
 /**
  * Exit program, return status `exit_code' to parent process.
  *
@@ -675,6 +696,8 @@ gtk_gnutella_exit(int exit_code)
 	static volatile sig_atomic_t safe_to_exit;
 	time_t exit_time = time(NULL);
 	time_delta_t exit_grace = EXIT_GRACE;
+	phaseprof_mark_t exit_mark;
+	bool exit_profiling = TRUE;
 	bool byeall =
 		!(shutdown_requested && (shutdown_user_flags & GTKG_SHUTDOWN_OFAST));
 	bool crashing =
@@ -699,12 +722,24 @@ gtk_gnutella_exit(int exit_code)
 	}
 
 	exiting = TRUE;
+	phaseprof_begin(PHASEPROF_SHUTDOWN);
+	ZERO(&exit_mark);
+
+	/*
+	 * Until the shutdown profile is complete, the resources used by each
+	 * step are recorded.  We stop before the final cleanup sequence, which
+	 * tears down the memory layers.
+	 */
 
 #define DO(fn) 	do {					\
 	exit_step = STRINGIFY(fn);			\
 	if (GNET_PROPERTY(shutdown_debug))	\
 		g_debug("SHUTDOWN calling %s", exit_step);	\
+	if (exit_profiling)					\
+		phaseprof_mark(&exit_mark);		\
 	fn();								\
+	if (exit_profiling)					\
+		phaseprof_record(PHASEPROF_SHUTDOWN, STRINGIFY(fn), &exit_mark); \
 } while (0)
 
 #define DO_BOOL(fn, arg)	do {			\
@@ -713,7 +748,11 @@ gtk_gnutella_exit(int exit_code)
 		g_debug("SHUTDOWN calling %s(%s)",	\
 			exit_step, (arg) ? "TRUE" : "FALSE"); \
 	}										\
+	if (exit_profiling)						\
+		phaseprof_mark(&exit_mark);			\
 	fn(arg);								\
+	if (exit_profiling)						\
+		phaseprof_record(PHASEPROF_SHUTDOWN, STRINGIFY(fn), &exit_mark); \
 } while (0)
 
 	DO(socket_shutdowning);			/* We're about to shutdown for good */
@@ -838,6 +877,9 @@ gtk_gnutella_exit(int exit_code)
 
 	DO(settings_shutdown);
 
+	main_profile_end(PHASEPROF_SHUTDOWN);
+	exit_profiling = FALSE;
+
 	/*
 	 * Show total CPU used, and the amount spent in user / kernel, before
 	 * we start the grace period...
@@ -2196,10 +2238,84 @@ main_command_line(void)
 #define GTA_REVISION NULL
 #endif
 
+/**
+ * Initialize the core layers, loading back their persisted state.
+ *
+ * This is a dependency graph: the routines flagged LOADER_F_THREAD only
+ * fill their own data structures and run in the background worker pool,
+ * concurrently with the others, which run in the main thread in the
+ * order they are listed here.  The routines using the data structures
+ * filled by a threaded loader must declare it as a dependency.
+ */
+static void G_COLD
+main_load_state(void)
+{
+	loader_t *ld = loader_make("startup");
+
+	loader_profile(ld, PHASEPROF_STARTUP);
+
+	loader_add(ld, "geo-ip", gip_init, LOADER_F_THREAD, NULL);
+	loader_add(ld, "bogons", bogons_init, LOADER_F_THREAD, NULL);
+	loader_add(ld, "sha1-cache", huge_load_cache, LOADER_F_THREAD, NULL);
+
+	loader_add(ld, "upload-stats", upload_stats_load_history, 0, NULL);
+	loader_add(ld, "ipp-cache", ipp_cache_load_all, 0, NULL);
+	loader_add(ld, "tls", tls_global_init, 0, NULL);
+	loader_add(ld, "pmsg", pmsg_init, 0, NULL);
+	loader_add(ld, "hostiles", hostiles_init, 0, NULL);
+	loader_add(ld, "spam", spam_init, 0, NULL);
+	loader_add(ld, "guid", guid_init, 0, NULL);
+	loader_add(ld, "uhc", uhc_init, 0, NULL);
+	loader_add(ld, "ghc", ghc_init, 0, NULL);
+	loader_add(ld, "gwc", gwc_init, 0, NULL);
+	loader_add(ld, "verify-sha1", verify_sha1_init, 0, NULL);
+	loader_add(ld, "verify-tth", verify_tth_init, 0, NULL);
+	loader_add(ld, "move", move_init, 0, NULL);
+	loader_add(ld, "ignore", ignore_init, 0, NULL);
+	loader_add(ld, "word-vec", word_vec_init, 0, NULL);
+
+	loader_add(ld, "fileinfo", file_info_init, 0, NULL);
+	loader_add(ld, "host", host_init, 0, "geo-ip", "bogons", NULL);
+	loader_add(ld, "gmsg", gmsg_init, 0, NULL);
+	loader_add(ld, "bsched", bsched_init, 0, NULL);
+	loader_add(ld, "dump", dump_init, 0, NULL);
+	loader_add(ld, "node", node_init, 0, NULL);
+	loader_add(ld, "g2-node", g2_node_init, 0, NULL);
+	loader_add(ld, "hcache", hcache_retrieve_all, 0,	/* after node_init() */
+		"node", NULL);
+	loader_add(ld, "routing", routing_init, 0, NULL);
+	loader_add(ld, "search", search_init, 0, NULL);
+	loader_add(ld, "share", share_init, 0, "sha1-cache", NULL);
+	loader_add(ld, "dmesh", dmesh_init, 0, NULL);	/* BEFORE download_init() */
+	loader_add(ld, "download", download_init, 0, "fileinfo", "dmesh", NULL);
+	loader_add(ld, "upload", upload_init, 0, NULL);
+	loader_add(ld, "shell", shell_init, 0, NULL);
+	loader_add(ld, "ban", ban_init, 0, NULL);
+	loader_add(ld, "whitelist", whitelist_init, 0, NULL);
+	loader_add(ld, "extensions", ext_init, 0, NULL);
+	loader_add(ld, "inet", inet_init, 0, NULL);
+	loader_add(ld, "crc", crc_init, 0, NULL);
+	loader_add(ld, "parq", parq_init, 0, NULL);
+	loader_add(ld, "hsep", hsep_init, 0, NULL);
+	loader_add(ld, "clock", clock_init, 0, NULL);
+	loader_add(ld, "dq", dq_init, 0, NULL);
+	loader_add(ld, "dh", dh_init, 0, NULL);
+	loader_add(ld, "sq", sq_init, 0, NULL);
+	loader_add(ld, "gdht", gdht_init, 0, NULL);
+	loader_add(ld, "pdht", pdht_init, 0, NULL);
+	loader_add(ld, "publisher", publisher_init, 0, NULL);
+	loader_add(ld, "guess", guess_init, 0, NULL);
+	loader_add(ld, "dht", dht_init, 0, NULL);
+
+	loader_run(ld);
+	loader_free_null(&ld);
+}
+
 int
 main(int argc, char **argv)
 {
 	size_t str_discrepancies;
+	phaseprof_mark_t pm;
 	int dflt_pattern = PATTERN_INIT_PROGRESS | PATTERN_INIT_SELECTED;
 	bool supervisor = FALSE;
 
@@ -2306,6 +2422,8 @@ main(int argc, char **argv)
 	/* At this point, vmm_alloc(), halloc() and zalloc() are up */
 
 	tm_init(TRUE);
+	phaseprof_begin(PHASEPROF_STARTUP);
+	phaseprof_mark(&pm);
 
 	signal_set(SIGINT, SIG_IGN);	/* ignore SIGINT in adns (e.g. for gdb) */
 #ifdef SIGHUP
@@ -2441,6 +2559,8 @@ main(int argc, char **argv)
 	crash_setccdate(__DATE__);
 	crash_setcctime(__TIME__);
 	crash_post_init();		/* Done with crash initialization */
+	phaseprof_record(PHASEPROF_STARTUP, "early-init", &pm);
+	phaseprof_mark(&pm);
 
 	/* Our regular inits */
 
@@ -2517,6 +2637,9 @@ main(int argc, char **argv)
 	hcache_init();			/* before settings_init() */
 	bsched_early_init();	/* before settings_init() */
 	ipp_cache_init();		/* before settings_init() */
+	phaseprof_record(PHASEPROF_STARTUP, "core-init", &pm);
+
+	phaseprof_mark(&pm);
 	settings_init(OPT(resume_session));
 
 	/*
@@ -2526,6 +2649,7 @@ main(int argc, char **argv)
 
 	xmalloc_post_init();	/* after settings_init() */
 	vmm_post_init();		/* after settings_init() */
+	phaseprof_record(PHASEPROF_STARTUP, "settings", &pm);
 
 	if (debugging(0) || is_running_on_mingw())
 		stacktrace_load_symbols();
@@ -2546,58 +2670,11 @@ main(int argc, char **argv)
 		main_gui_disable_ancient(OPT(no_expire));
 	}
 
-	upload_stats_load_history();	/* Loads the upload statistics */
-
 	map_test();
-	ipp_cache_load_all();
-	tls_global_init();
-	pmsg_init();
-	hostiles_init();
-	spam_init();
-	bogons_init();
-	gip_init();
-	guid_init();
-	uhc_init();
-	ghc_init();
-	gwc_init();
-	verify_sha1_init();
-	verify_tth_init();
-	move_init();
-	ignore_init();
-	word_vec_init();
-
-	file_info_init();
-	host_init();
-	gmsg_init();
-	bsched_init();
-	dump_init();
-	node_init();
-	g2_node_init();
-    hcache_retrieve_all();	/* after settings_init() and node_init() */
-	routing_init();
-	search_init();
-	share_init();
-	dmesh_init();			/* MUST be done BEFORE download_init() */
-	download_init();		/* MUST be done AFTER file_info_init() */
-	upload_init();
-	shell_init();
-	ban_init();
-	whitelist_init();
-	ext_init();
-	inet_init();
-	crc_init();
-	parq_init();
-	hsep_init();
-	clock_init();
-	dq_init();
-	dh_init();
-	sq_init();
-	gdht_init();
-	pdht_init();
-	publisher_init();
-	guess_init();
-
-	dht_init();
+	watcher_init();			/* Before any file is registered by a loader */
+	main_load_state();
+
+	phaseprof_mark(&pm);
 	upnp_post_init();
 
 	if (!running_topless) {
@@ -2607,6 +2684,8 @@ main(int argc, char **argv)
 	file_info_init_post();
 	download_restore_state();
 	ntp_init();
+	phaseprof_record(PHASEPROF_STARTUP, "post-init", &pm);
+	main_profile_end(PHASEPROF_STARTUP);
 	random_added_listener_add(settings_add_randomness);
 
 	/* Some signal handlers */
@@ -2637,6 +2716,7 @@ main(int argc, char **argv)
 	dht_attempt_bootstrap();
 	http_test();
 	vxml_test();
+	vxpull_test();
 	g2_tree_test();
 
 	if (OPT(topless))
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "latency" command.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "lib/ascii.h"
+#include "lib/latprof.h"
+#include "lib/parse.h"
+#include "lib/pslist.h"
+#include "lib/str.h"
+#include "lib/stringify.h"		/* For compact_time() */
+#include "lib/tm.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define LATENCY_SHOW_COUNT	20	/**< Default amount of routines listed */
+
+/**
+ * Sort latency information by decreasing worst run time.
+ */
+static int
+latency_max_cmp(const void *a, const void *b)
+{
+	const latprof_info_t *la = a, *lb = b;
+
+	return CMP(lb->max, la->max);
+}
+
+/**
+ * Sort latency information by decreasing total run time.
+ */
+static int
+latency_total_cmp(const void *a, const void *b)
+{
+	const latprof_info_t *la = a, *lb = b;
+
+	return CMP(lb->total, la->total);
+}
+
+static enum shell_reply
+shell_exec_latency_show(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *opt_n, *opt_t;
+	const option_t options[] = {
+		{ "n:", &opt_n },
+		{ "t", &opt_t },
+	};
+	int parsed;
+	uint i, count = LATENCY_SHOW_COUNT;
+	pslist_t *info, *sl;
+	str_t *s;
+	time_t now;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	if (opt_n != NULL) {
+		int error;
+
+		count = parse_uint(opt_n, NULL, 10, &error);
+		if (error) {
+			shell_set_formatted(sh, "Invalid count \"%s\"", opt_n);
+			return REPLY_ERROR;
+		}
+	}
+
+	info = latprof_info_list();
+	info = pslist_sort(info, NULL == opt_t ? latency_max_cmp : latency_total_cmp);
+
+	s = str_new(80);
+
+	shell_write(sh, "100~\n");
+	str_printf(s, "Latency profiling is %s\n",
+		latprof_is_enabled() ? "on" : "off");
+	shell_write(sh, str_2c(s));
+	shell_write(sh, "Kind     Calls     Avg-us    Max-us    Ago   "
+		" <10us    <100us   <1ms     <10ms    <100ms   <1s      >=1s    "
+		" Routine\n");
+
+	now = tm_time();
+	i = 0;
+
+	PSLIST_FOREACH(info, sl) {
+		latprof_info_t *li = sl->data;
+		uint j;
+
+		latprof_info_check(li);
+
+		if (i++ >= count)
+			break;
+
+		str_printf(s, "%-8s ", latprof_kind_to_string(li->kind));
+		str_catf(s, "%-9s ", uint64_to_string(li->count));
+		str_catf(s, "%-9s ",
+			uint64_to_string(0 == li->count ? 0 : li->total / li->count));
+		str_catf(s, "%-9lu ", li->max);
+		str_catf(s, "%-5s ", compact_time(delta_time(now, li->max_stamp)));
+		for (j = 0; j < LATPROF_BUCKETS; j++)
+			str_catf(s, " %-8s", uint64_to_string(li->hist[j]));
+		str_catf(s, " %s()\n", li->name);
+		shell_write(sh, str_2c(s));
+	}
+
+	str_destroy_null(&s);
+	latprof_info_list_free_null(&info);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
+/**
+ * Handles the latency command.
+ */
+enum shell_reply
+shell_exec_latency(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc < 2)
+		return REPLY_ERROR;
+
+	if (0 == ascii_strcasecmp(argv[1], "on")) {
+		latprof_enable(TRUE);
+		return REPLY_READY;
+	} else if (0 == ascii_strcasecmp(argv[1], "off")) {
+		latprof_enable(FALSE);
+		return REPLY_READY;
+	} else if (0 == ascii_strcasecmp(argv[1], "reset")) {
+		latprof_reset();
+		return REPLY_READY;
+	} else if (0 == ascii_strcasecmp(argv[1], "show")) {
+		return shell_exec_latency_show(sh, argc - 1, argv + 1);
+	}
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_latency(void)
+{
+	return "Callout and background task latency profiling";
+}
+
+const char *
+shell_help_latency(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		if (0 == ascii_strcasecmp(argv[1], "show")) {
+			return "latency show [-t] [-n count]\n"
+				"show run time statistics of profiled callbacks, worst first\n"
+				"-n: amount of routines to show (default is 20)\n"
+				"-t: sort by total run time instead\n";
+		}
+		if (
+			0 == ascii_strcasecmp(argv[1], "on") ||
+			0 == ascii_strcasecmp(argv[1], "off")
+		) {
+			return "latency on|off\n"
+				"turn profiling of callouts and task steps on or off\n";
+		}
+		if (0 == ascii_strcasecmp(argv[1], "reset")) {
+			return "latency reset\n"
+				"clear all the statistics collected so far\n";
+		}
+	} else {
+		return "latency on|off|reset\n"
+			"latency show [-t] [-n count]\n";
+	}
+	return NULL;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,499 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "metrics" command.
+ *
+ * Dumps internal counters and gauges using the Prometheus text exposition
+ * format, so that they can be scraped periodically by monitoring tools
+ * without having to parse the human-readable output of other commands.
+ *
+ * All metric names are prefixed with "gtkg_".  Counters that are still
+ * zero are omitted for the per-message-type series, to keep the output
+ * small: the value of missing series should be taken as 0.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/bsched.h"
+#include "core/gnet_stats.h"
+#include "core/mq.h"
+#include "core/nodes.h"
+
+#include "lib/ascii.h"
+#include "lib/cq.h"
+#include "lib/log.h"
+#include "lib/pslist.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/thread.h"
+#include "lib/vmm.h"
+#include "lib/xmalloc.h"
+#include "lib/zalloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define METRICS_PREFIX	"gtkg_"
+
+/**
+ * Emit the "# HELP" and "# TYPE" lines introducing a metric.
+ */
+static void
+metrics_header(str_t *s, const char *name, const char *type, const char *help)
+{
+	str_catf(s, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+	str_catf(s, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+/**
+ * Append label value to string, escaping it as required by the format.
+ */
+static void
+metrics_label(str_t *s, const char *value)
+{
+	const char *p = value;
+	int c;
+
+	while ((c = *p++)) {
+		if ('"' == c || '\\' == c)
+			str_putc(s, '\\');
+		if ('\n' == c)
+			STR_CAT(s, "\\n");
+		else
+			str_putc(s, c);
+	}
+}
+
+/**
+ * Emit a sample with one label.
+ */
+static void
+metrics_sample(str_t *s, const char *name,
+	const char *label, const char *value, uint64 v)
+{
+	str_catf(s, METRICS_PREFIX "%s{%s=\"", name, label);
+	metrics_label(s, value);
+	str_catf(s, "\"} %s\n", uint64_to_string(v));
+}
+
+/**
+ * Emit a sample with two labels.
+ */
+static void
+metrics_sample2(str_t *s, const char *name,
+	const char *label1, const char *value1,
+	const char *label2, const char *value2, uint64 v)
+{
+	str_catf(s, METRICS_PREFIX "%s{%s=\"", name, label1);
+	metrics_label(s, value1);
+	str_catf(s, "\",%s=\"", label2);
+	metrics_label(s, value2);
+	str_catf(s, "\"} %s\n", uint64_to_string(v));
+}
+
+/**
+ * Emit a sample with no label.
+ */
+static void
+metrics_value(str_t *s, const char *name, uint64 v)
+{
+	str_catf(s, METRICS_PREFIX "%s %s\n", name, uint64_to_string(v));
+}
+
+/**
+ * Gnutella message statistics, from gnet_stats.
+ */
+static void
+metrics_gnet(str_t *s)
+{
+	static const char *proto[] = { "tcp", "udp" };
+	gnet_stats_t *stats;
+	uint i, j;
+
+	/*
+	 * Statistics are large, allocate them on the heap.
+	 */
+
+	XMALLOC_ARRAY(stats, N_ITEMS(proto));
+
+	gnet_stats_get(&stats[0]);
+	metrics_header(s, "general", "untyped", "General statistics counters.");
+	for (i = 0; i < GNR_TYPE_COUNT; i++) {
+		metrics_sample(s, "general", "name",
+			gnet_stats_general_to_string(i), stats[0].general[i]);
+	}
+
+	gnet_stats_tcp_get(&stats[0]);
+	gnet_stats_udp_get(&stats[1]);
+
+#define MSG_STATS(metric, kind, field, help) G_STMT_START {					\
+	metrics_header(s, metric, "counter", help);								\
+	for (j = 0; j < N_ITEMS(proto); j++) {									\
+		for (i = 0; i < MSG_TYPE_COUNT; i++) {								\
+			uint64 v = stats[j].kind.field[i];								\
+			if (0 == v)														\
+				continue;													\
+			metrics_sample2(s, metric, "proto", proto[j],					\
+				"type", gnet_msg_type_description(i), v);					\
+		}																	\
+	}																		\
+} G_STMT_END
+
+#define MSG_STATS2(field, help) G_STMT_START {								\
+	MSG_STATS("messages_" #field "_total", pkg, field, help);				\
+	MSG_STATS("messages_" #field "_bytes_total", byte, field, help);		\
+} G_STMT_END
+
+	MSG_STATS2(received, "Messages received.");
+	MSG_STATS2(generated, "Messages generated locally.");
+	MSG_STATS2(relayed, "Messages relayed.");
+	MSG_STATS2(dropped, "Messages dropped.");
+	MSG_STATS2(expired, "Messages expired.");
+
+#undef MSG_STATS
+#undef MSG_STATS2
+
+	metrics_header(s, "messages_drop_reason_total", "counter",
+		"Messages dropped, by reason.");
+	for (j = 0; j < N_ITEMS(proto); j++) {
+		for (i = 0; i < MSG_DROP_REASON_COUNT; i++) {
+			metrics_sample2(s, "messages_drop_reason_total",
+				"proto", proto[j],
+				"reason", gnet_stats_drop_reason_name(i),
+				stats[j].drop_reason[i][MSG_TOTAL]);
+		}
+	}
+
+	XFREE_NULL(stats);
+}
+
+/**
+ * Message processing latency, as summaries in seconds.
+ */
+static void
+metrics_latency(str_t *s)
+{
+	static const uint pct[] = { 50, 90, 99 };
+	gnet_latency_stats_t *stats;
+	uint i, j;
+
+	XMALLOC(stats);
+	gnet_stats_latency_get(stats);
+
+	metrics_header(s, "message_latency_seconds", "summary",
+		"Message processing time.");
+
+	for (i = 0; i < MSG_TYPE_COUNT; i++) {
+		const gnet_latency_t *lat = &stats->msg[i];
+		const char *type = gnet_msg_type_description(i);
+
+		if (0 == lat->count)
+			continue;
+
+		for (j = 0; j < N_ITEMS(pct); j++) {
+			str_catf(s, METRICS_PREFIX "message_latency_seconds{type=\"");
+			metrics_label(s, type);
+			str_catf(s, "\",quantile=\"0.%02u\"} %.9f\n", pct[j],
+				gnet_latency_percentile(lat, pct[j]) / 1e9);
+		}
+		str_catf(s, METRICS_PREFIX "message_latency_seconds_sum{type=\"");
+		metrics_label(s, type);
+		str_catf(s, "\"} %.9f\n", lat->total / 1e9);
+		metrics_sample(s, "message_latency_seconds_count", "type", type,
+			lat->count);
+	}
+
+	XFREE_NULL(stats);
+}
+
+/**
+ * Bandwidth schedulers.
+ */
+static void
+metrics_bsched(str_t *s)
+{
+	uint i;
+
+#define BSCHED(name, type, help, expr) G_STMT_START {		\
+	metrics_header(s, name, type, help);					\
+	for (i = 0; i < NUM_BSCHED_BWS; i++) {					\
+		metrics_sample(s, name, "sched", bsched_name(i), expr);	\
+	}														\
+} G_STMT_END
+
+	BSCHED("bandwidth_bytes_total", "counter",
+		"Bytes transferred through scheduler.", bsched_bytes(i));
+	BSCHED("bandwidth_bytes_per_second", "gauge",
+		"Bandwidth used during last period.", bsched_bps(i));
+	BSCHED("bandwidth_avg_bytes_per_second", "gauge",
+		"Average bandwidth used.", bsched_avg_bps(i));
+	BSCHED("bandwidth_limit_bytes_per_second", "gauge",
+		"Configured bandwidth.", bsched_bw_per_second(i));
+	BSCHED("bandwidth_saturated", "gauge",
+		"Whether scheduler is saturated.", bsched_saturated(i));
+
+#undef BSCHED
+}
+
+/**
+ * Message queues of the connected nodes and of the UDP layer.
+ */
+static void
+metrics_mq(str_t *s)
+{
+	static const enum net_type nets[] = { NET_TYPE_IPV4, NET_TYPE_IPV6 };
+	const pslist_t *sl;
+	uint64 queues = 0, bytes = 0, messages = 0, max_bytes = 0;
+	uint64 flowc = 0, swift = 0;
+	uint i;
+
+	PSLIST_FOREACH(node_all_nodes(), sl) {
+		const gnutella_node_t *n = sl->data;
+		const mqueue_t *q = n->outq;
+		uint64 size;
+
+		node_check(n);
+
+		if (NULL == q)
+			continue;
+
+		size = mq_size(q);
+		queues++;
+		bytes += size;
+		messages += mq_count(q);
+		max_bytes = MAX(max_bytes, size);
+		if (mq_is_flow_controlled(q))
+			flowc++;
+		if (mq_is_swift_controlled(q))
+			swift++;
+	}
+
+	metrics_header(s, "node_queues", "gauge",
+		"Amount of node TX queues.");
+	metrics_value(s, "node_queues", queues);
+	metrics_header(s, "node_queue_bytes", "gauge",
+		"Bytes held in node TX queues.");
+	metrics_value(s, "node_queue_bytes", bytes);
+	metrics_header(s, "node_queue_messages", "gauge",
+		"Messages held in node TX queues.");
+	metrics_value(s, "node_queue_messages", messages);
+	metrics_header(s, "node_queue_max_bytes", "gauge",
+		"Bytes held in the largest node TX queue.");
+	metrics_value(s, "node_queue_max_bytes", max_bytes);
+	metrics_header(s, "node_queue_flow_controlled", "gauge",
+		"Node TX queues in flow-control.");
+	metrics_value(s, "node_queue_flow_controlled", flowc);
+	metrics_header(s, "node_queue_swift_controlled", "gauge",
+		"Node TX queues in swift mode.");
+	metrics_value(s, "node_queue_swift_controlled", swift);
+
+	metrics_header(s, "udp_queue_bytes", "gauge",
+		"Bytes held in UDP TX queues.");
+	for (i = 0; i < N_ITEMS(nets); i++) {
+		const mqueue_t *q = node_udp_get_outq(nets[i]);
+
+		if (q != NULL) {
+			metrics_sample(s, "udp_queue_bytes", "net",
+				net_type_to_string(nets[i]), mq_size(q));
+		}
+	}
+	metrics_header(s, "udp_queue_flow_controlled", "gauge",
+		"Whether UDP TX queue is in flow-control.");
+	for (i = 0; i < N_ITEMS(nets); i++) {
+		const mqueue_t *q = node_udp_get_outq(nets[i]);
+
+		if (q != NULL) {
+			metrics_sample(s, "udp_queue_flow_controlled", "net",
+				net_type_to_string(nets[i]), mq_is_flow_controlled(q));
+		}
+	}
+}
+
+typedef void (*metrics_dump_cb_t)(logagent_t *la, unsigned options);
+
+/**
+ * Convert the "name = value" lines logged by one of the statistics
+ * dumping routines into samples.
+ *
+ * @param s			the string where samples are appended
+ * @param name		metric name, the statistic name becoming its label
+ * @param help		description of the metric
+ * @param cb		the statistics dumping routine
+ * @param prefix	the prefix of each line logged by the routine
+ */
+static void
+metrics_dump(str_t *s, const char *name, const char *help,
+	metrics_dump_cb_t cb, const char *prefix)
+{
+	logagent_t *la = log_agent_string_make(0, prefix);
+	const char *p;
+
+	(*cb)(la, 0);
+	metrics_header(s, name, "untyped", help);
+
+	for (p = log_agent_string_get(la); *p != '\0'; /* empty */) {
+		const char *eol = vstrchr(p, '\n');
+		const char *key, *val;
+		size_t klen, vlen;
+
+		if (NULL == eol)
+			eol = p + vstrlen(p);
+
+		key = skip_ascii_blanks(p);
+		for (klen = 0; is_ascii_ident(key[klen]); klen++)
+			/* empty */;
+
+		val = skip_ascii_blanks(key + klen);
+		if (klen != 0 && '=' == *val) {
+			val = skip_ascii_blanks(val + 1);
+			for (vlen = 0; is_ascii_digit(val[vlen]); vlen++)
+				/* empty */;
+
+			if (vlen != 0 && val + vlen == eol) {
+				str_catf(s, METRICS_PREFIX "%s{stat=\"%.*s\"} %.*s\n",
+					name, (int) klen, key, (int) vlen, val);
+			}
+		}
+
+		p = '\0' == *eol ? eol : eol + 1;
+	}
+
+	log_agent_free_null(&la);
+}
+
+/**
+ * Callout queues.
+ */
+static void
+metrics_cq(str_t *s)
+{
+	pslist_t *info, *sl;
+
+	info = cq_info_list();
+
+#define CQ(metric, type, help, field) G_STMT_START {	\
+	metrics_header(s, metric, type, help);				\
+	PSLIST_FOREACH(info, sl) {							\
+		const cq_info_t *cqi = sl->data;				\
+		cq_info_check(cqi);								\
+		metrics_sample(s, metric, "queue", cqi->name, cqi->field);	\
+	}													\
+} G_STMT_END
+
+	CQ("cq_events", "gauge", "Events registered in callout queue.",
+		event_count);
+	CQ("cq_periodic_events", "gauge", "Periodic events in callout queue.",
+		periodic_count);
+	CQ("cq_idle_events", "gauge", "Idle events in callout queue.",
+		idle_count);
+	CQ("cq_heartbeats_total", "counter", "Callout queue heartbeats.",
+		heartbeat_count);
+	CQ("cq_triggered_total", "counter", "Callout queue triggered events.",
+		triggered_count);
+
+#undef CQ
+
+	cq_info_list_free_null(&info);
+}
+
+/**
+ * Thread counts.
+ */
+static void
+metrics_thread(str_t *s)
+{
+	metrics_header(s, "threads", "gauge", "Amount of running threads.");
+	metrics_value(s, "threads", thread_count());
+	metrics_header(s, "threads_discovered", "gauge",
+		"Amount of discovered threads.");
+	metrics_value(s, "threads_discovered", thread_discovered_count());
+}
+
+/**
+ * Dump metrics in the Prometheus text exposition format.
+ */
+enum shell_reply
+shell_exec_metrics(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	str_t *s;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	if (argc > 1) {
+		shell_set_formatted(sh, "Unexpected argument \"%s\"", argv[1]);
+		return REPLY_ERROR;
+	}
+
+	s = str_new(64 * 1024);
+
+	metrics_gnet(s);
+	metrics_latency(s);
+	metrics_bsched(s);
+	metrics_mq(s);
+	metrics_cq(s);
+	metrics_thread(s);
+
+	metrics_dump(s, "thread_stats", "Thread runtime statistics.",
+		thread_dump_stats_log, "THREAD ");
+	metrics_dump(s, "vmm_stats", "Virtual memory statistics.",
+		vmm_dump_stats_log, "VMM ");
+	metrics_dump(s, "xmalloc_stats", "Memory allocator statistics.",
+		xmalloc_dump_stats_log, "XM ");
+	metrics_dump(s, "zalloc_stats", "Zone allocator statistics.",
+		zalloc_dump_stats_log, "ZALLOC ");
+
+	shell_write(sh, "100~\n");
+	shell_write(sh, str_2c(s));
+	shell_write(sh, ".\n");
+
+	str_destroy_null(&s);
+	return REPLY_READY;
+}
+
+const char *
+shell_summary_metrics(void)
+{
+	return "Dump metrics for time-series scraping";
+}
+
+const char *
+shell_help_metrics(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	return "metrics\n"
+		"dumps internal statistics using the Prometheus text format.\n";
+}
+
+/* vi: set ts=4 sw=4 cindent: */
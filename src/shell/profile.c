@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup shell
+ * @file
+ *
+ * The "profile" command.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cmd.h"
+
+#include "core/settings.h"
+
+#include "lib/ascii.h"
+#include "lib/log.h"
+#include "lib/phaseprof.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+/**
+ * Display the startup profile of the running process.
+ */
+static enum shell_reply
+shell_exec_profile_startup(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	logagent_t *la;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	la = log_agent_string_make(0, NULL);
+	phaseprof_report_log(PHASEPROF_STARTUP, la);
+	shell_write(sh, "100~\n");
+	shell_write(sh, log_agent_string_get(la));
+	shell_write(sh, ".\n");
+	log_agent_free_null(&la);
+
+	return REPLY_READY;
+}
+
+/**
+ * Display the startup and shutdown profiles of the previous runs.
+ */
+static enum shell_reply
+shell_exec_profile_history(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	logagent_t *la;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	la = log_agent_string_make(0, NULL);
+	phaseprof_history_log(settings_config_dir(), la);
+	shell_write(sh, "100~\n");
+	shell_write(sh, log_agent_string_get(la));
+	shell_write(sh, ".\n");
+	log_agent_free_null(&la);
+
+	return REPLY_READY;
+}
+
+/**
+ * Display startup profiling information.
+ */
+enum shell_reply
+shell_exec_profile(struct gnutella_shell *sh, int argc, const char *argv[])
+{
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	/*
+	 * The "startup" string is optional.
+	 */
+
+	if (argc < 2)
+		return shell_exec_profile_startup(sh, argc, argv);
+
+#define CMD(name) G_STMT_START { \
+	if (0 == ascii_strcasecmp(argv[1], #name)) \
+		return shell_exec_profile_ ## name(sh, argc - 1, argv + 1); \
+} G_STMT_END
+
+	CMD(startup);
+	CMD(history);
+
+#undef CMD
+
+	shell_set_formatted(sh, _("Unknown operation \"%s\""), argv[1]);
+	return REPLY_ERROR;
+}
+
+const char *
+shell_summary_profile(void)
+{
+	return "Show startup and shutdown profiles";
+}
+
+const char *
+shell_help_profile(int argc, const char *argv[])
+{
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	return "profile [startup]\n"
+		"prints the wall-clock and CPU time, I/O and allocations of each\n"
+		"startup step of the running process.\n"
+		"profile history\n"
+		"prints the startup and shutdown profiles of the previous runs.\n";
+}
+
+/* vi: set ts=4 sw=4 cindent: */
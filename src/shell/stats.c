@@ -38,6 +38,7 @@
 
 #include "lib/ascii.h"
 #include "lib/options.h"
+#include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/teq.h"
 #include "lib/xmalloc.h"
@@ -191,6 +192,114 @@ shell_exec_stats_drop(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+static void *
+stats_latency_get_trampoline(void *s)
+{
+	gnet_stats_latency_get(s);
+	return NULL;
+}
+
+/**
+ * Format latency given in nanoseconds into buffer, using the most
+ * appropriate unit.
+ *
+ * @return the buffer.
+ */
+static const char *
+stats_latency_to_buf(uint64 ns, char *dst, size_t size)
+{
+	if (ns < 10000)
+		str_bprintf(dst, size, "%uns", (uint) ns);
+	else if (ns < UINT64_CONST(10000000))
+		str_bprintf(dst, size, "%uus", (uint) (ns / 1000));
+	else if (ns < UINT64_CONST(10000000000))
+		str_bprintf(dst, size, "%ums", (uint) (ns / 1000000));
+	else
+		str_bprintf(dst, size, "%us", (uint) (ns / 1000000000));
+
+	return dst;
+}
+
+#define STATS_LATENCY_FMT	"%-20s %10s %7s %7s %7s %7s %7s\n"
+
+/**
+ * Display one line of the latency statistics.
+ */
+static void
+stats_latency_show(struct gnutella_shell *sh,
+	const char *name, const gnet_latency_t *lat)
+{
+	char avg[16], p50[16], p90[16], p99[16], max[16];
+	char buf[128];
+
+	g_assert(lat->count != 0);
+
+	str_bprintf(ARYLEN(buf), STATS_LATENCY_FMT,
+		name, uint64_to_string(lat->count),
+		stats_latency_to_buf(lat->total / lat->count, ARYLEN(avg)),
+		stats_latency_to_buf(gnet_latency_percentile(lat, 50), ARYLEN(p50)),
+		stats_latency_to_buf(gnet_latency_percentile(lat, 90), ARYLEN(p90)),
+		stats_latency_to_buf(gnet_latency_percentile(lat, 99), ARYLEN(p99)),
+		stats_latency_to_buf(lat->max, ARYLEN(max)));
+
+	shell_write(sh, buf);
+}
+
+static enum shell_reply
+shell_exec_stats_latency(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *vendor;
+	const option_t options[] = {
+		{ "v", &vendor },		/* also show vendor messages */
+	};
+	int parsed;
+	uint i;
+	gnet_latency_stats_t *stats;
+	char buf[128];
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	/*
+	 * Latency statistics are only updated by the main thread, without
+	 * locks, so we need to fetch them from there.  The structure is
+	 * allocated on the heap since it is large.
+	 */
+
+	XMALLOC(stats);
+	(void) teq_rpc(THREAD_MAIN_ID, stats_latency_get_trampoline, stats);
+
+	str_bprintf(ARYLEN(buf), STATS_LATENCY_FMT,
+		"Message", "Count", "Avg", "p50", "p90", "p99", "Max");
+	shell_write(sh, "100~\n");
+	shell_write(sh, buf);
+
+	for (i = 0; i < MSG_TYPE_COUNT; i++) {
+		const gnet_latency_t *lat = &stats->msg[i];
+
+		if (0 == lat->count)
+			continue;
+
+		stats_latency_show(sh, gnet_msg_type_description(i), lat);
+	}
+
+	if (vendor != NULL) {
+		for (i = 0; i < stats->vmsg_count; i++)
+			stats_latency_show(sh, stats->vmsg[i].name, &stats->vmsg[i].lat);
+	}
+
+	shell_write(sh, ".\n");
+
+	XFREE_NULL(stats);
+	return REPLY_READY;
+}
+
 /**
  * Handle the stats command.
  */
@@ -213,6 +322,7 @@ shell_exec_stats(struct gnutella_shell *sh, int argc, const char *argv[])
 
 	CMD(general);
 	CMD(drop);
+	CMD(latency);
 
 #undef CMD
 
@@ -245,10 +355,18 @@ shell_help_stats(int argc, const char *argv[])
 				"-t : only show TCP messages.\n"
 				"-u : only show UDP messages.\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "latency")) {
+			return "stats latency [-v]\n"
+				"prints message processing latency: count, average, "
+				"50th, 90th\nand 99th percentiles, and maximum time "
+				"spent, per message type.\n"
+				"-v : also show latency per vendor message.\n";
+		}
 	} else {
 		return
 			"stats [general] [-p]\n"
 			"stats drop [-ptu]\n"
+			"stats latency [-v]\n"
 			;
 	}
 	return NULL;
@@ -45,9 +45,11 @@
 
 #include "if/core/search.h"
 
+#include "lib/acmatch.h"
 #include "lib/atoms.h"
 #include "lib/cstr.h"
 #include "lib/halloc.h"
+#include "lib/hset.h"
 #include "lib/hstrfn.h"
 #include "lib/parse.h"
 #include "lib/str.h"
@@ -95,6 +97,10 @@ struct filter_context {
 	size_t l_len;				/**< Length of lower-cased representation */
 	const gchar *utf8_name;		/**< Normalized UTF-8 version of name; atom */
 	size_t utf8_len;			/**< Length of UTF-8 name representation */
+	guint32 stamp;				/**< Record stamp in the filter engine */
+	guint scanned:1;			/**< Whether text automata were run */
+	guint sha1_checked:1;		/**< Whether SHA1 set was probed */
+	guint sha1_known:1;			/**< Whether SHA1 is referenced by rules */
 };
 
 /*
@@ -102,6 +108,7 @@ struct filter_context {
  */
 void filter_remove_rule(filter_t *f, rule_t *r);
 static void filter_free(filter_t *f);
+static void filter_prog_free(filter_t *f);
 
 /**
  * Public variables.
@@ -382,6 +389,8 @@ shadow_commit(shadow_t *shadow)
     shadow_filters = g_list_remove(shadow_filters, shadow);
     WFREE(shadow);
 
+    filter_invalidate();
+
     if (GUI_PROPERTY(gui_debug) >= 6) {
         g_debug("after commit filter looks like this");
         dump_filter(realf);
@@ -850,6 +859,7 @@ filter_apply_changes(void)
 
     g_list_free(filters);
     filters = g_list_copy(filters_current);
+    filter_invalidate();
 
     /*
      * Remove the SHADOW flag from all added filters
@@ -1293,6 +1303,7 @@ filter_new_for_search(struct search *s)
      */
     filters = g_list_append(filters, f);
     filters_current = g_list_append(filters_current, f);
+    filter_invalidate();
 
     /*
      * Crosslink filter and search
@@ -1375,6 +1386,9 @@ filter_free(filter_t *f)
 	G_LIST_FOREACH_SWAPPED(copy, filter_remove_rule, f);
 	g_list_free(copy);
 
+	filter_prog_free(f);
+	filter_invalidate();
+
 	atom_str_free_null(&f->name);
 	WFREE(f);
 }
@@ -1390,6 +1404,8 @@ filter_free_rule(rule_t *r)
     if (GUI_PROPERTY(gui_debug) >= 6)
         g_debug("freeing rule: %s", filter_rule_to_string(r));
 
+    filter_invalidate();		/* Compiled filters may refer to the rule */
+
     switch (r->type) {
     case RULE_TEXT:
         HFREE_NULL(r->u.text.match);
@@ -1471,6 +1487,7 @@ filter_add_rule(filter_t *f, rule_t * const r, filter_add_rule_func_t func)
 #else
     f->ruleset = (*func)(f->ruleset, r);
 #endif
+    filter_invalidate();
     r->target->refcount ++;
     if (GUI_PROPERTY(gui_debug) >= 6)
         g_debug("increased refcount on \"%s\" to %d",
@@ -1657,8 +1674,10 @@ filter_remove_rule(filter_t *f, rule_t *r)
     if (in_shadow_removed && (shadow != NULL))
        shadow->removed = g_list_remove(shadow->removed, r);
 
-    if (in_filter)
+    if (in_filter) {
         f->ruleset = g_list_remove(f->ruleset, r);
+        filter_invalidate();
+    }
 
     /*
      * Now we need to clean up the refcounts that may have been
@@ -2046,6 +2065,705 @@ filter_adapt_order(void)
 #endif /* USE_GTK2 */
 
 
+/***
+ *** Compiled filter engine.
+ ***/
+
+/*
+ * Filtering a record used to walk the GList of rules of each filter and
+ * run each rule matcher in turn, scanning the filename again for each text
+ * rule and resolving the rule target at each match.
+ *
+ * Each filter is now compiled into a program: a flat array of operations
+ * whose target is resolved up front.  All the text rules that can be
+ * expressed as literals (substring, words, prefix, suffix or exact match)
+ * share two Aho-Corasick automata, one for case-sensitive rules scanning the
+ * UTF-8 filename and one for the others scanning the lower-cased filename,
+ * so that each record is scanned at most twice whatever the amount of text
+ * rules.  SHA1 rules are fronted by a set of all the SHA1s used in rules.
+ *
+ * Rules are still visited in order to preserve the semantics of the filter
+ * chain and the per-rule statistics, but each visit is now a constant-time
+ * check, except for regular expressions.
+ *
+ * The compiled state is invalidated by filter_invalidate() whenever filters
+ * or rules are changed, and lazily rebuilt when the next record is filtered.
+ * The "active" and "negate" flags of rules and filters are not compiled and
+ * can therefore be changed freely.
+ */
+
+enum filter_action {
+	FILTER_A_JUMP = 0,			/**< Jump to sub-filter */
+	FILTER_A_SHOW,				/**< Display record */
+	FILTER_A_DROP,				/**< Hide record */
+	FILTER_A_DOWNLOAD,			/**< Download record */
+	FILTER_A_NODOWNLOAD,		/**< Do not download record */
+	FILTER_A_RETURN				/**< Return from filter */
+};
+
+enum filter_lit_kind {
+	FILTER_LIT_SUBSTR = 0,		/**< Literal can be anywhere */
+	FILTER_LIT_WORD,			/**< One of the words, anywhere */
+	FILTER_LIT_PREFIX,			/**< Literal must start the name */
+	FILTER_LIT_SUFFIX,			/**< Literal must end the name */
+	FILTER_LIT_EXACT			/**< Literal must be the whole name */
+};
+
+#define FILTER_SLOT_NONE	((guint32) -1)	/**< Rule not in the automata */
+#define FILTER_WORDS_MAX	32				/**< Max words in the automata */
+
+/**
+ * A literal registered in one of the text automata.
+ */
+struct filter_lit {
+	guint32 slot;				/**< Text slot of the rule */
+	guint32 len;				/**< Length of the literal */
+	guint8 word;				/**< Word index, for FILTER_LIT_WORD */
+	guint8 kind;				/**< enum filter_lit_kind */
+};
+
+/**
+ * A compiled rule.
+ */
+struct filter_op {
+	rule_t *rule;				/**< The rule */
+	filter_t *target;			/**< Sub-filter, for FILTER_A_JUMP */
+	guint32 slot;				/**< Text slot or SHA1 indexing, if not NONE */
+	guint32 want;				/**< Text slot bits required to match */
+	enum filter_action action;	/**< Resolved action */
+};
+
+/**
+ * A compiled filter.
+ */
+struct filter_prog {
+	guint32 generation;			/**< Engine generation when compiled */
+	size_t count;				/**< Amount of operations */
+	struct filter_op *ops;		/**< Operations, in rule order */
+};
+
+/**
+ * The filter engine, holding the state shared by all the compiled filters.
+ */
+static struct filter_engine {
+	guint32 generation;			/**< Bumped by filter_invalidate() */
+	guint32 compiled;			/**< Generation of compiled state */
+	guint32 stamp;				/**< Current record stamp */
+	acmatch_t *cs;				/**< Automaton for case-sensitive rules */
+	acmatch_t *ci;				/**< Automaton for case-insensitive rules */
+	hset_t *sha1;				/**< SHA1s referenced by rules */
+	struct filter_lit *lits;	/**< Literals held in the automata */
+	size_t lits_count;			/**< Amount of literals */
+	size_t lits_max;			/**< Allocated literals */
+	guint32 *seen;				/**< Record stamp, per text slot */
+	guint32 *bits;				/**< Matched literal bits, per text slot */
+	size_t slots;				/**< Amount of text slots */
+} filter_engine = { 1, 0, 0, NULL, NULL, NULL, NULL, 0, 0, NULL, NULL, 0 };
+
+/**
+ * Record that filters or rules were changed and that compiled filters
+ * must be rebuilt before being used.
+ */
+void
+filter_invalidate(void)
+{
+	filter_engine.generation++;
+}
+
+/**
+ * Free the compiled program of a filter.
+ */
+static void
+filter_prog_free(filter_t *f)
+{
+	struct filter_prog *prog = f->prog;
+
+	if (prog != NULL) {
+		HFREE_NULL(prog->ops);
+		WFREE(prog);
+		f->prog = NULL;
+	}
+}
+
+/**
+ * Release all the state shared by the compiled filters.
+ */
+static void
+filter_engine_reset(void)
+{
+	struct filter_engine *fe = &filter_engine;
+
+	acmatch_free_null(&fe->cs);
+	acmatch_free_null(&fe->ci);
+	hset_free_null(&fe->sha1);
+	HFREE_NULL(fe->lits);
+	HFREE_NULL(fe->seen);
+	HFREE_NULL(fe->bits);
+	fe->lits_count = fe->lits_max = 0;
+	fe->slots = 0;
+	fe->stamp = 0;
+}
+
+/**
+ * Register literal in the proper text automaton.
+ */
+static void
+filter_engine_add_lit(gboolean case_sensitive, const char *text, size_t len,
+	guint32 slot, enum filter_lit_kind kind, guint8 word)
+{
+	struct filter_engine *fe = &filter_engine;
+	struct filter_lit *lit;
+	acmatch_t **am;
+
+	g_assert(len != 0);
+
+	if (fe->lits_count == fe->lits_max) {
+		fe->lits_max = MAX(16, fe->lits_max * 2);
+		HREALLOC_ARRAY(fe->lits, fe->lits_max);
+	}
+
+	lit = &fe->lits[fe->lits_count];
+	lit->slot = slot;
+	lit->len = len;
+	lit->word = word;
+	lit->kind = kind;
+
+	am = case_sensitive ? &fe->cs : &fe->ci;
+
+	if (NULL == *am)
+		*am = acmatch_make(FALSE);
+
+	acmatch_add(*am, text, len, GUINT_TO_POINTER(fe->lits_count));
+	fe->lits_count++;
+}
+
+/**
+ * Register text rule in the automata, if possible.
+ *
+ * @param op		the operation for the text rule
+ * @param index		whether we can register the rule in the automata
+ */
+static void
+filter_op_compile_text(struct filter_op *op, gboolean index)
+{
+	const rule_t *r = op->rule;
+	gboolean cs = r->u.text.case_sensitive;
+	enum filter_lit_kind kind;
+	guint32 slot;
+
+	op->slot = FILTER_SLOT_NONE;
+
+	if (!index)
+		return;
+
+	switch (r->u.text.type) {
+	case RULE_TEXT_SUBSTR:	kind = FILTER_LIT_SUBSTR; break;
+	case RULE_TEXT_PREFIX:	kind = FILTER_LIT_PREFIX; break;
+	case RULE_TEXT_SUFFIX:	kind = FILTER_LIT_SUFFIX; break;
+	case RULE_TEXT_EXACT:	kind = FILTER_LIT_EXACT; break;
+	case RULE_TEXT_WORDS:
+		{
+			guint n = g_list_length(r->u.text.u.words);
+			const GList *l;
+			guint8 i = 0;
+
+			if (0 == n || n > FILTER_WORDS_MAX)
+				return;			/* Evaluated directly */
+
+			for (l = r->u.text.u.words; l != NULL; l = g_list_next(l)) {
+				if (0 == pattern_len(l->data))
+					return;		/* Empty word, evaluated directly */
+			}
+
+			slot = filter_engine.slots++;
+
+			for (l = r->u.text.u.words; l != NULL; l = g_list_next(l)) {
+				const cpattern_t *pat = l->data;
+
+				filter_engine_add_lit(cs, pattern_string(pat),
+					pattern_len(pat), slot, FILTER_LIT_WORD, i++);
+			}
+
+			op->slot = slot;
+			op->want = (FILTER_WORDS_MAX == n) ?
+				(guint32) -1 : (1U << n) - 1;
+		}
+		return;
+	case RULE_TEXT_REGEXP:
+	default:
+		return;					/* Evaluated directly */
+	}
+
+	if (0 == r->u.text.match_len)
+		return;					/* Empty literal, evaluated directly */
+
+	slot = filter_engine.slots++;
+	filter_engine_add_lit(cs, r->u.text.match, r->u.text.match_len,
+		slot, kind, 0);
+
+	op->slot = slot;
+	op->want = 1;
+}
+
+/**
+ * Compile filter into a program.
+ *
+ * @param f			the filter to compile
+ * @param index		whether rules can be registered in the shared indexes
+ */
+static void
+filter_prog_compile(filter_t *f, gboolean index)
+{
+	struct filter_prog *prog;
+	const GList *l;
+	size_t i = 0;
+
+	filter_prog_free(f);
+
+	WALLOC0(prog);
+	prog->generation = filter_engine.generation;
+	prog->count = g_list_length(f->ruleset);
+	HALLOC0_ARRAY(prog->ops, MAX(1, prog->count));
+
+	for (l = f->ruleset; l != NULL; l = g_list_next(l)) {
+		struct filter_op *op = &prog->ops[i++];
+		rule_t *r = l->data;
+
+		op->rule = r;
+		op->slot = FILTER_SLOT_NONE;
+
+		if (r->target == filter_return) {
+			op->action = FILTER_A_RETURN;
+		} else if (r->target == filter_show) {
+			op->action = FILTER_A_SHOW;
+		} else if (r->target == filter_drop) {
+			op->action = FILTER_A_DROP;
+		} else if (r->target == filter_download) {
+			op->action = FILTER_A_DOWNLOAD;
+		} else if (r->target == filter_nodownload) {
+			op->action = FILTER_A_NODOWNLOAD;
+		} else {
+			op->action = FILTER_A_JUMP;
+			op->target = r->target;
+		}
+
+		switch (r->type) {
+		case RULE_TEXT:
+			filter_op_compile_text(op, index);
+			break;
+		case RULE_SHA1:
+			if (index && r->u.sha1.hash != NULL) {
+				if (NULL == filter_engine.sha1)
+					filter_engine.sha1 = hset_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
+				hset_insert(filter_engine.sha1, r->u.sha1.hash);
+				op->slot = 0;		/* SHA1 is in the set */
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	g_assert(i == prog->count);
+
+	f->prog = prog;
+}
+
+/**
+ * Compile filter if not already done for the current generation.
+ */
+static void
+filter_engine_compile_filter(void *data, void *unused_udata)
+{
+	filter_t *f = data;
+
+	(void) unused_udata;
+
+	if (NULL == f->prog || f->prog->generation != filter_engine.generation)
+		filter_prog_compile(f, TRUE);
+}
+
+/**
+ * Make sure the compiled state is up-to-date, rebuilding it as needed.
+ */
+static void
+filter_engine_sync(void)
+{
+	struct filter_engine *fe = &filter_engine;
+
+	if G_LIKELY(fe->compiled == fe->generation)
+		return;
+
+	filter_engine_reset();
+
+	/*
+	 * The filters on which filtering happens are the committed ones, which
+	 * include the search filters and the global filters.
+	 */
+
+	g_list_foreach(filters, filter_engine_compile_filter, NULL);
+
+	if (fe->cs != NULL)
+		acmatch_compile(fe->cs);
+	if (fe->ci != NULL)
+		acmatch_compile(fe->ci);
+
+	if (fe->slots != 0) {
+		HALLOC0_ARRAY(fe->seen, fe->slots);
+		HALLOC0_ARRAY(fe->bits, fe->slots);
+	}
+
+	fe->compiled = fe->generation;
+
+	if (GUI_PROPERTY(gui_debug) >= 5) {
+		g_debug("%s(): compiled filters: %zu text literal%s in %zu slot%s, "
+			"%zu SHA1%s", G_STRFUNC, PLURAL(fe->lits_count), PLURAL(fe->slots),
+			PLURAL(NULL == fe->sha1 ? 0 : hset_count(fe->sha1)));
+	}
+}
+
+/**
+ * Free the compiled program of a filter, as a list iterator.
+ */
+static void
+filter_engine_free_filter(void *data, void *unused_udata)
+{
+	(void) unused_udata;
+	filter_prog_free(data);
+}
+
+/**
+ * Free all the compiled state.
+ */
+static void
+filter_engine_close(void)
+{
+	g_list_foreach(filters, filter_engine_free_filter, NULL);
+	filter_engine_reset();
+	filter_engine.compiled = 0;
+}
+
+/**
+ * Get the UTF-8 name of the record, computing it on the first call.
+ */
+static void
+filter_context_utf8_name(struct filter_context *ctx)
+{
+	if (NULL == ctx->utf8_name) {
+		ctx->utf8_name = atom_str_get(ctx->rec->utf8_name);
+		ctx->utf8_len = vstrlen(ctx->utf8_name);
+	}
+}
+
+/**
+ * Get the lower-cased name of the record, computing it on the first call.
+ */
+static void
+filter_context_lower_name(struct filter_context *ctx)
+{
+	if (NULL == ctx->l_name) {
+		gchar *s;
+
+		filter_context_utf8_name(ctx);
+		s = utf8_strlower_copy(ctx->utf8_name);
+
+		/*
+		 * Cache for further rules, to avoid costly utf8
+		 * lowercasing transformation for each text-matching
+		 * rule they have configured.
+		 */
+
+		ctx->l_name = atom_str_get(s);
+		ctx->l_len = vstrlen(ctx->l_name);
+
+		hfree(s);
+	}
+}
+
+/**
+ * Text scanning context.
+ */
+struct filter_scan {
+	size_t len;					/**< Length of scanned name */
+	guint32 stamp;				/**< Record stamp */
+};
+
+/**
+ * Automaton match callback: record literal match for the text slot.
+ *
+ * @return FALSE to continue scanning.
+ */
+static bool
+filter_engine_hit(void *value, size_t end, void *data)
+{
+	struct filter_engine *fe = &filter_engine;
+	const struct filter_scan *sc = data;
+	const struct filter_lit *lit = &fe->lits[GPOINTER_TO_UINT(value)];
+	guint32 bit = 0;
+
+	switch ((enum filter_lit_kind) lit->kind) {
+	case FILTER_LIT_SUBSTR:
+		bit = 1;
+		break;
+	case FILTER_LIT_WORD:
+		bit = 1U << lit->word;
+		break;
+	case FILTER_LIT_PREFIX:
+		if (end == lit->len)
+			bit = 1;
+		break;
+	case FILTER_LIT_SUFFIX:
+		if (end == sc->len)
+			bit = 1;
+		break;
+	case FILTER_LIT_EXACT:
+		if (end == sc->len && lit->len == sc->len)
+			bit = 1;
+		break;
+	}
+
+	if (fe->seen[lit->slot] != sc->stamp) {
+		fe->seen[lit->slot] = sc->stamp;
+		fe->bits[lit->slot] = 0;
+	}
+
+	fe->bits[lit->slot] |= bit;
+	return FALSE;
+}
+
+/**
+ * Scan the record name with the text automata, once per record.
+ */
+static void
+filter_engine_scan(struct filter_context *ctx)
+{
+	struct filter_engine *fe = &filter_engine;
+	struct filter_scan sc;
+
+	ctx->scanned = TRUE;
+	sc.stamp = ctx->stamp;
+
+	if (fe->cs != NULL) {
+		filter_context_utf8_name(ctx);
+		sc.len = ctx->utf8_len;
+		acmatch_search(fe->cs, ctx->utf8_name, sc.len, filter_engine_hit, &sc);
+	}
+
+	if (fe->ci != NULL) {
+		filter_context_lower_name(ctx);
+		sc.len = ctx->l_len;
+		acmatch_search(fe->ci, ctx->l_name, sc.len, filter_engine_hit, &sc);
+	}
+}
+
+/**
+ * Start filtering a new record.
+ */
+static void
+filter_engine_record(struct filter_context *ctx)
+{
+	struct filter_engine *fe = &filter_engine;
+
+	filter_engine_sync();
+
+	if G_UNLIKELY(0 == ++fe->stamp) {
+		/* Wrapped around, clear all the slot stamps */
+		if (fe->seen != NULL)
+			memset(fe->seen, 0, fe->slots * sizeof fe->seen[0]);
+		fe->stamp = 1;
+	}
+
+	ctx->stamp = fe->stamp;
+}
+
+/**
+ * Evaluate text rule directly, without the automata.
+ */
+static gboolean
+filter_text_matches(const rule_t *r, struct filter_context *ctx)
+{
+	gboolean match = FALSE;
+	const gchar *name;
+	size_t namelen;
+	int i;
+
+	if (r->u.text.case_sensitive) {
+		filter_context_utf8_name(ctx);
+		name = ctx->utf8_name;
+		namelen = ctx->utf8_len;
+	} else {
+		filter_context_lower_name(ctx);
+		name = ctx->l_name;
+		namelen = ctx->l_len;
+	}
+
+	switch (r->u.text.type) {
+	case RULE_TEXT_EXACT:
+		if (0 == strcmp(name, r->u.text.match))
+			match = TRUE;
+		break;
+	case RULE_TEXT_PREFIX:
+		if (0 == strncmp(name, r->u.text.match, r->u.text.match_len))
+			match = TRUE;
+		break;
+	case RULE_TEXT_WORDS:	/* Contains ALL the words */
+		{
+			GList *iter;
+			gboolean failed = FALSE;
+
+			for (
+				iter = g_list_first(r->u.text.u.words);
+				iter && !failed;
+				iter = g_list_next(iter)
+			) {
+				if (NULL == pattern_search(iter->data, name, 0, 0, qs_any))
+					failed = TRUE;
+			}
+
+			match = !failed;
+		}
+		break;
+	case RULE_TEXT_SUFFIX:
+		{
+			size_t n = r->u.text.match_len;
+
+			if (namelen >= n && 0 == strcmp(name + namelen - n, r->u.text.match))
+				match = TRUE;
+		}
+		break;
+	case RULE_TEXT_SUBSTR:
+		if (NULL != pattern_search(r->u.text.u.pattern, name, 0, 0, qs_any))
+			match = TRUE;
+		break;
+	case RULE_TEXT_REGEXP:
+		if (0 == (i = regexec(r->u.text.u.re, name, 0, NULL, 0)))
+			match = TRUE;
+		if (i == REG_ESPACE)
+			g_warning("%s(): regexp memory overflow", G_STRFUNC);
+		break;
+	default:
+		g_error("%s(): unknown text rule type: %d",
+			G_STRFUNC, r->u.text.type);
+	}
+
+	return match;
+}
+
+/**
+ * Check whether the record matches a flag rule.
+ */
+static gboolean
+filter_flag_matches(const rule_t *r, const struct record *rec)
+{
+	gboolean stable_match;
+	gboolean busy_match;
+	gboolean push_match;
+
+	stable_match =
+		(
+			r->u.flag.busy == RULE_FLAG_SET &&
+			(rec->results_set->status & ST_BUSY)
+		) ||
+		(
+			r->u.flag.busy == RULE_FLAG_UNSET &&
+			!(rec->results_set->status & ST_BUSY)
+		) ||
+		r->u.flag.busy == RULE_FLAG_IGNORE;
+
+	busy_match =
+		(
+			r->u.flag.push == RULE_FLAG_SET &&
+			(rec->results_set->status & ST_FIREWALL)
+		) ||
+		(
+			(r->u.flag.push == RULE_FLAG_UNSET) &&
+			!(rec->results_set->status & ST_FIREWALL)
+		) ||
+		r->u.flag.push == RULE_FLAG_IGNORE;
+
+	push_match =
+		(
+			r->u.flag.stable == RULE_FLAG_SET &&
+			(rec->results_set->status & ST_UPLOADED)
+		) ||
+		(
+			r->u.flag.stable == RULE_FLAG_UNSET &&
+			!(rec->results_set->status & ST_UPLOADED)
+		) ||
+		r->u.flag.stable == RULE_FLAG_IGNORE;
+
+	return stable_match && busy_match && push_match;
+}
+
+/**
+ * Check whether the current result state matches a state rule.
+ */
+static gboolean
+filter_state_matches(const rule_t *r, const filter_result_t *res)
+{
+	gboolean display_match;
+	gboolean download_match;
+
+	display_match =
+		(r->u.state.display == FILTER_PROP_STATE_IGNORE) ||
+		(res->props[FILTER_PROP_DISPLAY].state == r->u.state.display);
+
+	download_match =
+		(r->u.state.download == FILTER_PROP_STATE_IGNORE) ||
+		(res->props[FILTER_PROP_DOWNLOAD].state == r->u.state.download);
+
+	return display_match && download_match;
+}
+
+/**
+ * Check whether the record matches the condition of a compiled rule.
+ */
+static gboolean
+filter_op_matches(const struct filter_op *op, struct filter_context *ctx,
+	const filter_result_t *res)
+{
+	const rule_t *r = op->rule;
+	const struct record *rec = ctx->rec;
+
+	switch (r->type) {
+	case RULE_JUMP:
+		return TRUE;
+	case RULE_TEXT:
+		if (FILTER_SLOT_NONE == op->slot)
+			return filter_text_matches(r, ctx);
+		if (!ctx->scanned)
+			filter_engine_scan(ctx);
+		return filter_engine.seen[op->slot] == ctx->stamp &&
+			(filter_engine.bits[op->slot] & op->want) == op->want;
+	case RULE_IP:
+		return host_addr_matches(rec->results_set->addr,
+			r->u.ip.addr, r->u.ip.cidr);
+	case RULE_SIZE:
+		return rec->size >= r->u.size.lower && rec->size <= r->u.size.upper;
+	case RULE_SHA1:
+		if (rec->sha1 == r->u.sha1.hash)
+			return TRUE;
+		if (NULL == rec->sha1 || NULL == r->u.sha1.hash)
+			return FALSE;
+		if (op->slot != FILTER_SLOT_NONE) {
+			if (!ctx->sha1_checked) {
+				ctx->sha1_checked = TRUE;
+				ctx->sha1_known = hset_contains(filter_engine.sha1, rec->sha1);
+			}
+			if (!ctx->sha1_known)
+				return FALSE;
+		}
+		return sha1_eq(rec->sha1, r->u.sha1.hash);
+	case RULE_FLAG:
+		return filter_flag_matches(r, rec);
+	case RULE_STATE:
+		return filter_state_matches(r, res);
+	}
+
+	g_error("Unknown rule type: %d", r->type);
+	return FALSE;
+}
+
 #define MATCH_RULE(filter, r, res)									\
 do {																\
     (res)->props_set++;												\
@@ -2064,15 +2782,14 @@ do {																\
 static int
 filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
 {
-    GList *list;
     gint prop_count = 0;
     gboolean do_abort = FALSE;
-	const struct record *rec;
+    const struct filter_prog *prog;
+    size_t i;
 
     g_assert(filter != NULL);
     g_assert(ctx != NULL);
-	rec = ctx->rec;
-	record_check(rec);
+    record_check(ctx->rec);
     g_assert(res != NULL);
 
     /*
@@ -2082,213 +2799,38 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
     if (filter->visited || !filter_is_active(filter))
         return 0;
 
-    filter->visited = TRUE;
+    /*
+     * Filters not known to the engine (not committed yet) are compiled
+     * without using the shared indexes.
+     */
+
+    if (NULL == filter->prog || filter->prog->generation != filter_engine.generation)
+        filter_prog_compile(filter, FALSE);
 
-    list = filter->ruleset;
+    prog = filter->prog;
+    filter->visited = TRUE;
 
-	list = g_list_first(list);
-	while (list != NULL && res->props_set < MAX_FILTER_PROP && !do_abort) {
+    for (
+        i = 0;
+        i < prog->count && res->props_set < MAX_FILTER_PROP && !do_abort;
+        i++
+    ) {
+        const struct filter_op *op = &prog->ops[i];
         gboolean match = FALSE;
-		rule_t *r;
-		gint i;
+        rule_t *r = op->rule;
 
-        r = list->data;
         if (GUI_PROPERTY(gui_debug) >= 10)
             g_debug("trying to match against: %s", filter_rule_to_string(r));
 
-        if (RULE_IS_ACTIVE(r)) {
-            switch (r->type){
-            case RULE_JUMP:
-                match = TRUE;
-                break;
-            case RULE_TEXT: {
-				const gchar *l_name = ctx->l_name;
-				const gchar *utf8_name = ctx->utf8_name;
-
-				if (utf8_name == NULL) {
-					ctx->utf8_name = utf8_name = atom_str_get(rec->utf8_name);
-					ctx->utf8_len = vstrlen(utf8_name);
-				}
-
-				if (l_name == NULL) {
-					gchar *s = utf8_strlower_copy(utf8_name);
-
-					/*
-					 * Cache for further rules, to avoid costly utf8
-					 * lowercasing transformation for each text-matching
-					 * rule they have configured.
-					 */
-
-					ctx->l_name = atom_str_get(s);
-					ctx->l_len = vstrlen(ctx->l_name);
-					l_name = ctx->l_name;
-
-					hfree(s);
-				}
-
-                switch (r->u.text.type) {
-                case RULE_TEXT_EXACT:
-                    if (
-						0 == strcmp(r->u.text.case_sensitive ?
-							ctx->utf8_name : ctx->l_name, r->u.text.match)
-					)
-                        match = TRUE;
-                    break;
-                case RULE_TEXT_PREFIX:
-                    if (
-						0 == strncmp(r->u.text.case_sensitive ?
-							ctx->utf8_name : ctx->l_name,
-							r->u.text.match, r->u.text.match_len)
-					)
-                        match = TRUE;
-                    break;
-                case RULE_TEXT_WORDS:	/* Contains ALL the words */
-                    {
-                        GList *iter;
-						gboolean failed = FALSE;
-
-                        for (
-                            iter = g_list_first(r->u.text.u.words);
-                            iter && !failed;
-                            iter = g_list_next(iter)
-                        ) {
-                            if (
-								NULL == pattern_search(iter->data,
-									r->u.text.case_sensitive ?
-										ctx->utf8_name : ctx->l_name,
-									0, 0, qs_any)
-							)
-                                failed = TRUE;
-                        }
-
-						match = !failed;
-                    }
-                    break;
-                case RULE_TEXT_SUFFIX: {
-					size_t namelen = r->u.text.case_sensitive ?
-						ctx->utf8_len : ctx->l_len;
-					size_t n;
-                    n = r->u.text.match_len;
-                    if (namelen >= n
-                        && strcmp((r->u.text.case_sensitive
-                               ? utf8_name : l_name) + namelen
-                              - n, r->u.text.match) == 0)
-                        match = TRUE;
-				   }
-                    break;
-                case RULE_TEXT_SUBSTR:
-                    if (
-						NULL != pattern_search(
-							r->u.text.u.pattern,
-							r->u.text.case_sensitive ?
-								ctx->utf8_name : ctx->l_name,
-							0, 0, qs_any)
-					)
-                        match = TRUE;
-                    break;
-                case RULE_TEXT_REGEXP:
-                    if (
-						0 == (i = regexec(r->u.text.u.re,
-							r->u.text.case_sensitive ?
-								ctx->utf8_name : ctx->l_name, 0, NULL, 0))
-					)
-                        match = TRUE;
-                    if (i == REG_ESPACE)
-                        g_warning("%s(): regexp memory overflow", G_STRFUNC);
-                    break;
-                default:
-                    g_error("%s(): unknown text rule type: %d",
-						G_STRFUNC, r->u.text.type);
-                }
-                break;
-			}
-            case RULE_IP:
-				match = host_addr_matches(rec->results_set->addr,
-							r->u.ip.addr, r->u.ip.cidr);
-                break;
-            case RULE_SIZE:
-                if (rec->size >= r->u.size.lower &&
-                    rec->size <= r->u.size.upper)
-                    match = TRUE;
-                break;
-            case RULE_SHA1:
-                if (rec->sha1 == r->u.sha1.hash)
-                    match = TRUE;
-                else if (rec->sha1 != NULL && r->u.sha1.hash != NULL)
-                    if (sha1_eq(rec->sha1, r->u.sha1.hash))
-                        match = TRUE;
-                break;
-            case RULE_FLAG:
-                {
-                    gboolean stable_match;
-                    gboolean busy_match;
-                    gboolean push_match;
-
-                    stable_match =
-                        (
-							r->u.flag.busy == RULE_FLAG_SET &&
-							(rec->results_set->status & ST_BUSY)
-						) ||
-                        (
-							r->u.flag.busy == RULE_FLAG_UNSET &&
-							!(rec->results_set->status & ST_BUSY)
-						) ||
-                        r->u.flag.busy == RULE_FLAG_IGNORE;
-
-                    busy_match =
-                        (
-							r->u.flag.push == RULE_FLAG_SET &&
-							(rec->results_set->status & ST_FIREWALL)
-						) ||
-                        (
-							(r->u.flag.push == RULE_FLAG_UNSET) &&
-							!(rec->results_set->status & ST_FIREWALL)
-						) ||
-                        r->u.flag.push == RULE_FLAG_IGNORE;
-
-                    push_match =
-                        (
-							r->u.flag.stable == RULE_FLAG_SET &&
-							(rec->results_set->status & ST_UPLOADED)
-						) ||
-                        (
-							r->u.flag.stable == RULE_FLAG_UNSET &&
-							!(rec->results_set->status & ST_UPLOADED)
-						) ||
-						r->u.flag.stable == RULE_FLAG_IGNORE;
-
-                    match = stable_match && busy_match && push_match;
-                }
-                break;
-            case RULE_STATE:
-                {
-                    gboolean display_match;
-                    gboolean download_match;
-
-                    display_match =
-                        (r->u.state.display == FILTER_PROP_STATE_IGNORE) ||
-                        (res->props[FILTER_PROP_DISPLAY].state
-                            == r->u.state.display);
-
-                    download_match =
-                        (r->u.state.download == FILTER_PROP_STATE_IGNORE) ||
-                        (res->props[FILTER_PROP_DOWNLOAD].state
-                            == r->u.state.download);
-
-                    match = display_match && download_match;
-                }
-                break;
-            default:
-                g_error("Unknown rule type: %d", r->type);
-                break;
-            }
-        }
+        if (RULE_IS_ACTIVE(r))
+            match = filter_op_matches(op, ctx, res);
+
         /*
          * If negate is set, we invert the meaning of match.
          */
 
-		if (RULE_IS_NEGATED(r) && RULE_IS_ACTIVE(r))
-			match = !match;
+        if (RULE_IS_NEGATED(r) && RULE_IS_ACTIVE(r))
+            match = !match;
 
         /*
          * Try to match the builtin rules, but don't act on matches
@@ -2296,11 +2838,13 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
          * defined.
          */
         if (match) {
-            if (r->target == filter_return) {
+            switch (op->action) {
+            case FILTER_A_RETURN:
                 do_abort = TRUE;
                 r->match_count ++;
                 r->target->match_count ++;
-            } else if (r->target == filter_show) {
+                break;
+            case FILTER_A_SHOW:
                 if (!res->props[FILTER_PROP_DISPLAY].state) {
 
                     res->props[FILTER_PROP_DISPLAY].state =
@@ -2308,7 +2852,8 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
 
                     MATCH_RULE(filter, r, res);
                 }
-            } else if (r->target == filter_drop) {
+                break;
+            case FILTER_A_DROP:
                 if (!res->props[FILTER_PROP_DISPLAY].state) {
 
                     res->props[FILTER_PROP_DISPLAY].state =
@@ -2318,7 +2863,8 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
 
                     MATCH_RULE(filter, r, res);
                 }
-            } else if (r->target == filter_download) {
+                break;
+            case FILTER_A_DOWNLOAD:
                 if (!res->props[FILTER_PROP_DOWNLOAD].state) {
 
                     res->props[FILTER_PROP_DOWNLOAD].state =
@@ -2326,7 +2872,8 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
 
                     MATCH_RULE(filter, r, res);
                 }
-            } else if (r->target == filter_nodownload) {
+                break;
+            case FILTER_A_NODOWNLOAD:
                 if (!res->props[FILTER_PROP_DOWNLOAD].state) {
 
                     res->props[FILTER_PROP_DOWNLOAD].state =
@@ -2334,20 +2881,20 @@ filter_apply(filter_t *filter, struct filter_context *ctx, filter_result_t *res)
 
                     MATCH_RULE(filter, r, res);
                 }
-            } else {
+                break;
+            case FILTER_A_JUMP:
                 /*
                  * We have a matched rule the target is not a builtin
                  * rule, so it must be a subchain. We gosub.
                  */
-                prop_count += filter_apply(r->target, ctx, res);
+                prop_count += filter_apply(op->target, ctx, res);
                 r->match_count ++;
+                break;
             }
         } else {
             r->fail_count ++;
         }
-
-		list = g_list_next(list);
-	}
+    }
 
     filter->visited = FALSE;
     filter->fail_count += MAX_FILTER_PROP - prop_count;
@@ -2370,9 +2917,10 @@ filter_record(struct search *search, const struct record *rec)
     g_assert(search != NULL);
 	record_check(rec);
 
+	ZERO(&ctx);
 	ctx.rec = rec;
-	ctx.l_name = ctx.utf8_name = NULL;
-	ctx.l_len = ctx.utf8_len = 0;
+
+	filter_engine_record(&ctx);
 
 	/*
 	 * Initialize all properties with FILTER_PROP_STATE_UNKNOWN and
@@ -2477,6 +3025,8 @@ filter_shutdown(void)
      */
     for (f = filters; f != NULL; f = filters)
         filter_free(f->data);
+
+    filter_engine_close();
 }
 
 static void G_COLD
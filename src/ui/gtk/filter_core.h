@@ -35,6 +35,7 @@
  */
 
 struct record;
+struct filter_prog;
 
 typedef struct filter {
     const gchar *name;
@@ -45,6 +46,7 @@ typedef struct filter {
     guint32 flags;
     guint32 match_count;
     guint32 fail_count;
+    struct filter_prog *prog;	/**< Compiled rules, NULL if not compiled */
 } filter_t;
 
 enum {
@@ -196,6 +198,7 @@ void filter_prepend_rule(filter_t *f, rule_t * const r);
 void filter_append_rule_to_session(filter_t * f, rule_t * const r);
 void filter_revert_changes(void);
 void filter_apply_changes(void);
+void filter_invalidate(void);
 void filter_close_dialog(gboolean);
 void filter_close_search(struct search *);
 void filter_add_to_session(filter_t *f);
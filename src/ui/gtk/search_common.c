@@ -1676,6 +1676,7 @@ search_gui_create_search_with_filter(const char *name, guint32 flags)
          */
         search->filter->ruleset = g_list_append(search->filter->ruleset, rule);
         rule->target->refcount++;
+        filter_invalidate();
     }
 }
 
@@ -3428,6 +3429,7 @@ search_gui_new_search_entered(void)
 				g_assert(rule->target);
 				g_assert(rule->target->refcount >= 0);
 				rule->target->refcount++;
+				filter_invalidate();
 			}
 
         	search_gui_history_add(text);
@@ -551,6 +551,8 @@ search_retrieve_xml(void)
 		}
     }
 
+	filter_invalidate();		/* Rule targets were resolved */
+
 	/*
      * Verify bindings.
      */
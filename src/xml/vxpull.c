@@ -0,0 +1,1234 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup xml
+ * @file
+ *
+ * Streaming XML pull parser.
+ *
+ * This is a lightweight companion to the vxml parser, for consumers that
+ * only need to look at a few elements or attributes of small documents and
+ * do not want to pay for building an XML tree, nor for the allocation of
+ * each element name, attribute and text node.
+ *
+ * The document is tokenized in place, and the caller pulls events one at a
+ * time with vxpull_next().  Element names, attributes and text are returned
+ * as string views into the input buffer, which must therefore remain valid
+ * and unchanged whilst the parser is used.  Attributes of a start tag are
+ * only parsed when the caller asks for them.
+ *
+ * Views are returned raw: entity and character references are not expanded,
+ * which the caller can do with vxpull_decode() on the values it needs.
+ *
+ * The parser only handles UTF-8 (or plain ASCII) documents, does not know
+ * about namespaces (prefixed names are returned as-is), skips the DOCTYPE
+ * declaration, comments and processing instructions, and does not validate
+ * characters beyond what is required to tokenize the document.  Documents
+ * requiring more than that must be handled by vxml.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "vxpull.h"
+
+#include "lib/ascii.h"
+#include "lib/halloc.h"
+#include "lib/misc.h"
+#include "lib/str.h"
+#include "lib/utf8.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+/*
+ * Define to have pull parser testing at startup.
+ */
+#if 1
+#define VXPULL_TESTING
+#endif
+
+#define VXPULL_STACK	16		/**< Initial element stack size */
+
+enum vxpull_magic { VXPULL_MAGIC = 0x1a7e52c9 };
+
+/**
+ * The pull parser.
+ */
+struct vxpull {
+	enum vxpull_magic magic;
+	const char *name;			/**< Parser name (static string) */
+	const char *start;			/**< Start of document */
+	const char *end;			/**< First byte past the document */
+	const char *p;				/**< Parsing position */
+	const char *attrs;			/**< Attribute area of current start tag */
+	const char *attrs_end;		/**< End of attribute area */
+	const char *attr_next;		/**< Next attribute to return */
+	vxpull_str_t *stack;		/**< Stack of opened element names */
+	vxpull_str_t element;		/**< Current element name */
+	vxpull_str_t text;			/**< Current text */
+	size_t depth;				/**< Amount of opened elements */
+	size_t capacity;			/**< Capacity of the stack */
+	vxpull_error_t error;		/**< Parsing error */
+	uint32 options;				/**< Parsing options */
+	uint pending_end:1;			/**< Must return END for empty element */
+	uint root_seen:1;			/**< Root element was opened */
+	uint root_done:1;			/**< Root element was closed */
+	uint prologue:1;			/**< Prologue was handled */
+	vxpull_str_t stack0[VXPULL_STACK];	/**< Initial stack */
+};
+
+static inline void
+vxpull_check(const struct vxpull * const xp)
+{
+	g_assert(xp != NULL);
+	g_assert(VXPULL_MAGIC == xp->magic);
+}
+
+/**
+ * Is character an XML white space?
+ */
+static inline bool
+vxpull_is_blank(uchar c)
+{
+	return ' ' == c || '\n' == c || '\t' == c || '\r' == c;
+}
+
+/**
+ * Can character start an XML name?
+ *
+ * Any non-ASCII character is accepted, since we do not decode UTF-8.
+ */
+static inline bool
+vxpull_is_name_start(uchar c)
+{
+	return c >= 0x80 || is_ascii_alpha(c) || '_' == c || ':' == c;
+}
+
+/**
+ * Can character be part of an XML name?
+ */
+static inline bool
+vxpull_is_name_char(uchar c)
+{
+	return vxpull_is_name_start(c) ||
+		is_ascii_digit(c) || '-' == c || '.' == c;
+}
+
+/**
+ * Does data at `p' start with the given string?
+ */
+static inline bool
+vxpull_at(const vxpull_t *xp, const char *p, const char *str, size_t len)
+{
+	return UNSIGNED(xp->end - p) >= len && 0 == memcmp(p, str, len);
+}
+
+#define VXPULL_AT(xp,p,s)	vxpull_at((xp), (p), (s), CONST_STRLEN(s))
+
+/**
+ * Locate string in the data starting at `p'.
+ *
+ * @return start of string, NULL if not found.
+ */
+static const char *
+vxpull_find(const vxpull_t *xp, const char *p, const char *str, size_t len)
+{
+	for (;;) {
+		p = memchr(p, str[0], xp->end - p);
+		if (NULL == p || vxpull_at(xp, p, str, len))
+			return p;
+		p++;
+	}
+}
+
+#define VXPULL_FIND(xp,p,s)	vxpull_find((xp), (p), (s), CONST_STRLEN(s))
+
+/**
+ * Skip white space.
+ *
+ * @return first non-blank character at or after `p'.
+ */
+static inline const char *
+vxpull_skip_blanks(const vxpull_t *xp, const char *p)
+{
+	while (p < xp->end && vxpull_is_blank(*p))
+		p++;
+
+	return p;
+}
+
+/**
+ * Parse an XML name starting at `p'.
+ *
+ * @return first character past the name, NULL if there is no valid name.
+ */
+static const char *
+vxpull_scan_name(const vxpull_t *xp, const char *p)
+{
+	if (p >= xp->end || !vxpull_is_name_start(*p))
+		return NULL;
+
+	for (p++; p < xp->end && vxpull_is_name_char(*p); p++)
+		/* empty */;
+
+	return p;
+}
+
+/**
+ * Parse an attribute specification starting at `p', i.e. name = "value".
+ *
+ * @param xp		the parser
+ * @param p			start of the attribute name
+ * @param name		if non-NULL, filled with the attribute name
+ * @param value		if non-NULL, filled with the attribute value (unquoted)
+ *
+ * @return first character past the closing quote, NULL on error.
+ */
+static const char *
+vxpull_scan_attr(const vxpull_t *xp, const char *p,
+	vxpull_str_t *name, vxpull_str_t *value)
+{
+	const char *q, *v;
+	char quote;
+
+	q = vxpull_scan_name(xp, p);
+	if (NULL == q)
+		return NULL;
+
+	if (name != NULL) {
+		name->ptr = p;
+		name->len = q - p;
+	}
+
+	q = vxpull_skip_blanks(xp, q);
+	if (q >= xp->end || *q != '=')
+		return NULL;
+
+	q = vxpull_skip_blanks(xp, q + 1);
+	if (q >= xp->end || ('"' != *q && '\'' != *q))
+		return NULL;
+
+	quote = *q++;
+
+	for (v = q; q < xp->end && *q != quote; q++) {
+		if ('<' == *q)
+			return NULL;		/* Not allowed in attribute values */
+	}
+
+	if (q >= xp->end)
+		return NULL;
+
+	if (value != NULL) {
+		value->ptr = v;
+		value->len = q - v;
+	}
+
+	return q + 1;
+}
+
+/**
+ * Record parsing error.
+ *
+ * @return VXPULL_ERROR.
+ */
+static vxpull_event_t
+vxpull_fail(vxpull_t *xp, vxpull_error_t error)
+{
+	xp->error = error;
+	return VXPULL_ERROR;
+}
+
+/**
+ * Create a new pull parser for the given document.
+ *
+ * The document data is not copied, hence it must remain valid and unchanged
+ * until the parser is freed.
+ *
+ * @param name		the parser name, for logging (static string)
+ * @param data		start of the document
+ * @param len		length of the document
+ * @param options	parsing options
+ *
+ * @return a new parser.
+ */
+vxpull_t *
+vxpull_make(const char *name, const char *data, size_t len, uint32 options)
+{
+	vxpull_t *xp;
+
+	g_assert(data != NULL || 0 == len);
+
+	WALLOC0(xp);
+	xp->magic = VXPULL_MAGIC;
+	xp->name = name;
+	xp->start = xp->p = data;
+	xp->end = data + len;
+	xp->options = options;
+	xp->stack = xp->stack0;
+	xp->capacity = N_ITEMS(xp->stack0);
+
+	return xp;
+}
+
+/**
+ * Free the parser and nullify its pointer.
+ */
+void
+vxpull_free_null(vxpull_t **xp_ptr)
+{
+	vxpull_t *xp = *xp_ptr;
+
+	if (xp != NULL) {
+		vxpull_check(xp);
+
+		if (xp->stack != xp->stack0)
+			HFREE_NULL(xp->stack);
+
+		xp->magic = 0;
+		WFREE(xp);
+		*xp_ptr = NULL;
+	}
+}
+
+/**
+ * Push element name on the stack of opened elements.
+ */
+static void
+vxpull_push(vxpull_t *xp, vxpull_str_t name)
+{
+	if G_UNLIKELY(xp->depth == xp->capacity) {
+		size_t n = xp->capacity * 2;
+
+		if (xp->stack == xp->stack0) {
+			HALLOC_ARRAY(xp->stack, n);
+			memcpy(xp->stack, xp->stack0, sizeof xp->stack0);
+		} else {
+			HREALLOC_ARRAY(xp->stack, n);
+		}
+		xp->capacity = n;
+	}
+
+	xp->stack[xp->depth++] = name;
+}
+
+/**
+ * @return whether the string view is equal to the NUL-terminated string,
+ * ignoring ASCII case.
+ */
+static bool
+vxpull_str_caseeq(const vxpull_str_t s, const char *str)
+{
+	return vstrlen(str) == s.len && 0 == ascii_strncasecmp(s.ptr, str, s.len);
+}
+
+/**
+ * Handle the XML declaration, if any, checking that the document encoding
+ * is something we can parse.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+vxpull_prologue(vxpull_t *xp)
+{
+	const char *p = xp->p, *q, *end;
+
+	xp->prologue = TRUE;
+
+	if (VXPULL_AT(xp, p, "\xef\xbb\xbf"))		/* UTF-8 BOM */
+		xp->p = p = p + CONST_STRLEN("\xef\xbb\xbf");
+
+	if (
+		!VXPULL_AT(xp, p, "<?xml") ||
+		p + 5 >= xp->end || !vxpull_is_blank(p[5])
+	)
+		return TRUE;		/* No XML declaration */
+
+	end = VXPULL_FIND(xp, p, "?>");
+	if (NULL == end) {
+		xp->error = VXPULL_E_TRUNCATED;
+		return FALSE;
+	}
+
+	for (q = p + 5; q < end; /* empty */) {
+		vxpull_str_t name, value;
+
+		q = vxpull_skip_blanks(xp, q);
+		if (q >= end)
+			break;
+
+		q = vxpull_scan_attr(xp, q, &name, &value);
+		if (NULL == q || q > end) {
+			xp->error = VXPULL_E_SYNTAX;
+			return FALSE;
+		}
+
+		if (
+			vxpull_str_eq(name, "encoding") &&
+			!vxpull_str_caseeq(value, "UTF-8") &&
+			!vxpull_str_caseeq(value, "US-ASCII")
+		) {
+			xp->error = VXPULL_E_CHARSET;
+			return FALSE;
+		}
+	}
+
+	xp->p = end + CONST_STRLEN("?>");
+	return TRUE;
+}
+
+/**
+ * Skip markup declaration, starting right after "<!".
+ *
+ * This handles the DOCTYPE declaration with its internal subset, if any,
+ * ignoring brackets and '>' within quoted strings, comments and processing
+ * instructions.
+ *
+ * @return first character past the declaration, NULL if truncated.
+ */
+static const char *
+vxpull_skip_decl(const vxpull_t *xp, const char *p)
+{
+	int nesting = 0;
+
+	for (/* empty */; p < xp->end; p++) {
+		switch (*p) {
+		case '"':
+		case '\'':
+			p = memchr(p + 1, *p, xp->end - p - 1);
+			if (NULL == p)
+				return NULL;
+			break;
+		case '<':
+			if (VXPULL_AT(xp, p, "<!--")) {
+				p = VXPULL_FIND(xp, p + 4, "-->");
+				if (NULL == p)
+					return NULL;
+				p += 2;		/* On final '>' */
+			} else if (VXPULL_AT(xp, p, "<?")) {
+				p = VXPULL_FIND(xp, p + 2, "?>");
+				if (NULL == p)
+					return NULL;
+				p++;		/* On final '>' */
+			}
+			break;
+		case '[':
+			nesting++;
+			break;
+		case ']':
+			nesting--;
+			break;
+		case '>':
+			if (nesting <= 0)
+				return p + 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Parse a start tag, right after the opening "<".
+ */
+static vxpull_event_t
+vxpull_start_tag(vxpull_t *xp, const char *p)
+{
+	const char *q;
+	vxpull_str_t name;
+
+	if (xp->root_done)
+		return vxpull_fail(xp, VXPULL_E_OUTSIDE);
+
+	q = vxpull_scan_name(xp, p);
+	if (NULL == q)
+		return vxpull_fail(xp, VXPULL_E_BAD_NAME);
+
+	name.ptr = p;
+	name.len = q - p;
+
+	/*
+	 * Validate the attributes now, since we need to find the end of the tag
+	 * anyway, but they will be parsed again if the caller asks for them.
+	 */
+
+	xp->attrs = q;
+
+	for (;;) {
+		const char *a = vxpull_skip_blanks(xp, q);
+
+		if (a >= xp->end)
+			return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+
+		if ('>' == *a || '/' == *a) {
+			xp->attrs_end = a;
+			if ('/' == *a) {
+				if (a + 1 >= xp->end)
+					return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+				if (a[1] != '>')
+					return vxpull_fail(xp, VXPULL_E_SYNTAX);
+				xp->pending_end = TRUE;
+				a++;
+			}
+			xp->p = a + 1;
+			break;
+		}
+
+		if (a == q)
+			return vxpull_fail(xp, VXPULL_E_BAD_ATTR);	/* Needs a blank */
+
+		q = vxpull_scan_attr(xp, a, NULL, NULL);
+		if (NULL == q)
+			return vxpull_fail(xp, VXPULL_E_BAD_ATTR);
+	}
+
+	xp->attr_next = xp->attrs;
+	xp->root_seen = TRUE;
+	xp->element = name;
+	vxpull_push(xp, name);
+
+	return VXPULL_START;
+}
+
+/**
+ * Parse an end tag, right after the opening "</".
+ */
+static vxpull_event_t
+vxpull_end_tag(vxpull_t *xp, const char *p)
+{
+	const char *q;
+	const vxpull_str_t *top;
+
+	q = vxpull_scan_name(xp, p);
+	if (NULL == q)
+		return vxpull_fail(xp, VXPULL_E_BAD_NAME);
+
+	if (0 == xp->depth)
+		return vxpull_fail(xp, VXPULL_E_UNBALANCED);
+
+	top = &xp->stack[xp->depth - 1];
+	if (top->len != UNSIGNED(q - p) || 0 != memcmp(top->ptr, p, top->len))
+		return vxpull_fail(xp, VXPULL_E_UNBALANCED);
+
+	q = vxpull_skip_blanks(xp, q);
+	if (q >= xp->end)
+		return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+	if (*q != '>')
+		return vxpull_fail(xp, VXPULL_E_SYNTAX);
+
+	xp->p = q + 1;
+	xp->element = *top;
+	if (0 == --xp->depth)
+		xp->root_done = TRUE;
+
+	return VXPULL_END;
+}
+
+/**
+ * Fetch the next parsing event.
+ *
+ * Empty elements generate a VXPULL_START immediately followed by a
+ * VXPULL_END.  Comments, processing instructions and the DOCTYPE declaration
+ * are skipped.  Once an error has been reported, all subsequent calls will
+ * return VXPULL_ERROR.
+ *
+ * @return the next parsing event, VXPULL_EOF at the end of the document.
+ */
+vxpull_event_t
+vxpull_next(vxpull_t *xp)
+{
+	const char *p;
+
+	vxpull_check(xp);
+
+	if G_UNLIKELY(xp->error != VXPULL_E_OK)
+		return VXPULL_ERROR;
+
+	if G_UNLIKELY(!xp->prologue && !vxpull_prologue(xp))
+		return VXPULL_ERROR;
+
+	if (xp->pending_end) {
+		xp->pending_end = FALSE;
+		if (0 == --xp->depth)
+			xp->root_done = TRUE;
+		return VXPULL_END;		/* Name of element is still in `element' */
+	}
+
+	xp->attrs = xp->attrs_end = xp->attr_next = NULL;
+
+	for (p = xp->p; p < xp->end; p = xp->p) {
+		if ('<' != *p) {
+			const char *q = memchr(p, '<', xp->end - p);
+			const char *s = p, *e = NULL == q ? xp->end : q;
+
+			xp->p = e;
+
+			if (0 == xp->depth) {
+				/* Only blanks are allowed outside the root element */
+				if (vxpull_skip_blanks(xp, s) != e)
+					return vxpull_fail(xp, VXPULL_E_OUTSIDE);
+				continue;
+			}
+
+			if (xp->options & VXPULL_O_STRIP_BLANKS) {
+				s = vxpull_skip_blanks(xp, s);
+				while (e > s && vxpull_is_blank(e[-1]))
+					e--;
+				if (s == e)
+					continue;
+			}
+
+			xp->text.ptr = s;
+			xp->text.len = e - s;
+			return VXPULL_TEXT;
+		}
+
+		p++;		/* Skip '<' */
+
+		if (p >= xp->end)
+			return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+
+		switch (*p) {
+		case '/':
+			return vxpull_end_tag(xp, p + 1);
+		case '?':
+			{
+				const char *q = VXPULL_FIND(xp, p, "?>");
+				if (NULL == q)
+					return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+				xp->p = q + CONST_STRLEN("?>");
+			}
+			continue;
+		case '!':
+			if (VXPULL_AT(xp, p, "!--")) {
+				const char *q = VXPULL_FIND(xp, p + 3, "-->");
+				if (NULL == q)
+					return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+				xp->p = q + CONST_STRLEN("-->");
+			} else if (VXPULL_AT(xp, p, "![CDATA[")) {
+				const char *s = p + CONST_STRLEN("![CDATA["), *q;
+
+				if (0 == xp->depth)
+					return vxpull_fail(xp, VXPULL_E_OUTSIDE);
+				q = VXPULL_FIND(xp, s, "]]>");
+				if (NULL == q)
+					return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+				xp->p = q + CONST_STRLEN("]]>");
+				xp->text.ptr = s;
+				xp->text.len = q - s;
+				return VXPULL_TEXT;
+			} else if (VXPULL_AT(xp, p, "!DOCTYPE") && !xp->root_seen) {
+				const char *q = vxpull_skip_decl(xp, p + 1);
+				if (NULL == q)
+					return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+				xp->p = q;
+			} else {
+				return vxpull_fail(xp, VXPULL_E_SYNTAX);
+			}
+			continue;
+		default:
+			return vxpull_start_tag(xp, p);
+		}
+	}
+
+	if (xp->depth != 0)
+		return vxpull_fail(xp, VXPULL_E_TRUNCATED);
+
+	if (!xp->root_seen)
+		return vxpull_fail(xp, VXPULL_E_NO_ROOT);
+
+	return VXPULL_EOF;
+}
+
+/**
+ * Skip the remaining content of the current element, up to and including
+ * its end tag.
+ *
+ * This is meant to be called after a VXPULL_START event to ignore the whole
+ * element, or at any point within an element to skip the rest of it.
+ *
+ * @return TRUE if OK, FALSE on parsing error.
+ */
+bool
+vxpull_skip(vxpull_t *xp)
+{
+	size_t depth;
+
+	vxpull_check(xp);
+
+	depth = xp->depth;
+
+	while (xp->depth >= depth && xp->depth != 0) {
+		switch (vxpull_next(xp)) {
+		case VXPULL_ERROR:
+			return FALSE;
+		case VXPULL_EOF:
+			g_assert_not_reached();
+		default:
+			break;
+		}
+	}
+
+	return VXPULL_E_OK == xp->error;
+}
+
+/**
+ * @return the parsing error, VXPULL_E_OK if none.
+ */
+vxpull_error_t
+vxpull_error(const vxpull_t *xp)
+{
+	vxpull_check(xp);
+
+	return xp->error;
+}
+
+/**
+ * @return the English description of a parsing error.
+ */
+const char *
+vxpull_strerror(vxpull_error_t error)
+{
+	static const char *errstr[] = {
+		"OK",									/* VXPULL_E_OK */
+		"Truncated document",					/* VXPULL_E_TRUNCATED */
+		"Invalid markup",						/* VXPULL_E_SYNTAX */
+		"Invalid name",							/* VXPULL_E_BAD_NAME */
+		"Invalid attribute specification",		/* VXPULL_E_BAD_ATTR */
+		"End tag does not match start tag",		/* VXPULL_E_UNBALANCED */
+		"Content found outside root element",	/* VXPULL_E_OUTSIDE */
+		"No root element",						/* VXPULL_E_NO_ROOT */
+		"Unsupported document charset",			/* VXPULL_E_CHARSET */
+	};
+
+	STATIC_ASSERT(N_ITEMS(errstr) == VXPULL_E_MAX);
+
+	if (UNSIGNED(error) >= N_ITEMS(errstr))
+		return "Invalid error code";
+
+	return errstr[error];
+}
+
+/**
+ * @return the name of the parser, as given at creation time.
+ */
+const char *
+vxpull_name_of(const vxpull_t *xp)
+{
+	vxpull_check(xp);
+
+	return xp->name;
+}
+
+/**
+ * @return name of the element after a VXPULL_START or VXPULL_END event.
+ */
+vxpull_str_t
+vxpull_name(const vxpull_t *xp)
+{
+	vxpull_check(xp);
+
+	return xp->element;
+}
+
+/**
+ * @return the text after a VXPULL_TEXT event.
+ */
+vxpull_str_t
+vxpull_text(const vxpull_t *xp)
+{
+	vxpull_check(xp);
+
+	return xp->text;
+}
+
+/**
+ * Iterate over the attributes of the element after a VXPULL_START event.
+ *
+ * @param xp		the parser
+ * @param name		filled with the attribute name
+ * @param value		filled with the raw attribute value
+ *
+ * @return TRUE if an attribute was returned, FALSE when there are no more.
+ */
+bool
+vxpull_attr_next(vxpull_t *xp, vxpull_str_t *name, vxpull_str_t *value)
+{
+	const char *p;
+
+	vxpull_check(xp);
+	g_assert(name != NULL);
+	g_assert(value != NULL);
+
+	if (NULL == xp->attr_next)
+		return FALSE;
+
+	p = vxpull_skip_blanks(xp, xp->attr_next);
+
+	if (p >= xp->attrs_end) {
+		xp->attr_next = NULL;
+		return FALSE;
+	}
+
+	xp->attr_next = vxpull_scan_attr(xp, p, name, value);
+	g_assert(xp->attr_next != NULL);		/* Was validated already */
+
+	return TRUE;
+}
+
+/**
+ * Look for an attribute of the element after a VXPULL_START event.
+ *
+ * This does not disturb the vxpull_attr_next() iteration.
+ *
+ * @param xp		the parser
+ * @param name		the attribute name
+ * @param value		if non-NULL, filled with the raw attribute value
+ *
+ * @return TRUE if the attribute was found.
+ */
+bool
+vxpull_attr_get(const vxpull_t *xp, const char *name, vxpull_str_t *value)
+{
+	const char *p;
+
+	vxpull_check(xp);
+	g_assert(name != NULL);
+
+	if (NULL == xp->attrs)
+		return FALSE;
+
+	for (p = xp->attrs; /* empty */; /* empty */) {
+		vxpull_str_t aname, avalue;
+
+		p = vxpull_skip_blanks(xp, p);
+		if (p >= xp->attrs_end)
+			return FALSE;
+
+		p = vxpull_scan_attr(xp, p, &aname, &avalue);
+		g_assert(p != NULL);				/* Was validated already */
+
+		if (vxpull_str_eq(aname, name)) {
+			if (value != NULL)
+				*value = avalue;
+			return TRUE;
+		}
+	}
+}
+
+/**
+ * @return the amount of opened elements.
+ */
+unsigned
+vxpull_depth(const vxpull_t *xp)
+{
+	vxpull_check(xp);
+
+	return xp->depth;
+}
+
+/**
+ * @return the current parsing offset within the document.
+ */
+size_t
+vxpull_offset(const vxpull_t *xp)
+{
+	vxpull_check(xp);
+
+	return xp->p - xp->start;
+}
+
+/**
+ * @return whether the string view is equal to the NUL-terminated string.
+ */
+bool
+vxpull_str_eq(const vxpull_str_t s, const char *str)
+{
+	return vstrlen(str) == s.len && 0 == memcmp(s.ptr, str, s.len);
+}
+
+/**
+ * Decode a character or entity reference, starting after the '&'.
+ *
+ * @param p			start of reference name
+ * @param end		end of string
+ * @param uc		where decoded character is written
+ *
+ * @return first character past the reference, NULL if it was not valid.
+ */
+static const char *
+vxpull_decode_ref(const char *p, const char *end, uint32 *uc)
+{
+	static const struct {
+		const char *name;
+		size_t len;
+		char c;
+	} entities[] = {
+		{ "lt",		2,	'<' },
+		{ "gt",		2,	'>' },
+		{ "amp",	3,	'&' },
+		{ "quot",	4,	'"' },
+		{ "apos",	4,	'\'' },
+	};
+	const char *semi;
+	uint i;
+
+	semi = memchr(p, ';', end - p);
+	if (NULL == semi)
+		return NULL;
+
+	if ('#' == *p) {
+		uint32 v = 0;
+		bool hex = semi - p > 1 && 'x' == p[1];
+		const char *q = p + (hex ? 2 : 1);
+
+		if (q == semi)
+			return NULL;
+
+		for (/* empty */; q < semi; q++) {
+			int d = hex ? hex2int_inline(*q) : dec2int_inline(*q);
+			if (d < 0)
+				return NULL;
+			v = v * (hex ? 16 : 10) + d;
+			if (v > 0x10ffff)
+				return NULL;
+		}
+
+		if (0 == v)
+			return NULL;
+
+		*uc = v;
+		return semi + 1;
+	}
+
+	for (i = 0; i < N_ITEMS(entities); i++) {
+		if (
+			entities[i].len == UNSIGNED(semi - p) &&
+			0 == memcmp(entities[i].name, p, entities[i].len)
+		) {
+			*uc = entities[i].c;
+			return semi + 1;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Copy string view into the supplied buffer, expanding the predefined
+ * entities and character references, and NUL-terminating the result.
+ *
+ * Invalid or unknown references are copied verbatim.  The decoded string
+ * is never longer than the raw one, so a buffer of s.len + 1 bytes is
+ * always large enough.
+ *
+ * @param s			the string view to decode
+ * @param buf		the destination buffer
+ * @param len		length of the buffer
+ *
+ * @return the length of the decoded string, excluding the trailing NUL.
+ * If the returned value is larger than or equal to `len', the output was
+ * truncated.
+ */
+size_t
+vxpull_decode(const vxpull_str_t s, char *buf, size_t len)
+{
+	const char *p = s.ptr, *end = s.ptr + s.len;
+	size_t n = 0;
+
+	g_assert(buf != NULL || 0 == len);
+
+	while (p < end) {
+		const char *q = NULL;
+		char ubuf[4];
+		uint32 uc;
+		size_t ulen;
+
+		if ('&' == *p)
+			q = vxpull_decode_ref(p + 1, end, &uc);
+
+		if (NULL == q) {
+			ubuf[0] = *p++;
+			ulen = 1;
+		} else {
+			ulen = utf8_encode_char(uc, ARYLEN(ubuf));
+			p = q;
+		}
+
+		if (n + ulen < len)
+			memcpy(&buf[n], ubuf, ulen);
+		else if (n < len)
+			len = n + 1;		/* Truncated, do not write partial chars */
+		n += ulen;
+	}
+
+	if (len != 0)
+		buf[MIN(n, len - 1)] = '\0';
+
+	return n;
+}
+
+#ifdef VXPULL_TESTING
+static const char vxpull_empty[] =
+	"<a><b/><c x='1' y=\"2\" /><d></d></a>";
+
+static const char vxpull_cdata[] =
+	"<a>x<![CDATA[<b>&amp;]]]]>y<![CDATA[]]></a>";
+
+static const char vxpull_doctype[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<!DOCTYPE a [\n"
+	"<!ENTITY e \"]>\">\n"
+	"<!ELEMENT a (#PCDATA)>\n"
+	"<!-- ] -->\n"
+	"]>\n"
+	"<!-- comment -->\n"
+	"<?pi data?>\n"
+	"<a>t</a>\n";
+
+static const char vxpull_bom[] =
+	"\xef\xbb\xbf<?xml version='1.0' encoding='utf-8'?>\n<a>\xc3\xa9</a>";
+
+static const char vxpull_ascii[] =
+	"<?xml version='1.0' encoding = \"US-ASCII\" ?><a/>";
+
+static const char vxpull_iso[] =
+	"<?xml version='1.0' encoding='ISO-8859-1'?><a/>";
+
+static const char vxpull_blanks[] =
+	"<a>\n  <b> x y </b>\n  <c/>\n</a>\n";
+
+static const char vxpull_unbalanced[] = "<a><b></a></b>";
+static const char vxpull_stray_end[] = "</a>";
+static const char vxpull_truncated1[] = "<a><b>text";
+static const char vxpull_truncated2[] = "<a><b x='1'";
+static const char vxpull_truncated3[] = "<a><!-- comment";
+static const char vxpull_outside1[] = "<a/>text";
+static const char vxpull_outside2[] = "<a/><b/>";
+static const char vxpull_outside3[] = "text<a/>";
+static const char vxpull_outside4[] = "<![CDATA[x]]><a/>";
+static const char vxpull_no_root[] = " <!-- nothing --> ";
+static const char vxpull_bad_attr[] = "<a x='1'y='2'/>";
+
+/**
+ * Parse the whole document and build a trace of the events seen.
+ *
+ * Start tags are traced as "<name k=v>", end tags as "</name>", text as
+ * "[text]" and the end of the document as "$".
+ */
+static void G_COLD
+vxpull_run_test(int num, const char *name,
+	const char *data, size_t len, uint32 options,
+	const char *trace, vxpull_error_t error)
+{
+	vxpull_t *xp;
+	vxpull_event_t ev;
+	str_t *s = str_new(0);
+
+	g_assert('\0' == data[len]);	/* Given length is correct */
+
+	xp = vxpull_make(name, data, len, options);
+
+	do {
+		vxpull_str_t n, v;
+
+		switch ((ev = vxpull_next(xp))) {
+		case VXPULL_START:
+			n = vxpull_name(xp);
+			str_putc(s, '<');
+			str_cat_len(s, n.ptr, n.len);
+			while (vxpull_attr_next(xp, &n, &v)) {
+				str_putc(s, ' ');
+				str_cat_len(s, n.ptr, n.len);
+				str_putc(s, '=');
+				str_cat_len(s, v.ptr, v.len);
+			}
+			str_putc(s, '>');
+			break;
+		case VXPULL_END:
+			n = vxpull_name(xp);
+			str_cat(s, "</");
+			str_cat_len(s, n.ptr, n.len);
+			str_putc(s, '>');
+			break;
+		case VXPULL_TEXT:
+			n = vxpull_text(xp);
+			str_putc(s, '[');
+			str_cat_len(s, n.ptr, n.len);
+			str_putc(s, ']');
+			break;
+		case VXPULL_EOF:
+			str_putc(s, '$');
+			break;
+		case VXPULL_ERROR:
+			break;
+		}
+	} while (ev != VXPULL_EOF && ev != VXPULL_ERROR);
+
+	g_assert_log(0 == strcmp(trace, str_2c(s)),
+		"%s(): test #%d (\"%s\"): expected \"%s\", got \"%s\"",
+		G_STRFUNC, num, name, trace, str_2c(s));
+
+	g_assert_log(error == vxpull_error(xp),
+		"%s(): test #%d (\"%s\"): expected error \"%s\", got \"%s\"",
+		G_STRFUNC, num, name,
+		vxpull_strerror(error), vxpull_strerror(vxpull_error(xp)));
+
+	g_assert(VXPULL_E_OK == error || VXPULL_ERROR == vxpull_next(xp));
+	g_assert(0 == vxpull_depth(xp) || VXPULL_E_OK != error);
+
+	vxpull_free_null(&xp);
+	str_destroy_null(&s);
+}
+
+#define VXPULL_RUN(n, doc, opt, trace, err) \
+	vxpull_run_test((n), #doc, (doc), CONST_STRLEN(doc), (opt), (trace), (err))
+
+/**
+ * Decode raw string into a buffer of the given size, checking the result.
+ */
+static void G_COLD
+vxpull_run_decode(int num, const char *raw,
+	size_t size, const char *decoded, size_t length)
+{
+	vxpull_str_t v;
+	char buf[64];
+	size_t n;
+
+	g_assert(size < sizeof buf);
+
+	v.ptr = raw;
+	v.len = vstrlen(raw);
+
+	memset(buf, 'X', sizeof buf);
+	n = vxpull_decode(v, buf, size);
+
+	g_assert_log(length == n,
+		"%s(): test #%d: expected length %zu, got %zu",
+		G_STRFUNC, num, length, n);
+
+	g_assert_log(0 == strcmp(decoded, buf),
+		"%s(): test #%d: expected \"%s\", got \"%s\"",
+		G_STRFUNC, num, decoded, buf);
+
+	g_assert_log('X' == buf[size],		/* Nothing written past the end */
+		"%s(): test #%d: buffer overflow", G_STRFUNC, num);
+}
+
+void G_COLD
+vxpull_test(void)
+{
+	vxpull_t *xp;
+	vxpull_str_t v;
+
+	VXPULL_RUN(1, vxpull_empty, 0,
+		"<a><b></b><c x=1 y=2></c><d></d></a>$", VXPULL_E_OK);
+	VXPULL_RUN(2, vxpull_cdata, 0,
+		"<a>[x][<b>&amp;]]][y][]</a>$", VXPULL_E_OK);
+	VXPULL_RUN(3, vxpull_doctype, 0, "<a>[t]</a>$", VXPULL_E_OK);
+	VXPULL_RUN(4, vxpull_bom, 0, "<a>[\xc3\xa9]</a>$", VXPULL_E_OK);
+	VXPULL_RUN(5, vxpull_ascii, 0, "<a></a>$", VXPULL_E_OK);
+	VXPULL_RUN(6, vxpull_iso, 0, "", VXPULL_E_CHARSET);
+	VXPULL_RUN(7, vxpull_blanks, 0,
+		"<a>[\n  ]<b>[ x y ]</b>[\n  ]<c></c>[\n]</a>$", VXPULL_E_OK);
+	VXPULL_RUN(8, vxpull_blanks, VXPULL_O_STRIP_BLANKS,
+		"<a><b>[x y]</b><c></c></a>$", VXPULL_E_OK);
+	VXPULL_RUN(9, vxpull_unbalanced, 0, "<a><b>", VXPULL_E_UNBALANCED);
+	VXPULL_RUN(10, vxpull_stray_end, 0, "", VXPULL_E_UNBALANCED);
+	VXPULL_RUN(11, vxpull_truncated1, 0, "<a><b>[text]", VXPULL_E_TRUNCATED);
+	VXPULL_RUN(12, vxpull_truncated2, 0, "<a>", VXPULL_E_TRUNCATED);
+	VXPULL_RUN(13, vxpull_truncated3, 0, "<a>", VXPULL_E_TRUNCATED);
+	VXPULL_RUN(14, vxpull_outside1, 0, "<a></a>", VXPULL_E_OUTSIDE);
+	VXPULL_RUN(15, vxpull_outside2, 0, "<a></a>", VXPULL_E_OUTSIDE);
+	VXPULL_RUN(16, vxpull_outside3, 0, "", VXPULL_E_OUTSIDE);
+	VXPULL_RUN(17, vxpull_outside4, 0, "", VXPULL_E_OUTSIDE);
+	VXPULL_RUN(18, vxpull_no_root, 0, "", VXPULL_E_NO_ROOT);
+	VXPULL_RUN(19, vxpull_bad_attr, 0, "", VXPULL_E_BAD_ATTR);
+
+	/*
+	 * Attribute lookup does not disturb the iteration, and skipping an
+	 * element consumes it up to its end tag.
+	 */
+
+	xp = vxpull_make(G_STRFUNC, vxpull_empty, CONST_STRLEN(vxpull_empty), 0);
+	g_assert(VXPULL_START == vxpull_next(xp));
+	g_assert(VXPULL_START == vxpull_next(xp));
+	g_assert(vxpull_str_eq(vxpull_name(xp), "b"));
+	g_assert(vxpull_skip(xp));
+	g_assert(1 == vxpull_depth(xp));
+	g_assert(VXPULL_START == vxpull_next(xp));
+	g_assert(vxpull_attr_get(xp, "y", &v) && vxpull_str_eq(v, "2"));
+	g_assert(!vxpull_attr_get(xp, "z", NULL));
+	g_assert(vxpull_attr_next(xp, &v, &v) && vxpull_str_eq(v, "1"));
+	g_assert(vxpull_attr_get(xp, "x", &v) && vxpull_str_eq(v, "1"));
+	g_assert(vxpull_attr_next(xp, &v, &v) && vxpull_str_eq(v, "2"));
+	g_assert(!vxpull_attr_next(xp, &v, &v));
+	g_assert(2 == vxpull_depth(xp));
+	g_assert(VXPULL_END == vxpull_next(xp));
+	g_assert(vxpull_str_eq(vxpull_name(xp), "c"));
+	g_assert(1 == vxpull_depth(xp));
+	g_assert(vxpull_skip(xp));
+	g_assert(0 == vxpull_depth(xp));
+	g_assert(VXPULL_EOF == vxpull_next(xp));
+	vxpull_free_null(&xp);
+
+	/*
+	 * Predefined entities and character references.
+	 */
+
+	vxpull_run_decode(1, "a&lt;b&gt;&amp;&quot;&apos;", 48,
+		"a<b>&\"'", 7);
+	vxpull_run_decode(2, "&#65;&#x42;&#x20AC;&#8364;", 48,
+		"AB\xe2\x82\xac\xe2\x82\xac", 8);
+	vxpull_run_decode(3, "&foo; &#; &#0; &#x110000; &#xZ; &amp", 48,
+		"&foo; &#; &#0; &#x110000; &#xZ; &amp", 36);
+	vxpull_run_decode(4, "no reference", 48, "no reference", 12);
+
+	/*
+	 * Truncation: never write past the buffer, nor partial UTF-8 characters,
+	 * but always report the full decoded length.
+	 */
+
+	vxpull_run_decode(5, "abcdef", 4, "abc", 6);
+	vxpull_run_decode(6, "&lt;&gt;", 2, "<", 2);
+	vxpull_run_decode(7, "&#x20AC;abc", 3, "", 6);
+	vxpull_run_decode(8, "&#x20AC;abc", 4, "\xe2\x82\xac", 6);
+	vxpull_run_decode(9, "a&#x20AC;", 3, "a", 4);
+	vxpull_run_decode(10, "abc", 1, "", 3);
+
+	v.ptr = "a&amp;b";
+	v.len = CONST_STRLEN("a&amp;b");
+	g_assert(3 == vxpull_decode(v, NULL, 0));
+}
+#else	/* !VXPULL_TESTING */
+void G_COLD
+vxpull_test(void)
+{
+	/* Nothing to do */
+}
+#endif	/* VXPULL_TESTING */
+
+/* vi: set ts=4 sw=4 cindent: */
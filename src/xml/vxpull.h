@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup xml
+ * @file
+ *
+ * Streaming XML pull parser.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _xml_vxpull_h_
+#define _xml_vxpull_h_
+
+#include "common.h"
+
+struct vxpull;
+typedef struct vxpull vxpull_t;
+
+/**
+ * Parsing options.
+ */
+#define VXPULL_O_STRIP_BLANKS	(1 << 0)  /**< Strip leading/ending blanks */
+
+/**
+ * Parsing events returned by vxpull_next().
+ */
+typedef enum vxpull_event {
+	VXPULL_EOF = 0,			/**< End of document reached */
+	VXPULL_START,			/**< Start of element */
+	VXPULL_END,				/**< End of element */
+	VXPULL_TEXT,			/**< Character data */
+	VXPULL_ERROR			/**< Parsing error, see vxpull_error() */
+} vxpull_event_t;
+
+/**
+ * Parsing errors.
+ */
+typedef enum vxpull_error {
+	VXPULL_E_OK = 0,		/**< No error */
+	VXPULL_E_TRUNCATED,		/**< Truncated document */
+	VXPULL_E_SYNTAX,		/**< Invalid markup */
+	VXPULL_E_BAD_NAME,		/**< Invalid element or attribute name */
+	VXPULL_E_BAD_ATTR,		/**< Invalid attribute specification */
+	VXPULL_E_UNBALANCED,	/**< End tag does not match start tag */
+	VXPULL_E_OUTSIDE,		/**< Content found outside root element */
+	VXPULL_E_NO_ROOT,		/**< No root element */
+	VXPULL_E_CHARSET,		/**< Document charset is not UTF-8 */
+
+	VXPULL_E_MAX
+} vxpull_error_t;
+
+/**
+ * A string view into the parsed data, which is NOT NUL-terminated.
+ */
+typedef struct vxpull_str {
+	const char *ptr;		/**< Start of string */
+	size_t len;				/**< Length of string */
+} vxpull_str_t;
+
+/*
+ * Public interface.
+ */
+
+vxpull_t *vxpull_make(const char *name,
+	const char *data, size_t len, uint32 options);
+void vxpull_free_null(vxpull_t **xp_ptr);
+
+vxpull_event_t vxpull_next(vxpull_t *xp);
+bool vxpull_skip(vxpull_t *xp);
+vxpull_error_t vxpull_error(const vxpull_t *xp);
+const char *vxpull_strerror(vxpull_error_t error);
+const char *vxpull_name_of(const vxpull_t *xp);
+
+vxpull_str_t vxpull_name(const vxpull_t *xp);
+vxpull_str_t vxpull_text(const vxpull_t *xp);
+bool vxpull_attr_next(vxpull_t *xp, vxpull_str_t *name, vxpull_str_t *value);
+bool vxpull_attr_get(const vxpull_t *xp,
+	const char *name, vxpull_str_t *value);
+unsigned vxpull_depth(const vxpull_t *xp);
+size_t vxpull_offset(const vxpull_t *xp);
+
+bool vxpull_str_eq(const vxpull_str_t s, const char *str);
+size_t vxpull_decode(const vxpull_str_t s, char *buf, size_t len);
+
+void vxpull_test(void);
+
+#endif /* _xml_vxpull_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */